@@ -4,7 +4,17 @@ aquafs_SOURCES-y = \
 	fs/zbd_aquafs.cc \
 	fs/io_aquafs.cc \
 	fs/zonefs_aquafs.cc \
-	fs/zbdlib_aquafs.cc
+	fs/zbdlib_aquafs.cc \
+	fs/block_cache_aquafs.cc \
+	fs/metrics_histogram.cc \
+	fs/write_stats_aquafs.cc \
+	fs/trace_aquafs.cc \
+	fs/emu_aquafs.cc \
+	fs/token_aquafs.cc \
+	fs/fault_aquafs.cc \
+	fs/placement_aquafs.cc \
+	fs/finish_aquafs.cc \
+	fs/numa_aquafs.cc
 
 aquafs_HEADERS-y = \
 	fs/fs_aquafs.h \
@@ -15,7 +25,17 @@ aquafs_HEADERS-y = \
 	fs/snapshot.h \
 	fs/filesystem_utility.h \
 	fs/zonefs_aquafs.h \
-	fs/zbdlib_aquafs.h
+	fs/zbdlib_aquafs.h \
+	fs/block_cache_aquafs.h \
+	fs/metrics_histogram.h \
+	fs/write_stats_aquafs.h \
+	fs/trace_aquafs.h \
+	fs/emu_aquafs.h \
+	fs/token_aquafs.h \
+	fs/fault_aquafs.h \
+	fs/placement_aquafs.h \
+	fs/finish_aquafs.h \
+	fs/numa_aquafs.h
 
 aquafs_PKGCONFIG_REQUIRES-y += "libzbd >= 1.5.0"
 
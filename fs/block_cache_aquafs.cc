@@ -0,0 +1,138 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && !defined(OS_WIN)
+
+#include "block_cache_aquafs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <sstream>
+
+namespace AQUAFS_NAMESPACE {
+
+AquaFSBlockCache::AquaFSBlockCache(uint64_t capacity, uint32_t block_sz,
+                                   unsigned nr_shards)
+    : capacity_(capacity), block_sz_(block_sz) {
+  if (nr_shards == 0) nr_shards = 1;
+  uint64_t slots_per_shard = capacity / block_sz / nr_shards;
+  if (slots_per_shard == 0) slots_per_shard = 1;
+
+  for (unsigned i = 0; i < nr_shards; i++) {
+    std::unique_ptr<Shard> shard(new Shard());
+    shard->slots.resize(slots_per_shard);
+    shard->index.reserve(slots_per_shard);
+    if (posix_memalign((void**)&shard->data, block_sz,
+                       slots_per_shard * block_sz))
+      shard->data = nullptr;
+    /* A shard without memory never caches anything */
+    if (!shard->data) shard->slots.clear();
+    shards_.push_back(std::move(shard));
+  }
+}
+
+AquaFSBlockCache::~AquaFSBlockCache() {
+  for (auto& shard : shards_) free(shard->data);
+}
+
+uint32_t AquaFSBlockCache::Evict(Shard* shard) {
+  if (shard->used < shard->slots.size()) return shard->used++;
+
+  while (true) {
+    uint32_t idx = shard->hand;
+    Slot& slot = shard->slots[idx];
+    shard->hand = (shard->hand + 1) % shard->slots.size();
+    if (slot.referenced) {
+      slot.referenced = false;
+      continue;
+    }
+    if (slot.valid) shard->index.erase(slot.key);
+    slot.valid = false;
+    return idx;
+  }
+}
+
+bool AquaFSBlockCache::Lookup(uint64_t block_pos, uint32_t epoch, char* dst,
+                              size_t off, size_t len) {
+  Shard* shard = GetShard(block_pos);
+  std::lock_guard<std::mutex> lk(shard->mtx);
+
+  auto it = shard->index.find(block_pos);
+  if (it == shard->index.end()) {
+    misses_++;
+    return false;
+  }
+  Slot& slot = shard->slots[it->second];
+  if (slot.epoch != epoch) {
+    /* The zone was reset since, let CLOCK take the slot first */
+    slot.referenced = false;
+    misses_++;
+    return false;
+  }
+  memcpy(dst, shard->data + (uint64_t)it->second * block_sz_ + off, len);
+  slot.referenced = true;
+  hits_++;
+  return true;
+}
+
+void AquaFSBlockCache::Insert(uint64_t block_pos, uint32_t epoch,
+                              const char* data) {
+  Shard* shard = GetShard(block_pos);
+  std::lock_guard<std::mutex> lk(shard->mtx);
+  if (shard->slots.empty()) return;
+
+  uint32_t idx;
+  auto it = shard->index.find(block_pos);
+  if (it != shard->index.end()) {
+    idx = it->second;
+  } else {
+    idx = Evict(shard);
+    shard->index[block_pos] = idx;
+  }
+
+  Slot& slot = shard->slots[idx];
+  slot.key = block_pos;
+  slot.epoch = epoch;
+  slot.valid = true;
+  slot.referenced = true;
+  memcpy(shard->data + (uint64_t)idx * block_sz_, data, block_sz_);
+}
+
+void AquaFSBlockCache::SetBypass(IOType io_type, bool bypass) {
+  uint32_t bit = 1u << static_cast<uint32_t>(io_type);
+  if (bypass)
+    bypass_mask_.fetch_or(bit);
+  else
+    bypass_mask_.fetch_and(~bit);
+}
+
+Status AquaFSBlockCache::SetBypass(const std::string& io_types) {
+  static const std::unordered_map<std::string, IOType> names = {
+      {"data", IOType::kData},         {"filter", IOType::kFilter},
+      {"index", IOType::kIndex},       {"metadata", IOType::kMetadata},
+      {"wal", IOType::kWAL},           {"manifest", IOType::kManifest},
+      {"log", IOType::kLog},           {"unknown", IOType::kUnknown},
+  };
+
+  uint32_t mask = 0;
+  std::stringstream ss(io_types);
+  std::string name;
+  while (std::getline(ss, name, ',')) {
+    if (name.empty()) continue;
+    auto it = names.find(name);
+    if (it == names.end())
+      return Status::InvalidArgument("Unknown io type for block cache bypass",
+                                     name);
+    mask |= 1u << static_cast<uint32_t>(it->second);
+  }
+  bypass_mask_.store(mask);
+  return Status::OK();
+}
+
+}  // namespace AQUAFS_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && !defined(OS_WIN)
@@ -0,0 +1,91 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "aquafs_namespace.h"
+#include "rocksdb/file_system.h"
+#include "rocksdb/rocksdb_namespace.h"
+
+namespace AQUAFS_NAMESPACE {
+using namespace ROCKSDB_NAMESPACE;
+
+/* Block cache for buffered reads of zone data, used instead of the kernel
+ * page cache so that memory use is bounded and sparse files (which can
+ * not be read with direct I/O) are not cached twice.
+ *
+ * Blocks are keyed by their device offset, i.e. (zone, offset in zone),
+ * and tagged with the reset epoch of their zone: after a zone reset the
+ * old entries never hit and are recycled first. Each shard runs CLOCK
+ * over a fixed number of block slots. */
+class AquaFSBlockCache {
+ public:
+  explicit AquaFSBlockCache(uint64_t capacity, uint32_t block_sz,
+                            unsigned nr_shards = 16);
+  ~AquaFSBlockCache();
+
+  /* Copy len bytes at offset off of the block at block_pos into dst,
+   * returns false on a miss */
+  bool Lookup(uint64_t block_pos, uint32_t epoch, char* dst, size_t off,
+              size_t len);
+  void Insert(uint64_t block_pos, uint32_t epoch, const char* data);
+
+  /* Reads of the given io type skip the cache */
+  void SetBypass(IOType io_type, bool bypass);
+  bool Bypass(IOType io_type) const {
+    return bypass_mask_.load(std::memory_order_relaxed) &
+           (1u << static_cast<uint32_t>(io_type));
+  }
+  /* Set the bypass mask from a comma separated list of io types */
+  Status SetBypass(const std::string& io_types);
+
+  uint64_t GetCapacity() const { return capacity_; }
+  uint64_t GetHits() const { return hits_.load(); }
+  uint64_t GetMisses() const { return misses_.load(); }
+
+ private:
+  struct Slot {
+    uint64_t key = 0;
+    uint32_t epoch = 0;
+    bool valid = false;
+    bool referenced = false;
+  };
+
+  struct Shard {
+    std::mutex mtx;
+    std::vector<Slot> slots;
+    std::unordered_map<uint64_t, uint32_t> index;
+    char* data = nullptr;
+    uint32_t used = 0;
+    uint32_t hand = 0;
+  };
+
+  uint64_t capacity_;
+  uint32_t block_sz_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<uint32_t> bypass_mask_{0};
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+
+  Shard* GetShard(uint64_t block_pos) {
+    return shards_[(block_pos / block_sz_) % shards_.size()].get();
+  }
+  uint32_t Evict(Shard* shard);
+};
+
+}  // namespace AQUAFS_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
@@ -6,4 +6,41 @@
 
 DEFINE_uint64(gc_start_level, 20, "Enable GC when percent < n%");
 DEFINE_uint64(gc_slope, 3, "GC aggressiveness");
-DEFINE_uint64(gc_sleep_time, 10 * 1000, "GC sleep time between running capacity detection");
\ No newline at end of file
+DEFINE_uint64(gc_sleep_time, 10 * 1000, "GC sleep time between running capacity detection");
+DEFINE_uint64(readahead_max_window, 2 * 1024 * 1024,
+              "Max sequential readahead window per file in bytes, 0 disables");
+DEFINE_uint64(readahead_budget, 256 * 1024 * 1024,
+              "Memory shared by all readahead windows in bytes");
+DEFINE_uint64(block_cache_size, 0,
+              "Size of the block cache for buffered reads in bytes, 0 disables");
+DEFINE_string(block_cache_bypass, "wal",
+              "Comma separated io types whose reads skip the block cache: "
+              "data,filter,index,metadata,wal,manifest,log,unknown");
+DEFINE_bool(zone_append_shared_wal, false,
+            "Buffered WAL files append to one shared zone, using zone append "
+            "where the device supports it");
+DEFINE_uint64(trace_ring_size, 0,
+              "I/O trace records kept per thread, 0 disables tracing");
+DEFINE_string(trace_file, "",
+              "Dump the I/O trace to this file when the file system closes");
+DEFINE_string(stats_file, "",
+              "Append a JSON line with the write statistics of the mount to "
+              "this file when the file system closes");
+DEFINE_bool(latency_histograms, false,
+            "Keep latency histograms and add their percentiles to the "
+            "stats file, when no metrics exporter is used");
+DEFINE_string(placement_policy, "lifetime",
+              "How data is placed in open zones: lifetime (by lifetime hint) "
+              "or class (by file class and the age its files die at)");
+DEFINE_uint64(finish_headroom, 1,
+              "Active zones the background finish worker keeps free by "
+              "finishing zones not written to lately, 0 disables");
+DEFINE_uint64(reset_rate_limit, 0,
+              "Zone resets per second done in the background while enough "
+              "empty zones are ready, 0 for no limit");
+DEFINE_uint64(reset_pool_size, 4,
+              "Empty zones the background reset worker keeps ready for "
+              "allocations, regardless of the reset rate limit");
+DEFINE_bool(lifetime_prediction, false,
+            "Place files written without a lifetime hint as if they had the "
+            "hint predicted from their name and the age similar files died at");
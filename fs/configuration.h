@@ -10,5 +10,19 @@
 DECLARE_uint64(gc_start_level);
 DECLARE_uint64(gc_slope);
 DECLARE_uint64(gc_sleep_time);
+DECLARE_uint64(readahead_max_window);
+DECLARE_uint64(readahead_budget);
+DECLARE_uint64(block_cache_size);
+DECLARE_string(block_cache_bypass);
+DECLARE_bool(zone_append_shared_wal);
+DECLARE_uint64(trace_ring_size);
+DECLARE_string(trace_file);
+DECLARE_string(stats_file);
+DECLARE_bool(latency_histograms);
+DECLARE_string(placement_policy);
+DECLARE_bool(lifetime_prediction);
+DECLARE_uint64(finish_headroom);
+DECLARE_uint64(reset_rate_limit);
+DECLARE_uint64(reset_pool_size);
 
 #endif  // ROCKSDB_CONFIGURATION_H
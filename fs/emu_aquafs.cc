@@ -0,0 +1,621 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && !defined(OS_WIN)
+
+#include "emu_aquafs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <sstream>
+#include <thread>
+
+namespace AQUAFS_NAMESPACE {
+
+static const char kEmuMagic[8] = {'A', 'Q', 'F', 'S', 'E', 'M', 'U', '1'};
+
+struct EmuFileHeader {
+  char magic[8];
+  uint64_t zone_sz;
+  uint64_t zone_cap;
+  uint32_t block_sz;
+  uint32_t nr_zones;
+};
+
+/* Zone state and data of an emulated device. Memory devices map their
+ * zones lazily; a reset drops the pages so unwritten data reads as
+ * zeroes, like the holes punched into file backed devices. */
+struct EmuDevice {
+  std::mutex mtx;
+  std::vector<EmuZoneInfo> zones;
+  std::vector<char *> data;
+  uint64_t zone_sz = 0;
+  uint32_t block_sz = 0;
+  int fd = -1;
+  uint64_t data_offset = 0;
+  uint32_t nr_open = 0;
+  uint32_t nr_active = 0;
+  std::atomic<uint64_t> read_busy{0};
+  std::atomic<uint64_t> write_busy{0};
+
+  EmuDevice(const EmuOptions &options)
+      : zones(options.nr_zones),
+        data(options.nr_zones, nullptr),
+        zone_sz(options.zone_sz),
+        block_sz(options.block_sz) {
+    for (uint32_t i = 0; i < options.nr_zones; i++) {
+      zones[i].start = i * options.zone_sz;
+      zones[i].wp = zones[i].start;
+      zones[i].capacity = options.zone_cap;
+      zones[i].cond = EmuZoneCond::kEmpty;
+      zones[i].reserved = 0;
+    }
+  }
+
+  ~EmuDevice() {
+    for (char *d : data)
+      if (d != nullptr) munmap(d, zone_sz);
+    if (fd >= 0) close(fd);
+  }
+
+  /* Persist the state of one zone of a file backed device, so that its
+   * write pointer survives a crash. Must hold mtx */
+  int SaveZone(uint32_t idx) {
+    if (fd < 0) return 0;
+    ssize_t sz = sizeof(EmuZoneInfo);
+    off_t off = sizeof(EmuFileHeader) + (off_t)idx * sizeof(EmuZoneInfo);
+    return pwrite(fd, &zones[idx], sz, off) == sz ? 0 : -1;
+  }
+
+  /* Must hold mtx */
+  void Release(EmuZoneInfo &z) {
+    if (z.cond == EmuZoneCond::kImpOpen) {
+      nr_open--;
+      nr_active--;
+    } else if (z.cond == EmuZoneCond::kClosed) {
+      nr_active--;
+    }
+  }
+};
+
+/* Named memory devices live until the process exits, so that a file
+ * system can be created and mounted again on the same device */
+static std::mutex emu_devices_mtx;
+static std::map<std::string, std::shared_ptr<EmuDevice>> emu_devices;
+
+static uint64_t EmuNowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/* Sleep for the fixed latency of an operation, or until its transfer
+ * finishes on a channel of bw MB/s shared by all callers */
+static void EmuDelay(uint64_t lat_us, uint64_t bytes, uint64_t bw,
+                     std::atomic<uint64_t> *busy) {
+  if (lat_us == 0 && bw == 0) return;
+
+  uint64_t now = EmuNowMicros();
+  uint64_t done = now + lat_us;
+  if (bw > 0 && busy != nullptr) {
+    uint64_t xfer = bytes / bw; /* 1 MB/s moves a byte per microsecond */
+    uint64_t prev = busy->load(std::memory_order_relaxed);
+    uint64_t end;
+    do {
+      end = std::max(prev, now) + xfer;
+    } while (!busy->compare_exchange_weak(prev, end));
+    done = std::max(done, end);
+  }
+  if (done > now)
+    std::this_thread::sleep_for(std::chrono::microseconds(done - now));
+}
+
+static bool ParseSize(const std::string &value, uint64_t *out) {
+  char *end = nullptr;
+  errno = 0;
+  uint64_t v = strtoull(value.c_str(), &end, 0);
+  if (errno || end == value.c_str()) return false;
+
+  switch (*end) {
+    case '\0':
+      break;
+    case 'K':
+    case 'k':
+      v <<= 10;
+      end++;
+      break;
+    case 'M':
+    case 'm':
+      v <<= 20;
+      end++;
+      break;
+    case 'G':
+    case 'g':
+      v <<= 30;
+      end++;
+      break;
+    default:
+      return false;
+  }
+  if (*end != '\0') return false;
+  *out = v;
+  return true;
+}
+
+IOStatus EmuOptions::Parse(const std::string &spec, EmuOptions *options) {
+  std::stringstream ss(spec);
+  std::string item;
+
+  while (std::getline(ss, item, ':')) {
+    if (item.empty()) continue;
+    auto eq = item.find('=');
+    if (eq == std::string::npos)
+      return IOStatus::InvalidArgument("Malformed emulated device option: " +
+                                       item);
+    std::string key = item.substr(0, eq);
+    std::string value = item.substr(eq + 1);
+
+    if (key == "mem") {
+      options->mem = value;
+      continue;
+    }
+    if (key == "file") {
+      options->file = value;
+      continue;
+    }
+    if (key == "offline") {
+      std::stringstream zones(value);
+      std::string zone;
+      while (std::getline(zones, zone, '/')) {
+        uint64_t idx;
+        if (!ParseSize(zone, &idx))
+          return IOStatus::InvalidArgument("Bad offline zone: " + zone);
+        options->offline.push_back(idx);
+      }
+      continue;
+    }
+
+    uint64_t v;
+    if (!ParseSize(value, &v))
+      return IOStatus::InvalidArgument("Bad value for " + key + ": " + value);
+    if (key == "zones")
+      options->nr_zones = v;
+    else if (key == "zone_size")
+      options->zone_sz = v;
+    else if (key == "zone_cap")
+      options->zone_cap = v;
+    else if (key == "block_size")
+      options->block_sz = v;
+    else if (key == "max_active")
+      options->max_active = v;
+    else if (key == "max_open")
+      options->max_open = v;
+    else if (key == "max_append")
+      options->max_append = v;
+    else if (key == "read_lat")
+      options->read_lat = v;
+    else if (key == "write_lat")
+      options->write_lat = v;
+    else if (key == "reset_lat")
+      options->reset_lat = v;
+    else if (key == "finish_lat")
+      options->finish_lat = v;
+    else if (key == "read_bw")
+      options->read_bw = v;
+    else if (key == "write_bw")
+      options->write_bw = v;
+    else
+      return IOStatus::InvalidArgument("Unknown emulated device option: " +
+                                       key);
+  }
+
+  if (options->zone_cap == 0) options->zone_cap = options->zone_sz;
+  if (options->nr_zones == 0 || options->block_sz == 0 ||
+      options->zone_sz % options->block_sz ||
+      options->zone_cap % options->block_sz ||
+      options->zone_cap > options->zone_sz)
+    return IOStatus::InvalidArgument("Bad emulated device geometry");
+  if (options->max_append % options->block_sz)
+    return IOStatus::InvalidArgument(
+        "max_append must be a multiple of the block size");
+  return IOStatus::OK();
+}
+
+EmuBackend::EmuBackend(std::string spec) : spec_(std::move(spec)) {
+  parse_status_ = EmuOptions::Parse(spec_, &options_);
+}
+
+EmuBackend::~EmuBackend() {
+  if (dev_ && !readonly_) SaveState().PermitUncheckedError();
+}
+
+IOStatus EmuBackend::LoadFile(bool readonly, bool exclusive) {
+  int fd = open(options_.file.c_str(), readonly ? O_RDONLY : O_RDWR | O_CREAT,
+                0644);
+  if (fd < 0)
+    return IOStatus::InvalidArgument("Failed to open emulated device file " +
+                                     options_.file + ": " + strerror(errno));
+  if (exclusive && flock(fd, LOCK_EX | LOCK_NB)) {
+    close(fd);
+    return IOStatus::IOError("Emulated device file is busy: " + options_.file);
+  }
+
+  EmuFileHeader header;
+  bool formatted =
+      pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+      memcmp(header.magic, kEmuMagic, sizeof(kEmuMagic)) == 0;
+  if (!formatted && readonly) {
+    close(fd);
+    return IOStatus::InvalidArgument("Not an emulated device file: " +
+                                     options_.file);
+  }
+
+  /* The geometry of an existing file wins over the options */
+  if (formatted) {
+    options_.zone_sz = header.zone_sz;
+    options_.zone_cap = header.zone_cap;
+    options_.block_sz = header.block_sz;
+    options_.nr_zones = header.nr_zones;
+  }
+
+  dev_ = std::make_shared<EmuDevice>(options_);
+  dev_->fd = fd;
+  uint64_t meta_sz =
+      sizeof(header) + options_.nr_zones * sizeof(EmuZoneInfo);
+  uint64_t align = std::max<uint64_t>(4096, options_.block_sz);
+  dev_->data_offset = (meta_sz + align - 1) / align * align;
+
+  if (!formatted) {
+    if (ftruncate(fd, dev_->data_offset +
+                          (uint64_t)options_.nr_zones * options_.zone_sz))
+      return IOStatus::IOError("Failed to size emulated device file: " +
+                               std::string(strerror(errno)));
+    return SaveState();
+  }
+
+  ssize_t zones_sz = options_.nr_zones * sizeof(EmuZoneInfo);
+  if (pread(fd, dev_->zones.data(), zones_sz, sizeof(header)) != zones_sz)
+    return IOStatus::Corruption("Truncated emulated device file: " +
+                                options_.file);
+
+  /* Open zones were closed by the "power cycle" */
+  for (auto &z : dev_->zones) {
+    if (z.cond == EmuZoneCond::kImpOpen) z.cond = EmuZoneCond::kClosed;
+    if (z.cond == EmuZoneCond::kClosed) dev_->nr_active++;
+  }
+  return IOStatus::OK();
+}
+
+IOStatus EmuBackend::SaveState() {
+  if (dev_->fd < 0) return IOStatus::OK();
+
+  EmuFileHeader header;
+  memcpy(header.magic, kEmuMagic, sizeof(kEmuMagic));
+  header.zone_sz = options_.zone_sz;
+  header.zone_cap = options_.zone_cap;
+  header.block_sz = options_.block_sz;
+  header.nr_zones = options_.nr_zones;
+
+  std::lock_guard<std::mutex> lock(dev_->mtx);
+  ssize_t zones_sz = dev_->zones.size() * sizeof(EmuZoneInfo);
+  if (pwrite(dev_->fd, &header, sizeof(header), 0) != sizeof(header) ||
+      pwrite(dev_->fd, dev_->zones.data(), zones_sz, sizeof(header)) !=
+          zones_sz)
+    return IOStatus::IOError("Failed to save emulated zone state");
+  return IOStatus::OK();
+}
+
+IOStatus EmuBackend::Open(bool readonly, bool exclusive,
+                          unsigned int *max_active_zones,
+                          unsigned int *max_open_zones) {
+  if (!parse_status_.ok()) return parse_status_;
+  readonly_ = readonly;
+
+  if (!options_.file.empty()) {
+    IOStatus s = LoadFile(readonly, exclusive);
+    if (!s.ok()) return s;
+  } else if (!options_.mem.empty()) {
+    std::lock_guard<std::mutex> lock(emu_devices_mtx);
+    std::shared_ptr<EmuDevice> &dev = emu_devices[options_.mem];
+    if (!dev) dev = std::make_shared<EmuDevice>(options_);
+    dev_ = dev;
+    options_.zone_sz = dev_->zone_sz;
+    options_.zone_cap = dev_->zones[0].capacity;
+    options_.block_sz = dev_->block_sz;
+    options_.nr_zones = dev_->zones.size();
+  } else {
+    dev_ = std::make_shared<EmuDevice>(options_);
+  }
+
+  for (uint32_t idx : options_.offline) {
+    if (idx < options_.nr_zones) setZoneOffline(idx, 0, true);
+  }
+
+  block_sz_ = options_.block_sz;
+  zone_sz_ = options_.zone_sz;
+  nr_zones_ = options_.nr_zones;
+  *max_active_zones = options_.max_active;
+  *max_open_zones = options_.max_open;
+  return IOStatus::OK();
+}
+
+void EmuBackend::RemoveMemoryDevice(const std::string &name) {
+  std::lock_guard<std::mutex> lock(emu_devices_mtx);
+  emu_devices.erase(name);
+}
+
+std::unique_ptr<ZoneList> EmuBackend::ListZones() {
+  size_t sz = dev_->zones.size() * sizeof(EmuZoneInfo);
+  void *zones = malloc(sz);
+  if (zones == nullptr) return nullptr;
+
+  std::lock_guard<std::mutex> lock(dev_->mtx);
+  memcpy(zones, dev_->zones.data(), sz);
+  return std::make_unique<ZoneList>(zones, dev_->zones.size());
+}
+
+IOStatus EmuBackend::Reset(uint64_t start, bool *offline,
+                           uint64_t *max_capacity) {
+  if (readonly_) return IOStatus::IOError("Zone reset failed\n");
+  EmuDelay(options_.reset_lat, 0, 0, nullptr);
+
+  uint32_t idx = start / zone_sz_;
+  {
+    std::lock_guard<std::mutex> lock(dev_->mtx);
+    EmuZoneInfo &z = dev_->zones[idx];
+    if (z.cond == EmuZoneCond::kOffline) {
+      *offline = true;
+      *max_capacity = 0;
+      return IOStatus::OK();
+    }
+    dev_->Release(z);
+    z.cond = EmuZoneCond::kEmpty;
+    z.wp = z.start;
+    *offline = false;
+    *max_capacity = z.capacity;
+    if (dev_->data[idx] != nullptr)
+      madvise(dev_->data[idx], zone_sz_, MADV_DONTNEED);
+  }
+
+  if (dev_->fd >= 0) {
+    fallocate(dev_->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+              dev_->data_offset + start, zone_sz_);
+  }
+  return SaveState();
+}
+
+IOStatus EmuBackend::Finish(uint64_t start) {
+  if (readonly_) return IOStatus::IOError("Zone finish failed\n");
+  EmuDelay(options_.finish_lat, 0, 0, nullptr);
+
+  {
+    std::lock_guard<std::mutex> lock(dev_->mtx);
+    EmuZoneInfo &z = dev_->zones[start / zone_sz_];
+    if (z.cond == EmuZoneCond::kOffline)
+      return IOStatus::IOError("Zone finish failed\n");
+    dev_->Release(z);
+    z.cond = EmuZoneCond::kFull;
+    z.wp = z.start + zone_sz_;
+  }
+  return SaveState();
+}
+
+IOStatus EmuBackend::Close(uint64_t start) {
+  if (readonly_) return IOStatus::IOError("Zone close failed\n");
+
+  {
+    std::lock_guard<std::mutex> lock(dev_->mtx);
+    EmuZoneInfo &z = dev_->zones[start / zone_sz_];
+    if (z.cond != EmuZoneCond::kImpOpen) return IOStatus::OK();
+    dev_->nr_open--;
+    if (z.wp == z.start) {
+      dev_->nr_active--;
+      z.cond = EmuZoneCond::kEmpty;
+    } else {
+      z.cond = EmuZoneCond::kClosed;
+    }
+  }
+  return SaveState();
+}
+
+int EmuBackend::WriteAt(char *data, uint32_t size, uint64_t pos, bool append,
+                        uint64_t *written_pos) {
+  if (readonly_) {
+    errno = EBADF;
+    return -1;
+  }
+  if (size % block_sz_) {
+    errno = EINVAL;
+    return -1;
+  }
+  EmuDelay(options_.write_lat, size, options_.write_bw, &dev_->write_busy);
+
+  uint32_t idx = pos / zone_sz_;
+  if (idx >= nr_zones_) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  char *dst = nullptr;
+  bool filled = false;
+  {
+    std::lock_guard<std::mutex> lock(dev_->mtx);
+    EmuZoneInfo &z = dev_->zones[idx];
+    if (z.cond == EmuZoneCond::kFull || z.cond == EmuZoneCond::kOffline) {
+      errno = EIO;
+      return -1;
+    }
+    if (append) pos = z.wp;
+    /* Unaligned write or write past the zone capacity */
+    if (pos != z.wp || z.wp + size > z.start + z.capacity) {
+      errno = EIO;
+      return -1;
+    }
+
+    if (dev_->fd < 0 && dev_->data[idx] == nullptr) {
+      void *m = mmap(nullptr, zone_sz_, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (m == MAP_FAILED) return -1;
+      dev_->data[idx] = (char *)m;
+    }
+
+    if (z.cond != EmuZoneCond::kImpOpen) {
+      if (z.cond == EmuZoneCond::kEmpty && options_.max_active &&
+          dev_->nr_active >= options_.max_active) {
+        errno = EOVERFLOW;
+        return -1;
+      }
+      /* Like a drive, implicitly close another zone to open this one */
+      if (options_.max_open && dev_->nr_open >= options_.max_open) {
+        auto victim = std::find_if(
+            dev_->zones.begin(), dev_->zones.end(), [](const EmuZoneInfo &o) {
+              return o.cond == EmuZoneCond::kImpOpen;
+            });
+        if (victim == dev_->zones.end()) {
+          errno = ETOOMANYREFS;
+          return -1;
+        }
+        victim->cond = EmuZoneCond::kClosed;
+        dev_->nr_open--;
+      }
+      if (z.cond == EmuZoneCond::kEmpty) dev_->nr_active++;
+      dev_->nr_open++;
+      z.cond = EmuZoneCond::kImpOpen;
+    }
+
+    /* Reserve the range so that appends get distinct positions, the
+     * write pointer is rolled back if the data does not make it */
+    z.wp += size;
+    if (z.wp == z.start + z.capacity) {
+      dev_->Release(z);
+      z.cond = EmuZoneCond::kFull;
+      filled = true;
+    }
+
+    if (dev_->fd < 0) dst = dev_->data[idx] + (pos - z.start);
+  }
+
+  if (dst != nullptr) {
+    memcpy(dst, data, size);
+    if (written_pos != nullptr) *written_pos = pos;
+    return size;
+  }
+
+  uint64_t off = pos;
+  uint32_t left = size;
+  while (left) {
+    ssize_t ret = pwrite(dev_->fd, data, left, dev_->data_offset + off);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      break;
+    }
+    data += ret;
+    off += ret;
+    left -= ret;
+  }
+
+  int err = errno;
+  std::lock_guard<std::mutex> lock(dev_->mtx);
+  EmuZoneInfo &z = dev_->zones[idx];
+  if (left) {
+    /* Nothing was written behind us, the zone is as it was */
+    if (z.wp == pos + size) {
+      z.wp = pos;
+      if (filled && z.cond == EmuZoneCond::kFull) {
+        z.cond = EmuZoneCond::kClosed;
+        dev_->nr_active++;
+      }
+    }
+    errno = err;
+    return -1;
+  }
+  if (dev_->SaveZone(idx)) return -1;
+
+  if (written_pos != nullptr) *written_pos = pos;
+  return size;
+}
+
+int EmuBackend::Write(char *data, uint32_t size, uint64_t pos) {
+  return WriteAt(data, size, pos, false, nullptr);
+}
+
+int EmuBackend::ZoneAppend(char *data, uint32_t size, uint64_t start,
+                           uint64_t *pos) {
+  if (size > options_.max_append) {
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+  return WriteAt(data, size, start, true, pos) < 0 ? -1 : 0;
+}
+
+int EmuBackend::Read(char *buf, int size, uint64_t pos, bool /*direct*/) {
+  uint64_t dev_sz = (uint64_t)nr_zones_ * zone_sz_;
+  if (size <= 0 || pos >= dev_sz) return 0;
+  size = std::min<uint64_t>(size, dev_sz - pos);
+  EmuDelay(options_.read_lat, size, options_.read_bw, &dev_->read_busy);
+
+  int done = 0;
+  while (done < size) {
+    uint32_t idx = pos / zone_sz_;
+    uint64_t n = std::min<uint64_t>(size - done, (idx + 1) * zone_sz_ - pos);
+    char *src;
+    {
+      std::lock_guard<std::mutex> lock(dev_->mtx);
+      if (dev_->zones[idx].cond == EmuZoneCond::kOffline) {
+        errno = EIO;
+        return done ? done : -1;
+      }
+      src = dev_->data[idx];
+    }
+
+    if (dev_->fd >= 0) {
+      ssize_t ret = pread(dev_->fd, buf + done, n, dev_->data_offset + pos);
+      if (ret < 0) {
+        if (errno == EINTR) continue;
+        return done ? done : -1;
+      }
+      if (ret == 0) break;
+      n = ret;
+    } else if (src != nullptr) {
+      memcpy(buf + done, src + (pos - idx * zone_sz_), n);
+    } else {
+      memset(buf + done, 0, n);
+    }
+    done += n;
+    pos += n;
+  }
+  return done;
+}
+
+void EmuBackend::setZoneOffline(unsigned int idx, unsigned int /*idx2*/,
+                                bool offline) {
+  if (!dev_ || idx >= dev_->zones.size()) return;
+
+  std::lock_guard<std::mutex> lock(dev_->mtx);
+  EmuZoneInfo &z = dev_->zones[idx];
+  if (offline) {
+    dev_->Release(z);
+    z.cond = EmuZoneCond::kOffline;
+  } else if (z.cond == EmuZoneCond::kOffline) {
+    z.cond = EmuZoneCond::kEmpty;
+    z.wp = z.start;
+    if (dev_->data[idx] != nullptr)
+      madvise(dev_->data[idx], zone_sz_, MADV_DONTNEED);
+  }
+}
+
+}  // namespace AQUAFS_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && !defined(OS_WIN)
@@ -0,0 +1,150 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rocksdb/io_status.h"
+#include "rocksdb/rocksdb_namespace.h"
+#include "zbd_aquafs.h"
+
+namespace AQUAFS_NAMESPACE {
+using namespace ROCKSDB_NAMESPACE;
+
+enum class EmuZoneCond : uint32_t {
+  kEmpty = 0,
+  kImpOpen,
+  kClosed,
+  kFull,
+  kOffline,
+};
+
+/* Zone report entry, also the on-disk zone state of file backed devices */
+struct EmuZoneInfo {
+  uint64_t start;
+  uint64_t wp;
+  uint64_t capacity;
+  EmuZoneCond cond;
+  uint32_t reserved;
+};
+
+/* Geometry, limits and timing of an emulated device, parsed from the part
+ * of the URI after "emu:". Options are separated by ':', e.g.
+ * "emu:zones=64:zone_size=64M:write_lat=20:write_bw=1000" */
+struct EmuOptions {
+  std::string mem;  /* name of a memory device shared in the process */
+  std::string file; /* sparse regular file, memory when empty */
+  uint32_t nr_zones = 64;
+  uint64_t zone_sz = 64 << 20;
+  uint64_t zone_cap = 0; /* 0 means zone_sz */
+  uint32_t block_sz = 4096;
+  uint32_t max_active = 14; /* 0 means no limit */
+  uint32_t max_open = 14;
+  uint32_t max_append = 0; /* zone append is not emulated when 0 */
+
+  /* Fixed latency of every operation in microseconds */
+  uint64_t read_lat = 0;
+  uint64_t write_lat = 0;
+  uint64_t reset_lat = 0;
+  uint64_t finish_lat = 0;
+  /* Bandwidth shared by all readers or writers in MB/s, 0 means no limit */
+  uint64_t read_bw = 0;
+  uint64_t write_bw = 0;
+
+  std::vector<uint32_t> offline; /* zones offline from the start */
+
+  static IOStatus Parse(const std::string &spec, EmuOptions *options);
+};
+
+struct EmuDevice;
+
+/* Userspace zoned device: zone conditions, write pointer rules and the
+ * open/active limits of a ZNS drive, with data kept in memory or in a
+ * sparse file. Used to test and benchmark without zoned hardware. */
+class EmuBackend : public ZonedBlockDeviceBackend {
+ private:
+  std::string spec_;
+  EmuOptions options_;
+  IOStatus parse_status_;
+  std::shared_ptr<EmuDevice> dev_;
+  bool readonly_ = true;
+
+ public:
+  explicit EmuBackend(std::string spec);
+  ~EmuBackend();
+
+  IOStatus Open(bool readonly, bool exclusive, unsigned int *max_active_zones,
+                unsigned int *max_open_zones);
+  std::unique_ptr<ZoneList> ListZones();
+  IOStatus Reset(uint64_t start, bool *offline, uint64_t *max_capacity);
+  IOStatus Finish(uint64_t start);
+  IOStatus Close(uint64_t start);
+  int Read(char *buf, int size, uint64_t pos, bool direct);
+  int Write(char *data, uint32_t size, uint64_t pos);
+  int InvalidateCache(uint64_t /*pos*/, uint64_t /*size*/) { return 0; }
+  int ZoneAppend(char *data, uint32_t size, uint64_t start, uint64_t *pos);
+  [[nodiscard]] uint32_t GetMaxAppendSize() const {
+    return options_.max_append;
+  }
+
+  bool ZoneIsSwr(std::unique_ptr<ZoneList> & /*zones*/,
+                 unsigned int /*idx*/) {
+    return true;
+  }
+  bool ZoneIsOffline(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    return GetZone(zones, idx)->cond == EmuZoneCond::kOffline;
+  }
+  bool ZoneIsWritable(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    EmuZoneCond cond = GetZone(zones, idx)->cond;
+    return !(cond == EmuZoneCond::kFull || cond == EmuZoneCond::kOffline);
+  }
+  bool ZoneIsActive(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    EmuZoneCond cond = GetZone(zones, idx)->cond;
+    return cond == EmuZoneCond::kImpOpen || cond == EmuZoneCond::kClosed;
+  }
+  bool ZoneIsOpen(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    return GetZone(zones, idx)->cond == EmuZoneCond::kImpOpen;
+  }
+  uint64_t ZoneStart(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    return GetZone(zones, idx)->start;
+  }
+  uint64_t ZoneMaxCapacity(std::unique_ptr<ZoneList> &zones,
+                           unsigned int idx) {
+    return GetZone(zones, idx)->capacity;
+  }
+  uint64_t ZoneWp(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    return GetZone(zones, idx)->wp;
+  }
+  std::string GetFilename() { return "emu:" + spec_; }
+
+  /* Takes the zone offline at once, or brings it back empty */
+  void setZoneOffline(unsigned int idx, unsigned int idx2, bool offline);
+
+  /* Forgets a named memory device, its memory is freed once no backend
+   * has it open anymore */
+  static void RemoveMemoryDevice(const std::string &name);
+
+ private:
+  static EmuZoneInfo *GetZone(std::unique_ptr<ZoneList> &zones,
+                              unsigned int idx) {
+    return &((EmuZoneInfo *)zones->GetData())[idx];
+  }
+  int WriteAt(char *data, uint32_t size, uint64_t pos, bool append,
+              uint64_t *written_pos);
+  IOStatus LoadFile(bool readonly, bool exclusive);
+  IOStatus SaveState();
+};
+
+}  // namespace AQUAFS_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
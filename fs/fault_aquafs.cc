@@ -0,0 +1,131 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && !defined(OS_WIN)
+
+#include "fault_aquafs.h"
+
+#include <errno.h>
+
+namespace AQUAFS_NAMESPACE {
+
+FaultInjectionBackend::FaultInjectionBackend(
+    std::unique_ptr<ZonedBlockDeviceBackend> target,
+    const FaultOptions &options)
+    : target_(std::move(target)), options_(options), rng_(options.seed) {}
+
+IOStatus FaultInjectionBackend::Open(bool readonly, bool exclusive,
+                                     unsigned int *max_active_zones,
+                                     unsigned int *max_open_zones) {
+  IOStatus s =
+      target_->Open(readonly, exclusive, max_active_zones, max_open_zones);
+  if (!s.ok()) return s;
+  block_sz_ = target_->GetBlockSize();
+  zone_sz_ = target_->GetZoneSize();
+  nr_zones_ = target_->GetNrZones();
+  return IOStatus::OK();
+}
+
+bool FaultInjectionBackend::Chance(double rate) {
+  if (rate <= 0) return false;
+  std::lock_guard<std::mutex> lock(rng_mtx_);
+  return std::uniform_real_distribution<double>(0, 1)(rng_) < rate;
+}
+
+bool FaultInjectionBackend::CountIO() {
+  uint64_t io = ++stats_.ios;
+  if (options_.power_cut_at != 0 && io == options_.power_cut_at) {
+    power_cut_ = true;
+    return true;
+  }
+  return false;
+}
+
+IOStatus FaultInjectionBackend::Reset(uint64_t start, bool *offline,
+                                      uint64_t *max_capacity) {
+  if (CountIO() || power_cut_ || Chance(options_.fail_reset)) {
+    stats_.failed_resets++;
+    return IOStatus::IOError("Injected zone reset failure");
+  }
+
+  IOStatus s = target_->Reset(start, offline, max_capacity);
+  if (s.ok() && !*offline && Chance(options_.offline_on_reset)) {
+    unsigned int idx = start / zone_sz_;
+    target_->setZoneOffline(idx, idx, true);
+    stats_.offlined_zones++;
+    *offline = true;
+  }
+  return s;
+}
+
+IOStatus FaultInjectionBackend::Finish(uint64_t start) {
+  if (CountIO() || power_cut_ || Chance(options_.fail_finish)) {
+    stats_.failed_finishes++;
+    return IOStatus::IOError("Injected zone finish failure");
+  }
+  return target_->Finish(start);
+}
+
+IOStatus FaultInjectionBackend::Close(uint64_t start) {
+  if (CountIO() || power_cut_)
+    return IOStatus::IOError("Injected zone close failure");
+  return target_->Close(start);
+}
+
+int FaultInjectionBackend::Read(char *buf, int size, uint64_t pos,
+                                bool direct) {
+  if (power_cut_) {
+    errno = EIO;
+    return -1;
+  }
+  return target_->Read(buf, size, pos, direct);
+}
+
+int FaultInjectionBackend::Write(char *data, uint32_t size, uint64_t pos) {
+  bool cut = CountIO();
+  if (power_cut_ && !cut) {
+    errno = EIO;
+    return -1;
+  }
+
+  if (cut || Chance(options_.torn_write)) {
+    /* Some of the blocks made it to the media */
+    uint32_t blocks = size / block_sz_;
+    uint32_t torn = 0;
+    if (blocks > 0) {
+      std::lock_guard<std::mutex> lock(rng_mtx_);
+      torn = std::uniform_int_distribution<uint32_t>(0, blocks - 1)(rng_);
+    }
+    if (torn > 0) target_->Write(data, torn * block_sz_, pos);
+    stats_.torn_writes++;
+    errno = EIO;
+    return -1;
+  }
+  if (Chance(options_.fail_write)) {
+    stats_.failed_writes++;
+    errno = EIO;
+    return -1;
+  }
+  if (Chance(options_.drop_write)) {
+    stats_.dropped_writes++;
+    return size;
+  }
+  return target_->Write(data, size, pos);
+}
+
+int FaultInjectionBackend::ZoneAppend(char *data, uint32_t size,
+                                      uint64_t start, uint64_t *pos) {
+  if (CountIO() || power_cut_ || Chance(options_.fail_write)) {
+    stats_.failed_writes++;
+    errno = EIO;
+    return -1;
+  }
+  return target_->ZoneAppend(data, size, start, pos);
+}
+
+}  // namespace AQUAFS_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && !defined(OS_WIN)
@@ -0,0 +1,134 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+
+#include "rocksdb/io_status.h"
+#include "rocksdb/rocksdb_namespace.h"
+#include "zbd_aquafs.h"
+
+namespace AQUAFS_NAMESPACE {
+using namespace ROCKSDB_NAMESPACE;
+
+/* What to inject, rates are probabilities per operation */
+struct FaultOptions {
+  uint64_t seed = 0;
+  double fail_write = 0;  /* nothing written, EIO */
+  double torn_write = 0;  /* a block aligned prefix written, then EIO */
+  double drop_write = 0;  /* acknowledged but never written */
+  double fail_reset = 0;  /* reset not done, error returned */
+  double fail_finish = 0; /* finish not done, error returned */
+  double offline_on_reset = 0; /* the zone goes offline when reset */
+  /* Power is cut at this mutating operation, counted from 1, 0 means
+   * never. The operation that hits the cut is torn if it is a write. */
+  uint64_t power_cut_at = 0;
+};
+
+struct FaultStats {
+  std::atomic<uint64_t> ios{0}; /* mutating operations seen */
+  std::atomic<uint64_t> failed_writes{0};
+  std::atomic<uint64_t> torn_writes{0};
+  std::atomic<uint64_t> dropped_writes{0};
+  std::atomic<uint64_t> failed_resets{0};
+  std::atomic<uint64_t> failed_finishes{0};
+  std::atomic<uint64_t> offlined_zones{0};
+};
+
+/* Wraps any backend and injects faults into what AquaFS sends to it. After
+ * a power cut every operation fails, until a new device is opened on the
+ * target, what was written before the cut is what a remount will find. */
+class FaultInjectionBackend : public ZonedBlockDeviceBackend {
+ private:
+  std::unique_ptr<ZonedBlockDeviceBackend> target_;
+  FaultOptions options_;
+  FaultStats stats_;
+  std::atomic<bool> power_cut_{false};
+  std::mutex rng_mtx_;
+  std::mt19937_64 rng_;
+
+ public:
+  FaultInjectionBackend(std::unique_ptr<ZonedBlockDeviceBackend> target,
+                        const FaultOptions &options);
+
+  IOStatus Open(bool readonly, bool exclusive, unsigned int *max_active_zones,
+                unsigned int *max_open_zones);
+  std::unique_ptr<ZoneList> ListZones() { return target_->ListZones(); }
+  IOStatus Reset(uint64_t start, bool *offline, uint64_t *max_capacity);
+  IOStatus Finish(uint64_t start);
+  IOStatus Close(uint64_t start);
+  int Read(char *buf, int size, uint64_t pos, bool direct);
+  int Write(char *data, uint32_t size, uint64_t pos);
+  int ZoneAppend(char *data, uint32_t size, uint64_t start, uint64_t *pos);
+  int InvalidateCache(uint64_t pos, uint64_t size) {
+    return target_->InvalidateCache(pos, size);
+  }
+  [[nodiscard]] uint32_t GetRaidModeAt(uint64_t pos) {
+    return target_->GetRaidModeAt(pos);
+  }
+  [[nodiscard]] uint32_t GetMaxAppendSize() const {
+    return target_->GetMaxAppendSize();
+  }
+  [[nodiscard]] bool IsRAIDEnabled() const { return target_->IsRAIDEnabled(); }
+  [[nodiscard]] std::vector<int> GetNumaNodes() const {
+    return target_->GetNumaNodes();
+  }
+  int GetNumaNodeAt(uint64_t pos) { return target_->GetNumaNodeAt(pos); }
+  [[nodiscard]] uint64_t GetNumaRemoteBytes() const {
+    return target_->GetNumaRemoteBytes();
+  }
+
+  bool ZoneIsSwr(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    return target_->ZoneIsSwr(zones, idx);
+  }
+  bool ZoneIsOffline(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    return target_->ZoneIsOffline(zones, idx);
+  }
+  bool ZoneIsWritable(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    return target_->ZoneIsWritable(zones, idx);
+  }
+  bool ZoneIsActive(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    return target_->ZoneIsActive(zones, idx);
+  }
+  bool ZoneIsOpen(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    return target_->ZoneIsOpen(zones, idx);
+  }
+  uint64_t ZoneStart(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    return target_->ZoneStart(zones, idx);
+  }
+  uint64_t ZoneMaxCapacity(std::unique_ptr<ZoneList> &zones,
+                           unsigned int idx) {
+    return target_->ZoneMaxCapacity(zones, idx);
+  }
+  uint64_t ZoneWp(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
+    return target_->ZoneWp(zones, idx);
+  }
+  std::string GetFilename() { return "fault:" + target_->GetFilename(); }
+  void setZoneOffline(unsigned int idx, unsigned int idx2, bool offline) {
+    target_->setZoneOffline(idx, idx2, offline);
+  }
+
+  /* Cuts the power now */
+  void PowerCut() { power_cut_ = true; }
+  bool IsPowerCut() const { return power_cut_.load(); }
+  const FaultStats &GetStats() const { return stats_; }
+
+ private:
+  bool Chance(double rate);
+  /* Counts a mutating operation, true if it hits the power cut */
+  bool CountIO();
+};
+
+}  // namespace AQUAFS_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
@@ -0,0 +1,73 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && !defined(OS_WIN)
+
+#include "finish_aquafs.h"
+
+#include <algorithm>
+
+namespace AQUAFS_NAMESPACE {
+
+const char *finish_reason_str(FinishReason reason) {
+  switch (reason) {
+    case FinishReason::kThreshold:
+      return "threshold";
+    case FinishReason::kHeadroom:
+      return "headroom";
+    case FinishReason::kAllocation:
+      return "allocation";
+    case FinishReason::kOther:
+      return "other";
+    default:
+      return "unknown";
+  }
+}
+
+uint64_t ZoneFinishPolicy::FillTimeUs(const FinishCandidate &c,
+                                      uint64_t now_us) {
+  if (c.open_us == 0 || c.written == 0 || IsIdle(c, now_us))
+    return kMaxFillUs;
+  uint64_t elapsed = std::max<uint64_t>(now_us - c.open_us, 1);
+  double fill = (double)c.capacity * elapsed / c.written;
+  return (uint64_t)std::min<double>(fill, kMaxFillUs);
+}
+
+double ZoneFinishPolicy::Cost(const FinishCandidate &c, uint64_t now_us) {
+  double fill_s = (double)FillTimeUs(c, now_us) / 1000000;
+  return (double)c.capacity / (1 + fill_s);
+}
+
+uint64_t ZoneFinishPolicy::GetFinishes() const {
+  uint64_t finishes = 0;
+  for (uint32_t r = 0; r < (uint32_t)FinishReason::kMax; r++)
+    finishes += finishes_[r].load(std::memory_order_relaxed);
+  return finishes;
+}
+
+uint64_t ZoneFinishPolicy::GetWastedBytes() const {
+  uint64_t wasted = 0;
+  for (uint32_t r = 0; r < (uint32_t)FinishReason::kMax; r++)
+    wasted += wasted_[r].load(std::memory_order_relaxed);
+  return wasted;
+}
+
+void ZoneFinishPolicy::EncodeJson(std::ostream &json_stream) {
+  json_stream << "{";
+  for (uint32_t r = 0; r < (uint32_t)FinishReason::kMax; r++) {
+    if (r) json_stream << ",";
+    json_stream << "\"" << finish_reason_str((FinishReason)r)
+                << "\":{\"finishes\":"
+                << finishes_[r].load(std::memory_order_relaxed)
+                << ",\"wasted_bytes\":"
+                << wasted_[r].load(std::memory_order_relaxed) << "}";
+  }
+  json_stream << "}";
+}
+
+}  // namespace AQUAFS_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && !defined(OS_WIN)
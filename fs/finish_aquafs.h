@@ -0,0 +1,83 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+#include "aquafs_namespace.h"
+
+namespace AQUAFS_NAMESPACE {
+
+/* Why a zone was finished */
+enum class FinishReason : uint32_t {
+  /* Less than finish_threshold% capacity left */
+  kThreshold = 0,
+  /* Freeing an active zone ahead of the allocations that need one */
+  kHeadroom,
+  /* An allocation found no active zone left and had to wait for one */
+  kAllocation,
+  /* Finished outside the policy, e.g. old metadata zones */
+  kOther,
+  kMax,
+};
+
+const char *finish_reason_str(FinishReason reason);
+
+/* What the finish policy looks at in a partially written zone */
+struct FinishCandidate {
+  /* Bytes left, lost when the zone is finished */
+  uint64_t capacity;
+  uint64_t max_capacity;
+  /* Bytes written since the zone was opened */
+  uint64_t written;
+  /* When the zone was opened and last written to, 0 if not since mount */
+  uint64_t open_us;
+  uint64_t last_write_us;
+};
+
+/* Picks the zones to finish, and accounts every finish and the capacity it
+ * wastes */
+class ZoneFinishPolicy {
+ public:
+  /* Zones not written to for this long are taken for headroom */
+  static const uint64_t kIdleUs = 1000 * 1000;
+  /* Fill times are capped here, longer is as good as never */
+  static const uint64_t kMaxFillUs = 3600ull * 1000 * 1000;
+
+  /* Time until the zone fills at the rate it was written at so far */
+  static uint64_t FillTimeUs(const FinishCandidate &c, uint64_t now_us);
+  static bool IsIdle(const FinishCandidate &c, uint64_t now_us) {
+    return now_us >= c.last_write_us + kIdleUs;
+  }
+  static bool BelowThreshold(const FinishCandidate &c, uint32_t threshold) {
+    return c.capacity < c.max_capacity * threshold / 100;
+  }
+  /* How much finishing the zone costs, lower is a better victim. Little
+   * capacity left and a long way to fill it on its own make a zone cheap:
+   * it wastes little, or holds its active zone for long otherwise. */
+  static double Cost(const FinishCandidate &c, uint64_t now_us);
+
+  void Finished(FinishReason reason, uint64_t wasted) {
+    finishes_[(uint32_t)reason].fetch_add(1, std::memory_order_relaxed);
+    wasted_[(uint32_t)reason].fetch_add(wasted, std::memory_order_relaxed);
+  }
+  uint64_t GetFinishes() const;
+  uint64_t GetWastedBytes() const;
+  void EncodeJson(std::ostream &json_stream);
+
+ private:
+  std::atomic<uint64_t> finishes_[(uint32_t)FinishReason::kMax]{};
+  std::atomic<uint64_t> wasted_[(uint32_t)FinishReason::kMax]{};
+};
+
+}  // namespace AQUAFS_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
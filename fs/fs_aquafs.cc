@@ -16,6 +16,7 @@
 #include <cerrno>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <set>
 #include <sstream>
 #include <utility>
@@ -29,6 +30,7 @@
 #include "rocksdb/rocksdb_namespace.h"
 #include "rocksdb/utilities/object_registry.h"
 #include "snapshot.h"
+#include "trace_aquafs.h"
 #include "util/coding.h"
 #include "util/crc32c.h"
 #include "util/mutexlock.h"
@@ -133,6 +135,19 @@ void Superblock::GetReport(std::string* reportString) {
     reportString->append(raid_mode_str(raid_info_.main_mode));
     reportString->append("\nAquaFS Raid Number of Devices:\t");
     reportString->append(std::to_string(raid_info_.nr_devices));
+    reportString->append("\nAquaFS Raid Stripe Unit [Bytes]:\t");
+    reportString->append(raid_info_.stripe_unit
+                             ? std::to_string(raid_info_.stripe_unit)
+                             : std::to_string(block_size_));
+    if (raid_info_.dev_weights[0]) {
+      reportString->append("\nAquaFS Raid Stripe Weights:\t");
+      for (uint32_t i = 0; i < raid_info_.nr_devices &&
+                           i < RaidInfoBasic::kMaxWeightedDevices;
+           i++) {
+        if (i) reportString->append(",");
+        reportString->append(std::to_string(raid_info_.dev_weights[i]));
+      }
+    }
   }
 }
 
@@ -168,7 +183,7 @@ IOStatus AquaMetaLog::AddRecord(const Slice& slice) {
   assert(data != nullptr);
   assert((phys_sz % bs_) == 0);
 
-  ret = posix_memalign((void**)&buffer, sysconf(_SC_PAGESIZE), phys_sz);
+  ret = zbd_->AllocIOBuffer((void**)&buffer, sysconf(_SC_PAGESIZE), phys_sz);
   if (ret) return IOStatus::IOError("Failed to allocate memory");
 
   memset(buffer, 0, phys_sz);
@@ -187,8 +202,16 @@ IOStatus AquaMetaLog::AddRecord(const Slice& slice) {
   //          *(uint32_t*)(data), zone_->wp_);
 
   s = zone_->Append(buffer, phys_sz);
+  if (s.ok()) {
+    AQUAFS_TRACE(TraceEvent::kMetaRecord, 0, zone_->wp_ - phys_sz, record_sz);
+    zbd_->AccountWrite(zone_, WriteKind::kMeta, Env::WLTH_NOT_SET,
+                       IOType::kUnknown, record_sz + zMetaHeaderSize);
+    zbd_->AccountWrite(zone_, WriteKind::kMetaPadding, Env::WLTH_NOT_SET,
+                       IOType::kUnknown,
+                       phys_sz - record_sz - zMetaHeaderSize);
+  }
 
-  free(buffer);
+  zbd_->FreeIOBuffer(buffer, phys_sz);
   return s;
 }
 
@@ -313,12 +336,120 @@ AquaFS::~AquaFS() {
     gc_worker_->join();
   }
 
+  if (trace_dump_worker_) {
+    run_trace_dump_worker_ = false;
+    trace_dump_worker_->join();
+  }
+
+  if (!FLAGS_trace_file.empty()) {
+    IOStatus ios = DumpTrace(FLAGS_trace_file);
+    if (!ios.ok())
+      Warn(logger_, "Failed to dump I/O trace: %s", ios.ToString().c_str());
+  }
+
+  if (!FLAGS_stats_file.empty()) {
+    IOStatus ios = DumpStats(FLAGS_stats_file);
+    if (!ios.ok())
+      Warn(logger_, "Failed to dump statistics: %s", ios.ToString().c_str());
+  }
+
   meta_log_.reset(nullptr);
   ClearFiles();
   Info(logger_, "AquaFS unmounted");
   delete zbd_;
 }
 
+IOStatus AquaFS::DumpStats(const std::string& path) {
+  AquaFSSnapshot snapshot;
+  AquaFSSnapshotOptions options;
+  options.zbd_ = true;
+  GetAquaFSSnapshot(snapshot, options);
+
+  const ZBDSnapshot& zbd = snapshot.zbd_;
+  std::ostringstream json;
+  json << "{\"write_amplification\":" << zbd.write_stats.WriteAmplification()
+       << ",\"gc_bytes\":"
+       << zbd.write_stats.by_kind[(uint32_t)WriteKind::kGC]
+       << ",\"zone_resets\":" << zbd.zone_resets
+       << ",\"zone_reset_failures\":" << zbd.zone_reset_failures
+       << ",\"zone_finishes\":" << zbd.zone_finishes
+       << ",\"finish_wasted_bytes\":" << zbd.finish_wasted_bytes
+       << ",\"zone_finish_failures\":" << zbd.zone_finish_failures
+       << ",\"numa_remote_bytes\":" << zbd.numa_remote_bytes
+       << ",\"free_space\":" << zbd.free_space
+       << ",\"used_space\":" << zbd.used_space
+       << ",\"reclaimable_space\":" << zbd.reclaimable_space
+       << ",\"write_stats\":";
+  zbd.write_stats.EncodeJson(json);
+  if (zbd_->GetPlacement() != nullptr) {
+    json << ",\"placement\":";
+    zbd_->GetPlacement()->EncodeJson(json);
+  }
+  json << ",\"finish\":";
+  zbd_->GetFinishPolicy().EncodeJson(json);
+  if (zbd_->GetLifetimePredictor() != nullptr) {
+    json << ",\"lifetime_prediction\":";
+    zbd_->GetLifetimePredictor()->EncodeJson(json);
+  }
+  static const std::pair<uint32_t, const char*> latencies[] = {
+      {AQUAFS_READ_LATENCY, "read"},
+      {AQUAFS_WRITE_LATENCY, "write"},
+      {AQUAFS_SYNC_LATENCY, "sync"},
+      {AQUAFS_WAL_SYNC_LATENCY, "wal_sync"},
+      {AQUAFS_IO_ALLOC_LATENCY, "io_alloc"},
+  };
+  bool first = true;
+  for (const auto& l : latencies) {
+    AquaFSHistogramSnapshot h;
+    if (!zbd_->GetMetrics()->GetLatencyHistogram(l.first, &h)) continue;
+    json << (first ? ",\"latency_us\":{" : ",") << "\"" << l.second
+         << "\":{\"count\":" << h.count << ",\"p50\":" << h.Percentile(50)
+         << ",\"p99\":" << h.Percentile(99)
+         << ",\"p999\":" << h.Percentile(99.9) << "}";
+    first = false;
+  }
+  if (!first) json << "}";
+  json << "}\n";
+
+  std::ofstream out(path, std::ios::app);
+  out << json.str();
+  if (!out.good())
+    return IOStatus::IOError("Failed to write statistics file: " + path);
+  return IOStatus::OK();
+}
+
+void AquaFS::TraceDumpWorker() {
+  const std::string aux_path = superblock_->GetAuxFsPath();
+  const std::string request = AquaFSTracer::DumpRequestPath(aux_path);
+  const std::string result = AquaFSTracer::DumpResultPath(aux_path);
+
+  while (run_trace_dump_worker_) {
+    usleep(1000 * 500);
+
+    std::ifstream in(request);
+    if (!in.is_open()) continue;
+    std::string path;
+    std::getline(in, path);
+    in.close();
+    remove(request.c_str());
+
+    IOStatus ios = path.empty()
+                       ? IOStatus::InvalidArgument("No trace file in request")
+                       : DumpTrace(path);
+    if (ios.ok())
+      Info(logger_, "Dumped I/O trace to %s", path.c_str());
+    else
+      Warn(logger_, "Failed to dump I/O trace: %s", ios.ToString().c_str());
+
+    /* Publish the result atomically, the tool polls for it */
+    std::string tmp = result + ".tmp";
+    std::ofstream out(tmp, std::ios::trunc);
+    out << (ios.ok() ? std::string("OK") : ios.ToString()) << "\n";
+    out.close();
+    rename(tmp.c_str(), result.c_str());
+  }
+}
+
 void AquaFS::GCWorker() {
   while (run_gc_worker_) {
     usleep(1000 * FLAGS_gc_sleep_time);
@@ -548,7 +679,7 @@ IOStatus AquaFS::SyncFileExtents(ZoneFile* zoneFile,
   for (size_t i = 0; i < new_extents.size(); ++i) {
     ZoneExtent* old_ext = old_extents[i];
     if (old_ext->start_ != new_extents[i]->start_) {
-      old_ext->zone_->used_capacity_ -= old_ext->length_;
+      old_ext->zone_->ReleaseCapacity(old_ext->length_);
     }
     delete old_ext;
   }
@@ -631,6 +762,22 @@ IOStatus AquaFS::DeleteFileNoLock(std::string fname, const IOOptions& options,
       if (zoneFile->GetNrLinks() > 0) return s;
       /* Mark up the file as deleted so it won't be migrated by GC */
       zoneFile->SetDeleted();
+      AQUAFS_TRACE(TraceEvent::kFileDelete, (uint32_t)zoneFile->GetID(), 0,
+                   zoneFile->GetFileSize());
+      AquaFSPlacement* placement = zbd_->GetPlacement();
+      LifetimePredictor* predictor = zbd_->GetLifetimePredictor();
+      time_t m_time = zoneFile->GetFileModificationTime();
+      time_t now = time(0);
+      if (m_time != 0 && now >= m_time) {
+        if (placement != nullptr)
+          placement->FileDeleted(
+              file_class(fname, zoneFile->GetWriteLifeTimeHint(),
+                         zoneFile->GetIOType()),
+              now - m_time, zoneFile->GetFileSize());
+        if (predictor != nullptr)
+          predictor->FileDeleted(fname, zoneFile->GetWriteLifeTimeHint(),
+                                 zoneFile->GetIOType(), now - m_time);
+      }
       zoneFile.reset();
     }
   } else {
@@ -677,6 +824,32 @@ IOStatus AquaFS::NewRandomAccessFile(
   return IOStatus::OK();
 }
 
+#if (ROCKSDB_MAJOR >= 7)
+IOStatus AquaFS::Poll(std::vector<void*>& io_handles, size_t min_completions) {
+  std::vector<void*> aux_handles;
+  for (auto handle : io_handles) {
+    if (zbd_->IsAsyncRead(handle))
+      static_cast<ZoneAsyncRead*>(handle)->Complete();
+    else
+      aux_handles.push_back(handle);
+  }
+  if (aux_handles.empty()) return IOStatus::OK();
+  return target()->Poll(aux_handles, min_completions);
+}
+
+IOStatus AquaFS::AbortIO(std::vector<void*>& io_handles) {
+  std::vector<void*> aux_handles;
+  for (auto handle : io_handles) {
+    if (zbd_->IsAsyncRead(handle))
+      static_cast<ZoneAsyncRead*>(handle)->Abort();
+    else
+      aux_handles.push_back(handle);
+  }
+  if (aux_handles.empty()) return IOStatus::OK();
+  return target()->AbortIO(aux_handles);
+}
+#endif
+
 inline bool ends_with(std::string const& value, std::string const& ending) {
   if (ending.size() > value.size()) return false;
   return std::equal(ending.rbegin(), ending.rend(), value.rbegin());
@@ -867,7 +1040,6 @@ IOStatus AquaFS::DeleteDirRecursive(const std::string& d,
     std::lock_guard<std::mutex> lock(files_mtx_);
     s = DeleteDirRecursiveNoLock(d, options, dbg);
   }
-  if (s.ok()) s = zbd_->ResetUnusedIOZones();
   return s;
 }
 
@@ -877,7 +1049,6 @@ IOStatus AquaFS::OpenWritableFile(const std::string& filename,
                                   IODebugContext* dbg, bool reopen) {
   IOStatus s;
   std::string fname = FormatPathLexically(filename);
-  bool resetIOZones = false;
   {
     std::lock_guard<std::mutex> file_lock(files_mtx_);
     std::shared_ptr<ZoneFile> zoneFile = GetFileNoLock(fname);
@@ -893,7 +1064,6 @@ IOStatus AquaFS::OpenWritableFile(const std::string& filename,
     if (zoneFile != nullptr) {
       s = DeleteFileNoLock(fname, file_opts.io_options, dbg);
       if (!s.ok()) return s;
-      resetIOZones = true;
     }
 
     zoneFile =
@@ -905,6 +1075,8 @@ IOStatus AquaFS::OpenWritableFile(const std::string& filename,
     if (ends_with(fname, ".log")) {
       zoneFile->SetIOType(IOType::kWAL);
       zoneFile->SetSparse(!file_opts.use_direct_writes);
+      zoneFile->SetSharedAppend(zoneFile->IsSparse() &&
+                                FLAGS_zone_append_shared_wal);
     } else {
       zoneFile->SetIOType(IOType::kUnknown);
     }
@@ -922,8 +1094,6 @@ IOStatus AquaFS::OpenWritableFile(const std::string& filename,
         new ZonedWritableFile(zbd_, !file_opts.use_direct_writes, zoneFile));
   }
 
-  if (resetIOZones) s = zbd_->ResetUnusedIOZones();
-
   return s;
 }
 
@@ -936,7 +1106,6 @@ IOStatus AquaFS::DeleteFile(const std::string& fname, const IOOptions& options,
   files_mtx_.lock();
   s = DeleteFileNoLock(fname, options, dbg);
   files_mtx_.unlock();
-  if (s.ok()) s = zbd_->ResetUnusedIOZones();
   zbd_->LogZoneStats();
 
   return s;
@@ -1104,7 +1273,6 @@ IOStatus AquaFS::RenameFile(const std::string& source_path,
     std::lock_guard<std::mutex> lock(files_mtx_);
     s = RenameFileNoLock(source_path, dest_path, options, dbg);
   }
-  if (s.ok()) s = zbd_->ResetUnusedIOZones();
   return s;
 }
 
@@ -1505,6 +1673,9 @@ Status AquaFS::Mount(bool readonly) {
     std::unique_ptr<Superblock> super_block = std::make_unique<Superblock>();
     s = super_block->DecodeFrom(&super_record);
     if (s.ok()) s = super_block->CompatibleWith(zbd_);
+    // the superblock sits in the first block of the zone, which maps to the
+    // same place for every stripe unit; everything after it does not
+    if (s.ok()) s = super_block->ApplyRaidLayout(zbd_);
     if (!s.ok()) return s;
 
     Info(logger_, "Found OK superblock in zone %lu seq: %u\n", z->GetZoneNr(),
@@ -1605,6 +1776,8 @@ Status AquaFS::Mount(bool readonly) {
     if (!status.ok()) return status;
     Info(logger_, "  Done");
 
+    zbd_->StartBackgroundWorkers();
+
     if (superblock_->IsGCEnabled()) {
       Info(logger_, "Starting garbage collection worker");
       run_gc_worker_ = true;
@@ -1612,6 +1785,11 @@ Status AquaFS::Mount(bool readonly) {
     }
   }
 
+  if (AquaFSTracer::Get().IsEnabled()) {
+    run_trace_dump_worker_ = true;
+    trace_dump_worker_.reset(new std::thread(&AquaFS::TraceDumpWorker, this));
+  }
+
   LogFiles();
 
   return Status::OK();
@@ -1718,6 +1896,9 @@ Status NewAquaFS(FileSystem** fs, const ZbdBackendType backend_type,
   std::shared_ptr<Logger> logger;
   Status s;
 
+  if (FLAGS_latency_histograms && !metrics->IsEnabled())
+    metrics = std::make_shared<AquaFSHistogramMetrics>();
+
   // TerarkDB needs to log important information in production while AquaFS
   // doesn't (currently).
   //
@@ -1887,8 +2068,6 @@ IOStatus AquaFS::MigrateExtents(
   for (const auto& it : file_extents) {
     s = MigrateFileExtents(it.first, it.second);
     if (!s.ok()) break;
-    s = zbd_->ResetUnusedIOZones();
-    if (!s.ok()) break;
   }
   return s;
 }
@@ -1919,9 +2098,9 @@ IOStatus AquaFS::MigrateFileExtents(
         new ZoneExtent(ext->start_, ext->length_, ext->zone_));
   }
 
-  // Modify the new extent list
+  // Collect the extents that need to be migrated
+  std::vector<ZoneExtent*> pending;
   for (ZoneExtent* ext : new_extent_list) {
-    // Check if current extent need to be migrated
     auto it = std::find_if(migrate_exts.begin(), migrate_exts.end(),
                            [&](const ZoneExtentSnapshot* ext_snapshot) {
                              return ext_snapshot->start == ext->start_ &&
@@ -1932,34 +2111,78 @@ IOStatus AquaFS::MigrateFileExtents(
       Info(logger_, "Migrate extent not found, ext_start: %lu", ext->start_);
       continue;
     }
+    pending.push_back(ext);
+  }
 
+  // Modify the new extent list, every migration zone gets the extents that
+  // fit in it with a single copy
+  IOStatus copy_s = IOStatus::OK();
+  size_t i = 0;
+  while (i < pending.size()) {
     Zone* target_zone = nullptr;
 
     // Allocate a new migration zone.
-    s = zbd_->TakeMigrateZone(&target_zone, zfile->GetWriteLifeTimeHint(),
-                              ext->length_);
+    s = zbd_->TakeMigrateZone(&target_zone, zfile->GetPlacementLifeTime(),
+                              zfile->GetExtentRange(pending[i]).size);
     if (!s.ok()) {
+      i++;
       continue;
     }
 
     if (target_zone == nullptr) {
       zbd_->ReleaseMigrateZone(target_zone);
       Info(logger_, "Migrate Zone Acquire Failed, Ignore Task.");
+      i++;
       continue;
     }
 
-    uint64_t target_start = target_zone->wp_;
-    if (zfile->IsSparse()) {
+    std::vector<ZoneCopyRange> ranges;
+    std::vector<uint64_t> target_starts;
+    uint64_t target_wp = target_zone->wp_;
+    uint64_t capacity = target_zone->capacity_;
+    uint64_t gc_bytes = 0;
+    size_t first = i;
+    for (; i < pending.size(); i++) {
+      ZoneCopyRange range = zfile->GetExtentRange(pending[i]);
+      if (range.size > capacity) break;
       // For buffered write, AquaFS use inlined metadata for extents and each
       // extent has a SPARSE_HEADER_SIZE.
-      target_start = target_zone->wp_ + ZoneFile::SPARSE_HEADER_SIZE;
-      zfile->MigrateData(ext->start_ - ZoneFile::SPARSE_HEADER_SIZE,
-                         ext->length_ + ZoneFile::SPARSE_HEADER_SIZE,
-                         target_zone);
-      zbd_->AddGCBytesWritten(ext->length_ + ZoneFile::SPARSE_HEADER_SIZE);
-    } else {
-      zfile->MigrateData(ext->start_, ext->length_, target_zone);
-      zbd_->AddGCBytesWritten(ext->length_);
+      if (zfile->IsSparse()) {
+        target_starts.push_back(target_wp + ZoneFile::SPARSE_HEADER_SIZE);
+        gc_bytes += pending[i]->length_ + ZoneFile::SPARSE_HEADER_SIZE;
+      } else {
+        target_starts.push_back(target_wp);
+        gc_bytes += pending[i]->length_;
+      }
+      ranges.push_back(range);
+      target_wp += range.size;
+      capacity -= range.size;
+    }
+
+    if (ranges.empty()) {
+      zbd_->ReleaseMigrateZone(target_zone);
+      Info(logger_, "Migrate Zone too small, Ignore Task.");
+      i++;
+      continue;
+    }
+
+    uint64_t copy_bytes = target_wp - target_zone->wp_;
+    uint64_t trace_start = AquaFSTracer::Get().Now();
+    copy_s = zfile->MigrateData(ranges, target_zone);
+    AQUAFS_TRACE(TraceEvent::kGCMigrate, (uint32_t)zfile->GetID(),
+                 target_zone->start_, copy_bytes,
+                 AquaFSTracer::Get().Since(trace_start),
+                 zfile->GetWriteLifeTimeHint(), (uint8_t)zfile->GetIOType());
+    if (!copy_s.ok()) {
+      Error(logger_, "Migrate copy failed: %s", copy_s.ToString().c_str());
+      zbd_->ReleaseMigrateZone(target_zone);
+      break;
+    }
+    zbd_->AddGCBytesWritten(gc_bytes);
+    for (const auto& range : ranges) {
+      zbd_->AccountWrite(target_zone, WriteKind::kGC,
+                         zfile->GetWriteLifeTimeHint(), zfile->GetIOType(),
+                         range.size);
     }
 
     // If the file doesn't exist, skip
@@ -1969,9 +2192,12 @@ IOStatus AquaFS::MigrateFileExtents(
       break;
     }
 
-    ext->start_ = target_start;
-    ext->zone_ = target_zone;
-    ext->zone_->used_capacity_ += ext->length_;
+    for (size_t k = 0; k < target_starts.size(); k++) {
+      ZoneExtent* ext = pending[first + k];
+      ext->start_ = target_starts[k];
+      ext->zone_ = target_zone;
+      ext->zone_->used_capacity_ += ext->length_;
+    }
 
     zbd_->ReleaseMigrateZone(target_zone);
   }
@@ -1981,7 +2207,7 @@ IOStatus AquaFS::MigrateFileExtents(
 
   Info(logger_, "MigrateFileExtents Finished, fname: %s, extent count: %lu",
        fname.data(), migrate_exts.size());
-  return IOStatus::OK();
+  return copy_s;
 }
 IOStatus AquaFS::selectZoneToOffline() {
   auto p = dynamic_cast<RaidAutoZonedBlockDevice*>(zbd_->getBackend().get());
@@ -2093,6 +2319,12 @@ FactoryFunc<FileSystem> aquafs_filesystem_reg =
             if (!s.ok()) {
               *errmsg = s.ToString();
             }
+          } else if (devID.rfind("emu:") == 0) {
+            devID.replace(0, strlen("emu:"), "");
+            s = NewAquaFS(&fs, ZbdBackendType::kEmu, devID);
+            if (!s.ok()) {
+              *errmsg = s.ToString();
+            }
           } else {
             *errmsg = "Malformed URI";
           }
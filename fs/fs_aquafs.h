@@ -27,6 +27,7 @@ namespace fs = std::filesystem;
 #include "rocksdb/rocksdb_namespace.h"
 #include "rocksdb/status.h"
 #include "snapshot.h"
+#include "trace_aquafs.h"
 #include "version.h"
 #include "zbd_aquafs.h"
 
@@ -104,6 +105,9 @@ class Superblock {
   Status DecodeFrom(Slice* input);
   void EncodeTo(std::string* output);
   Status CompatibleWith(ZonedBlockDevice* zbd);
+  Status ApplyRaidLayout(ZonedBlockDevice* zbd) {
+    return raid_info_.apply(zbd);
+  }
 
   void GetReport(std::string* reportString);
 
@@ -167,6 +171,9 @@ class AquaFS : public FileSystemWrapper {
   std::unique_ptr<std::thread> gc_worker_ = nullptr;
   bool run_gc_worker_ = false;
 
+  std::unique_ptr<std::thread> trace_dump_worker_ = nullptr;
+  std::atomic<bool> run_trace_dump_worker_{false};
+
   struct AquaFSMetadataWriter : public MetadataWriter {
     AquaFS* aquaFS;
     IOStatus Persist(ZoneFile* zoneFile) {
@@ -268,8 +275,7 @@ class AquaFS : public FileSystemWrapper {
 
   std::shared_ptr<ZoneFile> GetFile(std::string fname);
 
-  /* Must hold files_mtx_, On successful return,
-   * caller must release files_mtx_ and call ResetUnusedIOZones() */
+  /* Must hold files_mtx_, zones left unused are reset in the background */
   IOStatus DeleteFileNoLock(std::string fname, const IOOptions& options,
                             IODebugContext* dbg);
 
@@ -357,6 +363,14 @@ class AquaFS : public FileSystemWrapper {
 
   IOStatus GetFileSize(const std::string& f, const IOOptions& options,
                        uint64_t* size, IODebugContext* dbg) override;
+
+#if (ROCKSDB_MAJOR >= 7)
+  // Handles from ZonedRandomAccessFile::ReadAsync are completed here, any
+  // other handle belongs to the aux file system
+  IOStatus Poll(std::vector<void*>& io_handles,
+                size_t min_completions) override;
+  IOStatus AbortIO(std::vector<void*>& io_handles) override;
+#endif
   IOStatus RenameFile(const std::string& f, const std::string& t,
                       const IOOptions& options, IODebugContext* dbg) override;
 
@@ -480,6 +494,14 @@ class AquaFS : public FileSystemWrapper {
       const std::string& fname,
       const std::vector<ZoneExtentSnapshot*>& migrate_exts);
 
+  /* Write the I/O trace recorded so far, tracing is enabled by
+   * --trace_ring_size */
+  IOStatus DumpTrace(const std::string& path) {
+    return AquaFSTracer::Get().Dump(path);
+  }
+  /* Append the write statistics of this mount to path as a JSON line */
+  IOStatus DumpStats(const std::string& path);
+
  private:
   // moved to configuration.cc
   // const uint64_t GC_START_LEVEL =
@@ -487,6 +509,9 @@ class AquaFS : public FileSystemWrapper {
   //     */
   // const uint64_t GC_SLOPE = 3; /* GC agressiveness */
   void GCWorker();
+  /* Serves dump requests from `aquafs trace-dump`, see
+   * AquaFSTracer::DumpRequestPath() */
+  void TraceDumpWorker();
 
  public:
   IOStatus selectZoneToOffline();
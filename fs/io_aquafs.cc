@@ -19,14 +19,18 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <iostream>
+#include <numeric>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "aquafs_namespace.h"
+#include "configuration.h"
 #include "rocksdb/env.h"
 #include "rocksdb/rocksdb_namespace.h"
+#include "trace_aquafs.h"
 #include "util/coding.h"
 
 namespace AQUAFS_NAMESPACE {
@@ -258,8 +262,8 @@ void ZoneFile::ClearExtents() {
   for (auto e = std::begin(extents_); e != std::end(extents_); ++e) {
     Zone* zone = (*e)->zone_;
 
-    assert(zone && zone->used_capacity_ >= (*e)->length_);
-    zone->used_capacity_ -= (*e)->length_;
+    assert(zone);
+    zone->ReleaseCapacity((*e)->length_);
     delete *e;
   }
   extents_.clear();
@@ -309,6 +313,7 @@ IOStatus ZoneFile::CloseWR() {
   s = PersistMetadata();
   if (!s.ok()) return s;
   ReleaseWRLock();
+  AQUAFS_TRACE(TraceEvent::kFileClose, (uint32_t)file_id_, 0, file_size_);
   return CloseActiveZone();
 }
 
@@ -362,7 +367,7 @@ IOStatus ZoneFile::InvalidateCache(uint64_t pos, uint64_t size) {
 }
 
 IOStatus ZoneFile::PositionedRead(uint64_t offset, size_t n, Slice* result,
-                                  char* scratch, bool direct) {
+                                  char* scratch, bool direct, IOType io_type) {
   AquaFSMetricsLatencyGuard guard(zbd_->GetMetrics(), AQUAFS_READ_LATENCY,
                                   Env::Default());
   zbd_->GetMetrics()->ReportQPS(AQUAFS_READ_QPS, 1);
@@ -398,7 +403,16 @@ IOStatus ZoneFile::PositionedRead(uint64_t offset, size_t n, Slice* result,
   else
     r_sz = n;
 
+  /* Direct reads touching several extents are planned as a whole instead
+   * of padding and reading every extent on its own */
+  if (direct && r_off + r_sz > extent_end) {
+    s = PlannedRead(offset, r_sz, scratch, &read);
+    *result = Slice(scratch, s.ok() ? read : 0);
+    return s;
+  }
+
   ptr = scratch;
+  if (io_type == IOType::kUnknown) io_type = io_type_;
 
   while (read != r_sz) {
     size_t pread_sz = r_sz - read;
@@ -417,7 +431,10 @@ IOStatus ZoneFile::PositionedRead(uint64_t offset, size_t n, Slice* result,
       aligned = true;
     }
 
-    r = zbd_->Read(ptr, r_off, pread_sz, direct && aligned);
+    if (direct)
+      r = zbd_->Read(ptr, r_off, pread_sz, aligned);
+    else
+      r = zbd_->CachedRead(ptr, r_off, pread_sz, extent->zone_, io_type);
     if (r <= 0) break;
 
     /* Verify and update the the bytes read count (if read size was incremented,
@@ -464,15 +481,27 @@ void ZoneFile::PushExtent() {
 
   assert(length <= (active_zone_->wp_ - extent_start_));
   extents_.push_back(new ZoneExtent(extent_start_, length, active_zone_));
+  AQUAFS_TRACE(TraceEvent::kExtentPush, (uint32_t)file_id_, extent_start_,
+               length);
 
   active_zone_->used_capacity_ += length;
   extent_start_ = active_zone_->wp_;
   extent_filepos_ = file_size_;
 }
 
+Env::WriteLifeTimeHint ZoneFile::GetPlacementLifeTime() {
+  LifetimePredictor* predictor = zbd_->GetLifetimePredictor();
+  if (predictor == nullptr) return lifetime_;
+  return predictor->Predict(GetFilename(), lifetime_, io_type_);
+}
+
 IOStatus ZoneFile::AllocateNewZone() {
   Zone* zone;
-  IOStatus s = zbd_->AllocateIOZone(lifetime_, io_type_, &zone);
+  /* The token class goes by the hint of RocksDB, not the predicted
+   * lifetime the zone is placed by */
+  IOStatus s = zbd_->AllocateIOZone(
+      GetPlacementLifeTime(), io_type_, zone_token_class(lifetime_, io_type_),
+      &zone, file_class(GetFilename(), lifetime_, io_type_));
 
   if (!s.ok()) return s;
   if (!zone) {
@@ -494,6 +523,8 @@ IOStatus ZoneFile::BufferedAppend(char* buffer, uint32_t data_size) {
   uint32_t block_sz = GetBlockSize();
   IOStatus s;
 
+  AQUAFS_TRACE(TraceEvent::kFileWrite, (uint32_t)file_id_, file_size_,
+               data_size, 0, lifetime_, (uint8_t)io_type_);
   if (active_zone_ == NULL) {
     s = AllocateNewZone();
     if (!s.ok()) return s;
@@ -516,9 +547,15 @@ IOStatus ZoneFile::BufferedAppend(char* buffer, uint32_t data_size) {
 
     s = active_zone_->Append(buffer, wr_size + pad_sz);
     if (!s.ok()) return s;
+    zbd_->AccountWrite(active_zone_, WriteKind::kUser, lifetime_, io_type_,
+                       wr_size);
+    zbd_->AccountWrite(active_zone_, WriteKind::kPadding, lifetime_, io_type_,
+                       pad_sz);
 
     extents_.push_back(
         new ZoneExtent(extent_start_, extent_length, active_zone_));
+    AQUAFS_TRACE(TraceEvent::kExtentPush, (uint32_t)file_id_, extent_start_,
+                 extent_length);
 
     extent_start_ = active_zone_->wp_;
     active_zone_->used_capacity_ += extent_length;
@@ -549,6 +586,10 @@ IOStatus ZoneFile::SparseAppend(char* sparse_buffer, uint32_t data_size) {
   uint32_t block_sz = GetBlockSize();
   IOStatus s;
 
+  AQUAFS_TRACE(TraceEvent::kFileWrite, (uint32_t)file_id_, file_size_,
+               data_size, 0, lifetime_, (uint8_t)io_type_);
+  if (shared_append_) return SharedSparseAppend(sparse_buffer, data_size);
+
   if (active_zone_ == NULL) {
     s = AllocateNewZone();
     if (!s.ok()) return s;
@@ -573,10 +614,16 @@ IOStatus ZoneFile::SparseAppend(char* sparse_buffer, uint32_t data_size) {
 
     s = active_zone_->Append(sparse_buffer, wr_size + pad_sz);
     if (!s.ok()) return s;
+    zbd_->AccountWrite(active_zone_, WriteKind::kUser, lifetime_, io_type_,
+                       extent_length);
+    zbd_->AccountWrite(active_zone_, WriteKind::kPadding, lifetime_, io_type_,
+                       pad_sz + ZoneFile::SPARSE_HEADER_SIZE);
 
     extents_.push_back(
         new ZoneExtent(extent_start_ + ZoneFile::SPARSE_HEADER_SIZE,
                        extent_length, active_zone_));
+    AQUAFS_TRACE(TraceEvent::kExtentPush, (uint32_t)file_id_,
+                 extent_start_ + ZoneFile::SPARSE_HEADER_SIZE, extent_length);
 
     extent_start_ = active_zone_->wp_;
     active_zone_->used_capacity_ += extent_length;
@@ -600,12 +647,65 @@ IOStatus ZoneFile::SparseAppend(char* sparse_buffer, uint32_t data_size) {
   return IOStatus::OK();
 }
 
+/* Sparse writes to the zone shared by all such files. Every write carries
+   its own header and becomes an extent of its own, the file has no active
+   zone and the extents can only be recovered from the metadata */
+IOStatus ZoneFile::SharedSparseAppend(char* sparse_buffer, uint32_t data_size) {
+  uint32_t left = data_size;
+  uint32_t wr_size;
+  uint32_t block_sz = GetBlockSize();
+  uint32_t max_sz = zbd_->GetMaxSharedAppendSize() / block_sz * block_sz;
+  IOStatus s;
+
+  while (left) {
+    wr_size = left + ZoneFile::SPARSE_HEADER_SIZE;
+    if (wr_size > max_sz) wr_size = max_sz;
+
+    /* Pad to the next block boundary if needed */
+    uint32_t align = wr_size % block_sz;
+    uint32_t pad_sz = 0;
+
+    if (align) pad_sz = block_sz - align;
+    if (pad_sz) memset(sparse_buffer + wr_size, 0x0, pad_sz);
+
+    uint64_t extent_length = wr_size - ZoneFile::SPARSE_HEADER_SIZE;
+    EncodeFixed64(sparse_buffer, extent_length);
+
+    Zone* zone = nullptr;
+    uint64_t pos;
+    s = zbd_->AppendShared(sparse_buffer, wr_size + pad_sz,
+                           GetPlacementLifeTime(), &zone, &pos);
+    if (!s.ok()) return s;
+    zbd_->AccountWrite(zone, WriteKind::kUser, lifetime_, io_type_,
+                       extent_length);
+    zbd_->AccountWrite(zone, WriteKind::kPadding, lifetime_, io_type_,
+                       pad_sz + ZoneFile::SPARSE_HEADER_SIZE);
+
+    extents_.push_back(new ZoneExtent(pos + ZoneFile::SPARSE_HEADER_SIZE,
+                                      extent_length, zone));
+    AQUAFS_TRACE(TraceEvent::kExtentPush, (uint32_t)file_id_,
+                 pos + ZoneFile::SPARSE_HEADER_SIZE, extent_length);
+    zone->used_capacity_ += extent_length;
+    file_size_ += extent_length;
+    left -= extent_length;
+
+    if (left) {
+      memmove((void*)(sparse_buffer + ZoneFile::SPARSE_HEADER_SIZE),
+              (void*)(sparse_buffer + wr_size), left);
+    }
+  }
+
+  return IOStatus::OK();
+}
+
 /* Assumes that data and size are block aligned */
 IOStatus ZoneFile::Append(void* data, int data_size) {
   uint32_t left = data_size;
   uint32_t wr_size, offset = 0;
   IOStatus s = IOStatus::OK();
 
+  AQUAFS_TRACE(TraceEvent::kFileWrite, (uint32_t)file_id_, file_size_,
+               data_size, 0, lifetime_, (uint8_t)io_type_);
   if (!active_zone_) {
     s = AllocateNewZone();
     if (!s.ok()) return s;
@@ -629,6 +729,8 @@ IOStatus ZoneFile::Append(void* data, int data_size) {
 
     s = active_zone_->Append((char*)data + offset, wr_size);
     if (!s.ok()) return s;
+    zbd_->AccountWrite(active_zone_, WriteKind::kUser, lifetime_, io_type_,
+                       wr_size);
 
     file_size_ += wr_size;
     left -= wr_size;
@@ -805,8 +907,8 @@ ZonedWritableFile::ZonedWritableFile(ZonedBlockDevice* zbd, bool _buffered,
 
       sparse_buffer_sz =
           1024 * 1024 + block_sz; /* one extra block size for padding */
-      int ret = posix_memalign((void**)&sparse_buffer, sysconf(_SC_PAGESIZE),
-                               sparse_buffer_sz);
+      int ret = zbd->AllocIOBuffer((void**)&sparse_buffer,
+                                   sysconf(_SC_PAGESIZE), sparse_buffer_sz);
 
       if (ret) sparse_buffer = nullptr;
 
@@ -817,7 +919,7 @@ ZonedWritableFile::ZonedWritableFile(ZonedBlockDevice* zbd, bool _buffered,
     } else {
       buffer_sz = 1024 * 1024;
       int ret =
-          posix_memalign((void**)&buffer, sysconf(_SC_PAGESIZE), buffer_sz);
+          zbd->AllocIOBuffer((void**)&buffer, sysconf(_SC_PAGESIZE), buffer_sz);
 
       if (ret) buffer = nullptr;
       assert(buffer != nullptr);
@@ -830,10 +932,13 @@ ZonedWritableFile::ZonedWritableFile(ZonedBlockDevice* zbd, bool _buffered,
 ZonedWritableFile::~ZonedWritableFile() {
   IOStatus s = CloseInternal();
   if (buffered) {
+    ZonedBlockDevice* zbd = zoneFile_->GetZbd();
     if (sparse_buffer != nullptr) {
-      free(sparse_buffer);
+      zbd->FreeIOBuffer(sparse_buffer, buffer_sz +
+                                           ZoneFile::SPARSE_HEADER_SIZE +
+                                           block_sz);
     } else {
-      free(buffer);
+      zbd->FreeIOBuffer(buffer, buffer_sz);
     }
   }
 
@@ -864,8 +969,10 @@ IOStatus ZonedWritableFile::DataSync() {
 
     /* We need to persist the new extent, if the file is not sparse,
      * as we can't use the active zone WP, which is block-aligned, to recover
-     * the file size */
-    if (!zoneFile_->IsSparse()) return zoneFile_->PersistMetadata();
+     * the file size. Sparse files in a shared zone can't be recovered from
+     * the WP either. */
+    if (!zoneFile_->IsSparse() || zoneFile_->IsSharedAppend())
+      return zoneFile_->PersistMetadata();
   } else {
     /* For direct writes, there is no buffer to flush, we just need to push
        an extent for the latest written data */
@@ -889,7 +996,8 @@ IOStatus ZonedWritableFile::Fsync(const IOOptions& /*options*/,
   if (!s.ok()) return s;
 
   /* As we've already synced the metadata in DataSync, no need to do it again */
-  if (buffered && !zoneFile_->IsSparse()) return IOStatus::OK();
+  if (buffered && (!zoneFile_->IsSparse() || zoneFile_->IsSharedAppend()))
+    return IOStatus::OK();
 
   return zoneFile_->PersistMetadata();
 }
@@ -1041,12 +1149,158 @@ void ZonedWritableFile::SetWriteLifeTimeHint(Env::WriteLifeTimeHint hint) {
   zoneFile_->SetWriteLifeTimeHint(hint);
 }
 
-IOStatus ZonedSequentialFile::Read(size_t n, const IOOptions& /*options*/,
+std::atomic<uint64_t> ZoneReadahead::budget_used_{0};
+
+ZoneReadahead::ZoneReadahead(ZoneFile* zoneFile, bool direct)
+    : zoneFile_(zoneFile),
+      direct_(direct),
+      block_sz_(zoneFile->GetBlockSize()) {}
+
+ZoneReadahead::~ZoneReadahead() {
+  std::unique_lock<std::mutex> lk(mtx_);
+  Drop(lk);
+}
+
+/* Double the window size if the budget has room for both windows,
+ * returns false if there is no window to read ahead into */
+bool ZoneReadahead::Grow() {
+  size_t max_sz = FLAGS_readahead_max_window / block_sz_ * block_sz_;
+  size_t target = window_sz_ ? window_sz_ * 2 : kInitialWindow;
+  if (target > max_sz) target = max_sz;
+  if (target <= window_sz_) return window_sz_ > 0;
+
+  uint64_t delta = 2 * (target - window_sz_);
+  if (budget_used_.fetch_add(delta) + delta > FLAGS_readahead_budget) {
+    budget_used_ -= delta;
+    return window_sz_ > 0;
+  }
+  window_sz_ = target;
+  return true;
+}
+
+void ZoneReadahead::Drop(std::unique_lock<std::mutex>& lk) {
+  WaitNext(lk);
+  free(cur_.buf);
+  free(next_.buf);
+  cur_ = Window();
+  next_ = Window();
+  budget_used_ -= 2 * window_sz_;
+  window_sz_ = 0;
+}
+
+/* Bring the window buffer up to the current window size, a failed
+ * allocation keeps the old buffer */
+bool ZoneReadahead::Resize(Window& w) {
+  if (w.cap < window_sz_) {
+    char* buf;
+    if (posix_memalign((void**)&buf, block_sz_, window_sz_) == 0) {
+      free(w.buf);
+      w.buf = buf;
+      w.cap = window_sz_;
+      w.len = 0;
+    }
+  }
+  return w.cap > 0;
+}
+
+IOStatus ZoneReadahead::Fill(Window& w, uint64_t offset) {
+  Slice result;
+  uint64_t aligned = offset / block_sz_ * block_sz_;
+  IOStatus s = zoneFile_->PositionedRead(aligned, w.cap, &result, w.buf,
+                                         direct_);
+  w.offset = aligned;
+  w.len = s.ok() ? result.size() : 0;
+  w.status = s;
+  return s;
+}
+
+/* Start filling the window following the current one, must hold mtx_ */
+void ZoneReadahead::FillNextAsync() {
+  if (next_pending_ || cur_.len < cur_.cap) return;
+  uint64_t offset = cur_.offset + cur_.len;
+  if (next_.len > 0 && next_.offset == offset) return;
+  if (!Resize(next_)) return;
+
+  next_.len = 0;
+  next_pending_ = true;
+  Window w = next_;
+  zoneFile_->GetZbd()->SubmitReadJob([this, w, offset]() mutable {
+    Fill(w, offset);
+    std::lock_guard<std::mutex> lk(mtx_);
+    next_ = w;
+    next_pending_ = false;
+    next_cv_.notify_all();
+  });
+}
+
+void ZoneReadahead::WaitNext(std::unique_lock<std::mutex>& lk) {
+  next_cv_.wait(lk, [this] { return !next_pending_; });
+}
+
+bool ZoneReadahead::Read(uint64_t offset, size_t n, Slice* result,
+                         char* scratch, IOStatus* s, bool nonblocking) {
+  if (FLAGS_readahead_max_window == 0) return false;
+
+  std::unique_lock<std::mutex> lk(mtx_, std::defer_lock);
+  if (nonblocking) {
+    if (!lk.try_lock()) return false;
+  } else {
+    lk.lock();
+  }
+
+  bool sequential = (offset == next_read_);
+  next_read_ = offset + n;
+  if (!sequential) {
+    sequential_reads_ = 0;
+    if (window_sz_) Drop(lk);
+    return false;
+  }
+  if (++sequential_reads_ < kMinSequentialReads) return false;
+  /* Large requests gain nothing from being copied through a window */
+  if (n >= FLAGS_readahead_max_window) return false;
+  if (!Grow()) return false;
+
+  IOStatus st;
+  size_t copied = 0;
+  while (copied < n) {
+    uint64_t pos = offset + copied;
+    if (!cur_.Contains(pos)) {
+      WaitNext(lk);
+      if (next_.Contains(pos)) {
+        std::swap(cur_, next_);
+      } else {
+        if (!Resize(cur_)) {
+          st = IOStatus::IOError("failed allocating readahead buffer\n");
+          break;
+        }
+        st = Fill(cur_, pos);
+        /* End of file */
+        if (!st.ok() || !cur_.Contains(pos)) break;
+      }
+    }
+    size_t avail = std::min(n - copied, (size_t)(cur_.offset + cur_.len - pos));
+    memcpy(scratch + copied, cur_.buf + (pos - cur_.offset), avail);
+    copied += avail;
+  }
+
+  if (st.ok()) {
+    FillNextAsync();
+  } else {
+    copied = 0;
+  }
+  *s = st;
+  *result = Slice(scratch, copied);
+  return true;
+}
+
+IOStatus ZonedSequentialFile::Read(size_t n, const IOOptions& options,
                                    Slice* result, char* scratch,
                                    IODebugContext* /*dbg*/) {
   IOStatus s;
 
-  s = zoneFile_->PositionedRead(rp, n, result, scratch, direct_);
+  if (!readahead_.Read(rp, n, result, scratch, &s))
+    s = zoneFile_->PositionedRead(rp, n, result, scratch, direct_,
+                                  options.type);
   if (s.ok()) rp += result->size();
 
   return s;
@@ -1060,56 +1314,315 @@ IOStatus ZonedSequentialFile::Skip(uint64_t n) {
 }
 
 IOStatus ZonedSequentialFile::PositionedRead(uint64_t offset, size_t n,
-                                             const IOOptions& /*options*/,
+                                             const IOOptions& options,
                                              Slice* result, char* scratch,
                                              IODebugContext* /*dbg*/) {
-  return zoneFile_->PositionedRead(offset, n, result, scratch, direct_);
+  return zoneFile_->PositionedRead(offset, n, result, scratch, direct_,
+                                   options.type);
 }
 
 IOStatus ZonedRandomAccessFile::Read(uint64_t offset, size_t n,
-                                     const IOOptions& /*options*/,
+                                     const IOOptions& options,
                                      Slice* result, char* scratch,
                                      IODebugContext* /*dbg*/) const {
-  return zoneFile_->PositionedRead(offset, n, result, scratch, direct_);
+  IOStatus s;
+  if (readahead_.Read(offset, n, result, scratch, &s, true)) return s;
+  return zoneFile_->PositionedRead(offset, n, result, scratch, direct_,
+                                   options.type);
 }
 
-IOStatus ZoneFile::MigrateData(uint64_t offset, uint32_t length,
-                               Zone* target_zone) {
-  uint32_t step = 128 << 10;
-  uint32_t read_sz = step;
-  int block_sz = zbd_->GetBlockSize();
+/* Small extents are padded to the block size when written, so the extents
+ * of a file are mostly adjacent blocks on the device. Map the request to
+ * the extent segments it touches, cover them with as few block aligned
+ * device ranges as possible, read the ranges into a bounce buffer in one
+ * batch and scatter the segments into scratch. */
+IOStatus ZoneFile::PlannedRead(uint64_t offset, size_t n, char* scratch,
+                               size_t* read) {
+  /* Unread blocks between two segments that are still worth reading over */
+  const uint64_t kMaxGapBlocks = 4;
+
+  struct Segment {
+    uint64_t dev_offset;
+    size_t len;
+    size_t range;
+  };
+  struct Range {
+    uint64_t start;
+    uint64_t end;
+    size_t buf_offset;
+    int r;
+  };
+
+  uint64_t block_sz = zbd_->GetBlockSize();
+  uint64_t zone_sz = zbd_->GetZoneSize();
+  std::vector<Segment> segments;
+  std::vector<Range> ranges;
+
+  size_t planned = 0;
+  while (planned < n) {
+    uint64_t dev_offset;
+    ZoneExtent* extent = GetExtent(offset + planned, &dev_offset);
+    if (!extent) break;
+    size_t len = std::min(n - planned,
+                          (size_t)(extent->start_ + extent->length_ -
+                                   dev_offset));
+    uint64_t start = dev_offset / block_sz * block_sz;
+    uint64_t end = (dev_offset + len + block_sz - 1) / block_sz * block_sz;
+
+    bool merged = false;
+    if (!ranges.empty()) {
+      Range& last = ranges.back();
+      if (start >= last.start &&
+          start <= last.end + kMaxGapBlocks * block_sz &&
+          start / zone_sz == last.start / zone_sz) {
+        last.end = std::max(last.end, end);
+        merged = true;
+      }
+    }
+    if (!merged) ranges.push_back({start, end, 0, 0});
+    segments.push_back({dev_offset, len, ranges.size() - 1});
+    planned += len;
+  }
 
-  assert(offset % block_sz == 0);
-  if (offset % block_sz != 0) {
-    return IOStatus::IOError("MigrateData offset is not aligned!\n");
+  size_t buf_sz = 0;
+  for (auto& range : ranges) {
+    range.buf_offset = buf_sz;
+    buf_sz += range.end - range.start;
   }
 
+  *read = 0;
+  if (buf_sz == 0) return IOStatus::OK();
+
   char* buf;
-  int ret = posix_memalign((void**)&buf, block_sz, step);
-  if (ret) {
-    return IOStatus::IOError("failed allocating alignment write buffer\n");
+  if (posix_memalign((void**)&buf, block_sz, buf_sz))
+    return IOStatus::IOError("failed allocating read buffer\n");
+
+  zbd_->RunReadJobs(
+      ranges.size(),
+      [&](size_t i) {
+        Range& range = ranges[i];
+        range.r = zbd_->Read(buf + range.buf_offset, range.start,
+                             range.end - range.start, true);
+      },
+      [&](size_t i) { return ranges[i].start; });
+
+  IOStatus s;
+  for (auto& segment : segments) {
+    const Range& range = ranges[segment.range];
+    if (range.r < 0) {
+      s = IOStatus::IOError("pread error\n");
+      break;
+    }
+    uint64_t skip = segment.dev_offset - range.start;
+    size_t avail = 0;
+    if ((uint64_t)range.r > skip)
+      avail = std::min(segment.len, (size_t)(range.r - skip));
+    memcpy(scratch + *read, buf + range.buf_offset + skip, avail);
+    *read += avail;
+    if (avail != segment.len) break;
   }
 
-  int pad_sz = 0;
-  while (length > 0) {
-    read_sz = length > read_sz ? read_sz : length;
-    pad_sz = read_sz % block_sz == 0 ? 0 : (block_sz - (read_sz % block_sz));
+  free(buf);
+  return s;
+}
 
-    int r = zbd_->Read(buf, offset, read_sz + pad_sz, true);
-    if (r < 0) {
-      free(buf);
-      return IOStatus::IOError(strerror(errno));
+IOStatus ZoneFile::MultiRead(FSReadRequest* reqs, size_t num_reqs,
+                             bool direct) {
+  if (num_reqs == 0) return IOStatus::OK();
+
+  struct ReadGroup {
+    uint64_t offset;
+    uint64_t len;
+    std::vector<FSReadRequest*> reqs;
+    /* Device offset of the first request, picks the NUMA node to read on */
+    uint64_t dev_offset;
+  };
+  std::vector<ReadGroup> groups;
+
+  std::vector<size_t> order(num_reqs);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [reqs](size_t a, size_t b) {
+    return reqs[a].offset < reqs[b].offset;
+  });
+
+  {
+    ReadLock lck(this);
+    /* File offset where the extent backing the last group ends */
+    uint64_t extent_end = 0;
+    for (auto i : order) {
+      FSReadRequest* req = &reqs[i];
+      if (!groups.empty()) {
+        ReadGroup& g = groups.back();
+        if (req->offset <= g.offset + g.len &&
+            req->offset + req->len <= extent_end) {
+          g.len = std::max(g.len, req->offset + req->len - g.offset);
+          g.reqs.push_back(req);
+          continue;
+        }
+      }
+      uint64_t dev_offset = 0;
+      ZoneExtent* extent = GetExtent(req->offset, &dev_offset);
+      extent_end =
+          extent ? req->offset + extent->start_ + extent->length_ - dev_offset
+                 : 0;
+      groups.push_back({req->offset, req->len, {req}, dev_offset});
     }
-    target_zone->Append(buf, r);
-    length -= read_sz;
-    offset += r;
   }
 
-  free(buf);
+  uint32_t block_sz = zbd_->GetBlockSize();
+  auto read_group = [this, direct, block_sz](ReadGroup& g) {
+    if (g.reqs.size() == 1) {
+      FSReadRequest* req = g.reqs[0];
+      req->status = PositionedRead(req->offset, req->len, &req->result,
+                                   req->scratch, direct);
+      return;
+    }
+
+    /* Unaligned tails are padded to the block size for direct reads */
+    size_t buf_sz = (g.len + block_sz - 1) / block_sz * block_sz;
+    char* buf;
+    IOStatus s;
+    Slice merged;
+    if (posix_memalign((void**)&buf, block_sz, buf_sz)) {
+      buf = nullptr;
+      s = IOStatus::IOError("failed allocating read buffer\n");
+    } else {
+      s = PositionedRead(g.offset, g.len, &merged, buf, direct);
+    }
+
+    for (auto req : g.reqs) {
+      uint64_t skip = req->offset - g.offset;
+      size_t avail = 0;
+      if (s.ok() && merged.size() > skip)
+        avail = std::min((size_t)(merged.size() - skip), req->len);
+      if (avail) memcpy(req->scratch, buf + skip, avail);
+      req->result = Slice(req->scratch, avail);
+      req->status = s;
+    }
+    free(buf);
+  };
 
+  zbd_->RunReadJobs(
+      groups.size(), [&](size_t i) { read_group(groups[i]); },
+      [&](size_t i) { return groups[i].dev_offset; });
   return IOStatus::OK();
 }
 
+IOStatus ZonedRandomAccessFile::MultiRead(FSReadRequest* reqs, size_t num_reqs,
+                                          const IOOptions& /*options*/,
+                                          IODebugContext* /*dbg*/) {
+  return zoneFile_->MultiRead(reqs, num_reqs, direct_);
+}
+
+IOStatus ZonedRandomAccessFile::Prefetch(uint64_t offset, size_t n,
+                                         const IOOptions& /*options*/,
+                                         IODebugContext* /*dbg*/) {
+  /* There is no page cache to warm for direct reads, NotSupported makes
+   * RocksDB fall back to its own prefetch buffer */
+  if (direct_)
+    return IOStatus::NotSupported("Prefetch is not supported for direct reads");
+  if (n == 0 || offset >= zoneFile_->GetFileSize()) return IOStatus::OK();
+
+  std::shared_ptr<ZoneFile> zoneFile = zoneFile_;
+  zoneFile_->GetZbd()->SubmitReadJob([zoneFile, offset, n] {
+    const size_t chunk_sz = 256 * KB;
+    std::unique_ptr<char[]> buf(new char[std::min(n, chunk_sz)]);
+    size_t done = 0;
+    while (done < n) {
+      Slice result;
+      IOStatus s = zoneFile->PositionedRead(
+          offset + done, std::min(n - done, chunk_sz), &result, buf.get(),
+          false);
+      if (!s.ok() || result.size() == 0) break;
+      done += result.size();
+    }
+  });
+  return IOStatus::OK();
+}
+
+void ZoneAsyncRead::Run(bool direct) {
+  IOStatus s = zoneFile_->PositionedRead(req_.offset, req_.len, &req_.result,
+                                         req_.scratch, direct);
+  std::lock_guard<std::mutex> lk(mtx_);
+  req_.status = s;
+  done_ = true;
+  cv_.notify_all();
+}
+
+void ZoneAsyncRead::Wait() {
+  std::unique_lock<std::mutex> lk(mtx_);
+  cv_.wait(lk, [this] { return done_; });
+}
+
+void ZoneAsyncRead::Complete() {
+  Wait();
+  {
+    std::lock_guard<std::mutex> lk(mtx_);
+    if (reaped_) return;
+    reaped_ = true;
+  }
+  cb_(req_, cb_arg_);
+}
+
+void ZoneAsyncRead::Abort() {
+  Wait();
+  std::lock_guard<std::mutex> lk(mtx_);
+  reaped_ = true;
+}
+
+void ZoneAsyncRead::Delete(void* handle) {
+  ZoneAsyncRead* read = static_cast<ZoneAsyncRead*>(handle);
+  read->Wait();
+  read->zbd_->UntrackAsyncRead(handle);
+  delete read;
+}
+
+#if (ROCKSDB_MAJOR >= 7)
+IOStatus ZonedRandomAccessFile::ReadAsync(
+    FSReadRequest& req, const IOOptions& /*opts*/,
+    std::function<void(const FSReadRequest&, void*)> cb, void* cb_arg,
+    void** io_handle, IOHandleDeleter* del_fn, IODebugContext* /*dbg*/) {
+  ZonedBlockDevice* zbd = zoneFile_->GetZbd();
+  ZoneAsyncRead* read = new ZoneAsyncRead(zbd, zoneFile_, req, cb, cb_arg);
+  bool direct = direct_;
+
+  zbd->TrackAsyncRead(read);
+  zbd->SubmitReadJob([read, direct] { read->Run(direct); });
+
+  *io_handle = read;
+  *del_fn = &ZoneAsyncRead::Delete;
+  return IOStatus::OK();
+}
+#endif
+
+ZoneCopyRange ZoneFile::GetExtentRange(const ZoneExtent* ext) {
+  uint32_t block_sz = zbd_->GetBlockSize();
+  uint64_t pos = ext->start_;
+  uint64_t length = ext->length_;
+
+  if (is_sparse_) {
+    pos -= ZoneFile::SPARSE_HEADER_SIZE;
+    length += ZoneFile::SPARSE_HEADER_SIZE;
+  }
+  if (length % block_sz) length += block_sz - (length % block_sz);
+
+  return ZoneCopyRange{pos, (uint32_t)length};
+}
+
+IOStatus ZoneFile::MigrateData(const std::vector<ZoneCopyRange>& ranges,
+                               Zone* target_zone) {
+  uint32_t block_sz = zbd_->GetBlockSize();
+
+  for (const auto& r : ranges) {
+    assert(r.pos % block_sz == 0 && r.size % block_sz == 0);
+    if (r.pos % block_sz != 0 || r.size % block_sz != 0) {
+      return IOStatus::IOError("MigrateData range is not aligned!\n");
+    }
+  }
+
+  return target_zone->Copy(ranges);
+}
+
 }  // namespace AQUAFS_NAMESPACE
 
 #endif  // !defined(ROCKSDB_LITE) && !defined(OS_WIN)
@@ -15,6 +15,8 @@
 #include <unistd.h>
 
 #include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <mutex>
 #include <sstream>
 #include <string>
@@ -25,6 +27,7 @@
 #include "rocksdb/file_system.h"
 #include "rocksdb/io_status.h"
 #include "rocksdb/rocksdb_namespace.h"
+#include "rocksdb/version.h"
 #include "zbd_aquafs.h"
 
 namespace AQUAFS_NAMESPACE {
@@ -76,6 +79,8 @@ class ZoneFile {
   time_t m_time_;
   bool is_sparse_ = false;
   bool is_deleted_ = false;
+  /* Sparse writes go to the zone shared with other such files */
+  bool shared_append_ = false;
 
   MetadataWriter* metadata_writer_ = NULL;
 
@@ -102,6 +107,7 @@ class ZoneFile {
   IOStatus Append(void* buffer, int data_size);
   IOStatus BufferedAppend(char* data, uint32_t size);
   IOStatus SparseAppend(char* data, uint32_t size);
+  IOStatus SharedSparseAppend(char* data, uint32_t size);
   IOStatus SetWriteLifeTimeHint(Env::WriteLifeTimeHint lifetime);
   void SetIOType(IOType io_type);
   std::string GetFilename();
@@ -115,9 +121,18 @@ class ZoneFile {
   ZonedBlockDevice* GetZbd() { return zbd_; }
   std::vector<ZoneExtent*> GetExtents() { return extents_; }
   Env::WriteLifeTimeHint GetWriteLifeTimeHint() { return lifetime_; }
+  /* The hint data is placed by, predicted if the file has none */
+  Env::WriteLifeTimeHint GetPlacementLifeTime();
 
+  /* Buffered reads go through the block cache unless io_type (or the
+   * io type of the file if not known) bypasses it */
   IOStatus PositionedRead(uint64_t offset, size_t n, Slice* result,
-                          char* scratch, bool direct);
+                          char* scratch, bool direct,
+                          IOType io_type = IOType::kUnknown);
+  /* Serve a batch of reads, requests that are adjacent within one extent
+   * are merged into a single device read and the merged reads are issued
+   * concurrently */
+  IOStatus MultiRead(FSReadRequest* reqs, size_t num_reqs, bool direct);
   ZoneExtent* GetExtent(uint64_t file_offset, uint64_t* dev_offset);
   void PushExtent();
   IOStatus AllocateNewZone();
@@ -131,7 +146,12 @@ class ZoneFile {
   void MetadataSynced() { nr_synced_extents_ = extents_.size(); };
   void MetadataUnsynced() { nr_synced_extents_ = 0; };
 
-  IOStatus MigrateData(uint64_t offset, uint32_t length, Zone* target_zone);
+  /* Block aligned device range holding an extent and its sparse header */
+  ZoneCopyRange GetExtentRange(const ZoneExtent* ext);
+  /* Copy the ranges to the write pointer of target_zone, on the device
+   * when the backend supports it */
+  IOStatus MigrateData(const std::vector<ZoneCopyRange>& ranges,
+                       Zone* target_zone);
 
   Status DecodeFrom(Slice* input);
   Status MergeUpdate(std::shared_ptr<ZoneFile> update, bool replace);
@@ -141,6 +161,8 @@ class ZoneFile {
   bool IsSparse() { return is_sparse_; };
 
   void SetSparse(bool is_sparse) { is_sparse_ = is_sparse; };
+  bool IsSharedAppend() { return shared_append_; };
+  void SetSharedAppend(bool shared) { shared_append_ = shared; };
   uint64_t HasActiveExtent() { return extent_start_ != NO_EXTENT; };
   uint64_t GetExtentStart() { return extent_start_; };
 
@@ -158,10 +180,15 @@ class ZoneFile {
  private:
   void ReleaseActiveZone();
   void SetActiveZone(Zone* zone);
+  /* Must hold a ReadLock */
+  IOStatus PlannedRead(uint64_t offset, size_t n, char* scratch,
+                       size_t* read);
   IOStatus CloseActiveZone();
 
  public:
-  std::shared_ptr<AquaFSMetrics> GetZBDMetrics() { return zbd_->GetMetrics(); };
+  const std::shared_ptr<AquaFSMetrics>& GetZBDMetrics() {
+    return zbd_->GetMetrics();
+  };
   IOType GetIOType() const { return io_type_; };
   bool IsDeleted() const { return is_deleted_; };
   void SetDeleted() { is_deleted_ = true; };
@@ -261,18 +288,74 @@ class ZonedWritableFile : public FSWritableFile {
   std::mutex buffer_mtx_;
 };
 
+/* Adaptive readahead for one reader of a zone file. Once a few reads in a
+ * row are sequential, data is read ahead along the extent list into a
+ * window that doubles with every sequential hit, and the following window
+ * is filled in the background. A seek drops the windows. The windows of all
+ * files share a global memory budget (readahead_budget). */
+class ZoneReadahead {
+ public:
+  explicit ZoneReadahead(ZoneFile* zoneFile, bool direct);
+  ~ZoneReadahead();
+
+  /* Serve a read through the readahead windows. Returns false if the read
+   * was not served and should go to the file directly. If nonblocking, a
+   * concurrent user of the windows makes this return false. */
+  bool Read(uint64_t offset, size_t n, Slice* result, char* scratch,
+            IOStatus* s, bool nonblocking = false);
+
+ private:
+  struct Window {
+    char* buf = nullptr;
+    size_t cap = 0;
+    uint64_t offset = 0;
+    size_t len = 0;
+    IOStatus status;
+
+    bool Contains(uint64_t pos) const {
+      return pos >= offset && pos < offset + len;
+    }
+  };
+
+  static const size_t kInitialWindow = 128 * KB;
+  static const uint32_t kMinSequentialReads = 2;
+  static std::atomic<uint64_t> budget_used_;
+
+  ZoneFile* zoneFile_;
+  bool direct_;
+  uint32_t block_sz_;
+
+  std::mutex mtx_;
+  std::condition_variable next_cv_;
+  uint64_t next_read_ = 0;
+  uint32_t sequential_reads_ = 0;
+  size_t window_sz_ = 0;
+  Window cur_;
+  Window next_;
+  bool next_pending_ = false;
+
+  bool Grow();
+  void Drop(std::unique_lock<std::mutex>& lk);
+  bool Resize(Window& w);
+  IOStatus Fill(Window& w, uint64_t offset);
+  void FillNextAsync();
+  void WaitNext(std::unique_lock<std::mutex>& lk);
+};
+
 class ZonedSequentialFile : public FSSequentialFile {
  private:
   std::shared_ptr<ZoneFile> zoneFile_;
   uint64_t rp;
   bool direct_;
+  ZoneReadahead readahead_;
 
  public:
   explicit ZonedSequentialFile(std::shared_ptr<ZoneFile> zoneFile,
                                const FileOptions& file_opts)
       : zoneFile_(zoneFile),
         rp(0),
-        direct_(file_opts.use_direct_reads && !zoneFile->IsSparse()) {}
+        direct_(file_opts.use_direct_reads && !zoneFile->IsSparse()),
+        readahead_(zoneFile.get(), direct_) {}
 
   IOStatus Read(size_t n, const IOOptions& options, Slice* result,
                 char* scratch, IODebugContext* dbg) override;
@@ -292,26 +375,70 @@ class ZonedSequentialFile : public FSSequentialFile {
   }
 };
 
+/* A read submitted through ZonedRandomAccessFile::ReadAsync, the io handle
+ * handed to RocksDB. The read runs on the device read workers, the callback
+ * is invoked from AquaFS::Poll on the polling thread. */
+class ZoneAsyncRead {
+ public:
+  ZonedBlockDevice* zbd_;
+  std::shared_ptr<ZoneFile> zoneFile_;
+  FSReadRequest req_;
+  std::function<void(const FSReadRequest&, void*)> cb_;
+  void* cb_arg_;
+
+  explicit ZoneAsyncRead(ZonedBlockDevice* zbd,
+                         std::shared_ptr<ZoneFile> zoneFile,
+                         const FSReadRequest& req,
+                         std::function<void(const FSReadRequest&, void*)> cb,
+                         void* cb_arg)
+      : zbd_(zbd), zoneFile_(zoneFile), req_(req), cb_(cb), cb_arg_(cb_arg) {}
+
+  void Run(bool direct);
+  void Wait();
+  /* Wait for the read and invoke the callback, at most once */
+  void Complete();
+  /* Wait for the read and drop the callback */
+  void Abort();
+
+  static void Delete(void* handle);
+
+ private:
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  bool done_ = false;
+  bool reaped_ = false;
+};
+
 class ZonedRandomAccessFile : public FSRandomAccessFile {
  private:
   std::shared_ptr<ZoneFile> zoneFile_;
   bool direct_;
+  /* Picks up compaction style scans, concurrent readers bypass it */
+  mutable ZoneReadahead readahead_;
 
  public:
   explicit ZonedRandomAccessFile(std::shared_ptr<ZoneFile> zoneFile,
                                  const FileOptions& file_opts)
       : zoneFile_(zoneFile),
-        direct_(file_opts.use_direct_reads && !zoneFile->IsSparse()) {}
+        direct_(file_opts.use_direct_reads && !zoneFile->IsSparse()),
+        readahead_(zoneFile.get(), direct_) {}
 
   IOStatus Read(uint64_t offset, size_t n, const IOOptions& options,
                 Slice* result, char* scratch,
                 IODebugContext* dbg) const override;
 
-  IOStatus Prefetch(uint64_t /*offset*/, size_t /*n*/,
-                    const IOOptions& /*options*/,
-                    IODebugContext* /*dbg*/) override {
-    return IOStatus::OK();
-  }
+  IOStatus MultiRead(FSReadRequest* reqs, size_t num_reqs,
+                     const IOOptions& options, IODebugContext* dbg) override;
+
+  IOStatus Prefetch(uint64_t offset, size_t n, const IOOptions& options,
+                    IODebugContext* dbg) override;
+
+#if (ROCKSDB_MAJOR >= 7)
+  IOStatus ReadAsync(FSReadRequest& req, const IOOptions& opts,
+                     std::function<void(const FSReadRequest&, void*)> cb,
+                     void* cb_arg, void** io_handle, IOHandleDeleter* del_fn,
+                     IODebugContext* dbg) override;
+#endif
 
   bool use_direct_io() const override { return direct_; }
 
@@ -31,7 +31,16 @@
 //    `NoAquaFSMetrics`)
 
 #pragma once
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#include <chrono>
+#include <thread>
+
 #include "aquafs_namespace.h"
+#include "metrics_histogram.h"
 #include "rocksdb/env.h"
 #include "rocksdb/rocksdb_namespace.h"
 namespace AQUAFS_NAMESPACE {
@@ -91,12 +100,23 @@ enum AquaFSMetricsHistograms : uint32_t {
 
   AQUAFS_RESETABLE_ZONES_COUNT,
 
+  AQUAFS_BLOCK_CACHE_HIT_QPS,
+  AQUAFS_BLOCK_CACHE_MISS_QPS,
+
+  AQUAFS_PADDING_WRITE_THROUGHPUT,
+  AQUAFS_GC_WRITE_THROUGHPUT,
+  AQUAFS_META_WRITE_THROUGHPUT,
+
+  AQUAFS_NUMA_REMOTE_THROUGHPUT,
+
   AQUAFS_HISTOGRAM_ENUM_MAX,
 
   AQUAFS_ZONE_WRITE_THROUGHPUT,
   AQUAFS_ZONE_WRITE_LATENCY,
 
   AQUAFS_L0_IO_ALLOC_LATENCY,
+
+  AQUAFS_LABEL_MAX,
 };
 
 struct AquaFSMetrics {
@@ -110,6 +130,13 @@ struct AquaFSMetrics {
   AquaFSMetrics() {}
   virtual ~AquaFSMetrics() {}
 
+  // Reporters that drop everything clear this so that latency guards can
+  // skip timing altogether.
+  bool IsEnabled() const { return enabled_; }
+
+ protected:
+  bool enabled_ = true;
+
  public:
   // Add a reporter named label.
   // You can give a type for type-checking.
@@ -119,6 +146,13 @@ struct AquaFSMetrics {
   virtual void Report(Label label, size_t value,
                       ReporterType type_check = 0) = 0;
   virtual void ReportSnapshot(const AquaFSSnapshot& snapshot) = 0;
+  // Get the distribution of a latency label since the metrics were created,
+  // e.g. snapshot->Percentile(99.9). Returns false if no histogram is kept
+  // for the label.
+  virtual bool GetLatencyHistogram(Label /*label*/,
+                                   AquaFSHistogramSnapshot* /*snapshot*/) {
+    return false;
+  }
 
  public:
   // Syntactic sugars for type-checking.
@@ -138,7 +172,7 @@ struct AquaFSMetrics {
 };
 
 struct NoAquaFSMetrics : public AquaFSMetrics {
-  NoAquaFSMetrics() : AquaFSMetrics() {}
+  NoAquaFSMetrics() : AquaFSMetrics() { enabled_ = false; }
   virtual ~NoAquaFSMetrics() {}
 
  public:
@@ -148,32 +182,100 @@ struct NoAquaFSMetrics : public AquaFSMetrics {
   virtual void ReportSnapshot(const AquaFSSnapshot& /*snapshot*/) override {}
 };
 
+// Keeps a histogram of every latency label and drops everything else, so
+// that GetLatencyHistogram() works without a metrics exporter.
+struct AquaFSHistogramMetrics : public AquaFSMetrics {
+  AquaFSHistogramMetrics() : AquaFSMetrics() {}
+  virtual ~AquaFSHistogramMetrics();
+
+ public:
+  virtual void AddReporter(uint32_t /*label*/, uint32_t /*type*/) override {}
+  virtual void Report(uint32_t /*label*/, size_t /*value*/,
+                      uint32_t /*type_check*/) override {}
+  virtual void ReportSnapshot(const AquaFSSnapshot& /*snapshot*/) override {}
+  virtual void ReportLatency(Label label, size_t latency) override;
+  virtual bool GetLatencyHistogram(Label label,
+                                   AquaFSHistogramSnapshot* snapshot) override;
+
+ private:
+  // Created on the first report of a label
+  std::atomic<AquaFSHistogram*> histograms_[AQUAFS_LABEL_MAX]{};
+};
+
+// Clock used by the latency guards. Reads the TSC when the CPU has an
+// invariant one, calibrated once against steady_clock, and falls back to
+// steady_clock otherwise.
+class AquaFSMetricsClock {
+ public:
+  static uint64_t NowMicros() {
+#if defined(__x86_64__)
+    static const double ticks_per_micro = TicksPerMicro();
+    if (ticks_per_micro > 0) return (uint64_t)(__rdtsc() / ticks_per_micro);
+#endif
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+ private:
+#if defined(__x86_64__)
+  static double TicksPerMicro() {
+    unsigned int eax, ebx, ecx, edx;
+    // CPUID 0x80000007 EDX bit 8: invariant TSC
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1 << 8)))
+      return 0;
+
+    auto t0 = std::chrono::steady_clock::now();
+    uint64_t c0 = __rdtsc();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    auto t1 = std::chrono::steady_clock::now();
+    uint64_t c1 = __rdtsc();
+
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0)
+                  .count();
+    if (us <= 0 || c1 <= c0) return 0;
+    return (double)(c1 - c0) / us;
+  }
+#endif
+};
+
 // The implementation of this class will start timing when initialized,
 // stop timing when it is destructured,
 // and report the difference in time to the target label via
 // metrics->ReportLatency(). By default, the method to collect the time will be
-// to call env->NowMicros().
+// AquaFSMetricsClock, or env->NowMicros() for any env but the default one.
+//
+// The guard only keeps a raw pointer, the owner of the metrics must outlive
+// it. Nothing is timed when the metrics are disabled.
 struct AquaFSMetricsLatencyGuard {
-  std::shared_ptr<AquaFSMetrics> metrics_;
+  AquaFSMetrics* metrics_;
   uint32_t label_;
   Env* env_;
   uint64_t begin_time_micro_;
 
-  AquaFSMetricsLatencyGuard(std::shared_ptr<AquaFSMetrics> metrics,
+  AquaFSMetricsLatencyGuard(const std::shared_ptr<AquaFSMetrics>& metrics,
                             uint32_t label, Env* env)
-      : metrics_(metrics),
+      : AquaFSMetricsLatencyGuard(metrics.get(), label, env) {}
+
+  AquaFSMetricsLatencyGuard(AquaFSMetrics* metrics, uint32_t label, Env* env)
+      : metrics_(metrics && metrics->IsEnabled() ? metrics : nullptr),
         label_(label),
         env_(env),
-        begin_time_micro_(GetTime()) {}
+        begin_time_micro_(metrics_ ? GetTime() : 0) {}
 
   virtual ~AquaFSMetricsLatencyGuard() {
+    if (!metrics_) return;
     uint64_t end_time_micro_ = GetTime();
-    assert(end_time_micro_ >= begin_time_micro_);
+    if (end_time_micro_ < begin_time_micro_) end_time_micro_ = begin_time_micro_;
     metrics_->ReportLatency(label_,
                             Report(end_time_micro_ - begin_time_micro_));
   }
   // overwrite this function if you wish to capture time by other methods.
-  virtual uint64_t GetTime() { return env_->NowMicros(); }
+  virtual uint64_t GetTime() {
+    if (env_ == nullptr || env_ == Env::Default())
+      return AquaFSMetricsClock::NowMicros();
+    return env_->NowMicros();
+  }
   // overwrite this function if you do not intend to report delays measured in
   // microseconds.
   virtual uint64_t Report(uint64_t time) { return time; }
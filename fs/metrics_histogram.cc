@@ -0,0 +1,148 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#include "metrics_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "metrics.h"
+
+namespace AQUAFS_NAMESPACE {
+
+uint32_t AquaFSHistogramSnapshot::BucketIndex(uint64_t value) {
+  if (value < kSubBuckets) return value;
+
+  uint32_t msb = 63 - __builtin_clzll(value);
+  if (msb >= kMaxValueBits) return kNumBuckets - 1;
+
+  /* The top kSubBucketBits + 1 bits of the value select the sub-bucket */
+  uint32_t shift = msb - kSubBucketBits;
+  return shift * kSubBuckets + (value >> shift);
+}
+
+uint64_t AquaFSHistogramSnapshot::BucketLow(uint32_t idx) {
+  if (idx < kSubBuckets) return idx;
+  uint32_t shift = idx / kSubBuckets - 1;
+  return (uint64_t)(idx - shift * kSubBuckets) << shift;
+}
+
+uint64_t AquaFSHistogramSnapshot::BucketHigh(uint32_t idx) {
+  if (idx < kSubBuckets) return idx;
+  if (idx == kNumBuckets - 1) return UINT64_MAX;
+  uint32_t shift = idx / kSubBuckets - 1;
+  return BucketLow(idx) + (1ULL << shift) - 1;
+}
+
+void AquaFSHistogramSnapshot::Merge(const AquaFSHistogramSnapshot &other) {
+  for (uint32_t i = 0; i < kNumBuckets; i++) buckets[i] += other.buckets[i];
+  count += other.count;
+  sum += other.sum;
+  min = std::min(min, other.min);
+  max = std::max(max, other.max);
+}
+
+void AquaFSHistogramSnapshot::Subtract(const AquaFSHistogramSnapshot &older) {
+  for (uint32_t i = 0; i < kNumBuckets; i++) {
+    buckets[i] -= std::min(buckets[i], older.buckets[i]);
+  }
+  count -= std::min(count, older.count);
+  sum -= std::min(sum, older.sum);
+}
+
+uint64_t AquaFSHistogramSnapshot::Percentile(double p) const {
+  if (count == 0) return 0;
+
+  uint64_t rank = (uint64_t)std::ceil(p / 100.0 * count);
+  rank = std::max<uint64_t>(1, std::min(rank, count));
+
+  uint64_t seen = 0;
+  for (uint32_t i = 0; i < kNumBuckets; i++) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      /* Report the middle of the bucket, within what was really seen */
+      uint64_t low = BucketLow(i);
+      uint64_t high = std::min(BucketHigh(i), max);
+      uint64_t mid = low + (high > low ? (high - low) / 2 : 0);
+      return std::max(std::min(mid, max), min == UINT64_MAX ? 0 : min);
+    }
+  }
+  return max;
+}
+
+AquaFSHistogram::AquaFSHistogram() : stripes_(new Stripe[kStripes]) {
+  for (uint32_t s = 0; s < kStripes; s++) {
+    for (auto &b : stripes_[s].buckets) b.store(0, std::memory_order_relaxed);
+  }
+}
+
+uint32_t AquaFSHistogram::StripeIndex() {
+  static std::atomic<uint32_t> next_stripe{0};
+  thread_local uint32_t stripe =
+      next_stripe.fetch_add(1, std::memory_order_relaxed) % kStripes;
+  return stripe;
+}
+
+void AquaFSHistogram::Record(uint64_t value) {
+  Stripe &s = stripes_[StripeIndex()];
+
+  s.buckets[AquaFSHistogramSnapshot::BucketIndex(value)].fetch_add(
+      1, std::memory_order_relaxed);
+  s.count.fetch_add(1, std::memory_order_relaxed);
+  s.sum.fetch_add(value, std::memory_order_relaxed);
+
+  uint64_t cur = s.min.load(std::memory_order_relaxed);
+  while (value < cur && !s.min.compare_exchange_weak(cur, value)) {
+  }
+  cur = s.max.load(std::memory_order_relaxed);
+  while (value > cur && !s.max.compare_exchange_weak(cur, value)) {
+  }
+}
+
+AquaFSHistogramSnapshot AquaFSHistogram::Snapshot() const {
+  AquaFSHistogramSnapshot snap;
+
+  for (uint32_t s = 0; s < kStripes; s++) {
+    const Stripe &stripe = stripes_[s];
+    for (uint32_t i = 0; i < AquaFSHistogramSnapshot::kNumBuckets; i++) {
+      snap.buckets[i] += stripe.buckets[i].load(std::memory_order_relaxed);
+    }
+    snap.count += stripe.count.load(std::memory_order_relaxed);
+    snap.sum += stripe.sum.load(std::memory_order_relaxed);
+    snap.min = std::min(snap.min, stripe.min.load(std::memory_order_relaxed));
+    snap.max = std::max(snap.max, stripe.max.load(std::memory_order_relaxed));
+  }
+  return snap;
+}
+
+AquaFSHistogramMetrics::~AquaFSHistogramMetrics() {
+  for (auto &h : histograms_) delete h.load();
+}
+
+void AquaFSHistogramMetrics::ReportLatency(Label label, size_t latency) {
+  if (label >= AQUAFS_LABEL_MAX) return;
+  AquaFSHistogram *h = histograms_[label].load(std::memory_order_acquire);
+  if (h == nullptr) {
+    AquaFSHistogram *created = new AquaFSHistogram();
+    if (histograms_[label].compare_exchange_strong(h, created,
+                                                   std::memory_order_acq_rel))
+      h = created;
+    else
+      delete created;
+  }
+  h->Record(latency);
+}
+
+bool AquaFSHistogramMetrics::GetLatencyHistogram(
+    Label label, AquaFSHistogramSnapshot *snapshot) {
+  if (label >= AQUAFS_LABEL_MAX) return false;
+  AquaFSHistogram *h = histograms_[label].load(std::memory_order_acquire);
+  if (h == nullptr) return false;
+  *snapshot = h->Snapshot();
+  return true;
+}
+
+}  // namespace AQUAFS_NAMESPACE
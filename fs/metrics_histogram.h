@@ -0,0 +1,87 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+// Log-linear latency histogram
+//
+// Values are put in buckets of 2^kSubBucketBits linear sub-buckets per
+// power of two (HDR style), so the relative error of any percentile is
+// below 1 / 2^kSubBucketBits whatever the magnitude of the value. Recording
+// is lock-free: every thread updates its own stripe with relaxed atomics,
+// and stripes are only merged when a snapshot is taken.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "aquafs_namespace.h"
+
+namespace AQUAFS_NAMESPACE {
+
+class AquaFSHistogramSnapshot {
+ public:
+  static const uint32_t kSubBucketBits = 5;
+  static const uint32_t kSubBuckets = 1 << kSubBucketBits;
+  /* Values up to 2^kMaxValueBits get their own bucket, larger ones end up
+   * in the last bucket */
+  static const uint32_t kMaxValueBits = 40;
+  static const uint32_t kNumBuckets =
+      (kMaxValueBits - kSubBucketBits + 1) * kSubBuckets;
+
+  std::vector<uint64_t> buckets;
+  uint64_t count = 0;
+  uint64_t sum = 0;
+  uint64_t min = UINT64_MAX;
+  uint64_t max = 0;
+
+  AquaFSHistogramSnapshot() : buckets(kNumBuckets, 0) {}
+
+  static uint32_t BucketIndex(uint64_t value);
+  /* Smallest and largest value that fall into the bucket */
+  static uint64_t BucketLow(uint32_t idx);
+  static uint64_t BucketHigh(uint32_t idx);
+
+  /* Add the samples of other to this snapshot */
+  void Merge(const AquaFSHistogramSnapshot &other);
+  /* Remove the samples of an older snapshot of the same histogram, min and
+   * max are kept as they can't be subtracted */
+  void Subtract(const AquaFSHistogramSnapshot &older);
+
+  /* Value below which p percent (0..100) of the samples fall */
+  uint64_t Percentile(double p) const;
+  double Mean() const { return count ? (double)sum / count : 0.0; }
+};
+
+class AquaFSHistogram {
+ public:
+  static const uint32_t kStripes = 8;
+
+  AquaFSHistogram();
+
+  void Record(uint64_t value);
+  /* Merged view of all stripes, cumulative since creation */
+  AquaFSHistogramSnapshot Snapshot() const;
+
+  /* Stripe of the calling thread, also used by other per-thread counters */
+  static uint32_t StripeIndex();
+
+ private:
+  struct Stripe {
+    std::array<std::atomic<uint64_t>, AquaFSHistogramSnapshot::kNumBuckets>
+        buckets;
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> min{UINT64_MAX};
+    std::atomic<uint64_t> max{0};
+  };
+
+  std::unique_ptr<Stripe[]> stripes_;
+};
+
+}  // namespace AQUAFS_NAMESPACE
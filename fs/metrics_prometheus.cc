@@ -4,6 +4,7 @@
 #include <prometheus/counter.h>
 #include <prometheus/registry.h>
 
+#include <algorithm>
 #include <chrono>
 #include <cstdint>
 #include <memory>
@@ -42,10 +43,27 @@ void AquaFSPrometheusMetrics::run() {
 
       // Handle concurrency by atomic exchange. We don't care about inaccuracy
       // caused by counters not being swapped atomically all at once.
-      gm->gcount->Set(metric.second->count.exchange(0));
-      gm->gtotal->Set(metric.second->value.exchange(0));
-      gm->gmin->Set(metric.second->min.exchange(UINT64_MAX));
-      gm->gmax->Set(metric.second->max.exchange(0));
+      uint64_t count = 0, total = 0, min = UINT64_MAX, max = 0;
+      for (auto &stripe : gm->stripes) {
+        count += stripe.count.exchange(0);
+        total += stripe.value.exchange(0);
+        min = std::min(min, stripe.min.exchange(UINT64_MAX));
+        max = std::max(max, stripe.max.exchange(0));
+      }
+      gm->gcount->Set(count);
+      gm->gtotal->Set(total);
+      gm->gmin->Set(min);
+      gm->gmax->Set(max);
+
+      if (gm->hist) {
+        auto snap = gm->hist->Snapshot();
+        auto interval = snap;
+        interval.Subtract(gm->last);
+        gm->last = std::move(snap);
+        gm->gp50->Set(interval.Percentile(50));
+        gm->gp99->Set(interval.Percentile(99));
+        gm->gp999->Set(interval.Percentile(99.9));
+      }
     }
   }
 }
@@ -54,32 +72,22 @@ void AquaFSPrometheusMetrics::Report(uint32_t label_uint, size_t value,
                                     uint32_t type_uint) {
   auto label = static_cast<AquaFSMetricsHistograms>(label_uint);
 
-  if (metric_map_.find(label) == metric_map_.end()) return;
+  auto it = metric_map_.find(label);
+  if (it == metric_map_.end()) return;
 
-  auto metric = metric_map_.find(label)->second;
-  metric->value += value;
-  metric->count++;
+  // Only threads of the same stripe share these counters
+  GaugeMetric *metric = it->second.get();
+  GaugeStripe &stripe = metric->stripes[AquaFSHistogram::StripeIndex()];
+  stripe.value.fetch_add(value, std::memory_order_relaxed);
+  stripe.count.fetch_add(1, std::memory_order_relaxed);
+  if (metric->hist) metric->hist->Record(value);
 
-  auto max = metric->max.load();
-  while (1) {
-    if (value > max) {
-      if (metric->max.compare_exchange_weak(max, value)) {
-        break;
-      }
-    } else {
-      break;
-    }
+  auto max = stripe.max.load(std::memory_order_relaxed);
+  while (value > max && !stripe.max.compare_exchange_weak(max, value)) {
   }
 
-  auto min = metric->min.load();
-  while (1) {
-    if (value < min) {
-      if (metric->min.compare_exchange_weak(min, value)) {
-        break;
-      }
-    } else {
-      break;
-    }
+  auto min = stripe.min.load(std::memory_order_relaxed);
+  while (value < min && !stripe.min.compare_exchange_weak(min, value)) {
   }
 }
 
@@ -102,7 +110,22 @@ void AquaFSPrometheusMetrics::AddReporter(uint32_t label_uint,
   metric->gcount = &metric->family->Add({{"type", "count"}});
   metric->gtotal = &metric->family->Add({{"type", "total"}});
 
-  metric->min = UINT64_MAX;
+  if (type == AQUAFS_REPORTER_TYPE_LATENCY) {
+    metric->gp50 = &metric->family->Add({{"type", "p50"}});
+    metric->gp99 = &metric->family->Add({{"type", "p99"}});
+    metric->gp999 = &metric->family->Add({{"type", "p999"}});
+    metric->hist = std::make_unique<AquaFSHistogram>();
+  }
 
   metric_map_.emplace(label, metric);
 }
+
+bool AquaFSPrometheusMetrics::GetLatencyHistogram(
+    uint32_t label_uint, AquaFSHistogramSnapshot *snapshot) {
+  auto label = static_cast<AquaFSMetricsHistograms>(label_uint);
+  auto it = metric_map_.find(label);
+
+  if (it == metric_map_.end() || !it->second->hist) return false;
+  *snapshot = it->second->hist->Snapshot();
+  return true;
+}
@@ -19,6 +19,15 @@ namespace AQUAFS_NAMESPACE {
 
 // using namespace prometheus;
 
+// Counters updated by the threads of one stripe, kept on their own cache
+// line so that reporting threads don't contend
+struct alignas(64) GaugeStripe {
+  std::atomic<uint64_t> value{0};
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> max{0};
+  std::atomic<uint64_t> min{UINT64_MAX};
+};
+
 class GaugeMetric {
  public:
   prometheus::Family<prometheus::Gauge> *family;
@@ -26,10 +35,13 @@ class GaugeMetric {
   prometheus::Gauge *gmax;
   prometheus::Gauge *gtotal;
   prometheus::Gauge *gcount;
-  std::atomic<uint64_t> value;
-  std::atomic<uint64_t> count;
-  std::atomic<uint64_t> max;
-  std::atomic<uint64_t> min;
+  // Latency reporters only: percentiles over the last report interval
+  prometheus::Gauge *gp50 = nullptr;
+  prometheus::Gauge *gp99 = nullptr;
+  prometheus::Gauge *gp999 = nullptr;
+  std::unique_ptr<AquaFSHistogram> hist;
+  AquaFSHistogramSnapshot last;
+  GaugeStripe stripes[AquaFSHistogram::kStripes];
 };
 
 class AquaFSPrometheusMetrics : public AQUAFS_NAMESPACE::AquaFSMetrics {
@@ -57,6 +69,12 @@ class AquaFSPrometheusMetrics : public AQUAFS_NAMESPACE::AquaFSMetrics {
            {"aquafs_zone_write_latency", AQUAFS_REPORTER_TYPE_LATENCY}},
           {AQUAFS_ROLL_LATENCY,
            {"aquafs_roll_latency", AQUAFS_REPORTER_TYPE_LATENCY}},
+          {AQUAFS_WAL_IO_ALLOC_LATENCY,
+           {"aquafs_wal_io_alloc_latency", AQUAFS_REPORTER_TYPE_LATENCY}},
+          {AQUAFS_NON_WAL_IO_ALLOC_LATENCY,
+           {"aquafs_non_wal_io_alloc_latency", AQUAFS_REPORTER_TYPE_LATENCY}},
+          {AQUAFS_L0_IO_ALLOC_LATENCY,
+           {"aquafs_l0_io_alloc_latency", AQUAFS_REPORTER_TYPE_LATENCY}},
           {AQUAFS_META_ALLOC_LATENCY,
            {"aquafs_meta_alloc_latency", AQUAFS_REPORTER_TYPE_LATENCY}},
           {AQUAFS_META_SYNC_LATENCY,
@@ -71,12 +89,25 @@ class AquaFSPrometheusMetrics : public AQUAFS_NAMESPACE::AquaFSMetrics {
           {AQUAFS_ROLL_QPS, {"aquafs_roll_qps", AQUAFS_REPORTER_TYPE_QPS}},
           {AQUAFS_WRITE_THROUGHPUT,
            {"aquafs_write_throughput", AQUAFS_REPORTER_TYPE_THROUGHPUT}},
+          {AQUAFS_PADDING_WRITE_THROUGHPUT,
+           {"aquafs_padding_write_throughput",
+            AQUAFS_REPORTER_TYPE_THROUGHPUT}},
+          {AQUAFS_GC_WRITE_THROUGHPUT,
+           {"aquafs_gc_write_throughput", AQUAFS_REPORTER_TYPE_THROUGHPUT}},
+          {AQUAFS_META_WRITE_THROUGHPUT,
+           {"aquafs_meta_write_throughput", AQUAFS_REPORTER_TYPE_THROUGHPUT}},
+          {AQUAFS_NUMA_REMOTE_THROUGHPUT,
+           {"aquafs_numa_remote_throughput", AQUAFS_REPORTER_TYPE_THROUGHPUT}},
           {AQUAFS_RESETABLE_ZONES_COUNT,
            {"aquafs_resetable_zones", AQUAFS_REPORTER_TYPE_GENERAL}},
           {AQUAFS_OPEN_ZONES_COUNT,
            {"aquafs_open_zones", AQUAFS_REPORTER_TYPE_GENERAL}},
           {AQUAFS_ACTIVE_ZONES_COUNT,
            {"aquafs_active_zones", AQUAFS_REPORTER_TYPE_GENERAL}},
+          {AQUAFS_BLOCK_CACHE_HIT_QPS,
+           {"aquafs_block_cache_hit_qps", AQUAFS_REPORTER_TYPE_QPS}},
+          {AQUAFS_BLOCK_CACHE_MISS_QPS,
+           {"aquafs_block_cache_miss_qps", AQUAFS_REPORTER_TYPE_QPS}},
       };
 
   void run();
@@ -105,6 +136,8 @@ class AquaFSPrometheusMetrics : public AQUAFS_NAMESPACE::AquaFSMetrics {
   }
 
   virtual void ReportSnapshot(const AquaFSSnapshot &snapshot) override {}
+  virtual bool GetLatencyHistogram(
+      uint32_t label, AquaFSHistogramSnapshot *snapshot) override;
 };
 
 }  // namespace ROCKSDB_NAMESPACE
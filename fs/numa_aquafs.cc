@@ -0,0 +1,118 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && !defined(OS_WIN)
+
+#include "numa_aquafs.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+
+#ifdef NUMA
+#include <numa.h>
+#endif
+
+namespace AQUAFS_NAMESPACE {
+
+int device_numa_node(const std::string &path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return -1;
+
+  /* Files on a zoned device (zonefs) sit on the device of their fs */
+  dev_t dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+  std::string link = "/sys/dev/block/" + std::to_string(major(dev)) + ":" +
+                     std::to_string(minor(dev));
+  char real[PATH_MAX];
+  if (realpath(link.c_str(), real) == nullptr) return -1;
+
+  /* The block device hangs below its controller, which knows the node */
+  std::string dir = real;
+  while (dir.length() > strlen("/sys/devices")) {
+    std::ifstream f(dir + "/numa_node");
+    int node;
+    if (f >> node) return node < 0 ? -1 : node;
+    dir = dir.substr(0, dir.find_last_of('/'));
+  }
+  return -1;
+}
+
+#ifdef NUMA
+
+static bool NumaAvailable() {
+  static const bool available = numa_available() >= 0 && numa_max_node() > 0;
+  return available;
+}
+
+/* Calls between two lookups of cached_numa_node() */
+static const uint32_t kNumaNodeRefresh = 1024;
+static thread_local int cached_node = -1;
+static thread_local uint32_t cached_node_calls = 0;
+
+int current_numa_node() {
+  if (!NumaAvailable()) return -1;
+  int cpu = sched_getcpu();
+  return cpu < 0 ? -1 : numa_node_of_cpu(cpu);
+}
+
+int cached_numa_node() {
+  if (cached_node_calls++ % kNumaNodeRefresh == 0)
+    cached_node = current_numa_node();
+  return cached_node;
+}
+
+int numa_aligned_alloc(void **ptr, size_t align, size_t size, int node) {
+  if (node < 0 || !NumaAvailable()) return posix_memalign(ptr, align, size);
+  if (align > (size_t)sysconf(_SC_PAGESIZE)) return EINVAL;
+
+  /* A fresh mapping bound to node before any page is touched, heap pages
+   * may already be faulted in elsewhere and keep the policy once freed */
+  *ptr = numa_alloc_onnode(size, node);
+  return *ptr == nullptr ? ENOMEM : 0;
+}
+
+void numa_aligned_free(void *ptr, size_t size, int node) {
+  if (ptr == nullptr) return;
+  if (node < 0 || !NumaAvailable()) {
+    free(ptr);
+    return;
+  }
+  numa_free(ptr, size);
+}
+
+void bind_thread_to_numa_node(int node) {
+  if (node < 0 || !NumaAvailable()) return;
+  numa_run_on_node(node);
+  /* Look the node up again on the next call */
+  cached_node_calls = 0;
+}
+
+#else
+
+int current_numa_node() { return -1; }
+
+int cached_numa_node() { return -1; }
+
+int numa_aligned_alloc(void **ptr, size_t align, size_t size, int) {
+  return posix_memalign(ptr, align, size);
+}
+
+void numa_aligned_free(void *ptr, size_t, int) { free(ptr); }
+
+void bind_thread_to_numa_node(int) {}
+
+#endif  // NUMA
+
+}  // namespace AQUAFS_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && !defined(OS_WIN)
@@ -0,0 +1,42 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <cstddef>
+#include <string>
+
+#include "aquafs_namespace.h"
+
+namespace AQUAFS_NAMESPACE {
+
+/* NUMA node of the device behind path, a block device or a file on one,
+ * -1 if not known */
+int device_numa_node(const std::string &path);
+
+/* The rest only place anything when built with NUMA (libnuma) on a system
+ * that has it */
+
+/* Node of the CPU the caller runs on, -1 if not known */
+int current_numa_node();
+/* current_numa_node() looked up once every few calls per thread, for hot
+ * paths that can live with a stale answer right after a migration */
+int cached_numa_node();
+/* Aligned buffer with its pages on node, -1 for posix_memalign() and the
+ * default policy. Placed buffers are mapped whole pages, align must not
+ * be larger than a page. Free with numa_aligned_free(). */
+int numa_aligned_alloc(void **ptr, size_t align, size_t size, int node);
+/* Free a buffer of numa_aligned_alloc(), with the size and node it was
+ * allocated with */
+void numa_aligned_free(void *ptr, size_t size, int node);
+/* Run the calling thread on the CPUs of node, -1 does nothing */
+void bind_thread_to_numa_node(int node);
+
+}  // namespace AQUAFS_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
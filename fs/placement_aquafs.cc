@@ -0,0 +1,239 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && !defined(OS_WIN)
+
+#include "placement_aquafs.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace AQUAFS_NAMESPACE {
+
+static const uint32_t kLifetimes = Env::WLTH_EXTREME + 1;
+
+static bool EndsWith(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+FileKind file_kind(const std::string &fname, IOType io_type) {
+  std::string base = fname.substr(fname.find_last_of('/') + 1);
+  if (io_type == IOType::kWAL || EndsWith(base, ".log")) return FileKind::kWAL;
+  if (base.rfind("MANIFEST", 0) == 0) return FileKind::kManifest;
+  if (EndsWith(base, ".sst")) return FileKind::kSST;
+  if (EndsWith(base, ".blob")) return FileKind::kBlob;
+  return FileKind::kOther;
+}
+
+uint32_t file_class(const std::string &fname, Env::WriteLifeTimeHint lifetime,
+                    IOType io_type) {
+  FileKind kind = file_kind(fname, io_type);
+  uint32_t l = std::min<uint32_t>(lifetime, kLifetimes - 1);
+  return (uint32_t)kind * kLifetimes + l;
+}
+
+const char *file_kind_str(FileKind kind) {
+  static const char *kinds[] = {"wal", "manifest", "sst", "blob", "other"};
+  if (kind >= FileKind::kMax) return "none";
+  return kinds[(uint32_t)kind];
+}
+
+std::string file_class_str(uint32_t cls) {
+  if (cls >= kFileClasses) return "none";
+  return std::string(file_kind_str((FileKind)(cls / kLifetimes))) + "/" +
+         std::to_string(cls % kLifetimes);
+}
+
+unsigned int GetLifeTimeDiff(Env::WriteLifeTimeHint zone_lifetime,
+                             Env::WriteLifeTimeHint file_lifetime) {
+  assert(file_lifetime <= Env::WLTH_EXTREME);
+
+  if ((file_lifetime == Env::WLTH_NOT_SET) ||
+      (file_lifetime == Env::WLTH_NONE)) {
+    if (file_lifetime == zone_lifetime) {
+      return 0;
+    } else {
+      return LIFETIME_DIFF_NOT_GOOD;
+    }
+  }
+
+  if (zone_lifetime > file_lifetime) return zone_lifetime - file_lifetime;
+  if (zone_lifetime == file_lifetime) return LIFETIME_DIFF_COULD_BE_WORSE;
+
+  return LIFETIME_DIFF_NOT_GOOD;
+}
+
+void DeathAgeStats::Add(uint64_t age_s) {
+  /* Racing deletes may lose an update, that is fine for an estimate */
+  int64_t sample = (int64_t)age_s * 1000;
+  int64_t mean = (int64_t)age_ms.load(std::memory_order_relaxed);
+  if (deletes.fetch_add(1, std::memory_order_relaxed) == 0)
+    mean = sample;
+  else
+    mean += (sample - mean) / 8;
+  age_ms.store((uint64_t)mean, std::memory_order_relaxed);
+}
+
+uint64_t DeathAgeStats::Age(uint64_t min_samples) const {
+  if (deletes.load(std::memory_order_relaxed) < min_samples) return 0;
+  return std::max<uint64_t>(age_ms.load(std::memory_order_relaxed), 1);
+}
+
+void AquaFSPlacement::EncodeJson(std::ostream &json_stream) {
+  json_stream << "{\"policy\":\"" << Name() << "\"}";
+}
+
+std::unique_ptr<AquaFSPlacement> AquaFSPlacement::Create(
+    const std::string &name) {
+  if (name == "lifetime") return std::unique_ptr<AquaFSPlacement>(
+      new LifetimePlacement());
+  if (name == "class") return std::unique_ptr<AquaFSPlacement>(
+      new FileClassPlacement());
+  return nullptr;
+}
+
+uint64_t FileClassPlacement::DeathAge(uint32_t cls) const {
+  if (cls >= kFileClasses) return 0;
+  uint64_t age_ms = stats_[cls].age.Age(kMinSamples);
+  if (age_ms == 0) return 0;
+  /* Anything younger than a second counts as a second */
+  return std::max<uint64_t>(age_ms / 1000, 1);
+}
+
+unsigned int FileClassPlacement::Score(Env::WriteLifeTimeHint zone_lifetime,
+                                       uint32_t zone_class,
+                                       Env::WriteLifeTimeHint file_lifetime,
+                                       uint32_t file_class) {
+  unsigned int diff = GetLifeTimeDiff(zone_lifetime, file_lifetime);
+  if (zone_class == kNoFileClass || file_class == kNoFileClass) return diff;
+  if (zone_class == file_class) return 0;
+
+  uint64_t zone_age = DeathAge(zone_class);
+  uint64_t file_age = DeathAge(file_class);
+  if (zone_age == 0 || file_age == 0) {
+    /* Unknown yet, keep classes apart unless the hint says they fit */
+    return std::max<unsigned int>(diff, LIFETIME_DIFF_COULD_BE_WORSE);
+  }
+
+  /* Data that dies within twice the age of the other is good company, the
+   * closer the better. Within four times is still better than a finish. */
+  uint64_t lo = std::min(zone_age, file_age);
+  uint64_t hi = std::max(zone_age, file_age);
+  if (hi <= 2 * lo)
+    return 1 + (unsigned int)((LIFETIME_DIFF_COULD_BE_WORSE - 2) * (hi - lo) /
+                              lo);
+  if (hi <= 4 * lo) return LIFETIME_DIFF_COULD_BE_WORSE;
+  return LIFETIME_DIFF_NOT_GOOD;
+}
+
+void FileClassPlacement::FileDeleted(uint32_t file_class, uint64_t age_s,
+                                     uint64_t size) {
+  if (file_class >= kFileClasses) return;
+  stats_[file_class].age.Add(age_s);
+  stats_[file_class].bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void FileClassPlacement::EncodeJson(std::ostream &json_stream) {
+  json_stream << "{\"policy\":\"" << Name() << "\",\"classes\":[";
+  bool first = true;
+  for (uint32_t c = 0; c < kFileClasses; c++) {
+    uint64_t deletes = stats_[c].age.deletes.load(std::memory_order_relaxed);
+    if (deletes == 0) continue;
+    if (!first) json_stream << ",";
+    first = false;
+    json_stream << "{\"class\":\"" << file_class_str(c)
+                << "\",\"deletes\":" << deletes << ",\"bytes\":"
+                << stats_[c].bytes.load(std::memory_order_relaxed)
+                << ",\"death_age_ms\":"
+                << stats_[c].age.age_ms.load(std::memory_order_relaxed)
+                << "}";
+  }
+  json_stream << "]}";
+}
+
+static bool IsHinted(Env::WriteLifeTimeHint hint) {
+  return hint != Env::WLTH_NOT_SET && hint != Env::WLTH_NONE;
+}
+
+Env::WriteLifeTimeHint LifetimePredictor::Predict(
+    const std::string &fname, Env::WriteLifeTimeHint hint,
+    IOType io_type) const {
+  if (IsHinted(hint)) return hint;
+  return Predict(file_kind(fname, io_type), hint);
+}
+
+Env::WriteLifeTimeHint LifetimePredictor::Predict(
+    FileKind kind, Env::WriteLifeTimeHint hint) const {
+  uint64_t age = unhinted_[(uint32_t)kind].Age(kMinSamples);
+  if (age == 0) {
+    /* What RocksDB would have hinted, roughly */
+    switch (kind) {
+      case FileKind::kWAL:
+        return Env::WLTH_SHORT;
+      case FileKind::kManifest:
+        return Env::WLTH_MEDIUM;
+      case FileKind::kSST:
+        return Env::WLTH_LONG;
+      case FileKind::kBlob:
+        return Env::WLTH_EXTREME;
+      default:
+        return hint;
+    }
+  }
+
+  /* Closest hinted files, by order of magnitude */
+  Env::WriteLifeTimeHint best = Env::WLTH_NOT_SET;
+  double best_dist = 0;
+  for (int h = Env::WLTH_SHORT; h <= Env::WLTH_EXTREME; h++) {
+    uint64_t h_age = hinted_[h].Age(kMinSamples);
+    if (h_age == 0) continue;
+    double dist = std::fabs(std::log((double)age / (double)h_age));
+    if (best == Env::WLTH_NOT_SET || dist < best_dist) {
+      best = (Env::WriteLifeTimeHint)h;
+      best_dist = dist;
+    }
+  }
+  if (best != Env::WLTH_NOT_SET) return best;
+
+  /* Nothing carries hints, bucket the age */
+  if (age < 60 * 1000) return Env::WLTH_SHORT;
+  if (age < 15 * 60 * 1000) return Env::WLTH_MEDIUM;
+  if (age < 4 * 3600 * 1000) return Env::WLTH_LONG;
+  return Env::WLTH_EXTREME;
+}
+
+void LifetimePredictor::FileDeleted(const std::string &fname,
+                                    Env::WriteLifeTimeHint hint,
+                                    IOType io_type, uint64_t age_s) {
+  if (IsHinted(hint)) {
+    if (hint <= Env::WLTH_EXTREME) hinted_[hint].Add(age_s);
+    return;
+  }
+  unhinted_[(uint32_t)file_kind(fname, io_type)].Add(age_s);
+}
+
+void LifetimePredictor::EncodeJson(std::ostream &json_stream) {
+  json_stream << "{\"unhinted\":[";
+  bool first = true;
+  for (uint32_t k = 0; k < (uint32_t)FileKind::kMax; k++) {
+    uint64_t deletes = unhinted_[k].deletes.load(std::memory_order_relaxed);
+    if (deletes == 0) continue;
+    if (!first) json_stream << ",";
+    first = false;
+    json_stream << "{\"kind\":\"" << file_kind_str((FileKind)k)
+                << "\",\"deletes\":" << deletes << ",\"death_age_ms\":"
+                << unhinted_[k].age_ms.load(std::memory_order_relaxed)
+                << ",\"predicted\":"
+                << Predict((FileKind)k, Env::WLTH_NOT_SET) << "}";
+  }
+  json_stream << "]}";
+}
+
+}  // namespace AQUAFS_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && !defined(OS_WIN)
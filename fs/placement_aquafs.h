@@ -0,0 +1,159 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+
+#include "aquafs_namespace.h"
+#include "rocksdb/env.h"
+#include "rocksdb/file_system.h"
+#include "rocksdb/rocksdb_namespace.h"
+
+/* Placement scores, see AquaFSPlacement::Score() */
+#define LIFETIME_DIFF_NOT_GOOD (100)
+#define LIFETIME_DIFF_COULD_BE_WORSE (50)
+
+namespace AQUAFS_NAMESPACE {
+using namespace ROCKSDB_NAMESPACE;
+
+/* What kind of file data is, from its name and io type */
+enum class FileKind : uint32_t {
+  kWAL = 0,
+  kManifest,
+  kSST,
+  kBlob,
+  kOther,
+  kMax,
+};
+
+/* A file class is a kind together with a lifetime hint, so that e.g. SSTs
+ * of different levels are told apart */
+const uint32_t kNoFileClass = UINT32_MAX;
+const uint32_t kFileClasses =
+    (uint32_t)FileKind::kMax * (Env::WLTH_EXTREME + 1);
+
+FileKind file_kind(const std::string &fname, IOType io_type);
+const char *file_kind_str(FileKind kind);
+uint32_t file_class(const std::string &fname, Env::WriteLifeTimeHint lifetime,
+                    IOType io_type);
+std::string file_class_str(uint32_t cls);
+
+unsigned int GetLifeTimeDiff(Env::WriteLifeTimeHint zone_lifetime,
+                             Env::WriteLifeTimeHint file_lifetime);
+
+/* The age files die at, learned from deletions */
+struct DeathAgeStats {
+  std::atomic<uint64_t> deletes{0};
+  /* Exponentially weighted mean age, in milliseconds */
+  std::atomic<uint64_t> age_ms{0};
+
+  /* A file died age_s seconds after it was last written */
+  void Add(uint64_t age_s);
+  /* Mean age in milliseconds, 0 until min_samples deletions were seen */
+  uint64_t Age(uint64_t min_samples) const;
+};
+
+/* Decides which open zone new data of a file goes to */
+class AquaFSPlacement {
+ public:
+  virtual ~AquaFSPlacement() = default;
+
+  virtual const char *Name() const = 0;
+  /* How badly a file fits a zone holding data of another file, 0 is a
+   * perfect match. At LIFETIME_DIFF_COULD_BE_WORSE or above the allocator
+   * opens an empty zone instead if it can. */
+  virtual unsigned int Score(Env::WriteLifeTimeHint zone_lifetime,
+                             uint32_t zone_class,
+                             Env::WriteLifeTimeHint file_lifetime,
+                             uint32_t file_class) = 0;
+  /* A file was deleted age_s seconds after it was last written */
+  virtual void FileDeleted(uint32_t /*file_class*/, uint64_t /*age_s*/,
+                           uint64_t /*size*/) {}
+  virtual void EncodeJson(std::ostream &json_stream);
+
+  /* "lifetime" or "class", nullptr for anything else */
+  static std::unique_ptr<AquaFSPlacement> Create(const std::string &name);
+};
+
+/* Scores by lifetime hint distance only */
+class LifetimePlacement : public AquaFSPlacement {
+ public:
+  const char *Name() const override { return "lifetime"; }
+  unsigned int Score(Env::WriteLifeTimeHint zone_lifetime,
+                     uint32_t /*zone_class*/,
+                     Env::WriteLifeTimeHint file_lifetime,
+                     uint32_t /*file_class*/) override {
+    return GetLifeTimeDiff(zone_lifetime, file_lifetime);
+  }
+};
+
+/* Streams every file class to zones of its own, and lets classes share a
+ * zone only when their files are seen to die at about the same age. Ages
+ * are learned from deletions. Classes without enough deletions yet fall
+ * back to the lifetime hint distance. */
+class FileClassPlacement : public AquaFSPlacement {
+ public:
+  /* Deletions needed before the death age of a class is trusted */
+  static const uint64_t kMinSamples = 8;
+
+  const char *Name() const override { return "class"; }
+  unsigned int Score(Env::WriteLifeTimeHint zone_lifetime,
+                     uint32_t zone_class,
+                     Env::WriteLifeTimeHint file_lifetime,
+                     uint32_t file_class) override;
+  void FileDeleted(uint32_t file_class, uint64_t age_s,
+                   uint64_t size) override;
+  void EncodeJson(std::ostream &json_stream) override;
+
+  /* Mean age at deletion in seconds, 0 when not known yet */
+  uint64_t DeathAge(uint32_t cls) const;
+
+ private:
+  struct ClassStats {
+    DeathAgeStats age;
+    std::atomic<uint64_t> bytes{0};
+  };
+  ClassStats stats_[kFileClasses];
+};
+
+/* Guesses a lifetime hint for files written without one, so that they can
+ * share zones with files expected to die at the same time. Until enough
+ * files of a kind were deleted the guess is a fixed one per kind, after
+ * that it is the hint of hinted files dying at about the same age, or a
+ * bucket of the age itself if no files carry hints. */
+class LifetimePredictor {
+ public:
+  /* Deletions needed before the death age of a kind is trusted */
+  static const uint64_t kMinSamples = 8;
+
+  /* hint itself unless it is WLTH_NOT_SET or WLTH_NONE */
+  Env::WriteLifeTimeHint Predict(const std::string &fname,
+                                 Env::WriteLifeTimeHint hint,
+                                 IOType io_type) const;
+  /* A file was deleted age_s seconds after it was last written */
+  void FileDeleted(const std::string &fname, Env::WriteLifeTimeHint hint,
+                   IOType io_type, uint64_t age_s);
+  void EncodeJson(std::ostream &json_stream);
+
+ private:
+  Env::WriteLifeTimeHint Predict(FileKind kind,
+                                 Env::WriteLifeTimeHint hint) const;
+
+  /* Files without a hint by kind, files with one by hint */
+  DeathAgeStats unhinted_[(uint32_t)FileKind::kMax];
+  DeathAgeStats hinted_[Env::WLTH_EXTREME + 1];
+};
+
+}  // namespace AQUAFS_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
@@ -4,6 +4,8 @@
 
 #include "zone_raid.h"
 
+#include <algorithm>
+#include <cstring>
 #include <memory>
 #include <queue>
 #include <utility>
@@ -90,6 +92,12 @@ IOStatus AbstractRaidZonedBlockDevice::Open(bool readonly, bool exclusive,
   Info(logger_, "Open(readonly=%s, exclusive=%s)",
        std::to_string(readonly).c_str(), std::to_string(exclusive).c_str());
   IOStatus s;
+  // the tightest limit of the members, 0 is no limit
+  auto tighter = [](unsigned int a, unsigned int b) {
+    return a && b ? std::min(a, b) : a + b;
+  };
+  unsigned int active_limit = 0;
+  unsigned int open_limit = 0;
   for (auto &&d : devices_) {
     s = d->Open(readonly, exclusive, max_active_zones, max_open_zones);
     if (!s.ok()) return s;
@@ -99,10 +107,19 @@ IOStatus AbstractRaidZonedBlockDevice::Open(bool readonly, bool exclusive,
          d->GetFilename().c_str(), d->GetNrZones() * d->GetZoneSize(),
          d->GetNrZones(), d->GetZoneSize(), d->GetBlockSize(),
          *max_active_zones, *max_open_zones);
-    assert(d->GetNrZones() == def_dev()->GetNrZones());
-    assert(d->GetZoneSize() == def_dev()->GetZoneSize());
-    assert(d->GetBlockSize() == def_dev()->GetBlockSize());
+    active_limit = tighter(active_limit, *max_active_zones);
+    open_limit = tighter(open_limit, *max_open_zones);
+    if (d->GetBlockSize() != def_dev()->GetBlockSize())
+      return IOStatus::NotSupported("RAID Error", "block size mismatch");
+    if (!mixedZoneCountSupported() &&
+        d->GetNrZones() != def_dev()->GetNrZones())
+      return IOStatus::NotSupported("RAID Error", "zone count mismatch");
+    if (!mixedZoneSizeSupported() &&
+        d->GetZoneSize() != def_dev()->GetZoneSize())
+      return IOStatus::NotSupported("RAID Error", "zone size mismatch");
   }
+  *max_active_zones = active_limit;
+  *max_open_zones = open_limit;
   syncBackendInfo();
   Info(logger_, "after Open(): nr_zones=%x, zone_sz=%lx blk_sz=%x", nr_zones_,
        zone_sz_, block_sz_);
@@ -118,6 +135,28 @@ void AbstractRaidZonedBlockDevice::syncBackendInfo() {
   zone_sz_ = def_dev()->GetZoneSize();
   nr_zones_ = def_dev()->GetNrZones();
 }
+void AbstractRaidZonedBlockDevice::decodeZone(size_t dev,
+                                              std::unique_ptr<ZoneList> &zones,
+                                              unsigned int idx,
+                                              raid_zone_t *z) const {
+  auto &d = devices_[dev];
+  memset(z, 0, sizeof(*z));
+  z->start = d->ZoneStart(zones, idx);
+  z->wp = d->ZoneWp(zones, idx);
+  z->capacity = d->ZoneMaxCapacity(zones, idx);
+  z->len = d->GetZoneSize();
+  z->type = d->ZoneIsSwr(zones, idx) ? ZBD_ZONE_TYPE_SWR : ZBD_ZONE_TYPE_CNV;
+  if (d->ZoneIsOffline(zones, idx))
+    z->cond = ZBD_ZONE_COND_OFFLINE;
+  else if (d->ZoneIsOpen(zones, idx))
+    z->cond = ZBD_ZONE_COND_IMP_OPEN;
+  else if (d->ZoneIsActive(zones, idx))
+    z->cond = ZBD_ZONE_COND_CLOSED;
+  else if (!d->ZoneIsWritable(zones, idx))
+    z->cond = ZBD_ZONE_COND_FULL;
+  else
+    z->cond = z->wp == z->start ? ZBD_ZONE_COND_EMPTY : ZBD_ZONE_COND_CLOSED;
+}
 std::string AbstractRaidZonedBlockDevice::GetFilename() {
   std::string name = std::string("raid") + raid_mode_str(main_mode_) + ":";
   for (auto p = devices_.begin(); p != devices_.end(); p++) {
@@ -126,7 +165,41 @@ std::string AbstractRaidZonedBlockDevice::GetFilename() {
   }
   return name;
 }
+Status AbstractRaidZonedBlockDevice::setStripeUnit(uint32_t stripe_unit) {
+  if (stripe_unit == 0) stripe_unit = GetBlockSize();
+  if (stripe_unit % def_dev()->GetBlockSize())
+    return Status::InvalidArgument(
+        "RAID Error", "stripe unit must be a multiple of the block size");
+  for (auto &&d : devices_) {
+    if (d->GetZoneSize() % stripe_unit)
+      return Status::InvalidArgument(
+          "RAID Error", "stripe unit must divide the zone size of " +
+                            d->GetFilename());
+  }
+  stripe_unit_ = stripe_unit;
+  Info(logger_, "stripe unit set to %x", stripe_unit_);
+  return Status::OK();
+}
 bool AbstractRaidZonedBlockDevice::IsRAIDEnabled() const { return true; }
+std::vector<int> AbstractRaidZonedBlockDevice::GetNumaNodes() const {
+  std::vector<int> nodes;
+  for (auto &&d : devices_) {
+    for (int node : d->GetNumaNodes()) {
+      if (std::find(nodes.begin(), nodes.end(), node) == nodes.end())
+        nodes.push_back(node);
+    }
+  }
+  return nodes;
+}
+int AbstractRaidZonedBlockDevice::GetNumaNodeAt(uint64_t /*pos*/) {
+  auto nodes = GetNumaNodes();
+  return nodes.size() == 1 ? nodes[0] : -1;
+}
+uint64_t AbstractRaidZonedBlockDevice::GetNumaRemoteBytes() const {
+  uint64_t bytes = 0;
+  for (auto &&d : devices_) bytes += d->GetNumaRemoteBytes();
+  return bytes;
+}
 RaidMode AbstractRaidZonedBlockDevice::getMainMode() const {
   return main_mode_;
 }
@@ -78,7 +78,26 @@ class AbstractRaidZonedBlockDevice : public ZonedBlockDeviceBackend {
 
   std::string GetFilename() override;
   [[nodiscard]] bool IsRAIDEnabled() const override;
+  [[nodiscard]] std::vector<int> GetNumaNodes() const override;
+  // the node shared by all devices, modes that place pos on one device
+  // override this
+  int GetNumaNodeAt(uint64_t pos) override;
+  [[nodiscard]] uint64_t GetNumaRemoteBytes() const override;
   [[nodiscard]] RaidMode getMainMode() const;
+  [[nodiscard]] uint32_t GetRaidModeAt(uint64_t /*pos*/) override {
+    return static_cast<uint32_t>(main_mode_);
+  }
+  // bytes placed on one device before striping moves on to the next one
+  [[nodiscard]] uint32_t getStripeUnit() const {
+    return stripe_unit_ ? stripe_unit_ : GetBlockSize();
+  }
+  // 0 selects the device block size; must be chosen before any data is
+  // written, it is recorded in the superblock at mkfs
+  virtual Status setStripeUnit(uint32_t stripe_unit);
+  // stripe units owned by device idx in one stripe cycle, 0 if not striped
+  [[nodiscard]] virtual uint32_t getDeviceWeight(size_t /*idx*/) const {
+    return 0;
+  }
 
  protected:
   std::shared_ptr<Logger> logger_{};
@@ -87,8 +106,21 @@ class AbstractRaidZonedBlockDevice : public ZonedBlockDeviceBackend {
   // how many zones in total of all devices
   uint32_t total_nr_devices_zones_{};
   const IOStatus unsupported = IOStatus::NotSupported("Raid unsupported");
+  uint32_t stripe_unit_{};
 
   virtual void syncBackendInfo();
+  // decode zone idx of device dev through the device's own accessors, the
+  // layout of a device zone list depends on its backend
+  void decodeZone(size_t dev, std::unique_ptr<ZoneList> &zones,
+                  unsigned int idx, raid_zone_t *z) const;
+  // an entry of a zone list merged by this device
+  static raid_zone_t *mergedZone(std::unique_ptr<ZoneList> &zones,
+                                 unsigned int idx) {
+    return &reinterpret_cast<raid_zone_t *>(zones->GetData())[idx];
+  }
+  // whether members may differ in zone count, and in zone size
+  [[nodiscard]] virtual bool mixedZoneCountSupported() const { return false; }
+  [[nodiscard]] virtual bool mixedZoneSizeSupported() const { return false; }
 
   template <class T>
   T nr_dev_t() const {
@@ -4,10 +4,190 @@
 
 #include "zone_raid0.h"
 
+#include <algorithm>
+#include <numeric>
+
+#include "zone_raid_auto.h"
+
 namespace AQUAFS_NAMESPACE {
+void Raid0ZonedBlockDevice::buildStripeMap() {
+  // give every device a number of zones per raid zone proportional to its
+  // zone count, so that shares follow capacity; the device with the fewest
+  // zones gives m of them, take the m that leaves the most usable capacity
+  dev_zones_.assign(nr_dev(), 1);
+  uint64_t min_nr = UINT64_MAX;
+  uint64_t total = 0;
+  for (auto &&d : devices_) {
+    min_nr = std::min<uint64_t>(min_nr, d->GetNrZones());
+    total += static_cast<uint64_t>(d->GetNrZones()) * d->GetZoneSize();
+  }
+  uint64_t best_usable = 0;
+  if (min_nr > 0 && min_nr != UINT64_MAX) {
+    for (uint64_t m = 1; m <= std::min<uint64_t>(max_device_zones_, min_nr);
+         m++) {
+      std::vector<uint32_t> k;
+      uint64_t nr = UINT64_MAX;
+      uint64_t share = 0;
+      for (auto &&d : devices_) {
+        auto kd = std::min<uint64_t>(d->GetNrZones() * m / min_nr,
+                                     max_device_zones_);
+        k.emplace_back(static_cast<uint32_t>(kd));
+        nr = std::min<uint64_t>(nr, d->GetNrZones() / kd);
+        share += kd * d->GetZoneSize();
+      }
+      if (nr * share > best_usable) {
+        best_usable = nr * share;
+        dev_zones_ = k;
+      }
+    }
+  }
+  // weight every lane by the zone size of its device in blocks, reduced by
+  // the gcd
+  auto bs = static_cast<uint64_t>(GetBlockSize());
+  std::vector<uint64_t> units;
+  uint64_t g = 0;
+  for (auto &&d : devices_) {
+    auto u = bs ? d->GetZoneSize() / bs : 0;
+    units.emplace_back(u);
+    g = std::gcd(g, u);
+  }
+  dev_weights_.assign(nr_dev(), 1);
+  if (g > 0) {
+    auto max_u = *std::max_element(units.begin(), units.end());
+    bool scaled = max_u / g > kMaxStripeCycle;
+    for (size_t i = 0; i < nr_dev(); i++) {
+      auto w = units[i] / g;
+      // keep the cycle short, losing a little capacity on odd ratios
+      if (scaled) w = std::max<uint64_t>(1, units[i] * kMaxStripeCycle / max_u);
+      dev_weights_[i] = static_cast<uint32_t>(w);
+    }
+    if (scaled)
+      Warn(logger_,
+           "RAID0 zone size ratio does not fit a %u unit stripe cycle, "
+           "weights are rounded and part of the larger zones stays unused",
+           kMaxStripeCycle);
+  }
+  // lanes of the same index come together, so that consecutive stripe units
+  // still go to different devices whenever possible
+  lane_dev_.clear();
+  lane_zone_.clear();
+  auto max_k = *std::max_element(dev_zones_.begin(), dev_zones_.end());
+  for (uint32_t j = 0; j < max_k; j++) {
+    for (size_t i = 0; i < nr_dev(); i++) {
+      if (j < dev_zones_[i]) {
+        lane_dev_.emplace_back(static_cast<idx_t>(i));
+        lane_zone_.emplace_back(j);
+      }
+    }
+  }
+  // interleave the units of one cycle over the lanes
+  slot_lane_.clear();
+  slot_off_.clear();
+  std::vector<uint32_t> used(lane_dev_.size(), 0);
+  bool placed = true;
+  while (placed) {
+    placed = false;
+    for (size_t l = 0; l < lane_dev_.size(); l++) {
+      if (used[l] < dev_weights_[lane_dev_[l]]) {
+        slot_lane_.emplace_back(static_cast<idx_t>(l));
+        slot_off_.emplace_back(used[l]++);
+        placed = true;
+      }
+    }
+  }
+  cycle_units_ = slot_lane_.size();
+  if (best_usable)
+    Info(logger_, "RAID0 uses %lu of %lu bytes of its members", best_usable,
+         total);
+}
+uint64_t Raid0ZonedBlockDevice::stripe_capacity(
+    const std::vector<uint64_t> &lane_capacity) const {
+  uint64_t su = getStripeUnit();
+  if (!su) return 0;
+  uint64_t cycles = UINT64_MAX;
+  for (size_t l = 0; l < lane_dev_.size(); l++)
+    cycles = std::min<uint64_t>(
+        cycles, lane_capacity[l] / su / dev_weights_[lane_dev_[l]]);
+  return cycles * cycle_units_ * su;
+}
+uint64_t Raid0ZonedBlockDevice::req_pos(uint64_t pos, size_t *idx_dev) const {
+  uint64_t su = getStripeUnit();
+  auto idx = pos / GetZoneSize();
+  auto unit = (pos % GetZoneSize()) / su;
+  auto cycle = unit / cycle_units_;
+  auto slot = unit % cycle_units_;
+  auto l = slot_lane_[slot];
+  *idx_dev = lane_dev_[l];
+  return lane_zone_start(idx, l) +
+         (cycle * dev_weights_[lane_dev_[l]] + slot_off_[slot]) * su +
+         pos % su;
+}
 void Raid0ZonedBlockDevice::syncBackendInfo() {
   AbstractRaidZonedBlockDevice::syncBackendInfo();
-  zone_sz_ *= nr_dev();
+  buildStripeMap();
+  // a raid zone ends when the first lane runs out of its share
+  std::vector<uint64_t> lane_zone_sz;
+  for (size_t i = 0; i < nr_dev(); i++)
+    nr_zones_ = std::min(nr_zones_, devices_[i]->GetNrZones() / dev_zones_[i]);
+  for (auto d : lane_dev_)
+    lane_zone_sz.emplace_back(devices_[d]->GetZoneSize());
+  zone_sz_ = stripe_capacity(lane_zone_sz);
+}
+IOStatus Raid0ZonedBlockDevice::Open(bool readonly, bool exclusive,
+                                     unsigned int *max_active_zones,
+                                     unsigned int *max_open_zones) {
+  // the weights of every device are recorded in the superblock
+  if (nr_dev() > RaidInfoBasic::kMaxWeightedDevices)
+    return IOStatus::NotSupported(
+        "RAID Error", "RAID0 supports up to " +
+                          std::to_string(RaidInfoBasic::kMaxWeightedDevices) +
+                          " devices");
+  auto s = AbstractRaidZonedBlockDevice::Open(readonly, exclusive,
+                                             max_active_zones, max_open_zones);
+  if (!s.ok()) return s;
+  // an active raid zone keeps dev_zones_[d] zones of device d active
+  auto max_k = *std::max_element(dev_zones_.begin(), dev_zones_.end());
+  unsigned int limit = *max_active_zones && *max_open_zones
+                           ? std::min(*max_active_zones, *max_open_zones)
+                           : *max_active_zones + *max_open_zones;
+  if (limit && limit / max_k < kMinActiveZones) {
+    max_device_zones_ = std::max(1u, limit / kMinActiveZones);
+    syncBackendInfo();
+    max_k = *std::max_element(dev_zones_.begin(), dev_zones_.end());
+  }
+  if (*max_active_zones)
+    *max_active_zones = std::max(1u, *max_active_zones / max_k);
+  if (*max_open_zones) *max_open_zones = std::max(1u, *max_open_zones / max_k);
+  return s;
+}
+Status Raid0ZonedBlockDevice::setStripeUnit(uint32_t stripe_unit) {
+  auto old_stripe_unit = stripe_unit_;
+  auto s = AbstractRaidZonedBlockDevice::setStripeUnit(stripe_unit);
+  if (!s.ok()) return s;
+  // the zone size and every zone capacity must stay the same, Zone objects
+  // built at open time keep using them
+  std::vector<uint64_t> lane_zone_sz;
+  for (auto d : lane_dev_)
+    lane_zone_sz.emplace_back(devices_[d]->GetZoneSize());
+  if (stripe_capacity(lane_zone_sz) != zone_sz_) {
+    stripe_unit_ = old_stripe_unit;
+    return Status::InvalidArgument(
+        "RAID Error", "stripe unit does not divide the weighted zone layout");
+  }
+  for (size_t i = 0; i < nr_dev(); i++) {
+    auto zones = devices_[i]->ListZones();
+    if (!zones) continue;
+    for (idx_t z = 0; z < GetNrZones() * dev_zones_[i]; z++) {
+      if (devices_[i]->ZoneMaxCapacity(zones, z) %
+          (static_cast<uint64_t>(getStripeUnit()) * dev_weights_[i])) {
+        stripe_unit_ = old_stripe_unit;
+        return Status::InvalidArgument(
+            "RAID Error", "stripe unit does not divide the zone capacity of " +
+                              devices_[i]->GetFilename());
+      }
+    }
+  }
+  return Status::OK();
 }
 Raid0ZonedBlockDevice::Raid0ZonedBlockDevice(
     const std::shared_ptr<Logger> &logger,
@@ -17,50 +197,62 @@ Raid0ZonedBlockDevice::Raid0ZonedBlockDevice(
   syncBackendInfo();
 }
 std::unique_ptr<ZoneList> Raid0ZonedBlockDevice::ListZones() {
-  auto zones = def_dev()->ListZones();
-  if (zones) {
-    auto nr_zones = zones->ZoneCount();
-    // TODO: mix use of ZoneFS and libzbd
-    auto data = new struct zbd_zone[nr_zones];
-    auto ptr = data;
-    memcpy(data, zones->GetData(), sizeof(struct zbd_zone) * nr_zones);
-    for (decltype(nr_zones) i = 0; i < nr_zones; i++) {
-      ptr->start *= nr_dev();
-      ptr->capacity *= nr_dev();
-      // what's this? len == capacity?
-      ptr->len *= nr_dev();
-      ptr++;
+  // report every device exactly once and merge them into one striped table
+  // of raid_zone_t, so that the ZoneIs*/ZoneWp queries below never go back
+  // to the devices
+  std::vector<std::unique_ptr<ZoneList>> list;
+  for (auto &&d : devices_) {
+    auto zones = d->ListZones();
+    if (!zones) return nullptr;
+    list.emplace_back(std::move(zones));
+  }
+  auto nr_zones = GetNrZones();
+  auto data = new raid_zone_t[nr_zones];
+  for (decltype(nr_zones) i = 0; i < nr_zones; i++) {
+    auto ptr = &data[i];
+    uint64_t written = 0;
+    std::vector<uint64_t> lane_capacity;
+    for (size_t l = 0; l < lane_dev_.size(); l++) {
+      raid_zone_t z;
+      decodeZone(lane_dev_[l], list[lane_dev_[l]], lane_zone(i, l), &z);
+      if (l == 0) *ptr = z;
+      written += z.wp - z.start;
+      lane_capacity.emplace_back(z.capacity);
+      // one offline member takes the whole stripe offline
+      if (zbd_zone_offline(&z)) ptr->cond = ZBD_ZONE_COND_OFFLINE;
     }
-    return std::make_unique<ZoneList>(data, nr_zones);
-  } else {
-    return nullptr;
+    ptr->start = static_cast<uint64_t>(i) * GetZoneSize();
+    ptr->capacity = stripe_capacity(lane_capacity);
+    ptr->len = GetZoneSize();
+    ptr->wp = ptr->start + written;
   }
+  return std::make_unique<ZoneList>(data, nr_zones);
 }
 IOStatus Raid0ZonedBlockDevice::Reset(uint64_t start, bool *offline,
                                       uint64_t *max_capacity) {
   assert(start % GetBlockSize() == 0);
   assert(start % GetZoneSize() == 0);
-  // auto idx_dev = get_idx_dev(start);
-  auto s = start / nr_dev();
-  // auto r = devices_[idx_dev]->Reset(s, offline, max_capacity);
+  auto idx = start / GetZoneSize();
   IOStatus r{};
-  for (auto &&d : devices_) {
-    r = d->Reset(s, offline, max_capacity);
-    if (r.ok()) {
-      *max_capacity *= nr_dev();
-    }
+  std::vector<uint64_t> lane_capacity(lane_dev_.size());
+  bool any_offline = false;
+  for (size_t l = 0; l < lane_dev_.size(); l++) {
+    r = devices_[lane_dev_[l]]->Reset(lane_zone_start(idx, l), offline,
+                                      &lane_capacity[l]);
+    if (!r.ok()) return r;
+    any_offline |= *offline;
   }
+  *offline = any_offline;
+  *max_capacity = any_offline ? 0 : stripe_capacity(lane_capacity);
   return r;
 }
 IOStatus Raid0ZonedBlockDevice::Finish(uint64_t start) {
   assert(start % GetBlockSize() == 0);
   assert(start % GetZoneSize() == 0);
-  // auto idx_dev = get_idx_dev(start);
-  auto s = start / nr_dev();
-  // auto r = devices_[idx_dev]->Finish(s);
+  auto idx = start / GetZoneSize();
   IOStatus r{};
-  for (auto &&d : devices_) {
-    r = d->Finish(s);
+  for (size_t l = 0; l < lane_dev_.size(); l++) {
+    r = devices_[lane_dev_[l]]->Finish(lane_zone_start(idx, l));
     if (!r.ok()) return r;
   }
   return r;
@@ -68,12 +260,10 @@ IOStatus Raid0ZonedBlockDevice::Finish(uint64_t start) {
 IOStatus Raid0ZonedBlockDevice::Close(uint64_t start) {
   assert(start % GetBlockSize() == 0);
   assert(start % GetZoneSize() == 0);
-  // auto idx_dev = get_idx_dev(start);
-  auto s = start / nr_dev();
-  // auto r = devices_[idx_dev]->Close(s);
+  auto idx = start / GetZoneSize();
   IOStatus r{};
-  for (auto &&d : devices_) {
-    r = d->Close(s);
+  for (size_t l = 0; l < lane_dev_.size(); l++) {
+    r = devices_[lane_dev_[l]]->Close(lane_zone_start(idx, l));
     if (!r.ok()) {
       return r;
     }
@@ -82,14 +272,16 @@ IOStatus Raid0ZonedBlockDevice::Close(uint64_t start) {
 }
 int Raid0ZonedBlockDevice::Read(char *buf, int size, uint64_t pos,
                                 bool direct) {
-  // split read range as blocks
+  // split read range as stripe units
   int sz_read = 0;
   // TODO: Read blocks in multi-threads
   int r;
+  size_t idx_dev;
   while (size > 0) {
-    auto req_size =
-        std::min(size, static_cast<int>(GetBlockSize() - pos % GetBlockSize()));
-    r = devices_[get_idx_dev(pos)]->Read(buf, req_size, req_pos(pos), direct);
+    auto req_size = std::min(
+        size, static_cast<int>(getStripeUnit() - pos % getStripeUnit()));
+    auto p = req_pos(pos, &idx_dev);
+    r = devices_[idx_dev]->Read(buf, req_size, p, direct);
     if (r > 0) {
       size -= r;
       sz_read += r;
@@ -102,15 +294,15 @@ int Raid0ZonedBlockDevice::Read(char *buf, int size, uint64_t pos,
   return sz_read;
 }
 int Raid0ZonedBlockDevice::Write(char *data, uint32_t size, uint64_t pos) {
-  // split read range as blocks
+  // split write range as stripe units
   int sz_written = 0;
   // TODO: write blocks in multi-threads
   int r;
+  size_t idx_dev;
   while (size > 0) {
     auto req_size = std::min(
-        size, GetBlockSize() - (static_cast<uint32_t>(pos)) % GetBlockSize());
-    auto p = req_pos(pos);
-    auto idx_dev = get_idx_dev(pos);
+        size, getStripeUnit() - static_cast<uint32_t>(pos % getStripeUnit()));
+    auto p = req_pos(pos, &idx_dev);
     r = devices_[idx_dev]->Write(data, req_size, p);
     // Debug(logger_, "WRITE: pos=%lx, dev=%lu, req_sz=%x, req_pos=%lx,
     // ret=%d",
@@ -128,63 +320,53 @@ int Raid0ZonedBlockDevice::Write(char *data, uint32_t size, uint64_t pos) {
 }
 int Raid0ZonedBlockDevice::InvalidateCache(uint64_t pos, uint64_t size) {
   assert(size % GetBlockSize() == 0);
-  for (size_t i = 0; i < nr_dev(); i++) {
-    devices_[i]->InvalidateCache(req_pos(pos), size / nr_dev());
+  // every lane holds its weighted share of the range, starting at the
+  // cycle that contains pos
+  uint64_t su = getStripeUnit();
+  auto idx = pos / GetZoneSize();
+  auto cycle = (pos % GetZoneSize()) / su / cycle_units_;
+  auto nr_cycles = (size / su + cycle_units_ - 1) / cycle_units_ + 1;
+  for (size_t l = 0; l < lane_dev_.size(); l++) {
+    auto w = dev_weights_[lane_dev_[l]];
+    devices_[lane_dev_[l]]->InvalidateCache(
+        lane_zone_start(idx, l) + cycle * w * su, nr_cycles * w * su);
   }
   return 0;
 }
+// The zone list handed in is the merged table built by ListZones().
 bool Raid0ZonedBlockDevice::ZoneIsSwr(std::unique_ptr<ZoneList> &zones,
                                       unsigned int idx) {
-  // asserts that all devices have the same zone layout
-  auto z = def_dev()->ListZones();
-  return def_dev()->ZoneIsSwr(z, idx);
+  return zbd_zone_swr(mergedZone(zones, idx));
 }
 bool Raid0ZonedBlockDevice::ZoneIsOffline(std::unique_ptr<ZoneList> &zones,
                                           unsigned int idx) {
-  // asserts that all devices have the same zone layout
-  auto z = def_dev()->ListZones();
-  return def_dev()->ZoneIsOffline(z, idx);
+  return zbd_zone_offline(mergedZone(zones, idx));
 }
 bool Raid0ZonedBlockDevice::ZoneIsWritable(std::unique_ptr<ZoneList> &zones,
                                            unsigned int idx) {
-  // asserts that all devices have the same zone layout
-  auto z = def_dev()->ListZones();
-  return def_dev()->ZoneIsWritable(z, idx);
+  auto z = mergedZone(zones, idx);
+  return !(zbd_zone_full(z) || zbd_zone_offline(z) || zbd_zone_rdonly(z));
 }
 bool Raid0ZonedBlockDevice::ZoneIsActive(std::unique_ptr<ZoneList> &zones,
                                          unsigned int idx) {
-  // asserts that all devices have the same zone layout
-  auto z = def_dev()->ListZones();
-  return def_dev()->ZoneIsActive(z, idx);
+  auto z = mergedZone(zones, idx);
+  return zbd_zone_imp_open(z) || zbd_zone_exp_open(z) || zbd_zone_closed(z);
 }
 bool Raid0ZonedBlockDevice::ZoneIsOpen(std::unique_ptr<ZoneList> &zones,
                                        unsigned int idx) {
-  // asserts that all devices have the same zone layout
-  auto z = def_dev()->ListZones();
-  return def_dev()->ZoneIsOpen(z, idx);
+  auto z = mergedZone(zones, idx);
+  return zbd_zone_imp_open(z) || zbd_zone_exp_open(z);
 }
 uint64_t Raid0ZonedBlockDevice::ZoneStart(std::unique_ptr<ZoneList> &zones,
                                           unsigned int idx) {
-  auto r =
-      std::accumulate(devices_.begin(), devices_.end(),
-                      static_cast<uint64_t>(0), [&](uint64_t sum, auto &d) {
-                        auto z = d->ListZones();
-                        return sum + d->ZoneStart(z, idx);
-                      });
-  return r;
+  return zbd_zone_start(mergedZone(zones, idx));
 }
 uint64_t Raid0ZonedBlockDevice::ZoneMaxCapacity(
     std::unique_ptr<ZoneList> &zones, unsigned int idx) {
-  // asserts that all devices have the same zone layout
-  auto z = def_dev()->ListZones();
-  return def_dev()->ZoneMaxCapacity(z, idx) * nr_dev();
+  return zbd_zone_capacity(mergedZone(zones, idx));
 }
 uint64_t Raid0ZonedBlockDevice::ZoneWp(std::unique_ptr<ZoneList> &zones,
                                        unsigned int idx) {
-  return std::accumulate(devices_.begin(), devices_.end(),
-                         static_cast<uint64_t>(0), [&](uint64_t sum, auto &d) {
-                           auto z = d->ListZones();
-                           return sum + d->ZoneWp(z, idx);
-                         });
+  return zbd_zone_wp(mergedZone(zones, idx));
 }
 }  // namespace AQUAFS_NAMESPACE
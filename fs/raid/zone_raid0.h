@@ -6,36 +6,62 @@
 #define ROCKSDB_ZONE_RAID0_H
 
 #include <cstdint>
+#include <vector>
 
 #include "zone_raid.h"
 
 namespace AQUAFS_NAMESPACE {
 class Raid0ZonedBlockDevice : public AbstractRaidZonedBlockDevice {
  protected:
-  template <typename T>
-  auto get_idx_block(T pos) const {
-    return pos / static_cast<T>(GetBlockSize());
-  }
-  template <typename T>
-  auto get_idx_dev(T pos) const {
-    return get_idx_dev(pos, nr_dev_t<T>());
-  }
-  template <typename T>
-  auto get_idx_dev(T pos, T m) const {
-    return get_idx_block(pos) % m;
+  // Weighted stripe map. Device d gives dev_zones_[d] of its zones to every
+  // raid zone, in proportion to its capacity, so mixed-capacity members fill
+  // up together. Each of those zones is a lane: lane_dev_[l] / lane_zone_[l]
+  // give the device of lane l and which of the device's zones in the raid
+  // zone it is.
+  // A stripe cycle is cycle_units_ stripe units (see getStripeUnit()), every
+  // lane of device d owns dev_weights_[d] of them, in proportion to the zone
+  // size of d. slot_lane_[u] / slot_off_[u] give the lane of unit u in a
+  // cycle and its unit index inside that lane's share of the cycle.
+  std::vector<uint32_t> dev_zones_{};
+  std::vector<uint32_t> dev_weights_{};
+  std::vector<idx_t> lane_dev_{};
+  std::vector<uint32_t> lane_zone_{};
+  std::vector<idx_t> slot_lane_{};
+  std::vector<uint32_t> slot_off_{};
+  uint64_t cycle_units_{};
+
+  // cap the cycle length so the slot tables stay small
+  static const uint32_t kMaxStripeCycle = 64;
+  // cap the zones one device gives to a raid zone, lowered by Open() so
+  // that the devices can keep kMinActiveZones raid zones active
+  static const uint32_t kMaxDeviceZones = 8;
+  static const uint32_t kMinActiveZones = 6;
+  uint32_t max_device_zones_ = kMaxDeviceZones;
+
+  void buildStripeMap();
+  // capacity of a raid zone given the capacities of its lane zones, whole
+  // stripe cycles only
+  uint64_t stripe_capacity(const std::vector<uint64_t> &lane_capacity) const;
+  // device zone index of lane idx_lane in raid zone idx
+  uint64_t lane_zone(uint64_t idx, size_t idx_lane) const {
+    return idx * dev_zones_[lane_dev_[idx_lane]] + lane_zone_[idx_lane];
   }
-  template <typename T>
-  auto req_pos(T pos) const {
-    auto blk_offset = pos % static_cast<T>(GetBlockSize());
-    return blk_offset +
-           ((pos - blk_offset) / GetBlockSize()) / nr_dev() * GetBlockSize();
+  // device zone start of lane idx_lane in raid zone idx
+  uint64_t lane_zone_start(uint64_t idx, size_t idx_lane) const {
+    return lane_zone(idx, idx_lane) *
+           devices_[lane_dev_[idx_lane]]->GetZoneSize();
   }
+  // translate a raid position to a device position, sets idx_dev
+  uint64_t req_pos(uint64_t pos, size_t *idx_dev) const;
 
  public:
   Raid0ZonedBlockDevice(
       const std::shared_ptr<Logger> &logger,
       std::vector<std::unique_ptr<ZonedBlockDeviceBackend>> &&devices);
 
+  IOStatus Open(bool readonly, bool exclusive, unsigned int *max_active_zones,
+                unsigned int *max_open_zones) override;
+
   std::unique_ptr<ZoneList> ListZones() override;
   IOStatus Reset(uint64_t start, bool *offline,
                  uint64_t *max_capacity) override;
@@ -58,8 +84,17 @@ class Raid0ZonedBlockDevice : public AbstractRaidZonedBlockDevice {
                            unsigned int idx) override;
   uint64_t ZoneWp(std::unique_ptr<ZoneList> &zones, unsigned int idx) override;
 
+  Status setStripeUnit(uint32_t stripe_unit) override;
+
+  [[nodiscard]] uint32_t getDeviceWeight(size_t idx) const override {
+    return idx < dev_weights_.size() ? dev_zones_[idx] * dev_weights_[idx]
+                                     : 0;
+  }
+
  protected:
   void syncBackendInfo() override;
+  [[nodiscard]] bool mixedZoneCountSupported() const override { return true; }
+  [[nodiscard]] bool mixedZoneSizeSupported() const override { return true; }
 };
 }  // namespace AQUAFS_NAMESPACE
 
@@ -260,7 +260,7 @@ int RaidAutoZonedBlockDevice::Read(char *buf, int size, uint64_t pos,
         mapped_pos = getAutoMappedDevicePos(pos);
         auto req_size = std::min(
             size,
-            static_cast<int>(GetBlockSize() - mapped_pos % GetBlockSize()));
+            static_cast<int>(getStripeUnit() - mapped_pos % getStripeUnit()));
         r = devices_[m.device_idx]->Read(buf, req_size, mapped_pos, direct);
         // Info(
         //     logger_,
@@ -381,8 +381,8 @@ int RaidAutoZonedBlockDevice::Write(char *data, uint32_t size, uint64_t pos) {
         //        m.zone_idx, mapped_pos, size);
         // }
         auto req_size =
-            std::min(size, static_cast<uint32_t>(GetBlockSize() -
-                                                 mapped_pos % GetBlockSize()));
+            std::min(size, static_cast<uint32_t>(getStripeUnit() -
+                                                 mapped_pos % getStripeUnit()));
         r = devices_[m.device_idx]->Write(data, req_size, mapped_pos);
         // Info(logger_,
         //      "RAID-A: [written=%x] WRITE raid0 mapping pos=%lx to "
@@ -405,6 +405,26 @@ int RaidAutoZonedBlockDevice::Write(char *data, uint32_t size, uint64_t pos) {
   return -1;
 }
 
+uint32_t RaidAutoZonedBlockDevice::GetRaidModeAt(uint64_t pos) {
+  auto f = allocator.mode_map_.find(pos / zone_sz_);
+  if (f == allocator.mode_map_.end()) return static_cast<uint32_t>(main_mode_);
+  return static_cast<uint32_t>(f->second.mode);
+}
+
+int RaidAutoZonedBlockDevice::GetNumaNodeAt(uint64_t pos) {
+  // zones in concat mode live on one device, the others are spread
+  auto f = allocator.mode_map_.find(pos / zone_sz_);
+  if (f == allocator.mode_map_.end() ||
+      !(f->second.mode == RaidMode::RAID_C ||
+        f->second.mode == RaidMode::RAID_NONE))
+    return AbstractRaidZonedBlockDevice::GetNumaNodeAt(pos);
+  auto m = allocator.device_zone_map_.find(getAutoDeviceZoneIdx(pos));
+  if (m == allocator.device_zone_map_.end() || m->second.empty())
+    return AbstractRaidZonedBlockDevice::GetNumaNodeAt(pos);
+  return devices_[m->second[0].device_idx]->GetNumaNodeAt(
+      getAutoMappedDevicePos(pos));
+}
+
 int RaidAutoZonedBlockDevice::InvalidateCache(uint64_t pos, uint64_t size) {
   // Debug(logger_, "InvalidateCache(pos=%lx, sz=%lx)", pos, size);
   assert(size % zone_sz_ == 0);
@@ -513,6 +533,8 @@ void RaidAutoZonedBlockDevice::flush_zone_info() {
     // Debug(logger_, "flush_zone_info: zone %x is raid%s", idx,
     //      raid_mode_str(mode_item.mode));
     std::unique_ptr<ZoneList> zone_list = nullptr;
+    // the device zone the condition of the raid zone is taken from
+    RaidMapItem cond_item{};
     auto p = a_zones_.get();
     p[idx].start = idx * zone_sz_;
     if (mode_item.mode == RaidMode::RAID_NONE ||
@@ -524,6 +546,7 @@ void RaidAutoZonedBlockDevice::flush_zone_info() {
             getAutoDeviceZone(idx * zone_sz_ + i * def_dev()->GetZoneSize());
       auto map_item = map_items.front();
       zone_list = devices_[map_item.device_idx]->ListZones();
+      cond_item = map_item;
       uint64_t wp = std::accumulate(
           map_items.begin(), map_items.end(), static_cast<uint64_t>(0),
           [&](uint64_t sum, auto &item) {
@@ -552,6 +575,7 @@ void RaidAutoZonedBlockDevice::flush_zone_info() {
         auto m = fm->second;
         auto mm = m[0];
         zone_list = devices_[mm.device_idx]->ListZones();
+        cond_item = mm;
         auto c = devices_[mm.device_idx]->ZoneWp(zone_list, mm.zone_idx) -
                  devices_[mm.device_idx]->ZoneStart(zone_list, mm.zone_idx);
         // if (c > 0) {
@@ -563,13 +587,11 @@ void RaidAutoZonedBlockDevice::flush_zone_info() {
       }
       p[idx].wp = p[idx].start + cnt;
     }
-    raid_zone_t *zone_list_ptr =
-        reinterpret_cast<raid_zone_t *>(zone_list->GetData());
-    // FIXME: ZoneFS
-    p[idx].flags = zone_list_ptr->flags;
-    p[idx].type = zone_list_ptr->type;
-    p[idx].cond = zone_list_ptr->cond;
-    memcpy(p[idx].reserved, zone_list_ptr->reserved, sizeof(p[idx].reserved));
+    raid_zone_t z;
+    decodeZone(cond_item.device_idx, zone_list, cond_item.zone_idx, &z);
+    p[idx].flags = z.flags;
+    p[idx].type = z.type;
+    p[idx].cond = z.cond;
     // p[idx].capacity = devices_[map_item.device_idx]->ZoneMaxCapacity(
     //                       zone_list, map_item.zone_idx) *
     //                   nr_dev();
@@ -614,13 +636,13 @@ T RaidAutoZonedBlockDevice::getAutoMappedDevicePos(T pos) {
   //   return pos;
   // } else
   if (mode_item.mode == RaidMode::RAID0) {
+    T su = getStripeUnit();
     auto base = map_item.zone_idx * def_dev()->GetZoneSize();
-    auto nr_blk_in_raid_zone = zone_sz_ / block_sz_;
-    auto blk_idx_raid_zone = blk_idx % nr_blk_in_raid_zone;
-    auto blk_idx_dev_zone = blk_idx_raid_zone / nr_dev();
-    auto offset_in_blk = pos % block_sz_;
-    auto offset_in_zone = blk_idx_dev_zone * block_sz_;
-    return base + offset_in_zone + offset_in_blk;
+    auto unit_idx_raid_zone = (pos % zone_sz_) / su;
+    auto unit_idx_dev_zone = unit_idx_raid_zone / nr_dev();
+    auto offset_in_unit = pos % su;
+    auto offset_in_zone = unit_idx_dev_zone * su;
+    return base + offset_in_zone + offset_in_unit;
   } else if (mode_item.mode == RaidMode::RAID1) {
     // FIXME
     return map_item.zone_idx * def_dev()->GetZoneSize() + pos % zone_sz_;
@@ -654,7 +676,9 @@ idx_t RaidAutoZonedBlockDevice::getAutoDeviceZoneIdx(T pos) {
   } else if (mode_item.mode == RaidMode::RAID0) {
     // Info(logger_, "\t[pos=%x] raid_zone_idx=%lx raid_zone_block_idx = %lx",
     //      static_cast<uint32_t>(pos), raid_zone_idx, raid_zone_block_idx);
-    return raid_zone_idx * nr_dev() + raid_zone_block_idx % nr_dev();
+    auto raid_zone_unit_idx =
+        raid_zone_block_idx / (getStripeUnit() / block_sz_);
+    return raid_zone_idx * nr_dev() + raid_zone_unit_idx % nr_dev();
   }
   Warn(logger_, "Cannot locate device zone at pos=%x",
        static_cast<uint32_t>(pos));
@@ -758,7 +782,9 @@ Status RaidAutoZonedBlockDevice::ScanAndHandleOffline() {
         assert(wp >= start);
         auto sz = wp - start;
         char *buf = nullptr;
-        if (posix_memalign((void **)(&buf), getpagesize(), sz)) {
+        int node = devices_[restoring->device_idx]->GetNumaNodeAt(
+            restoring->zone_idx * zone_sz_ / nr_dev());
+        if (numa_aligned_alloc((void **)(&buf), getpagesize(), sz, node)) {
           return Status::IOError("Allocate memory failed!");
         }
         auto read_sz = devices_[fine->device_idx]->Read(
@@ -767,7 +793,7 @@ Status RaidAutoZonedBlockDevice::ScanAndHandleOffline() {
         if (read_sz < 0) {
           Error(logger_, "Cannot read data from dev %x zone %x, sz=%lx",
                 fine->device_idx, fine->zone_idx, sz);
-          free(buf);
+          numa_aligned_free(buf, sz, node);
           return Status::IOError("Cannot recover data");
         }
         // restore data
@@ -791,10 +817,10 @@ Status RaidAutoZonedBlockDevice::ScanAndHandleOffline() {
         if (static_cast<decltype(sz)>(written) != sz) {
           Error(logger_, "Cannot write restored data! written=%x, cause: %s",
                 written, strerror(errno));
-          free(buf);
+          numa_aligned_free(buf, sz, node);
           return Status::IOError("Cannot recover data");
         } else {
-          free(buf);
+          numa_aligned_free(buf, sz, node);
         }
       }
     } else {
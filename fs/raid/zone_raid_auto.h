@@ -44,6 +44,8 @@ class RaidAutoZonedBlockDevice : public AbstractRaidZonedBlockDevice {
   int Read(char *buf, int size, uint64_t pos, bool direct) override;
   int Write(char *data, uint32_t size, uint64_t pos) override;
   int InvalidateCache(uint64_t pos, uint64_t size) override;
+  uint32_t GetRaidModeAt(uint64_t pos) override;
+  int GetNumaNodeAt(uint64_t pos) override;
   bool ZoneIsSwr(std::unique_ptr<ZoneList> &zones, idx_t idx) override;
   bool ZoneIsOffline(std::unique_ptr<ZoneList> &zones, idx_t idx) override;
   bool ZoneIsWritable(std::unique_ptr<ZoneList> &zones, idx_t idx) override;
@@ -79,9 +81,16 @@ class RaidInfoBasic {
   uint32_t dev_block_size = 0; /* in bytes */
   uint32_t dev_zone_size = 0;  /* in blocks */
   uint32_t dev_nr_zones = 0;   /* in one device */
+  // extension: stripe units per device in one stripe cycle, all zero for
+  // layouts that are not weighted (and for filesystems created before)
+  static const uint32_t kMaxWeightedDevices = 16;
+  uint32_t dev_weights[kMaxWeightedDevices] = {0};
+  // extension: striping granularity in bytes, 0 means the device block size
+  uint32_t stripe_unit = 0;
 
   void load(ZonedBlockDevice *zbd) {
-    assert(sizeof(RaidInfoBasic) == sizeof(uint32_t) * 5);
+    assert(sizeof(RaidInfoBasic) ==
+           sizeof(uint32_t) * (6 + kMaxWeightedDevices));
     if (zbd->IsRAIDEnabled()) {
       auto be =
           dynamic_cast<AbstractRaidZonedBlockDevice *>(zbd->getBackend().get());
@@ -91,9 +100,24 @@ class RaidInfoBasic {
       dev_block_size = be->def_dev()->GetBlockSize();
       dev_zone_size = be->def_dev()->GetZoneSize();
       dev_nr_zones = be->def_dev()->GetNrZones();
+      for (uint32_t i = 0; i < nr_devices && i < kMaxWeightedDevices; i++)
+        dev_weights[i] = be->getDeviceWeight(i);
+      stripe_unit = be->getStripeUnit();
     }
   }
 
+  // configure the backend with the layout recorded at mkfs, must be called
+  // before reading anything but the superblock itself
+  Status apply(ZonedBlockDevice *zbd) const {
+    if (!zbd->IsRAIDEnabled()) return Status::OK();
+    auto be =
+        dynamic_cast<AbstractRaidZonedBlockDevice *>(zbd->getBackend().get());
+    if (!be) return Status::NotSupported("RAID Error", "cannot cast pointer");
+    if (be->getStripeUnit() == stripe_unit || stripe_unit == 0)
+      return Status::OK();
+    return be->setStripeUnit(stripe_unit);
+  }
+
   Status compatible(ZonedBlockDevice *zbd) const {
     if (!zbd->IsRAIDEnabled()) return Status::OK();
     auto be =
@@ -112,6 +136,14 @@ class RaidInfoBasic {
       return Status::Corruption("RAID Error", "dev_zone_size mismatch");
     if (dev_nr_zones != be->def_dev()->GetNrZones())
       return Status::Corruption("RAID Error", "dev_nr_zones mismatch");
+    for (uint32_t i = 0; i < nr_devices && i < kMaxWeightedDevices; i++) {
+      // zero: recorded before weighted striping, layout is round-robin
+      auto w = dev_weights[i] ? dev_weights[i] : 1;
+      if (be->getDeviceWeight(i) && w != be->getDeviceWeight(i))
+        return Status::Corruption("RAID Error",
+                                  "stripe weight mismatch on device " +
+                                      std::to_string(i));
+    }
     return Status::OK();
   }
 };
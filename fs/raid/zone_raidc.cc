@@ -4,6 +4,7 @@
 
 #include "zone_raidc.h"
 
+#include <algorithm>
 #include <cstdint>
 namespace AQUAFS_NAMESPACE {
 RaidCZonedBlockDevice::RaidCZonedBlockDevice(
@@ -14,193 +15,159 @@ RaidCZonedBlockDevice::RaidCZonedBlockDevice(
 void RaidCZonedBlockDevice::syncBackendInfo() {
   AbstractRaidZonedBlockDevice::syncBackendInfo();
   nr_zones_ = total_nr_devices_zones_;
+  dev_offset_.assign(1, 0);
+  uniform_dev_sz_ = def_dev()->GetNrZones() * def_dev()->GetZoneSize();
+  for (auto &&d : devices_) {
+    auto sz = d->GetNrZones() * d->GetZoneSize();
+    if (sz != uniform_dev_sz_) uniform_dev_sz_ = 0;
+    dev_offset_.emplace_back(dev_offset_.back() + sz);
+  }
+}
+size_t RaidCZonedBlockDevice::get_idx_dev(uint64_t pos) const {
+  if (dev_offset_.empty() || pos >= dev_offset_.back()) return nr_dev();
+  if (uniform_dev_sz_) return pos / uniform_dev_sz_;
+  auto it = std::upper_bound(dev_offset_.begin(), dev_offset_.end(), pos);
+  return std::distance(dev_offset_.begin(), it) - 1;
 }
 std::unique_ptr<ZoneList> RaidCZonedBlockDevice::ListZones() {
   std::vector<std::unique_ptr<ZoneList>> list;
   for (auto &&dev : devices_) {
     auto zones = dev->ListZones();
-    if (zones) {
-      list.emplace_back(std::move(zones));
-    }
+    // a missing member would shift the zones of the ones after it
+    if (!zones) return nullptr;
+    list.emplace_back(std::move(zones));
   }
   // merge zones
   auto nr_zones = std::accumulate(
       list.begin(), list.end(), 0,
       [](int sum, auto &zones) { return sum + zones->ZoneCount(); });
-  auto data = new struct zbd_zone[nr_zones];
+  auto data = new raid_zone_t[nr_zones];
   auto ptr = data;
-  for (auto &&zones : list) {
+  uint64_t base = 0;
+  for (size_t i = 0; i < list.size(); i++) {
+    auto &&zones = list[i];
     auto nr = zones->ZoneCount();
-    memcpy(ptr, zones->GetData(), sizeof(struct zbd_zone) * nr);
+    for (decltype(nr) j = 0; j < nr; j++) {
+      decodeZone(i, zones, j, &ptr[j]);
+      // rebase device-local positions into the concatenated address space
+      ptr[j].start += base;
+      ptr[j].wp += base;
+    }
     ptr += nr;
+    base += devices_[i]->GetNrZones() * devices_[i]->GetZoneSize();
   }
   return std::make_unique<ZoneList>(data, nr_zones);
 }
 IOStatus RaidCZonedBlockDevice::Reset(uint64_t start, bool *offline,
                                       uint64_t *max_capacity) {
-  for (auto &&d : devices_) {
-    auto sz = d->GetNrZones() * d->GetZoneSize();
-    if (sz > start) {
-      return d->Reset(start, offline, max_capacity);
-    } else {
-      start -= sz;
-    }
-  }
-  return IOStatus::IOError();
+  auto idx = get_idx_dev(start);
+  if (idx >= nr_dev()) return IOStatus::IOError();
+  return devices_[idx]->Reset(start - dev_offset_[idx], offline, max_capacity);
 }
 IOStatus RaidCZonedBlockDevice::Finish(uint64_t start) {
-  for (auto &&d : devices_) {
-    auto sz = d->GetNrZones() * d->GetZoneSize();
-    if (sz > start) {
-      return d->Finish(start);
-    } else {
-      start -= sz;
-    }
-  }
-  return unsupported;
+  auto idx = get_idx_dev(start);
+  if (idx >= nr_dev()) return unsupported;
+  return devices_[idx]->Finish(start - dev_offset_[idx]);
 }
 IOStatus RaidCZonedBlockDevice::Close(uint64_t start) {
-  for (auto &&d : devices_) {
-    auto sz = d->GetNrZones() * d->GetZoneSize();
-    if (sz > start) {
-      return d->Close(start);
-    } else {
-      start -= sz;
-    }
-  }
-  return unsupported;
+  auto idx = get_idx_dev(start);
+  if (idx >= nr_dev()) return unsupported;
+  return devices_[idx]->Close(start - dev_offset_[idx]);
 }
 int RaidCZonedBlockDevice::Read(char *buf, int size, uint64_t pos,
                                 bool direct) {
-  for (auto &&d : devices_) {
-    auto sz = d->GetNrZones() * d->GetZoneSize();
-    if (sz > pos) {
-      return d->Read(buf, size, pos, direct);
+  // split requests crossing a device boundary into per-device sub-requests
+  int sz_read = 0;
+  int r;
+  while (size > 0) {
+    auto idx = get_idx_dev(pos);
+    if (idx >= nr_dev()) return sz_read ? sz_read : -1;
+    auto req_size = static_cast<int>(
+        std::min(static_cast<uint64_t>(size), dev_remaining(idx, pos)));
+    r = devices_[idx]->Read(buf, req_size, pos - dev_offset_[idx], direct);
+    if (r > 0) {
+      size -= r;
+      sz_read += r;
+      buf += r;
+      pos += r;
     } else {
-      pos -= sz;
+      return sz_read ? sz_read : r;
     }
   }
-  return -1;
+  return sz_read;
 }
 int RaidCZonedBlockDevice::Write(char *data, uint32_t size, uint64_t pos) {
-  for (auto &&d : devices_) {
-    auto sz = d->GetNrZones() * d->GetZoneSize();
-    if (sz > pos) {
-      return d->Write(data, size, pos);
+  int sz_written = 0;
+  int r;
+  while (size > 0) {
+    auto idx = get_idx_dev(pos);
+    if (idx >= nr_dev()) return sz_written ? sz_written : -1;
+    auto req_size = static_cast<uint32_t>(
+        std::min(static_cast<uint64_t>(size), dev_remaining(idx, pos)));
+    r = devices_[idx]->Write(data, req_size, pos - dev_offset_[idx]);
+    if (r > 0) {
+      size -= r;
+      sz_written += r;
+      data += r;
+      pos += r;
     } else {
-      pos -= sz;
+      return sz_written ? sz_written : r;
     }
   }
-  return -1;
+  return sz_written;
 }
-int RaidCZonedBlockDevice::InvalidateCache(uint64_t pos, uint64_t size) {
-  for (auto &&d : devices_) {
-    auto sz = d->GetNrZones() * d->GetZoneSize();
-    if (sz > pos) {
-      return d->InvalidateCache(pos, size);
-    } else {
-      pos -= sz;
-    }
-  }
-  return 0;
+int RaidCZonedBlockDevice::GetNumaNodeAt(uint64_t pos) {
+  auto idx = get_idx_dev(pos);
+  if (idx >= nr_dev()) return -1;
+  return devices_[idx]->GetNumaNodeAt(pos - dev_offset_[idx]);
 }
+int RaidCZonedBlockDevice::InvalidateCache(uint64_t pos, uint64_t size) {
+  int r = 0;
+  while (size > 0) {
+    auto idx = get_idx_dev(pos);
+    if (idx >= nr_dev()) break;
+    auto req_size = std::min(size, dev_remaining(idx, pos));
+    r = devices_[idx]->InvalidateCache(pos - dev_offset_[idx], req_size);
+    size -= req_size;
+    pos += req_size;
+  }
+  return r;
+}
+// The zone list handed in is the merged table built by ListZones(), which
+// keeps the layout of the default device, so it can decode every entry.
 bool RaidCZonedBlockDevice::ZoneIsSwr(std::unique_ptr<ZoneList> &zones,
                                       unsigned int idx) {
-  for (auto &&d : devices_) {
-    if (d->GetNrZones() > idx) {
-      auto z = d->ListZones();
-      return d->ZoneIsSwr(z, idx);
-    } else {
-      idx -= d->GetNrZones();
-    }
-  }
-  return false;
+  return zbd_zone_swr(mergedZone(zones, idx));
 }
 bool RaidCZonedBlockDevice::ZoneIsOffline(std::unique_ptr<ZoneList> &zones,
                                           unsigned int idx) {
-  for (auto &&d : devices_) {
-    if (d->GetNrZones() > idx) {
-      // FIXME: optimize list-zones
-      auto z = d->ListZones();
-      return d->ZoneIsOffline(z, idx);
-    } else {
-      idx -= d->GetNrZones();
-    }
-  }
-  return false;
+  return zbd_zone_offline(mergedZone(zones, idx));
 }
 bool RaidCZonedBlockDevice::ZoneIsWritable(std::unique_ptr<ZoneList> &zones,
                                            unsigned int idx) {
-  for (auto &&d : devices_) {
-    if (d->GetNrZones() > idx) {
-      auto z = d->ListZones();
-      return d->ZoneIsWritable(z, idx);
-    } else {
-      idx -= d->GetNrZones();
-    }
-  }
-  return false;
+  auto z = mergedZone(zones, idx);
+  return !(zbd_zone_full(z) || zbd_zone_offline(z) || zbd_zone_rdonly(z));
 }
 bool RaidCZonedBlockDevice::ZoneIsActive(std::unique_ptr<ZoneList> &zones,
                                          unsigned int idx) {
-  for (auto &&d : devices_) {
-    if (d->GetNrZones() > idx) {
-      auto z = d->ListZones();
-      return d->ZoneIsActive(z, idx);
-    } else {
-      idx -= d->GetNrZones();
-    }
-  }
-  return false;
+  auto z = mergedZone(zones, idx);
+  return zbd_zone_imp_open(z) || zbd_zone_exp_open(z) || zbd_zone_closed(z);
 }
 bool RaidCZonedBlockDevice::ZoneIsOpen(std::unique_ptr<ZoneList> &zones,
                                        unsigned int idx) {
-  for (auto &&d : devices_) {
-    if (d->GetNrZones() > idx) {
-      auto z = d->ListZones();
-      return d->ZoneIsOpen(z, idx);
-    } else {
-      idx -= d->GetNrZones();
-    }
-  }
-  return false;
+  auto z = mergedZone(zones, idx);
+  return zbd_zone_imp_open(z) || zbd_zone_exp_open(z);
 }
 uint64_t RaidCZonedBlockDevice::ZoneStart(std::unique_ptr<ZoneList> &zones,
                                           unsigned int idx) {
-  for (auto &&d : devices_) {
-    if (d->GetNrZones() > idx) {
-      auto z = d->ListZones();
-      // FIXME: is it right?
-      return d->ZoneStart(z, idx);
-    } else {
-      idx -= d->GetNrZones();
-    }
-  }
-  return 0;
+  return zbd_zone_start(mergedZone(zones, idx));
 }
 uint64_t RaidCZonedBlockDevice::ZoneMaxCapacity(
     std::unique_ptr<ZoneList> &zones, unsigned int idx) {
-  for (auto &&d : devices_) {
-    if (d->GetNrZones() > idx) {
-      auto z = d->ListZones();
-      return d->ZoneMaxCapacity(z, idx);
-    } else {
-      idx -= d->GetNrZones();
-    }
-  }
-  return 0;
+  return zbd_zone_capacity(mergedZone(zones, idx));
 }
 uint64_t RaidCZonedBlockDevice::ZoneWp(std::unique_ptr<ZoneList> &zones,
                                        unsigned int idx) {
-  for (auto &&d : devices_) {
-    if (d->GetNrZones() > idx) {
-      auto z = d->ListZones();
-      // FIXME: is it right?
-      return d->ZoneWp(z, idx);
-    } else {
-      idx -= d->GetNrZones();
-    }
-  }
-  return 0;
+  return zbd_zone_wp(mergedZone(zones, idx));
 }
-}  // namespace AQUAFS_NAMESPACE
\ No newline at end of file
+}  // namespace AQUAFS_NAMESPACE
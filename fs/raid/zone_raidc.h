@@ -6,6 +6,7 @@
 #define ROCKSDB_ZONE_RAIDC_H
 
 #include <cstdint>
+#include <vector>
 
 #include "zone_raid.h"
 
@@ -23,6 +24,7 @@ class RaidCZonedBlockDevice : public AbstractRaidZonedBlockDevice {
   int Read(char *buf, int size, uint64_t pos, bool direct) override;
   int Write(char *data, uint32_t size, uint64_t pos) override;
   int InvalidateCache(uint64_t pos, uint64_t size) override;
+  int GetNumaNodeAt(uint64_t pos) override;
   bool ZoneIsSwr(std::unique_ptr<ZoneList> &zones, unsigned int idx) override;
   bool ZoneIsOffline(std::unique_ptr<ZoneList> &zones,
                      unsigned int idx) override;
@@ -39,6 +41,23 @@ class RaidCZonedBlockDevice : public AbstractRaidZonedBlockDevice {
 
  protected:
   void syncBackendInfo() override;
+  // devices are concatenated, so any zone count works; zones are still
+  // addressed by one zone size
+  [[nodiscard]] bool mixedZoneCountSupported() const override { return true; }
+
+ private:
+  // dev_offset_[i] is the first raid position served by devices_[i], the last
+  // element is the total size; filled by syncBackendInfo()
+  std::vector<uint64_t> dev_offset_{};
+  // non-zero when all devices have the same size, routing is then a division
+  uint64_t uniform_dev_sz_{};
+
+  // find the device serving raid position pos, returns nr_dev() if out of
+  // range
+  size_t get_idx_dev(uint64_t pos) const;
+  uint64_t dev_remaining(size_t idx, uint64_t pos) const {
+    return dev_offset_[idx + 1] - pos;
+  }
 };
 }  // namespace AQUAFS_NAMESPACE
 
@@ -35,6 +35,13 @@ class ZBDSnapshot {
   uint64_t free_space;
   uint64_t used_space;
   uint64_t reclaimable_space;
+  uint64_t zone_resets;
+  uint64_t zone_reset_failures;
+  uint64_t zone_finishes;
+  uint64_t finish_wasted_bytes;
+  uint64_t zone_finish_failures;
+  uint64_t numa_remote_bytes;
+  AquaFSWriteStatsSnapshot write_stats;
 
  public:
   ZBDSnapshot() = default;
@@ -43,7 +50,14 @@ class ZBDSnapshot {
   explicit ZBDSnapshot(ZonedBlockDevice& zbd)
       : free_space(zbd.GetFreeSpace()),
         used_space(zbd.GetUsedSpace()),
-        reclaimable_space(zbd.GetReclaimableSpace()) {}
+        reclaimable_space(zbd.GetReclaimableSpace()),
+        zone_resets(zbd.GetZoneResets()),
+        zone_reset_failures(zbd.GetZoneResetFailures()),
+        zone_finishes(zbd.GetZoneFinishes()),
+        finish_wasted_bytes(zbd.GetFinishWastedBytes()),
+        zone_finish_failures(zbd.GetZoneFinishFailures()),
+        numa_remote_bytes(zbd.GetNumaRemoteBytes()),
+        write_stats(zbd.GetWriteStats()) {}
 };
 
 class ZoneSnapshot {
@@ -54,6 +68,9 @@ class ZoneSnapshot {
   uint64_t capacity;
   uint64_t used_capacity;
   uint64_t max_capacity;
+  Env::WriteLifeTimeHint lifetime;
+  // bytes written since mount, by WriteKind
+  uint64_t written[(uint32_t)WriteKind::kMax];
 
  public:
   ZoneSnapshot(const Zone& zone)
@@ -61,7 +78,11 @@ class ZoneSnapshot {
         wp(zone.wp_),
         capacity(zone.capacity_),
         used_capacity(zone.used_capacity_),
-        max_capacity(zone.max_capacity_) {}
+        max_capacity(zone.max_capacity_),
+        lifetime(zone.lifetime_) {
+    for (uint32_t k = 0; k < (uint32_t)WriteKind::kMax; k++)
+      written[k] = zone.written_[k].load(std::memory_order_relaxed);
+  }
 };
 
 class ZoneExtentSnapshot {
@@ -0,0 +1,82 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && !defined(OS_WIN)
+
+#include "token_aquafs.h"
+
+#include <algorithm>
+
+namespace AQUAFS_NAMESPACE {
+
+ZoneTokenClass zone_token_class(Env::WriteLifeTimeHint lifetime,
+                                IOType io_type) {
+  if (io_type == IOType::kWAL) return ZoneTokenClass::kWAL;
+  // L0 flushes have lifetime MEDIUM
+  if (lifetime == Env::WLTH_MEDIUM) return ZoneTokenClass::kFlush;
+  return ZoneTokenClass::kCompaction;
+}
+
+void ZoneTokenPool::Reset(long limit, long reserve) {
+  limit_ = limit;
+  /* Keep at least one token for everybody */
+  reserve_ = std::max(0L, std::min(reserve, limit - 1));
+  used_ = 0;
+}
+
+bool ZoneTokenPool::TryTake(long class_limit) {
+  long used = used_.load();
+  while (used < class_limit) {
+    if (used_.compare_exchange_weak(used, used + 1)) return true;
+  }
+  return false;
+}
+
+bool ZoneTokenPool::TryGet(ZoneTokenClass cls) {
+  return TryTake(ClassLimit(cls));
+}
+
+void ZoneTokenPool::Get(ZoneTokenClass cls) {
+  /* Don't overtake anyone already waiting */
+  if (nr_waiters_.load() == 0 && TryTake(ClassLimit(cls))) return;
+
+  std::unique_lock<std::mutex> lk(mtx_);
+  /* Announce ourselves before queueing, a Put() that misses us has already
+   * given back its token and Grant() below will find it */
+  nr_waiters_++;
+  Waiter w;
+  waiters_[(uint32_t)cls].push_back(&w);
+  Grant();
+  if (!w.granted) waits_++;
+  w.cv.wait(lk, [&w] { return w.granted; });
+  nr_waiters_--;
+}
+
+void ZoneTokenPool::Put() {
+  used_--;
+  if (nr_waiters_.load() == 0) return;
+
+  std::lock_guard<std::mutex> lk(mtx_);
+  Grant();
+}
+
+void ZoneTokenPool::Grant() {
+  for (uint32_t c = 0; c < (uint32_t)ZoneTokenClass::kMax; c++) {
+    auto &q = waiters_[c];
+    while (!q.empty() && TryTake(ClassLimit((ZoneTokenClass)c))) {
+      Waiter *w = q.front();
+      q.pop_front();
+      w->granted = true;
+      w->cv.notify_one();
+    }
+    /* Later classes wait behind this one */
+    if (!q.empty()) return;
+  }
+}
+
+}  // namespace AQUAFS_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && !defined(OS_WIN)
@@ -0,0 +1,93 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+#include "aquafs_namespace.h"
+#include "rocksdb/env.h"
+#include "rocksdb/file_system.h"
+#include "rocksdb/rocksdb_namespace.h"
+
+namespace AQUAFS_NAMESPACE {
+using namespace ROCKSDB_NAMESPACE;
+
+/* Who is waiting for a zone token, waiters of a lower class are served
+ * first */
+enum class ZoneTokenClass : uint32_t {
+  kWAL = 0,
+  kFlush,
+  kCompaction,
+  kMax,
+};
+
+/* Class of a writer from what RocksDB tells the file system about the file.
+ * RocksDB does not say whether an SST comes from a flush or a compaction, so
+ * a non-WAL file with the WLTH_MEDIUM hint is taken for a flush: with level
+ * compaction RocksDB gives it to L0 files. An intra-L0 compaction gets the
+ * flush class too, and with other compaction styles, where SSTs are not
+ * hinted, flushes get the compaction class. Pass the hint of RocksDB, not a
+ * predicted lifetime. */
+ZoneTokenClass zone_token_class(Env::WriteLifeTimeHint lifetime,
+                                IOType io_type);
+
+/* Counting semaphore for open and active zone tokens.
+ *
+ * Tokens are taken with a CAS on the counter while nobody is queued. Once a
+ * taker has to wait it is queued FIFO in its class, and returned tokens are
+ * handed straight to the first waiter that may use them so that no waiter
+ * is woken up just to find the token gone. All classes but kWAL leave
+ * `reserve` tokens unused, so a WAL is never starved by flushes and
+ * compactions. */
+class ZoneTokenPool {
+ public:
+  void Reset(long limit, long reserve);
+
+  /* Takes a token if one is free for the class, never blocks */
+  bool TryGet(ZoneTokenClass cls);
+  /* Takes a token, waiting in line for one if needed */
+  void Get(ZoneTokenClass cls);
+  void Put();
+  /* Counts a token held since before the pool was in use */
+  void Add() { used_.fetch_add(1); }
+
+  long Used() const { return used_.load(std::memory_order_relaxed); }
+  long Limit() const { return limit_; }
+  uint64_t Waits() const { return waits_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Waiter {
+    std::condition_variable cv;
+    bool granted = false;
+  };
+
+  long ClassLimit(ZoneTokenClass cls) const {
+    return cls == ZoneTokenClass::kWAL ? limit_ : limit_ - reserve_;
+  }
+  bool TryTake(long class_limit);
+  /* Hands free tokens to the waiters, mtx_ held */
+  void Grant();
+
+  std::atomic<long> used_{0};
+  std::atomic<long> nr_waiters_{0};
+  std::atomic<uint64_t> waits_{0};
+  long limit_ = 0;
+  long reserve_ = 0;
+
+  std::mutex mtx_;
+  std::deque<Waiter *> waiters_[(uint32_t)ZoneTokenClass::kMax];
+};
+
+}  // namespace AQUAFS_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
@@ -0,0 +1,314 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && !defined(OS_WIN)
+
+#include "trace_aquafs.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include "metrics.h"
+#include "zbd_aquafs.h"
+
+namespace AQUAFS_NAMESPACE {
+
+static const char kTraceMagic[8] = {'A', 'Q', 'F', 'S', 'T', 'R', 'C', '1'};
+static const uint32_t kTraceVersion = 2;
+
+struct AquaFSTraceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t count;
+};
+
+const char *trace_event_str(TraceEvent event) {
+  switch (event) {
+    case TraceEvent::kZoneAlloc:
+      return "zone_alloc";
+    case TraceEvent::kZoneFinish:
+      return "zone_finish";
+    case TraceEvent::kZoneReset:
+      return "zone_reset";
+    case TraceEvent::kExtentPush:
+      return "extent_push";
+    case TraceEvent::kMetaRecord:
+      return "meta_record";
+    case TraceEvent::kGCMigrate:
+      return "gc_migrate";
+    case TraceEvent::kRead:
+      return "read";
+    case TraceEvent::kWrite:
+      return "write";
+    case TraceEvent::kFileWrite:
+      return "file_write";
+    case TraceEvent::kFileClose:
+      return "file_close";
+    case TraceEvent::kFileDelete:
+      return "file_delete";
+    default:
+      return "unknown";
+  }
+}
+
+AquaFSTracer &AquaFSTracer::Get() {
+  static AquaFSTracer tracer;
+  return tracer;
+}
+
+void AquaFSTracer::Enable(uint32_t ring_size) {
+  ring_size_.store(ring_size, std::memory_order_relaxed);
+}
+
+uint64_t AquaFSTracer::Now() const {
+  return IsEnabled() ? AquaFSMetricsClock::NowMicros() : 0;
+}
+
+AquaFSTracer::Ring *AquaFSTracer::ThreadRing() {
+  thread_local Ring *ring = nullptr;
+  if (ring != nullptr) return ring;
+
+  uint32_t size = ring_size_.load(std::memory_order_relaxed);
+  if (size == 0) return nullptr;
+
+  /* Rings outlive their threads so that their records can still be dumped */
+  std::lock_guard<std::mutex> lock(rings_mtx_);
+  Ring *r = new Ring();
+  r->records.reset(new AquaFSTraceRecord[size]);
+  r->size = size;
+  r->thread = (uint32_t)rings_.size();
+  rings_.emplace_back(r);
+  ring = r;
+  return ring;
+}
+
+void AquaFSTracer::Record(TraceEvent event, uint32_t id, uint64_t pos,
+                          uint64_t size, uint64_t latency_us,
+                          uint8_t lifetime, uint8_t io_type) {
+  Ring *ring = ThreadRing();
+  if (ring == nullptr) return;
+
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  AquaFSTraceRecord &rec = ring->records[head % ring->size];
+  rec.ts_us = AquaFSMetricsClock::NowMicros();
+  rec.pos = pos;
+  rec.size = (uint32_t)std::min<uint64_t>(size, UINT32_MAX);
+  rec.latency_us = (uint32_t)std::min<uint64_t>(latency_us, UINT32_MAX);
+  rec.id = id;
+  rec.event = (uint8_t)event;
+  rec.lifetime = lifetime;
+  rec.io_type = io_type;
+  rec.thread = ring->thread;
+  memset(rec.reserved, 0, sizeof(rec.reserved));
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+std::vector<AquaFSTraceRecord> AquaFSTracer::Collect() {
+  std::vector<AquaFSTraceRecord> records;
+  std::lock_guard<std::mutex> lock(rings_mtx_);
+
+  for (const auto &ring : rings_) {
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t first = head > ring->size ? head - ring->size : 0;
+    size_t start = records.size();
+    for (uint64_t i = first; i < head; i++) {
+      records.push_back(ring->records[i % ring->size]);
+    }
+
+    /* Drop what the owning thread overwrote while we were copying, the slot
+     * of the record it is writing now included */
+    uint64_t now = ring->head.load(std::memory_order_acquire);
+    uint64_t valid = now >= ring->size ? now - ring->size + 1 : 0;
+    if (valid > first) {
+      uint64_t drop = std::min(valid - first, head - first);
+      records.erase(records.begin() + start, records.begin() + start + drop);
+    }
+  }
+
+  std::stable_sort(records.begin(), records.end(),
+                   [](const AquaFSTraceRecord &a, const AquaFSTraceRecord &b) {
+                     return a.ts_us < b.ts_us;
+                   });
+  return records;
+}
+
+IOStatus AquaFSTracer::Dump(const std::string &path) {
+  std::vector<AquaFSTraceRecord> records = Collect();
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out.is_open())
+    return IOStatus::IOError("Failed to open trace file: " + path);
+
+  AquaFSTraceHeader header;
+  memcpy(header.magic, kTraceMagic, sizeof(header.magic));
+  header.version = kTraceVersion;
+  header.record_size = sizeof(AquaFSTraceRecord);
+  header.count = records.size();
+
+  out.write((const char *)&header, sizeof(header));
+  out.write((const char *)records.data(),
+            records.size() * sizeof(AquaFSTraceRecord));
+  if (!out.good())
+    return IOStatus::IOError("Failed to write trace file: " + path);
+  return IOStatus::OK();
+}
+
+IOStatus AquaFSTracer::Load(const std::string &path,
+                            std::vector<AquaFSTraceRecord> *records) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in.is_open())
+    return IOStatus::IOError("Failed to open trace file: " + path);
+
+  AquaFSTraceHeader header;
+  if (!in.read((char *)&header, sizeof(header)) ||
+      memcmp(header.magic, kTraceMagic, sizeof(header.magic)) != 0)
+    return IOStatus::Corruption("Not an AquaFS trace: " + path);
+  if (header.version != kTraceVersion ||
+      header.record_size != sizeof(AquaFSTraceRecord))
+    return IOStatus::NotSupported("Unsupported trace version");
+
+  records->resize(header.count);
+  if (!in.read((char *)records->data(),
+               header.count * sizeof(AquaFSTraceRecord)))
+    return IOStatus::Corruption("Truncated trace file: " + path);
+  return IOStatus::OK();
+}
+
+AquaFSTraceReplayer::~AquaFSTraceReplayer() {
+  for (auto &it : files_) CloseFile(it.second).PermitUncheckedError();
+  free(buf_);
+}
+
+IOStatus AquaFSTraceReplayer::Write(ReplayFile &file, uint64_t size) {
+  uint32_t block_sz = zbd_->GetBlockSize();
+  size = (size + block_sz - 1) / block_sz * block_sz;
+
+  while (size > 0) {
+    IOStatus s;
+    if (file.active == nullptr || file.active->capacity_ == 0) {
+      s = CloseFile(file);
+      if (!s.ok()) return s;
+
+      uint64_t start = AquaFSMetricsClock::NowMicros();
+      s = zbd_->AllocateIOZone(file.lifetime, file.io_type,
+                               zone_token_class(file.lifetime, file.io_type),
+                               &file.active);
+      alloc_latency_.Record(AquaFSMetricsClock::NowMicros() - start);
+      if (!s.ok()) return s;
+      if (file.active == nullptr)
+        return IOStatus::NoSpace("Zone allocation failure during replay");
+    }
+
+    uint32_t chunk = (uint32_t)std::min<uint64_t>(
+        std::min<uint64_t>(size, file.active->capacity_), buf_sz_);
+    uint64_t start = AquaFSMetricsClock::NowMicros();
+    s = file.active->Append(buf_, chunk);
+    write_latency_.Record(AquaFSMetricsClock::NowMicros() - start);
+    if (!s.ok()) return s;
+
+    file.active->used_capacity_ += chunk;
+    file.extents.emplace_back(file.active, chunk);
+    bytes_ += chunk;
+    size -= chunk;
+  }
+  return IOStatus::OK();
+}
+
+IOStatus AquaFSTraceReplayer::CloseFile(ReplayFile &file) {
+  if (file.active == nullptr) return IOStatus::OK();
+
+  bool full = file.active->IsFull();
+  IOStatus s = file.active->Close();
+  file.active->Release();
+  zbd_->PutOpenIOZoneToken();
+  if (full) zbd_->PutActiveIOZoneToken();
+  file.active = nullptr;
+  return s;
+}
+
+IOStatus AquaFSTraceReplayer::DeleteFile(uint32_t id) {
+  auto it = files_.find(id);
+  if (it == files_.end()) return IOStatus::OK();
+
+  IOStatus s = CloseFile(it->second);
+  /* Zones left unused are reset by the reset worker, as on file deletes */
+  for (const auto &extent : it->second.extents)
+    extent.first->ReleaseCapacity(extent.second);
+  files_.erase(it);
+  return s;
+}
+
+IOStatus AquaFSTraceReplayer::Replay(
+    const std::vector<AquaFSTraceRecord> &records) {
+  if (buf_ == nullptr) {
+    buf_sz_ = 1024 * 1024;
+    if (posix_memalign((void **)&buf_, zbd_->GetBlockSize(), buf_sz_))
+      return IOStatus::IOError("Failed to allocate replay buffer");
+    memset(buf_, 0, buf_sz_);
+  }
+
+  uint64_t start = AquaFSMetricsClock::NowMicros();
+  IOStatus s;
+  for (const auto &rec : records) {
+    switch ((TraceEvent)rec.event) {
+      case TraceEvent::kFileWrite: {
+        ReplayFile &file = files_[rec.id];
+        file.lifetime = (Env::WriteLifeTimeHint)rec.lifetime;
+        file.io_type = (IOType)rec.io_type;
+        s = Write(file, rec.size);
+        break;
+      }
+      case TraceEvent::kFileClose: {
+        auto it = files_.find(rec.id);
+        if (it != files_.end()) s = CloseFile(it->second);
+        break;
+      }
+      case TraceEvent::kFileDelete:
+        s = DeleteFile(rec.id);
+        break;
+      default:
+        continue;
+    }
+    if (!s.ok()) break;
+    events_++;
+  }
+  elapsed_us_ += AquaFSMetricsClock::NowMicros() - start;
+  return s;
+}
+
+static void EncodeJsonLatency(std::ostream &json_stream,
+                              const AquaFSHistogramSnapshot &snap) {
+  json_stream << "{\"count\":" << snap.count << ",\"mean\":" << snap.Mean()
+              << ",\"p50\":" << snap.Percentile(50)
+              << ",\"p99\":" << snap.Percentile(99)
+              << ",\"p999\":" << snap.Percentile(99.9) << "}";
+}
+
+void AquaFSTraceReplayer::EncodeJson(std::ostream &json_stream) {
+  double mb_per_s =
+      elapsed_us_ ? (double)bytes_ / (1024 * 1024) / (elapsed_us_ / 1e6) : 0.0;
+
+  json_stream << "{";
+  json_stream << "\"events\":" << events_ << ",";
+  json_stream << "\"bytes\":" << bytes_ << ",";
+  json_stream << "\"elapsed_us\":" << elapsed_us_ << ",";
+  json_stream << "\"mb_per_s\":" << mb_per_s << ",";
+  json_stream << "\"free_space\":" << zbd_->GetFreeSpace() << ",";
+  json_stream << "\"reclaimable_space\":" << zbd_->GetReclaimableSpace()
+              << ",";
+  json_stream << "\"alloc_latency_us\":";
+  EncodeJsonLatency(json_stream, alloc_latency_.Snapshot());
+  json_stream << ",\"write_latency_us\":";
+  EncodeJsonLatency(json_stream, write_latency_.Snapshot());
+  json_stream << "}";
+}
+
+}  // namespace AQUAFS_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && !defined(OS_WIN)
@@ -0,0 +1,162 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "aquafs_namespace.h"
+#include "metrics_histogram.h"
+#include "rocksdb/env.h"
+#include "rocksdb/file_system.h"
+#include "rocksdb/io_status.h"
+#include "rocksdb/rocksdb_namespace.h"
+
+namespace AQUAFS_NAMESPACE {
+using namespace ROCKSDB_NAMESPACE;
+
+class Zone;
+class ZonedBlockDevice;
+
+enum class TraceEvent : uint8_t {
+  kZoneAlloc = 0, /* pos: zone start */
+  kZoneFinish,
+  kZoneReset,
+  kExtentPush,  /* id: file, pos: extent start, size: extent length */
+  kMetaRecord,  /* size: record size */
+  kGCMigrate,   /* id: file, pos: target zone start, size: bytes moved */
+  kRead,        /* backend reads and writes, pos/size of the request */
+  kWrite,
+  kFileWrite,   /* id: file, size: bytes appended by the file */
+  kFileClose,   /* id: file, closed for writing */
+  kFileDelete,  /* id: file */
+  kMax,
+};
+
+const char *trace_event_str(TraceEvent event);
+
+/* Fixed size binary trace record, also the on-disk format */
+struct AquaFSTraceRecord {
+  uint64_t ts_us;
+  uint64_t pos;
+  uint32_t size;
+  uint32_t latency_us;
+  uint32_t id;
+  uint32_t thread;
+  uint8_t event;
+  uint8_t lifetime;
+  uint8_t io_type;
+  uint8_t reserved[5];
+};
+static_assert(sizeof(AquaFSTraceRecord) == 40, "trace records are 40 bytes");
+
+/* Per-thread trace rings. Every thread writes to its own ring without
+ * locks, the oldest records are overwritten once a ring is full. Dumping
+ * while tracing is best effort: records being overwritten at that moment
+ * are skipped. */
+class AquaFSTracer {
+ public:
+  static AquaFSTracer &Get();
+
+  /* ring_size records per thread, 0 disables tracing */
+  void Enable(uint32_t ring_size);
+  bool IsEnabled() const {
+    return ring_size_.load(std::memory_order_relaxed) != 0;
+  }
+  /* Start time for a latency, 0 when tracing is disabled */
+  uint64_t Now() const;
+  uint64_t Since(uint64_t start) const { return start ? Now() - start : 0; }
+
+  void Record(TraceEvent event, uint32_t id, uint64_t pos, uint64_t size,
+              uint64_t latency_us = 0, uint8_t lifetime = 0,
+              uint8_t io_type = 0);
+
+  /* All records of all threads, oldest first */
+  std::vector<AquaFSTraceRecord> Collect();
+  IOStatus Dump(const std::string &path);
+  static IOStatus Load(const std::string &path,
+                       std::vector<AquaFSTraceRecord> *records);
+
+  /* A mounted file system with tracing enabled dumps its trace when this
+   * file shows up in its aux directory. The file holds the path to dump
+   * to; once done, it is replaced by DumpResultPath() holding "OK" or the
+   * error. */
+  static std::string DumpRequestPath(const std::string &aux_path) {
+    return aux_path + "/TRACE_DUMP";
+  }
+  static std::string DumpResultPath(const std::string &aux_path) {
+    return aux_path + "/TRACE_DUMP.result";
+  }
+
+ private:
+  struct Ring {
+    std::unique_ptr<AquaFSTraceRecord[]> records;
+    uint32_t size;
+    uint32_t thread;
+    std::atomic<uint64_t> head{0};
+  };
+
+  AquaFSTracer() = default;
+  Ring *ThreadRing();
+
+  std::atomic<uint32_t> ring_size_{0};
+  std::mutex rings_mtx_;
+  std::vector<std::unique_ptr<Ring>> rings_;
+};
+
+#define AQUAFS_TRACE(...)                                        \
+  do {                                                           \
+    AquaFSTracer &tracer_ = AquaFSTracer::Get();                 \
+    if (tracer_.IsEnabled()) tracer_.Record(__VA_ARGS__);        \
+  } while (0)
+
+/* Drives a ZonedBlockDevice with the file writes and deletes of a trace,
+ * so that allocator and reset policies can be compared on recorded I/O
+ * patterns without RocksDB. Data written is zeroes. */
+class AquaFSTraceReplayer {
+ public:
+  explicit AquaFSTraceReplayer(ZonedBlockDevice *zbd) : zbd_(zbd) {}
+  ~AquaFSTraceReplayer();
+
+  IOStatus Replay(const std::vector<AquaFSTraceRecord> &records);
+  void EncodeJson(std::ostream &json_stream);
+
+ private:
+  struct ReplayFile {
+    Zone *active = nullptr;
+    Env::WriteLifeTimeHint lifetime = Env::WLTH_NOT_SET;
+    IOType io_type = IOType::kUnknown;
+    std::vector<std::pair<Zone *, uint64_t>> extents;
+  };
+
+  IOStatus Write(ReplayFile &file, uint64_t size);
+  IOStatus CloseFile(ReplayFile &file);
+  IOStatus DeleteFile(uint32_t id);
+
+  ZonedBlockDevice *zbd_;
+  std::map<uint32_t, ReplayFile> files_;
+  char *buf_ = nullptr;
+  uint32_t buf_sz_ = 0;
+
+  uint64_t events_ = 0;
+  uint64_t bytes_ = 0;
+  uint64_t elapsed_us_ = 0;
+  AquaFSHistogram alloc_latency_;
+  AquaFSHistogram write_latency_;
+};
+
+}  // namespace AQUAFS_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
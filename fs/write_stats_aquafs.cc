@@ -0,0 +1,130 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#if !defined(ROCKSDB_LITE) && !defined(OS_WIN)
+
+#include "write_stats_aquafs.h"
+
+#include <algorithm>
+
+#include "metrics_histogram.h"
+
+namespace AQUAFS_NAMESPACE {
+
+const char *write_kind_str(WriteKind kind) {
+  switch (kind) {
+    case WriteKind::kUser:
+      return "user";
+    case WriteKind::kPadding:
+      return "padding";
+    case WriteKind::kGC:
+      return "gc";
+    case WriteKind::kMeta:
+      return "meta";
+    case WriteKind::kMetaPadding:
+      return "meta_padding";
+    default:
+      return "unknown";
+  }
+}
+
+uint64_t AquaFSWriteStatsSnapshot::Total() const {
+  uint64_t total = 0;
+  for (uint32_t k = 0; k < kKinds; k++) total += by_kind[k];
+  return total;
+}
+
+double AquaFSWriteStatsSnapshot::WriteAmplification() const {
+  uint64_t user = by_kind[(uint32_t)WriteKind::kUser];
+  return user ? (double)Total() / user : 0.0;
+}
+
+static void EncodeJsonKinds(std::ostream &json_stream, const uint64_t *kinds) {
+  json_stream << "{";
+  for (uint32_t k = 0; k < AquaFSWriteStatsSnapshot::kKinds; k++) {
+    if (k) json_stream << ",";
+    json_stream << "\"" << write_kind_str((WriteKind)k) << "\":" << kinds[k];
+  }
+  json_stream << "}";
+}
+
+void AquaFSWriteStatsSnapshot::EncodeJson(std::ostream &json_stream) const {
+  json_stream << "{";
+  json_stream << "\"write_amplification\":" << WriteAmplification() << ",";
+  json_stream << "\"total\":";
+  EncodeJsonKinds(json_stream, by_kind);
+
+  json_stream << ",\"lifetime\":[";
+  for (uint32_t l = 0; l < kLifetimes; l++) {
+    if (l) json_stream << ",";
+    EncodeJsonKinds(json_stream, by_lifetime[l]);
+  }
+  json_stream << "],\"io_type\":[";
+  for (uint32_t t = 0; t < kIOTypes; t++) {
+    if (t) json_stream << ",";
+    EncodeJsonKinds(json_stream, by_io_type[t]);
+  }
+  json_stream << "],\"raid_mode\":[";
+  for (uint32_t r = 0; r < kRaidModes; r++) {
+    if (r) json_stream << ",";
+    EncodeJsonKinds(json_stream, by_raid_mode[r]);
+  }
+  json_stream << "]}";
+}
+
+AquaFSWriteStats::AquaFSWriteStats()
+    : stripes_(new Stripe[AquaFSHistogram::kStripes]) {
+  for (uint32_t s = 0; s < AquaFSHistogram::kStripes; s++) {
+    Stripe &stripe = stripes_[s];
+    for (auto &row : stripe.by_lifetime)
+      for (auto &c : row) c.store(0, std::memory_order_relaxed);
+    for (auto &row : stripe.by_io_type)
+      for (auto &c : row) c.store(0, std::memory_order_relaxed);
+    for (auto &row : stripe.by_raid_mode)
+      for (auto &c : row) c.store(0, std::memory_order_relaxed);
+  }
+}
+
+void AquaFSWriteStats::Add(WriteKind kind, Env::WriteLifeTimeHint lifetime,
+                           IOType io_type, uint32_t raid_mode, uint64_t bytes) {
+  if (bytes == 0) return;
+
+  Stripe &stripe = stripes_[AquaFSHistogram::StripeIndex()];
+  uint32_t k = (uint32_t)kind;
+  uint32_t l = std::min<uint32_t>(lifetime, Snapshot::kLifetimes - 1);
+  uint32_t t = std::min<uint32_t>((uint32_t)io_type, Snapshot::kIOTypes - 1);
+  uint32_t r = std::min<uint32_t>(raid_mode, Snapshot::kRaidModes - 1);
+
+  stripe.by_lifetime[l][k].fetch_add(bytes, std::memory_order_relaxed);
+  stripe.by_io_type[t][k].fetch_add(bytes, std::memory_order_relaxed);
+  stripe.by_raid_mode[r][k].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+AquaFSWriteStatsSnapshot AquaFSWriteStats::GetSnapshot() const {
+  Snapshot snap;
+
+  for (uint32_t s = 0; s < AquaFSHistogram::kStripes; s++) {
+    const Stripe &stripe = stripes_[s];
+    for (uint32_t k = 0; k < Snapshot::kKinds; k++) {
+      for (uint32_t l = 0; l < Snapshot::kLifetimes; l++) {
+        uint64_t v = stripe.by_lifetime[l][k].load(std::memory_order_relaxed);
+        snap.by_lifetime[l][k] += v;
+        snap.by_kind[k] += v;
+      }
+      for (uint32_t t = 0; t < Snapshot::kIOTypes; t++)
+        snap.by_io_type[t][k] +=
+            stripe.by_io_type[t][k].load(std::memory_order_relaxed);
+      for (uint32_t r = 0; r < Snapshot::kRaidModes; r++)
+        snap.by_raid_mode[r][k] +=
+            stripe.by_raid_mode[r][k].load(std::memory_order_relaxed);
+    }
+  }
+  return snap;
+}
+
+}  // namespace AQUAFS_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && !defined(OS_WIN)
@@ -0,0 +1,80 @@
+// Copyright (c) Facebook, Inc. and its affiliates. All Rights Reserved.
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+#pragma once
+
+#if !defined(ROCKSDB_LITE) && defined(OS_LINUX)
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+
+#include "aquafs_namespace.h"
+#include "rocksdb/env.h"
+#include "rocksdb/file_system.h"
+#include "rocksdb/rocksdb_namespace.h"
+
+namespace AQUAFS_NAMESPACE {
+using namespace ROCKSDB_NAMESPACE;
+
+/* What the bytes of a device write were spent on */
+enum class WriteKind : uint32_t {
+  kUser = 0,    /* file data */
+  kPadding,     /* block padding and sparse headers of file writes */
+  kGC,          /* data moved by garbage collection */
+  kMeta,        /* metadata log records */
+  kMetaPadding, /* block padding of metadata log records */
+  kMax,
+};
+
+const char *write_kind_str(WriteKind kind);
+
+class AquaFSWriteStatsSnapshot {
+ public:
+  static const uint32_t kKinds = (uint32_t)WriteKind::kMax;
+  static const uint32_t kLifetimes = Env::WLTH_EXTREME + 1;
+  static const uint32_t kIOTypes = (uint32_t)IOType::kInvalid + 1;
+  /* Indexed by RaidMode */
+  static const uint32_t kRaidModes = 8;
+
+  uint64_t by_kind[kKinds] = {};
+  uint64_t by_lifetime[kLifetimes][kKinds] = {};
+  uint64_t by_io_type[kIOTypes][kKinds] = {};
+  uint64_t by_raid_mode[kRaidModes][kKinds] = {};
+
+  uint64_t Total() const;
+  /* Device bytes written per byte of file data */
+  double WriteAmplification() const;
+  void EncodeJson(std::ostream &json_stream) const;
+};
+
+/* Write accounting by lifetime hint, io type and RAID mode of the target
+ * zone. Counters are striped per thread so writers don't share cache
+ * lines; they are summed when a snapshot is taken. */
+class AquaFSWriteStats {
+ public:
+  AquaFSWriteStats();
+
+  void Add(WriteKind kind, Env::WriteLifeTimeHint lifetime, IOType io_type,
+           uint32_t raid_mode, uint64_t bytes);
+  AquaFSWriteStatsSnapshot GetSnapshot() const;
+
+ private:
+  using Snapshot = AquaFSWriteStatsSnapshot;
+
+  struct alignas(64) Stripe {
+    std::atomic<uint64_t> by_lifetime[Snapshot::kLifetimes][Snapshot::kKinds];
+    std::atomic<uint64_t> by_io_type[Snapshot::kIOTypes][Snapshot::kKinds];
+    std::atomic<uint64_t> by_raid_mode[Snapshot::kRaidModes][Snapshot::kKinds];
+  };
+
+  std::unique_ptr<Stripe[]> stripes_;
+};
+
+}  // namespace AQUAFS_NAMESPACE
+
+#endif  // !defined(ROCKSDB_LITE) && defined(OS_LINUX)
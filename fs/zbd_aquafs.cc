@@ -8,6 +8,7 @@
 
 #include "zbd_aquafs.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <cstring>
@@ -22,6 +23,8 @@
 #include <vector>
 
 #include "aquafs_namespace.h"
+#include "configuration.h"
+#include "emu_aquafs.h"
 #include "raid/zone_raid.h"
 #include "raid/zone_raid0.h"
 #include "raid/zone_raid1.h"
@@ -31,6 +34,7 @@
 #include "rocksdb/io_status.h"
 #include "rocksdb/rocksdb_namespace.h"
 #include "snapshot.h"
+#include "trace_aquafs.h"
 #include "zbdlib_aquafs.h"
 #include "zonefs_aquafs.h"
 
@@ -46,6 +50,7 @@ Zone::Zone(ZonedBlockDevice *zbd, ZonedBlockDeviceBackend *zbd_be,
       max_capacity_(zbd_be->ZoneMaxCapacity(zones, idx)),
       wp_(zbd_be->ZoneWp(zones, idx)) {
   lifetime_ = Env::WLTH_NOT_SET;
+  file_class_ = kNoFileClass;
   used_capacity_ = 0;
   capacity_ = 0;
   if (zbd_be->ZoneIsWritable(zones, idx))
@@ -65,8 +70,25 @@ void Zone::EncodeJson(std::ostream &json_stream) {
   json_stream << "\"max_capacity\":" << max_capacity_ << ",";
   json_stream << "\"wp\":" << wp_ << ",";
   json_stream << "\"lifetime\":" << lifetime_ << ",";
-  json_stream << "\"used_capacity\":" << used_capacity_;
-  json_stream << "}";
+  json_stream << "\"file_class\":\"" << file_class_str(file_class_) << "\",";
+  json_stream << "\"used_capacity\":" << used_capacity_ << ",";
+  json_stream << "\"written\":{";
+  for (uint32_t k = 0; k < (uint32_t)WriteKind::kMax; k++) {
+    if (k) json_stream << ",";
+    json_stream << "\"" << write_kind_str((WriteKind)k) << "\":" << written_[k];
+  }
+  json_stream << "}}";
+}
+
+void Zone::MarkWritten() {
+  uint64_t now = AquaFSMetricsClock::NowMicros();
+  if (IsEmpty()) open_us_.store(now, std::memory_order_relaxed);
+  last_write_us_.store(now, std::memory_order_relaxed);
+}
+
+void Zone::ReleaseCapacity(uint64_t length) {
+  assert(used_capacity_ >= length);
+  if (used_capacity_.fetch_sub(length) == length) zbd_->QueueReset(this);
 }
 
 IOStatus Zone::Reset() {
@@ -76,8 +98,12 @@ IOStatus Zone::Reset() {
   assert(!IsUsed());
   assert(IsBusy());
 
+  uint64_t trace_start = AquaFSTracer::Get().Now();
   IOStatus ios = zbd_be_->Reset(start_, &offline, &max_capacity);
   if (ios != IOStatus::OK()) return ios;
+  AQUAFS_TRACE(TraceEvent::kZoneReset, 0, start_, wp_ - start_,
+               AquaFSTracer::Get().Since(trace_start), lifetime_);
+  zbd_->AddZoneReset();
 
   if (offline)
     capacity_ = 0;
@@ -86,15 +112,21 @@ IOStatus Zone::Reset() {
 
   wp_ = start_;
   lifetime_ = Env::WLTH_NOT_SET;
+  file_class_ = kNoFileClass;
+  cache_epoch_.fetch_add(1, std::memory_order_release);
 
   return IOStatus::OK();
 }
 
-IOStatus Zone::Finish() {
+IOStatus Zone::Finish(FinishReason reason) {
   assert(IsBusy());
 
+  uint64_t trace_start = AquaFSTracer::Get().Now();
   IOStatus ios = zbd_be_->Finish(start_);
   if (ios != IOStatus::OK()) return ios;
+  AQUAFS_TRACE(TraceEvent::kZoneFinish, 0, start_, wp_ - start_,
+               AquaFSTracer::Get().Since(trace_start), lifetime_);
+  zbd_->AddZoneFinish(reason, capacity_);
 
   capacity_ = 0;
   wp_ = start_ + zbd_->GetZoneSize();
@@ -126,6 +158,9 @@ IOStatus Zone::Append(char *data, uint32_t size) {
 
   assert((size % zbd_->GetBlockSize()) == 0);
 
+  MarkWritten();
+  uint64_t trace_start = AquaFSTracer::Get().Now();
+  uint64_t trace_pos = wp_;
   while (left) {
     ret = zbd_be_->Write(ptr, left, wp_);
     if (ret < 0) {
@@ -138,6 +173,68 @@ IOStatus Zone::Append(char *data, uint32_t size) {
     left -= ret;
     zbd_->AddBytesWritten(ret);
   }
+  AQUAFS_TRACE(TraceEvent::kWrite, 0, trace_pos, size,
+               AquaFSTracer::Get().Since(trace_start), lifetime_);
+
+  return IOStatus::OK();
+}
+
+IOStatus Zone::AppendShared(char *data, uint32_t size, uint64_t *pos) {
+  AquaFSMetricsLatencyGuard guard(zbd_->GetMetrics(), AQUAFS_ZONE_WRITE_LATENCY,
+                                  Env::Default());
+  zbd_->GetMetrics()->ReportThroughput(AQUAFS_ZONE_WRITE_THROUGHPUT, size);
+
+  assert((size % zbd_->GetBlockSize()) == 0);
+
+  MarkWritten();
+  if (size <= zbd_be_->GetMaxAppendSize()) {
+    /* The device orders concurrent appends, only account for the data */
+    if (zbd_be_->ZoneAppend(data, size, start_, pos) < 0) {
+      return IOStatus::IOError(strerror(errno));
+    }
+    std::lock_guard<std::mutex> lock(append_mtx_);
+    wp_ += size;
+  } else {
+    std::lock_guard<std::mutex> lock(append_mtx_);
+    char *ptr = data;
+    uint32_t left = size;
+    int ret;
+
+    *pos = wp_;
+    while (left) {
+      ret = zbd_be_->Write(ptr, left, wp_);
+      if (ret < 0) {
+        return IOStatus::IOError(strerror(errno));
+      }
+      ptr += ret;
+      wp_ += ret;
+      left -= ret;
+    }
+  }
+  zbd_->AddBytesWritten(size);
+
+  return IOStatus::OK();
+}
+
+IOStatus Zone::Copy(const std::vector<ZoneCopyRange> &ranges) {
+  AquaFSMetricsLatencyGuard guard(zbd_->GetMetrics(), AQUAFS_ZONE_WRITE_LATENCY,
+                                  Env::Default());
+  uint64_t size = 0;
+
+  for (const auto &r : ranges) size += r.size;
+  if (capacity_ < size)
+    return IOStatus::NoSpace("Not enough capacity for copy");
+
+  assert((size % zbd_->GetBlockSize()) == 0);
+  zbd_->GetMetrics()->ReportThroughput(AQUAFS_ZONE_WRITE_THROUGHPUT, size);
+
+  uint64_t copied = 0;
+  int ret = zbd_be_->Copy(ranges, wp_, &copied);
+  /* The device write pointer moved by what was copied, even on failure */
+  wp_ += copied;
+  capacity_ -= copied;
+  zbd_->AddBytesWritten(copied);
+  if (ret < 0) return IOStatus::IOError(strerror(errno));
 
   return IOStatus::OK();
 }
@@ -169,6 +266,10 @@ ZonedBlockDevice::ZonedBlockDevice(std::string path, ZbdBackendType backend,
   } else if (backend == ZbdBackendType::kZoneFS) {
     zbd_be_ = std::make_unique<ZoneFsBackend>(path);
     Info(logger_, "New zonefs backing: %s", zbd_be_->GetFilename().c_str());
+  } else if (backend == ZbdBackendType::kEmu) {
+    zbd_be_ = std::make_unique<EmuBackend>(path);
+    Info(logger_, "New emulated zoned device: %s",
+         zbd_be_->GetFilename().c_str());
   } else if (backend == ZbdBackendType::kRaid) {
     // parse raid uri. format: "raid<num>:dev:null0,<path2>,<path3>,..."
     const std::string raid_prefix = "raid";
@@ -193,6 +294,9 @@ ZonedBlockDevice::ZonedBlockDevice(std::string path, ZbdBackendType backend,
         if (p.find("dev:") == 0) {
           auto pp = p.substr(strlen("dev:"));
           raid_devices.emplace_back(std::make_unique<ZbdlibBackend>(pp));
+        } else if (p.find("emu:") == 0) {
+          auto pp = p.substr(strlen("emu:"));
+          raid_devices.emplace_back(std::make_unique<EmuBackend>(pp));
         } else
           raid_devices.emplace_back(std::make_unique<ZoneFsBackend>(p));
       }
@@ -229,6 +333,15 @@ ZonedBlockDevice::ZonedBlockDevice(std::string path, ZbdBackendType backend,
   if (zbd_be_ == nullptr) Error(logger_, "Failed to load zone data backend");
 }
 
+ZonedBlockDevice::ZonedBlockDevice(
+    std::unique_ptr<ZonedBlockDeviceBackend> backend,
+    std::shared_ptr<Logger> logger, std::shared_ptr<AquaFSMetrics> metrics)
+    : zbd_be_(std::move(backend)),
+      logger_(std::move(logger)),
+      metrics_(std::move(metrics)) {
+  if (zbd_be_ == nullptr) Error(logger_, "Failed to load zone data backend");
+}
+
 IOStatus ZonedBlockDevice::Open(bool readonly, bool exclusive) {
   std::unique_ptr<ZoneList> zone_rep;
   unsigned int max_nr_active_zones;
@@ -282,8 +395,9 @@ IOStatus ZonedBlockDevice::Open(bool readonly, bool exclusive) {
     i++;
   }
 
-  active_io_zones_ = 0;
-  open_io_zones_ = 0;
+  /* Avoid non-priortized allocators from starving prioritized ones */
+  active_io_zones_.Reset(max_nr_active_io_zones_, 0);
+  open_io_zones_.Reset(max_nr_open_io_zones_, 1);
 
   for (; i < zone_rep->ZoneCount(); i++) {
     /* Only use sequential write required zones */
@@ -297,7 +411,7 @@ IOStatus ZonedBlockDevice::Open(bool readonly, bool exclusive) {
         }
         io_zones.push_back(newZone);
         if (zbd_be_->ZoneIsActive(zone_rep, i)) {
-          active_io_zones_++;
+          active_io_zones_.Add();
           if (zbd_be_->ZoneIsOpen(zone_rep, i)) {
             if (!readonly) {
               newZone->Close();
@@ -314,6 +428,35 @@ IOStatus ZonedBlockDevice::Open(bool readonly, bool exclusive) {
 
   start_time_ = time(NULL);
 
+  numa_nodes_ = zbd_be_->GetNumaNodes();
+  if (numa_nodes_.size() == 1) numa_node_ = numa_nodes_[0];
+  for (int node : numa_nodes_)
+    Info(logger_, "Device on NUMA node %d", node);
+
+  if (FLAGS_block_cache_size > 0) {
+    block_cache_.reset(
+        new AquaFSBlockCache(FLAGS_block_cache_size, GetBlockSize()));
+    Status s = block_cache_->SetBypass(FLAGS_block_cache_bypass);
+    if (!s.ok()) return status_to_io_status(std::move(s));
+    Info(logger_, "Block cache enabled: %lu bytes, bypass: %s",
+         FLAGS_block_cache_size, FLAGS_block_cache_bypass.c_str());
+  }
+
+  placement_ = AquaFSPlacement::Create(FLAGS_placement_policy);
+  if (!placement_)
+    return IOStatus::InvalidArgument("Unknown placement policy: " +
+                                     FLAGS_placement_policy);
+  Info(logger_, "Zone placement policy: %s", placement_->Name());
+  if (FLAGS_lifetime_prediction)
+    lifetime_predictor_.reset(new LifetimePredictor());
+
+  if (FLAGS_trace_ring_size > 0) {
+    AquaFSTracer::Get().Enable(
+        (uint32_t)std::min<uint64_t>(FLAGS_trace_ring_size, UINT32_MAX));
+    Info(logger_, "I/O tracing enabled: %lu records per thread",
+         FLAGS_trace_ring_size);
+  }
+
   return IOStatus::OK();
 }
 
@@ -366,7 +509,7 @@ void ZonedBlockDevice::LogZoneStats() {
        "%lu %lu %lu %lu %ld %ld\n",
        time(NULL) - start_time_, used_capacity / MB, reclaimable_capacity / MB,
        100 * reclaimable_capacity / reclaimables_max_capacity, active,
-       active_io_zones_.load(), open_io_zones_.load());
+       active_io_zones_.Used(), open_io_zones_.Used());
 }
 
 void ZonedBlockDevice::LogZoneUsage() {
@@ -426,36 +569,50 @@ void ZonedBlockDevice::LogGarbageInfo() {
   Info(logger_, "%s", ss.str().data());
 }
 
-ZonedBlockDevice::~ZonedBlockDevice() {
-  for (const auto z : meta_zones) {
-    delete z;
-  }
-
+void ZonedBlockDevice::StartBackgroundWorkers() {
+  if (reset_worker_.joinable()) return;
   for (const auto z : io_zones) {
-    delete z;
+    if (z->IsEmpty() && !z->IsFull()) PutEmptyZone(z);
+  }
+  /* Finish threshold and headroom are kept off the allocation path */
+  finish_worker_ = std::thread(&ZonedBlockDevice::FinishWorker, this);
+  /* Zones are reset in the background as their data goes away */
+  {
+    std::lock_guard<std::mutex> lk(reset_mtx_);
+    reset_running_ = true;
   }
+  reset_worker_ = std::thread(&ZonedBlockDevice::ResetWorker, this);
 }
 
-#define LIFETIME_DIFF_NOT_GOOD (100)
-#define LIFETIME_DIFF_COULD_BE_WORSE (50)
+ZonedBlockDevice::~ZonedBlockDevice() {
+  {
+    std::lock_guard<std::mutex> lk(finish_mtx_);
+    finish_stop_ = true;
+  }
+  finish_cv_.notify_all();
+  if (finish_worker_.joinable()) finish_worker_.join();
 
-unsigned int GetLifeTimeDiff(Env::WriteLifeTimeHint zone_lifetime,
-                             Env::WriteLifeTimeHint file_lifetime) {
-  assert(file_lifetime <= Env::WLTH_EXTREME);
+  {
+    std::lock_guard<std::mutex> lk(reset_mtx_);
+    reset_running_ = false;
+  }
+  reset_cv_.notify_all();
+  if (reset_worker_.joinable()) reset_worker_.join();
 
-  if ((file_lifetime == Env::WLTH_NOT_SET) ||
-      (file_lifetime == Env::WLTH_NONE)) {
-    if (file_lifetime == zone_lifetime) {
-      return 0;
-    } else {
-      return LIFETIME_DIFF_NOT_GOOD;
-    }
+  {
+    std::lock_guard<std::mutex> lk(read_jobs_mtx_);
+    read_workers_stop_ = true;
   }
+  read_jobs_cv_.notify_all();
+  for (auto &t : read_workers_) t.join();
 
-  if (zone_lifetime > file_lifetime) return zone_lifetime - file_lifetime;
-  if (zone_lifetime == file_lifetime) return LIFETIME_DIFF_COULD_BE_WORSE;
+  for (const auto z : meta_zones) {
+    delete z;
+  }
 
-  return LIFETIME_DIFF_NOT_GOOD;
+  for (const auto z : io_zones) {
+    delete z;
+  }
 }
 
 IOStatus ZonedBlockDevice::AllocateMetaZone(Zone **out_meta_zone) {
@@ -485,48 +642,153 @@ IOStatus ZonedBlockDevice::AllocateMetaZone(Zone **out_meta_zone) {
   return IOStatus::NoSpace("Out of metadata zones");
 }
 
+IOStatus ZonedBlockDevice::ResetIOZone(Zone *z) {
+  if (z->IsEmpty() || z->IsUsed()) return z->CheckRelease();
+
+  bool full = z->IsFull();
+  IOStatus reset_status = z->Reset();
+  IOStatus release_status = z->CheckRelease();
+  if (!reset_status.ok()) return reset_status;
+  if (!release_status.ok()) return release_status;
+  if (!full) PutActiveIOZoneToken();
+  if (!z->IsFull()) PutEmptyZone(z);
+  return IOStatus::OK();
+}
+
 IOStatus ZonedBlockDevice::ResetUnusedIOZones() {
   for (const auto z : io_zones) {
     if (z->Acquire()) {
-      if (!z->IsEmpty() && !z->IsUsed()) {
-        bool full = z->IsFull();
-        IOStatus reset_status = z->Reset();
-        IOStatus release_status = z->CheckRelease();
-        if (!reset_status.ok()) return reset_status;
-        if (!release_status.ok()) return release_status;
-        if (!full) PutActiveIOZoneToken();
-      } else {
-        IOStatus release_status = z->CheckRelease();
-        if (!release_status.ok()) return release_status;
-      }
+      IOStatus s = ResetIOZone(z);
+      if (!s.ok()) return s;
     }
   }
   return IOStatus::OK();
 }
 
-void ZonedBlockDevice::WaitForOpenIOZoneToken(bool prioritized) {
-  long allocator_open_limit;
+void ZonedBlockDevice::QueueReset(Zone *zone) {
+  if (zone->reset_queued_.exchange(true)) return;
+  {
+    std::lock_guard<std::mutex> lk(reset_mtx_);
+    if (!reset_running_) {
+      zone->reset_queued_ = false;
+      return;
+    }
+    reset_queue_.push_back(zone);
+  }
+  reset_cv_.notify_one();
+}
 
-  /* Avoid non-priortized allocators from starving prioritized ones */
-  if (prioritized) {
-    allocator_open_limit = max_nr_open_io_zones_;
-  } else {
-    allocator_open_limit = max_nr_open_io_zones_ - 1;
+void ZonedBlockDevice::SweepUnusedZones() {
+  for (const auto z : io_zones) {
+    if (!z->IsEmpty() && !z->IsUsed()) QueueReset(z);
   }
+}
+
+bool ZonedBlockDevice::ResetsThrottled() {
+  return FLAGS_reset_rate_limit > 0 &&
+         GetEmptyZones() >= FLAGS_reset_pool_size;
+}
 
+void ZonedBlockDevice::ResetWorker() {
+  bind_thread_to_numa_node(numa_node_);
+  const auto interval = std::chrono::milliseconds(AQUAFS_RESET_INTERVAL_MS);
+  auto next_sweep = std::chrono::steady_clock::now() + interval;
+  std::unique_lock<std::mutex> lk(reset_mtx_);
+
+  while (reset_running_) {
+    if (std::chrono::steady_clock::now() >= next_sweep) {
+      /* Pick up zones that were busy when their last extent went away. On
+       * a fixed schedule, so that a steady stream of resets can not keep
+       * them waiting. */
+      lk.unlock();
+      SweepUnusedZones();
+      lk.lock();
+      next_sweep = std::chrono::steady_clock::now() + interval;
+      continue;
+    }
+
+    if (reset_queue_.empty()) {
+      reset_cv_.wait_until(lk, next_sweep, [this] {
+        return !reset_running_ || !reset_queue_.empty();
+      });
+      continue;
+    }
+
+    size_t n = std::min<size_t>(reset_queue_.size(), AQUAFS_RESET_BATCH);
+    uint64_t rate = FLAGS_reset_rate_limit;
+    /* Only throttled while allocations have empty zones to go to */
+    if (rate > 0 && ResetsThrottled()) {
+      n = reset_limiter_.Take(n, rate, AquaFSMetricsClock::NowMicros());
+      if (n == 0) {
+        auto refill = std::chrono::steady_clock::now() +
+                      std::chrono::microseconds(reset_limiter_.WaitUs(rate));
+        reset_cv_.wait_until(lk, std::min(refill, next_sweep));
+        continue;
+      }
+    }
+
+    std::vector<Zone *> batch;
+    for (size_t i = 0; i < n; i++) {
+      Zone *z = reset_queue_.front();
+      reset_queue_.pop_front();
+      z->reset_queued_ = false;
+      batch.push_back(z);
+    }
+    lk.unlock();
+
+    for (const auto z : batch) {
+      /* Busy zones are in use again, or left for the next sweep */
+      if (!z->Acquire()) continue;
+      IOStatus s = ResetIOZone(z);
+      if (!s.ok()) {
+        /* The zone keeps its data, the next sweep queues it again */
+        zone_reset_failures_++;
+        Error(logger_, "Background reset of zone %lu failed: %s",
+              z->GetZoneNr(), s.ToString().c_str());
+      }
+    }
+
+    lk.lock();
+  }
+}
+
+void ZonedBlockDevice::PutEmptyZone(Zone *z) {
+  std::lock_guard<std::mutex> lk(empty_zones_mtx_);
+  if (z->in_empty_pool_) return;
+  z->in_empty_pool_ = true;
+  empty_zones_.push_back(z);
+}
+
+Zone *ZonedBlockDevice::TakeEmptyZone() {
+  std::lock_guard<std::mutex> lk(empty_zones_mtx_);
+  if (empty_zones_.empty()) return nullptr;
+  Zone *z = empty_zones_.front();
+  empty_zones_.pop_front();
+  z->in_empty_pool_ = false;
+  return z;
+}
+
+size_t ZonedBlockDevice::GetEmptyZones() {
+  std::lock_guard<std::mutex> lk(empty_zones_mtx_);
+  /* Pooled zones can still be allocated by the scan in AllocateEmptyZone,
+   * drop the ones that are not empty anymore */
+  for (auto it = empty_zones_.begin(); it != empty_zones_.end();) {
+    if ((*it)->IsEmpty()) {
+      ++it;
+    } else {
+      (*it)->in_empty_pool_ = false;
+      it = empty_zones_.erase(it);
+    }
+  }
+  return empty_zones_.size();
+}
+
+void ZonedBlockDevice::WaitForOpenIOZoneToken(ZoneTokenClass cls) {
   /* Wait for an open IO Zone token - after this function returns
    * the caller is allowed to write to a closed zone. The callee
    * is responsible for calling a PutOpenIOZoneToken to return the resource
    */
-  std::unique_lock<std::mutex> lk(zone_resources_mtx_);
-  zone_resources_.wait(lk, [this, allocator_open_limit] {
-    if (open_io_zones_.load() < allocator_open_limit) {
-      open_io_zones_++;
-      return true;
-    } else {
-      return false;
-    }
-  });
+  open_io_zones_.Get(cls);
 }
 
 bool ZonedBlockDevice::GetActiveIOZoneTokenIfAvailable() {
@@ -534,86 +796,99 @@ bool ZonedBlockDevice::GetActiveIOZoneTokenIfAvailable() {
    * the caller is allowed to write to a closed zone. The callee
    * is responsible for calling a PutActiveIOZoneToken to return the resource
    */
-  std::unique_lock<std::mutex> lk(zone_resources_mtx_);
-  if (active_io_zones_.load() < max_nr_active_io_zones_) {
-    active_io_zones_++;
-    return true;
-  }
-  return false;
+  return active_io_zones_.TryGet(ZoneTokenClass::kWAL);
 }
 
-void ZonedBlockDevice::PutOpenIOZoneToken() {
-  {
-    std::unique_lock<std::mutex> lk(zone_resources_mtx_);
-    open_io_zones_--;
-  }
-  zone_resources_.notify_one();
+void ZonedBlockDevice::PutOpenIOZoneToken() { open_io_zones_.Put(); }
+
+void ZonedBlockDevice::PutActiveIOZoneToken() { active_io_zones_.Put(); }
+
+FinishCandidate ZonedBlockDevice::GetFinishCandidate(Zone *z) {
+  FinishCandidate c;
+  c.capacity = z->capacity_;
+  c.max_capacity = z->max_capacity_;
+  c.written = z->wp_ - z->start_;
+  c.open_us = z->open_us_.load(std::memory_order_relaxed);
+  c.last_write_us = z->last_write_us_.load(std::memory_order_relaxed);
+  return c;
 }
 
-void ZonedBlockDevice::PutActiveIOZoneToken() {
-  {
-    std::unique_lock<std::mutex> lk(zone_resources_mtx_);
-    active_io_zones_--;
+IOStatus ZonedBlockDevice::FinishIOZone(Zone *z, FinishReason reason) {
+  IOStatus s = z->Finish(reason);
+  if (!s.ok()) {
+    z->Release();
+    Debug(logger_, "Failed finishing zone");
+    return s;
   }
-  zone_resources_.notify_one();
+  s = z->CheckRelease();
+  PutActiveIOZoneToken();
+  return s;
 }
 
 IOStatus ZonedBlockDevice::ApplyFinishThreshold() {
   IOStatus s;
+  uint32_t threshold = finish_threshold_;
 
-  if (finish_threshold_ == 0) return IOStatus::OK();
+  if (threshold == 0) return IOStatus::OK();
 
+  /* If there is less than finish_threshold_% remaining capacity in a
+   * non-open-zone, finish the zone */
+  auto below = [&](Zone *z) {
+    return !(z->IsEmpty() || z->IsFull()) &&
+           ZoneFinishPolicy::BelowThreshold(GetFinishCandidate(z), threshold);
+  };
   for (const auto z : io_zones) {
-    if (z->Acquire()) {
-      bool within_finish_threshold =
-          z->capacity_ < (z->max_capacity_ * finish_threshold_ / 100);
-      if (!(z->IsEmpty() || z->IsFull()) && within_finish_threshold) {
-        /* If there is less than finish_threshold_% remaining capacity in a
-         * non-open-zone, finish the zone */
-        s = z->Finish();
-        if (!s.ok()) {
-          z->Release();
-          Debug(logger_, "Failed finishing zone");
-          return s;
-        }
-        s = z->CheckRelease();
-        if (!s.ok()) return s;
-        PutActiveIOZoneToken();
-      } else {
-        s = z->CheckRelease();
-        if (!s.ok()) return s;
-      }
+    /* Zones are judged without being taken, so that allocations do not find
+     * them busy meanwhile, and checked again once taken */
+    if (z->IsBusy() || !below(z) || !z->Acquire()) continue;
+    if (below(z)) {
+      s = FinishIOZone(z, FinishReason::kThreshold);
+    } else {
+      s = z->CheckRelease();
     }
+    if (!s.ok()) return s;
   }
 
   return IOStatus::OK();
 }
 
-IOStatus ZonedBlockDevice::FinishCheapestIOZone() {
+IOStatus ZonedBlockDevice::PickFinishVictim(bool idle_only, Zone **victim) {
   IOStatus s;
-  Zone *finish_victim = nullptr;
-
+  uint64_t now = AquaFSMetricsClock::NowMicros();
+  auto candidate = [&](Zone *z) {
+    return !(z->IsEmpty() || z->IsFull()) &&
+           (!idle_only || ZoneFinishPolicy::IsIdle(GetFinishCandidate(z), now));
+  };
+
+  /* Rank the zones without taking them, so that allocations do not find
+   * them busy meanwhile. Only the victim is taken, and checked again. */
+  std::vector<std::pair<double, Zone *>> ranked;
   for (const auto z : io_zones) {
-    if (z->Acquire()) {
-      if (z->IsEmpty() || z->IsFull()) {
-        s = z->CheckRelease();
-        if (!s.ok()) return s;
-        continue;
-      }
-      if (finish_victim == nullptr) {
-        finish_victim = z;
-        continue;
-      }
-      if (finish_victim->capacity_ > z->capacity_) {
-        s = finish_victim->CheckRelease();
-        if (!s.ok()) return s;
-        finish_victim = z;
-      } else {
-        s = z->CheckRelease();
-        if (!s.ok()) return s;
-      }
+    if (z->IsBusy() || !candidate(z)) continue;
+    ranked.emplace_back(ZoneFinishPolicy::Cost(GetFinishCandidate(z), now), z);
+  }
+  std::sort(ranked.begin(), ranked.end(),
+            [](const std::pair<double, Zone *> &a,
+               const std::pair<double, Zone *> &b) { return a.first < b.first; });
+
+  *victim = nullptr;
+  for (const auto &r : ranked) {
+    Zone *z = r.second;
+    if (!z->Acquire()) continue;
+    if (candidate(z)) {
+      *victim = z;
+      break;
     }
+    s = z->CheckRelease();
+    if (!s.ok()) return s;
   }
+  return IOStatus::OK();
+}
+
+IOStatus ZonedBlockDevice::FinishCheapestIOZone() {
+  Zone *finish_victim = nullptr;
+  IOStatus s = PickFinishVictim(false, &finish_victim);
+  if (!s.ok()) return s;
 
   // If all non-busy zones are empty or full, we should return success.
   if (finish_victim == nullptr) {
@@ -621,23 +896,55 @@ IOStatus ZonedBlockDevice::FinishCheapestIOZone() {
     return IOStatus::OK();
   }
 
-  s = finish_victim->Finish();
-  IOStatus release_status = finish_victim->CheckRelease();
+  return FinishIOZone(finish_victim, FinishReason::kAllocation);
+}
 
-  if (s.ok()) {
-    PutActiveIOZoneToken();
+IOStatus ZonedBlockDevice::KeepFinishHeadroom() {
+  long headroom = (long)std::min<uint64_t>(
+      FLAGS_finish_headroom, std::max<long>(active_io_zones_.Limit() - 1, 0));
+
+  while (active_io_zones_.Limit() - active_io_zones_.Used() < headroom) {
+    Zone *finish_victim = nullptr;
+    IOStatus s = PickFinishVictim(true, &finish_victim);
+    if (!s.ok()) return s;
+    if (finish_victim == nullptr) break;
+    s = FinishIOZone(finish_victim, FinishReason::kHeadroom);
+    if (!s.ok()) return s;
   }
+  return IOStatus::OK();
+}
+
+void ZonedBlockDevice::FinishWorker() {
+  bind_thread_to_numa_node(numa_node_);
+  std::unique_lock<std::mutex> lk(finish_mtx_);
+  while (!finish_stop_) {
+    finish_cv_.wait_for(lk,
+                        std::chrono::milliseconds(AQUAFS_FINISH_INTERVAL_MS));
+    if (finish_stop_) break;
+    lk.unlock();
+
+    IOStatus s = ApplyFinishThreshold();
+    if (s.ok()) s = KeepFinishHeadroom();
+    if (!s.ok()) {
+      /* Tried again on the next round */
+      zone_finish_failures_++;
+      Error(logger_, "Background zone finish failed: %s",
+            s.ToString().c_str());
+    }
 
-  if (!release_status.ok()) {
-    return release_status;
+    lk.lock();
   }
+}
 
-  return s;
+void ZonedBlockDevice::KickFinishWorker() {
+  if (active_io_zones_.Limit() - active_io_zones_.Used() <=
+      (long)FLAGS_finish_headroom)
+    finish_cv_.notify_one();
 }
 
 IOStatus ZonedBlockDevice::GetBestOpenZoneMatch(
     Env::WriteLifeTimeHint file_lifetime, unsigned int *best_diff_out,
-    Zone **zone_out, uint32_t min_capacity) {
+    Zone **zone_out, uint32_t min_capacity, uint32_t file_class) {
   unsigned int best_diff = LIFETIME_DIFF_NOT_GOOD;
   Zone *allocated_zone = nullptr;
   IOStatus s;
@@ -646,7 +953,8 @@ IOStatus ZonedBlockDevice::GetBestOpenZoneMatch(
     if (z->Acquire()) {
       if ((z->used_capacity_ > 0) && !z->IsFull() &&
           z->capacity_ >= min_capacity) {
-        unsigned int diff = GetLifeTimeDiff(z->lifetime_, file_lifetime);
+        unsigned int diff = placement_->Score(z->lifetime_, z->file_class_,
+                                              file_lifetime, file_class);
         if (diff <= best_diff) {
           if (allocated_zone != nullptr) {
             s = allocated_zone->CheckRelease();
@@ -678,17 +986,58 @@ IOStatus ZonedBlockDevice::GetBestOpenZoneMatch(
 IOStatus ZonedBlockDevice::AllocateEmptyZone(Zone **zone_out) {
   IOStatus s;
   Zone *allocated_zone = nullptr;
-  for (const auto z : io_zones) {
-    if (z->Acquire()) {
-      if (z->IsEmpty()) {
-        allocated_zone = z;
-        break;
+
+  /* Zones made empty by resets first, entries may be stale */
+  Zone *pooled;
+  while (allocated_zone == nullptr && (pooled = TakeEmptyZone()) != nullptr) {
+    if (pooled->Acquire()) {
+      if (pooled->IsEmpty()) {
+        allocated_zone = pooled;
       } else {
-        s = z->CheckRelease();
+        s = pooled->CheckRelease();
         if (!s.ok()) return s;
       }
     }
   }
+
+  if (allocated_zone == nullptr) {
+    for (const auto z : io_zones) {
+      if (z->Acquire()) {
+        if (z->IsEmpty()) {
+          allocated_zone = z;
+          break;
+        } else {
+          s = z->CheckRelease();
+          if (!s.ok()) return s;
+        }
+      }
+    }
+  }
+
+  /* The reset worker is behind, reset an unused zone here */
+  if (allocated_zone == nullptr) {
+    for (const auto z : io_zones) {
+      if (z->Acquire()) {
+        if (!z->IsEmpty() && !z->IsUsed()) {
+          bool full = z->IsFull();
+          s = z->Reset();
+          if (!s.ok()) {
+            z->Release();
+            return s;
+          }
+          if (!full) PutActiveIOZoneToken();
+          allocated_zone = z;
+          break;
+        } else {
+          s = z->CheckRelease();
+          if (!s.ok()) return s;
+        }
+      }
+    }
+  }
+
+  if (GetEmptyZones() < FLAGS_reset_pool_size) reset_cv_.notify_one();
+
   *zone_out = allocated_zone;
   return IOStatus::OK();
 }
@@ -702,10 +1051,66 @@ IOStatus ZonedBlockDevice::InvalidateCache(uint64_t pos, uint64_t size) {
   return IOStatus::OK();
 }
 
+int ZonedBlockDeviceBackend::Copy(const std::vector<ZoneCopyRange> &ranges,
+                                  uint64_t dst, uint64_t *copied) {
+  /* Source ranges are gathered into one buffer so that short extents are
+   * written out together */
+  const uint32_t buf_sz = AQUAFS_COPY_BUFFER_SIZE;
+  uint32_t filled = 0;
+  char *buf;
+
+  *copied = 0;
+  /* On the node of the device written to, members of a RAID may differ */
+  int node = GetNumaNodeAt(dst);
+  if (numa_aligned_alloc((void **)&buf, block_sz_, buf_sz, node)) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  auto flush = [&]() -> bool {
+    uint32_t done = 0;
+    while (done < filled) {
+      int ret = Write(buf + done, filled - done, dst);
+      if (ret < 0) return false;
+      done += ret;
+      dst += ret;
+      *copied += ret;
+    }
+    filled = 0;
+    return true;
+  };
+
+  for (const auto &r : ranges) {
+    uint32_t off = 0;
+    while (off < r.size) {
+      uint32_t n = std::min(r.size - off, buf_sz - filled);
+      int ret = Read(buf + filled, n, r.pos + off, true);
+      if (ret <= 0) {
+        if (ret == -1 && errno == EINTR) continue;
+        if (ret == 0) errno = EIO;
+        numa_aligned_free(buf, buf_sz, node);
+        return -1;
+      }
+      filled += ret;
+      off += ret;
+      if (filled == buf_sz && !flush()) {
+        numa_aligned_free(buf, buf_sz, node);
+        return -1;
+      }
+    }
+  }
+
+  bool ok = flush();
+  numa_aligned_free(buf, buf_sz, node);
+  return ok ? 0 : -1;
+}
+
 int ZonedBlockDevice::Read(char *buf, uint64_t offset, int n, bool direct) {
   int ret = 0;
   int left = n;
   int r = -1;
+  uint64_t trace_start = AquaFSTracer::Get().Now();
+  uint64_t trace_pos = offset;
 
   while (left) {
     r = zbd_be_->Read(buf, left, offset, direct);
@@ -721,10 +1126,181 @@ int ZonedBlockDevice::Read(char *buf, uint64_t offset, int n, bool direct) {
     offset += r;
   }
 
+  AQUAFS_TRACE(TraceEvent::kRead, 0, trace_pos, ret,
+               AquaFSTracer::Get().Since(trace_start));
   if (r < 0) return r;
   return ret;
 }
 
+int ZonedBlockDevice::CachedRead(char *buf, uint64_t offset, int n, Zone *zone,
+                                 IOType io_type) {
+  if (!block_cache_ || !zone || block_cache_->Bypass(io_type))
+    return Read(buf, offset, n, false);
+
+  uint32_t block_sz = GetBlockSize();
+  uint32_t epoch = zone->cache_epoch_.load(std::memory_order_acquire);
+  /* Blocks below the write pointer do not change until the next reset */
+  uint64_t stable_end = zone->wp_ / block_sz * block_sz;
+  size_t hits = 0, misses = 0;
+  int done = 0;
+
+  while (done < n) {
+    uint64_t pos = offset + done;
+    uint64_t block = pos / block_sz * block_sz;
+    size_t in_block = pos - block;
+    size_t len = std::min((size_t)(n - done), (size_t)(block_sz - in_block));
+
+    if (block + block_sz > stable_end) {
+      int r = Read(buf + done, pos, n - done, false);
+      if (r < 0) return r;
+      done += r;
+      break;
+    }
+
+    if (block_cache_->Lookup(block, epoch, buf + done, in_block, len)) {
+      hits++;
+      done += len;
+      continue;
+    }
+
+    /* Read the rest of the request in one go, past the page cache */
+    uint64_t end = (offset + n + block_sz - 1) / block_sz * block_sz;
+    if (end > stable_end) end = stable_end;
+    char *tmp;
+    if (posix_memalign((void **)&tmp, block_sz, end - block)) {
+      int r = Read(buf + done, pos, n - done, false);
+      if (r < 0) return r;
+      done += r;
+      break;
+    }
+    int r = Read(tmp, block, end - block, true);
+    if (r < 0) {
+      free(tmp);
+      return r;
+    }
+    for (uint64_t b = 0; b + block_sz <= (uint64_t)r; b += block_sz) {
+      block_cache_->Insert(block + b, epoch, tmp + b);
+      misses++;
+    }
+    size_t avail = 0;
+    if ((size_t)r > in_block)
+      avail = std::min((size_t)r - in_block, (size_t)(n - done));
+    memcpy(buf + done, tmp + in_block, avail);
+    free(tmp);
+    done += avail;
+    if (avail == 0) break;
+  }
+
+  if (hits) metrics_->ReportQPS(AQUAFS_BLOCK_CACHE_HIT_QPS, hits);
+  if (misses) metrics_->ReportQPS(AQUAFS_BLOCK_CACHE_MISS_QPS, misses);
+  return done;
+}
+
+/* Set on read worker threads, jobs started from a worker run inline so that
+ * workers never wait on jobs queued behind them */
+static thread_local bool in_read_worker = false;
+
+void ZonedBlockDevice::ReadWorker(int numa_node, size_t queue) {
+  bind_thread_to_numa_node(numa_node);
+  in_read_worker = true;
+  while (true) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lk(read_jobs_mtx_);
+      auto &own = read_jobs_[queue];
+      auto &any = read_jobs_.back();
+      read_jobs_cv_.wait(lk, [&] {
+        return read_workers_stop_ || !own.empty() || !any.empty();
+      });
+      auto &jobs = own.empty() ? any : own;
+      /* Drain queued jobs before stopping, their owners wait for them */
+      if (jobs.empty()) return;
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+    job();
+  }
+}
+
+void ZonedBlockDevice::SubmitReadJob(std::function<void()> job,
+                                     int numa_node) {
+  bool node_job = false;
+  {
+    std::lock_guard<std::mutex> lk(read_jobs_mtx_);
+    if (read_workers_.empty()) {
+      /* Spread over the nodes of the devices, with a queue per node when
+       * there are several */
+      size_t nodes = numa_nodes_.size() > 1
+                         ? std::min<size_t>(numa_nodes_.size(),
+                                            AQUAFS_READ_WORKERS)
+                         : 0;
+      read_jobs_.resize(nodes + 1);
+      for (int i = 0; i < AQUAFS_READ_WORKERS; i++) {
+        int node = numa_nodes_.empty()
+                       ? -1
+                       : numa_nodes_[i % numa_nodes_.size()];
+        read_workers_.emplace_back(&ZonedBlockDevice::ReadWorker, this,
+                                   node, nodes ? i % nodes : nodes);
+      }
+    }
+
+    size_t queue = read_jobs_.size() - 1;
+    auto it = std::find(numa_nodes_.begin(), numa_nodes_.end(), numa_node);
+    if (numa_node >= 0 && (size_t)(it - numa_nodes_.begin()) < queue) {
+      queue = it - numa_nodes_.begin();
+      node_job = true;
+    }
+    read_jobs_[queue].push_back(std::move(job));
+  }
+  /* Only the workers of the node take a job queued for it */
+  if (node_job)
+    read_jobs_cv_.notify_all();
+  else
+    read_jobs_cv_.notify_one();
+}
+
+void ZonedBlockDevice::RunReadJobs(
+    size_t count, const std::function<void(size_t)> &job,
+    const std::function<uint64_t(size_t)> &pos_of) {
+  if (count == 1 || in_read_worker) {
+    for (size_t i = 0; i < count; i++) job(i);
+    return;
+  }
+
+  /* Keep the first job for the calling thread, the rest go to the workers */
+  std::mutex mtx;
+  std::condition_variable cv;
+  size_t pending = count - 1;
+  for (size_t i = 1; i < count; i++) {
+    SubmitReadJob(
+        [&, i] {
+          job(i);
+          std::lock_guard<std::mutex> lk(mtx);
+          if (--pending == 0) cv.notify_all();
+        },
+        pos_of ? GetNumaNodeAt(pos_of(i)) : -1);
+  }
+  job(0);
+
+  std::unique_lock<std::mutex> lk(mtx);
+  cv.wait(lk, [&] { return pending == 0; });
+}
+
+void ZonedBlockDevice::TrackAsyncRead(void *handle) {
+  std::lock_guard<std::mutex> lk(read_jobs_mtx_);
+  async_reads_.insert(handle);
+}
+
+void ZonedBlockDevice::UntrackAsyncRead(void *handle) {
+  std::lock_guard<std::mutex> lk(read_jobs_mtx_);
+  async_reads_.erase(handle);
+}
+
+bool ZonedBlockDevice::IsAsyncRead(void *handle) {
+  std::lock_guard<std::mutex> lk(read_jobs_mtx_);
+  return async_reads_.count(handle) > 0;
+}
+
 IOStatus ZonedBlockDevice::ReleaseMigrateZone(Zone *zone) {
   IOStatus s = IOStatus::OK();
   {
@@ -759,8 +1335,97 @@ IOStatus ZonedBlockDevice::TakeMigrateZone(Zone **out_zone,
   return s;
 }
 
+uint32_t ZonedBlockDevice::GetMaxSharedAppendSize() {
+  uint32_t max_append = zbd_be_->GetMaxAppendSize();
+  return max_append ? max_append : AQUAFS_SHARED_APPEND_MAX;
+}
+
+IOStatus ZonedBlockDevice::ReleaseSharedZone(Zone *zone) {
+  bool full = zone->IsFull();
+  IOStatus s = zone->Close();
+  if (!s.ok()) {
+    return s;
+  }
+  s = zone->CheckRelease();
+  if (!s.ok()) {
+    return s;
+  }
+  PutOpenIOZoneToken();
+  if (full) {
+    PutActiveIOZoneToken();
+  }
+  return s;
+}
+
+IOStatus ZonedBlockDevice::AppendShared(char *data, uint32_t size,
+                                        Env::WriteLifeTimeHint lifetime,
+                                        Zone **out_zone, uint64_t *pos) {
+  Zone *zone;
+  IOStatus s;
+
+  if (size > GetMaxSharedAppendSize()) {
+    return IOStatus::InvalidArgument("Shared append too large");
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(shared_zone_mtx_);
+    while (shared_zone_ == nullptr || shared_zone_->capacity_ < size) {
+      if (shared_zone_ != nullptr) {
+        /* Writes still in flight keep the zone, the last one releases it */
+        Zone *retired = shared_zone_;
+        shared_zone_ = nullptr;
+        retired->shared_retired_ = true;
+        if (retired->shared_users_ == 0) {
+          s = ReleaseSharedZone(retired);
+          if (!s.ok()) return s;
+        }
+      }
+
+      Zone *allocated = nullptr;
+      s = AllocateIOZone(lifetime, IOType::kWAL, ZoneTokenClass::kWAL,
+                         &allocated, file_class("", lifetime, IOType::kWAL));
+      if (!s.ok()) return s;
+      if (allocated == nullptr) {
+        return IOStatus::NoSpace("Zone allocation failure\n");
+      }
+      if (allocated->capacity_ < size) {
+        /* Too little left to be of use, finish it so it is not picked
+         * again */
+        s = allocated->Finish();
+        if (!s.ok()) {
+          allocated->Release();
+          return s;
+        }
+      }
+      allocated->shared_retired_ = false;
+      shared_zone_ = allocated;
+    }
+
+    zone = shared_zone_;
+    zone->capacity_ -= size;
+    zone->shared_users_++;
+  }
+
+  s = zone->AppendShared(data, size, pos);
+
+  {
+    std::lock_guard<std::mutex> lock(shared_zone_mtx_);
+    zone->shared_users_--;
+    if (zone->shared_retired_ && zone->shared_users_ == 0) {
+      IOStatus rs = ReleaseSharedZone(zone);
+      if (s.ok()) s = rs;
+    }
+  }
+
+  *out_zone = zone;
+  return s;
+}
+
 IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
-                                          IOType io_type, Zone **out_zone) {
+                                          IOType io_type,
+                                          ZoneTokenClass token_class,
+                                          Zone **out_zone,
+                                          uint32_t file_class) {
   Zone *allocated_zone = nullptr;
   unsigned int best_diff = LIFETIME_DIFF_NOT_GOOD;
   int new_zone = 0;
@@ -778,6 +1443,7 @@ IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
 
   AquaFSMetricsLatencyGuard guard(metrics_, tag, Env::Default());
   metrics_->ReportQPS(AQUAFS_IO_ALLOC_QPS, 1);
+  uint64_t trace_start = AquaFSTracer::Get().Now();
 
   // Check if a deferred IO error was set
   s = GetZoneDeferredStatus();
@@ -785,17 +1451,13 @@ IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
     return s;
   }
 
-  if (io_type != IOType::kWAL) {
-    s = ApplyFinishThreshold();
-    if (!s.ok()) {
-      return s;
-    }
-  }
+  KickFinishWorker();
 
-  WaitForOpenIOZoneToken(io_type == IOType::kWAL);
+  WaitForOpenIOZoneToken(token_class);
 
   /* Try to fill an already open zone(with the best life time diff) */
-  s = GetBestOpenZoneMatch(file_lifetime, &best_diff, &allocated_zone);
+  s = GetBestOpenZoneMatch(file_lifetime, &best_diff, &allocated_zone, 0,
+                           file_class);
   if (!s.ok()) {
     PutOpenIOZoneToken();
     return s;
@@ -847,6 +1509,7 @@ IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
       if (allocated_zone != nullptr) {
         assert(allocated_zone->IsBusy());
         allocated_zone->lifetime_ = file_lifetime;
+        allocated_zone->file_class_ = file_class;
         new_zone = true;
       } else {
         PutActiveIOZoneToken();
@@ -860,6 +1523,10 @@ IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
           "Allocating zone(new=%d) start: 0x%lx wp: 0x%lx lt: %d file lt: %d\n",
           new_zone, allocated_zone->start_, allocated_zone->wp_,
           allocated_zone->lifetime_, file_lifetime);
+    AQUAFS_TRACE(TraceEvent::kZoneAlloc, new_zone, allocated_zone->start_,
+                 allocated_zone->capacity_,
+                 AquaFSTracer::Get().Since(trace_start), file_lifetime,
+                 (uint8_t)io_type);
   } else {
     PutOpenIOZoneToken();
   }
@@ -870,8 +1537,13 @@ IOStatus ZonedBlockDevice::AllocateIOZone(Env::WriteLifeTimeHint file_lifetime,
 
   *out_zone = allocated_zone;
 
-  metrics_->ReportGeneral(AQUAFS_OPEN_ZONES_COUNT, open_io_zones_);
-  metrics_->ReportGeneral(AQUAFS_ACTIVE_ZONES_COUNT, active_io_zones_);
+  metrics_->ReportGeneral(AQUAFS_OPEN_ZONES_COUNT, open_io_zones_.Used());
+  metrics_->ReportGeneral(AQUAFS_ACTIVE_ZONES_COUNT, active_io_zones_.Used());
+  uint64_t remote = GetNumaRemoteBytes();
+  uint64_t reported = numa_remote_reported_.exchange(remote);
+  if (remote > reported)
+    metrics_->ReportThroughput(AQUAFS_NUMA_REMOTE_THROUGHPUT,
+                               remote - reported);
 
   return IOStatus::OK();
 }
@@ -906,9 +1578,37 @@ void ZonedBlockDevice::EncodeJson(std::ostream &json_stream) {
   EncodeJsonZone(json_stream, meta_zones);
   json_stream << ",\"io\":";
   EncodeJsonZone(json_stream, io_zones);
+  json_stream << ",\"write_stats\":";
+  GetWriteStats().EncodeJson(json_stream);
   json_stream << "}";
 }
 
+void ZonedBlockDevice::AccountWrite(Zone *zone, WriteKind kind,
+                                    Env::WriteLifeTimeHint lifetime,
+                                    IOType io_type, uint64_t bytes) {
+  if (bytes == 0) return;
+
+  zone->written_[(uint32_t)kind].fetch_add(bytes, std::memory_order_relaxed);
+  write_stats_.Add(kind, lifetime, io_type, zbd_be_->GetRaidModeAt(zone->start_),
+                   bytes);
+
+  if (!metrics_->IsEnabled()) return;
+  switch (kind) {
+    case WriteKind::kPadding:
+      metrics_->ReportThroughput(AQUAFS_PADDING_WRITE_THROUGHPUT, bytes);
+      break;
+    case WriteKind::kGC:
+      metrics_->ReportThroughput(AQUAFS_GC_WRITE_THROUGHPUT, bytes);
+      break;
+    case WriteKind::kMeta:
+    case WriteKind::kMetaPadding:
+      metrics_->ReportThroughput(AQUAFS_META_WRITE_THROUGHPUT, bytes);
+      break;
+    default:
+      break;
+  }
+}
+
 IOStatus ZonedBlockDevice::GetZoneDeferredStatus() {
   std::lock_guard<std::mutex> lock(zone_deferred_status_mutex_);
   return zone_deferred_status_;
@@ -916,7 +1616,8 @@ IOStatus ZonedBlockDevice::GetZoneDeferredStatus() {
 
 void ZonedBlockDevice::SetZoneDeferredStatus(IOStatus status) {
   std::lock_guard<std::mutex> lk(zone_deferred_status_mutex_);
-  if (!zone_deferred_status_.ok()) {
+  /* Keep the first error */
+  if (zone_deferred_status_.ok()) {
     zone_deferred_status_ = status;
   }
 }
@@ -18,19 +18,28 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <functional>
 #include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include "aquafs_namespace.h"
+#include "block_cache_aquafs.h"
+#include "finish_aquafs.h"
 #include "metrics.h"
+#include "numa_aquafs.h"
+#include "placement_aquafs.h"
 #include "rocksdb/env.h"
 #include "rocksdb/file_system.h"
 #include "rocksdb/io_status.h"
 #include "rocksdb/rocksdb_namespace.h"
+#include "token_aquafs.h"
+#include "write_stats_aquafs.h"
 
 #ifndef KB
 #define KB (1024)
@@ -48,6 +57,40 @@
 #define AQUAFS_META_ZONES (3 + 1)
 #endif
 
+#ifndef AQUAFS_READ_WORKERS
+/* Number of threads serving asynchronous and batched reads, bounds the
+ * queue depth a single reader can reach on the device */
+#define AQUAFS_READ_WORKERS (8)
+#endif
+
+#ifndef AQUAFS_SHARED_APPEND_MAX
+/* Largest write to a shared zone when the backend has no native zone
+ * append and appends are serialized on the zone instead */
+#define AQUAFS_SHARED_APPEND_MAX (1 * MB)
+#endif
+
+#ifndef AQUAFS_COPY_BUFFER_SIZE
+/* Bounce buffer used when copies between zones go through the host */
+#define AQUAFS_COPY_BUFFER_SIZE (1 * MB)
+#endif
+
+#ifndef AQUAFS_FINISH_INTERVAL_MS
+/* How often the finish worker checks the finish threshold and headroom
+ * when no allocation wakes it up earlier */
+#define AQUAFS_FINISH_INTERVAL_MS (100)
+#endif
+
+#ifndef AQUAFS_RESET_INTERVAL_MS
+/* How often the reset worker looks for unused zones that were busy when
+ * their last extent went away, whether or not resets are queued */
+#define AQUAFS_RESET_INTERVAL_MS (1000)
+#endif
+
+#ifndef AQUAFS_RESET_BATCH
+/* Most zones the reset worker resets per wakeup */
+#define AQUAFS_RESET_BATCH (16)
+#endif
+
 #ifndef AQUAFS_MIN_ZONES
 /* Minimum of number of zones that makes sense */
 #define AQUAFS_MIN_ZONES (32)
@@ -56,6 +99,12 @@
 namespace AQUAFS_NAMESPACE {
 using namespace ROCKSDB_NAMESPACE;
 
+/* Block aligned source range of a copy between zones */
+struct ZoneCopyRange {
+  uint64_t pos;
+  uint32_t size;
+};
+
 class ZonedBlockDevice;
 class ZonedBlockDeviceBackend;
 class ZoneSnapshot;
@@ -88,13 +137,42 @@ class Zone {
   uint64_t max_capacity_;
   uint64_t wp_;
   Env::WriteLifeTimeHint lifetime_;
+  /* Class of the file the zone was opened for, see file_class() */
+  uint32_t file_class_;
   std::atomic<uint64_t> used_capacity_;
+  /* Bumped on every reset, stale block cache entries are told apart by it */
+  std::atomic<uint32_t> cache_epoch_{0};
+
+  /* Bytes written to the zone since mount, by WriteKind */
+  std::atomic<uint64_t> written_[(uint32_t)WriteKind::kMax]{};
+  /* When the zone was opened and last written to since mount, for the
+   * finish policy */
+  std::atomic<uint64_t> open_us_{0};
+  std::atomic<uint64_t> last_write_us_{0};
+  /* In the reset queue of the device */
+  std::atomic<bool> reset_queued_{false};
+  /* In the empty zone pool of the device, protected by its lock */
+  bool in_empty_pool_ = false;
+
+  /* Shared zone state, protected by the device shared zone lock */
+  uint32_t shared_users_ = 0;
+  bool shared_retired_ = false;
 
   IOStatus Reset();
-  IOStatus Finish();
+  IOStatus Finish(FinishReason reason = FinishReason::kOther);
   IOStatus Close();
 
   IOStatus Append(char *data, uint32_t size);
+  /* Append for zones written by several files at once. The location is
+   * picked by the device (zone append) and returned in pos; backends
+   * without zone append serialize on the zone and write at the write
+   * pointer. Capacity must have been reserved by the caller. */
+  IOStatus AppendShared(char *data, uint32_t size, uint64_t *pos);
+  /* Copy the ranges, in order, to the write pointer of this zone */
+  IOStatus Copy(const std::vector<ZoneCopyRange> &ranges);
+  /* Drop length bytes of used capacity, queueing the zone for a reset
+   * when nothing in it is used any more */
+  void ReleaseCapacity(uint64_t length);
   bool IsUsed();
   bool IsFull() const;
   bool IsEmpty() const;
@@ -115,6 +193,11 @@ class Zone {
   void EncodeJson(std::ostream &json_stream);
 
   inline IOStatus CheckRelease();
+
+ private:
+  std::mutex append_mtx_;
+
+  void MarkWritten();
 };
 
 class ZonedBlockDeviceBackend {
@@ -136,6 +219,27 @@ class ZonedBlockDeviceBackend {
   virtual int Read(char *buf, int size, uint64_t pos, bool direct) = 0;
   virtual int Write(char *data, uint32_t size, uint64_t pos) = 0;
   virtual int InvalidateCache(uint64_t pos, uint64_t size) = 0;
+  /* Zone append: write to the zone at start at a location picked by the
+   * device, returned in pos. Without native support -1 is returned and
+   * errno is set to EOPNOTSUPP. */
+  virtual int ZoneAppend(char * /*data*/, uint32_t /*size*/,
+                         uint64_t /*start*/, uint64_t * /*pos*/) {
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+  /* RaidMode of the data at pos, RAID_NONE for plain devices */
+  [[nodiscard]] virtual uint32_t GetRaidModeAt(uint64_t /*pos*/) {
+    return 0;
+  }
+  /* Largest single zone append in bytes, 0 without native support */
+  [[nodiscard]] virtual uint32_t GetMaxAppendSize() const { return 0; }
+  /* Copy the ranges, in order, to dst which must be the write pointer of
+   * the destination zone. Returns 0 on success. The bytes written to dst
+   * are returned in copied, also when the copy failed part way. The default
+   * goes through host memory, backends that can copy on the device override
+   * it. */
+  virtual int Copy(const std::vector<ZoneCopyRange> &ranges, uint64_t dst,
+                   uint64_t *copied);
   virtual bool ZoneIsSwr(std::unique_ptr<ZoneList> &zones,
                          unsigned int idx) = 0;
   virtual bool ZoneIsOffline(std::unique_ptr<ZoneList> &zones,
@@ -157,6 +261,18 @@ class ZonedBlockDeviceBackend {
   [[nodiscard]] uint64_t GetZoneSize() const { return zone_sz_; };
   [[nodiscard]] uint32_t GetNrZones() const { return nr_zones_; };
   [[nodiscard]] virtual bool IsRAIDEnabled() const { return false; };
+  /* NUMA nodes of the devices behind the backend, empty if not known */
+  [[nodiscard]] virtual std::vector<int> GetNumaNodes() const {
+    if (numa_node_ < 0) return {};
+    return {numa_node_};
+  }
+  /* NUMA node of the device holding pos, -1 if not known or if pos is
+   * spread over devices on different nodes */
+  virtual int GetNumaNodeAt(uint64_t /*pos*/) { return numa_node_; }
+  /* Bytes read or written from a CPU on another node than the device */
+  [[nodiscard]] virtual uint64_t GetNumaRemoteBytes() const {
+    return numa_remote_bytes_.load(std::memory_order_relaxed);
+  }
   virtual ~ZonedBlockDeviceBackend() = default;
 
   virtual void setZoneOffline(unsigned int idx, unsigned int idx2,
@@ -172,9 +288,42 @@ class ZonedBlockDeviceBackend {
 
  protected:
   std::unordered_set<unsigned int> sim_offline_zones;
+  /* Set by Open() of backends on a device, -1 if not known */
+  int numa_node_ = -1;
+  std::atomic<uint64_t> numa_remote_bytes_{0};
+
+  void AccountNumaIO(uint64_t bytes) {
+    if (numa_node_ >= 0 && cached_numa_node() != numa_node_)
+      numa_remote_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+  }
 };
 
-enum class ZbdBackendType { kBlockDev, kZoneFS, kRaid };
+enum class ZbdBackendType { kBlockDev, kZoneFS, kRaid, kEmu };
+
+/* Token bucket of the reset worker, refilled at rate_per_s resets per
+ * second up to AQUAFS_RESET_BATCH. The time is passed in. */
+class ResetRateLimiter {
+ public:
+  /* Resets out of want allowed at now_us, taken from the bucket */
+  size_t Take(size_t want, uint64_t rate_per_s, uint64_t now_us) {
+    if (last_us_ != 0 && now_us > last_us_)
+      budget_ = std::min<double>(
+          budget_ + (double)(now_us - last_us_) * rate_per_s / 1000000,
+          AQUAFS_RESET_BATCH);
+    last_us_ = now_us;
+    size_t n = std::min<size_t>(want, (size_t)budget_);
+    budget_ -= n;
+    return n;
+  }
+  /* Microseconds until Take() allows one more reset */
+  uint64_t WaitUs(uint64_t rate_per_s) const {
+    return budget_ >= 1 ? 0 : (uint64_t)((1 - budget_) * 1000000 / rate_per_s);
+  }
+
+ private:
+  double budget_ = AQUAFS_RESET_BATCH;
+  uint64_t last_us_ = 0;
+};
 
 class ZonedBlockDevice {
  private:
@@ -183,16 +332,16 @@ class ZonedBlockDevice {
   std::vector<Zone *> meta_zones;
   time_t start_time_{};
   std::shared_ptr<Logger> logger_;
-  uint32_t finish_threshold_ = 0;
+  std::atomic<uint32_t> finish_threshold_{0};
   std::atomic<uint64_t> bytes_written_{0};
   std::atomic<uint64_t> gc_bytes_written_{0};
+  std::atomic<uint64_t> zone_resets_{0};
+  /* Failed resets and finishes of the background workers, retried later */
+  std::atomic<uint64_t> zone_reset_failures_{0};
+  std::atomic<uint64_t> zone_finish_failures_{0};
 
-  std::atomic<long> active_io_zones_{};
-  std::atomic<long> open_io_zones_{};
-  /* Protects zone_resuorces_  condition variable, used
-     for notifying changes in open_io_zones_ */
-  std::mutex zone_resources_mtx_;
-  std::condition_variable zone_resources_;
+  ZoneTokenPool active_io_zones_;
+  ZoneTokenPool open_io_zones_;
   std::mutex zone_deferred_status_mutex_;
   IOStatus zone_deferred_status_;
 
@@ -205,6 +354,57 @@ class ZonedBlockDevice {
 
   std::shared_ptr<AquaFSMetrics> metrics_;
 
+  /* NUMA nodes of the devices, and the node buffers and workers are placed
+   * on, -1 if the devices do not share one */
+  std::vector<int> numa_nodes_;
+  int numa_node_ = -1;
+  std::atomic<uint64_t> numa_remote_reported_{0};
+
+  /* Read workers, started on first use. With devices on several NUMA
+   * nodes, jobs for a device queue for the workers on its node; the last
+   * queue is served by all workers. */
+  std::vector<std::thread> read_workers_;
+  std::vector<std::deque<std::function<void()>>> read_jobs_;
+  std::mutex read_jobs_mtx_;
+  std::condition_variable read_jobs_cv_;
+  bool read_workers_stop_ = false;
+  std::unordered_set<void *> async_reads_;
+
+  std::unique_ptr<AquaFSBlockCache> block_cache_;
+
+  std::unique_ptr<AquaFSPlacement> placement_;
+  std::unique_ptr<LifetimePredictor> lifetime_predictor_;
+
+  /* Finishes zones under the finish threshold and keeps active zones free
+   * for allocations, in the background */
+  ZoneFinishPolicy finish_policy_;
+  std::thread finish_worker_;
+  std::mutex finish_mtx_;
+  std::condition_variable finish_cv_;
+  bool finish_stop_ = false;
+
+  /* Resets zones whose data is all gone in the background, and keeps
+   * the empty zones it made for AllocateEmptyZone */
+  std::thread reset_worker_;
+  std::mutex reset_mtx_;
+  std::condition_variable reset_cv_;
+  std::deque<Zone *> reset_queue_;
+  /* Protected by reset_mtx_ */
+  bool reset_running_ = false;
+  ResetRateLimiter reset_limiter_;
+  std::mutex empty_zones_mtx_;
+  std::deque<Zone *> empty_zones_;
+
+  AquaFSWriteStats write_stats_;
+
+  /* Zone written concurrently through AppendShared */
+  std::mutex shared_zone_mtx_;
+  Zone *shared_zone_ = nullptr;
+
+  void ReadWorker(int numa_node, size_t queue);
+  void FinishWorker();
+  void ResetWorker();
+
   void EncodeJsonZone(std::ostream &json_stream,
                       const std::vector<Zone *> zones);
 
@@ -213,16 +413,33 @@ class ZonedBlockDevice {
                             std::shared_ptr<Logger> logger,
                             std::shared_ptr<AquaFSMetrics> metrics =
                                 std::make_shared<NoAquaFSMetrics>());
+  /* On top of an already constructed backend, e.g. a fault injecting one */
+  explicit ZonedBlockDevice(std::unique_ptr<ZonedBlockDeviceBackend> backend,
+                            std::shared_ptr<Logger> logger,
+                            std::shared_ptr<AquaFSMetrics> metrics =
+                                std::make_shared<NoAquaFSMetrics>());
   virtual ~ZonedBlockDevice();
 
   IOStatus Open(bool readonly, bool exclusive);
 
   Zone *GetIOZone(uint64_t offset);
 
+  /* token_class is the priority of the caller when it has to wait for a
+   * zone token, see zone_token_class() */
   IOStatus AllocateIOZone(Env::WriteLifeTimeHint file_lifetime, IOType io_type,
-                          Zone **out_zone);
+                          ZoneTokenClass token_class, Zone **out_zone,
+                          uint32_t file_class = kNoFileClass);
   IOStatus AllocateMetaZone(Zone **out_meta_zone);
 
+  /* Append to the zone shared by small sparse writers, allocating a new
+   * shared zone when the current one is out of capacity. Returns the zone
+   * and the device offset the data landed at. */
+  IOStatus AppendShared(char *data, uint32_t size,
+                        Env::WriteLifeTimeHint lifetime, Zone **out_zone,
+                        uint64_t *pos);
+  /* Largest size accepted by AppendShared */
+  uint32_t GetMaxSharedAppendSize();
+
   uint64_t GetFreeSpace();
   uint64_t GetUsedSpace();
   uint64_t GetReclaimableSpace();
@@ -230,7 +447,22 @@ class ZonedBlockDevice {
   std::string GetFilename();
   uint32_t GetBlockSize();
 
+  /* Reset every zone with data but nothing used in it, inline */
   IOStatus ResetUnusedIOZones();
+  /* Start finishing and resetting zones in the background. Only for a
+   * mounted file system: until recovery rebuilt the used capacity of the
+   * zones, every zone with data looks unused. */
+  void StartBackgroundWorkers();
+  /* Have the reset worker reset zone once nothing is used in it */
+  void QueueReset(Zone *zone);
+  /* Queue every zone with data but nothing used in it, the reset worker
+   * does this on its own every AQUAFS_RESET_INTERVAL_MS */
+  void SweepUnusedZones();
+  /* Whether --reset_rate_limit applies, it does not while the pool is short
+   * of --reset_pool_size empty zones */
+  bool ResetsThrottled();
+  /* Empty zones waiting in the pool for allocations */
+  size_t GetEmptyZones();
   void LogZoneStats();
   void LogZoneUsage();
   void LogGarbageInfo();
@@ -248,13 +480,39 @@ class ZonedBlockDevice {
 
   void SetZoneDeferredStatus(IOStatus status);
 
-  std::shared_ptr<AquaFSMetrics> GetMetrics() { return metrics_; }
+  const std::shared_ptr<AquaFSMetrics> &GetMetrics() { return metrics_; }
 
   void GetZoneSnapshot(std::vector<ZoneSnapshot> &snapshot);
 
   int Read(char *buf, uint64_t offset, int n, bool direct);
+  /* Buffered read of data in zone through the block cache (if enabled),
+   * misses are read with direct I/O and only the blocks below the write
+   * pointer are cached */
+  int CachedRead(char *buf, uint64_t offset, int n, Zone *zone,
+                 IOType io_type);
+  AquaFSBlockCache *GetBlockCache() { return block_cache_.get(); }
+  AquaFSPlacement *GetPlacement() { return placement_.get(); }
+  /* nullptr unless lifetime prediction is enabled */
+  LifetimePredictor *GetLifetimePredictor() {
+    return lifetime_predictor_.get();
+  }
   IOStatus InvalidateCache(uint64_t pos, uint64_t size);
 
+  /* Run a read job on the read workers, so that independent reads can be
+   * in flight at the same time. Jobs reading from one device pass its
+   * node, see GetNumaNodeAt(), to run on a worker of that node. */
+  void SubmitReadJob(std::function<void()> job, int numa_node = -1);
+  /* Run job(0) .. job(count - 1) on the calling thread and the read
+   * workers, returns when all are done. pos_of(i), if given, is a device
+   * position job i reads from. */
+  void RunReadJobs(size_t count, const std::function<void(size_t)> &job,
+                   const std::function<uint64_t(size_t)> &pos_of = nullptr);
+  /* Bookkeeping for handles handed out by ReadAsync, lets the file system
+   * tell its own handles apart from the ones of the aux file system */
+  void TrackAsyncRead(void *handle);
+  void UntrackAsyncRead(void *handle);
+  bool IsAsyncRead(void *handle);
+
   IOStatus ReleaseMigrateZone(Zone *zone);
 
   IOStatus TakeMigrateZone(Zone **out_zone, Env::WriteLifeTimeHint lifetime,
@@ -262,10 +520,47 @@ class ZonedBlockDevice {
 
   void AddBytesWritten(uint64_t written) { bytes_written_ += written; };
   void AddGCBytesWritten(uint64_t written) { gc_bytes_written_ += written; };
+  void AddZoneReset() { zone_resets_++; };
+  void AddZoneFinish(FinishReason reason, uint64_t wasted) {
+    finish_policy_.Finished(reason, wasted);
+  };
+  uint64_t GetZoneResets() { return zone_resets_.load(); };
+  uint64_t GetZoneResetFailures() { return zone_reset_failures_.load(); };
+  uint64_t GetZoneFinishFailures() { return zone_finish_failures_.load(); };
+  uint64_t GetZoneFinishes() { return finish_policy_.GetFinishes(); };
+  /* Capacity left in zones when they were finished */
+  uint64_t GetFinishWastedBytes() { return finish_policy_.GetWastedBytes(); };
+  ZoneFinishPolicy &GetFinishPolicy() { return finish_policy_; }
   uint64_t GetUserBytesWritten() {
     return bytes_written_.load() - gc_bytes_written_.load();
   };
   uint64_t GetTotalBytesWritten() { return bytes_written_.load(); };
+  /* Attribute bytes written to zone, on top of AddBytesWritten */
+  void AccountWrite(Zone *zone, WriteKind kind,
+                    Env::WriteLifeTimeHint lifetime, IOType io_type,
+                    uint64_t bytes);
+  AquaFSWriteStatsSnapshot GetWriteStats() const {
+    return write_stats_.GetSnapshot();
+  }
+  /* Aligned buffer for I/O to the device, on the NUMA node of the device.
+   * Free with FreeIOBuffer(). */
+  int AllocIOBuffer(void **ptr, size_t align, size_t size) {
+    return numa_aligned_alloc(ptr, align, size, numa_node_);
+  }
+  void FreeIOBuffer(void *ptr, size_t size) {
+    numa_aligned_free(ptr, size, numa_node_);
+  }
+  /* NUMA node of the device holding pos, -1 if not known */
+  int GetNumaNodeAt(uint64_t pos) {
+    if (numa_nodes_.size() <= 1) return numa_node_;
+    return zbd_be_->GetNumaNodeAt(pos);
+  }
+  const std::vector<int> &GetNumaNodes() const { return numa_nodes_; }
+  uint64_t GetNumaRemoteBytes() const {
+    return zbd_be_->GetNumaRemoteBytes();
+  }
+  /* Allocations that had to queue for an open zone token */
+  uint64_t GetOpenIOZoneTokenWaits() const { return open_io_zones_.Waits(); }
 
   [[nodiscard]] bool IsRAIDEnabled() const { return zbd_be_->IsRAIDEnabled(); }
   [[nodiscard]] const std::unique_ptr<ZonedBlockDeviceBackend> &getBackend()
@@ -276,13 +571,30 @@ class ZonedBlockDevice {
  private:
   IOStatus GetZoneDeferredStatus();
   bool GetActiveIOZoneTokenIfAvailable();
-  void WaitForOpenIOZoneToken(bool prioritized);
+  void WaitForOpenIOZoneToken(ZoneTokenClass cls);
+  /* Also called on zones that are not acquired, the result may then be
+   * stale */
+  FinishCandidate GetFinishCandidate(Zone *z);
+  /* Finish the acquired zone z and release it */
+  IOStatus FinishIOZone(Zone *z, FinishReason reason);
+  /* Acquired cheapest zone to finish, nullptr if there is none */
+  IOStatus PickFinishVictim(bool idle_only, Zone **victim);
   IOStatus ApplyFinishThreshold();
   IOStatus FinishCheapestIOZone();
+  IOStatus KeepFinishHeadroom();
+  /* Wake the finish worker if active zones run short */
+  void KickFinishWorker();
   IOStatus GetBestOpenZoneMatch(Env::WriteLifeTimeHint file_lifetime,
                                 unsigned int *best_diff_out, Zone **zone_out,
-                                uint32_t min_capacity = 0);
+                                uint32_t min_capacity = 0,
+                                uint32_t file_class = kNoFileClass);
   IOStatus AllocateEmptyZone(Zone **zone_out);
+  /* Reset the acquired zone z if it is unused, and release it */
+  IOStatus ResetIOZone(Zone *z);
+  void PutEmptyZone(Zone *z);
+  Zone *TakeEmptyZone();
+  /* Must hold shared_zone_mtx_ */
+  IOStatus ReleaseSharedZone(Zone *zone);
 };
 
 }  // namespace AQUAFS_NAMESPACE
@@ -11,10 +11,13 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <libzbd/zbd.h>
+#include <linux/nvme_ioctl.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <fstream>
 #include <string>
 
@@ -29,7 +32,13 @@ ZbdlibBackend::ZbdlibBackend(std::string bdevname)
     : filename_("/dev/" + bdevname),
       read_f_(-1),
       read_direct_f_(-1),
-      write_f_(-1) {}
+      write_f_(-1),
+      nsid_(0),
+      lba_sz_(0),
+      max_append_sz_(0),
+      copy_ranges_(0),
+      copy_range_len_(0),
+      copy_len_(0) {}
 
 std::string ZbdlibBackend::ErrorToString(int err) {
   char *err_str = strerror(err);
@@ -61,6 +70,58 @@ IOStatus ZbdlibBackend::CheckScheduler() {
   return IOStatus::OK();
 }
 
+uint64_t ZbdlibBackend::ReadQueueAttr(const std::string &attr) {
+  std::string s = filename_;
+  uint64_t val = 0;
+
+  s.erase(0, 5);  // Remove "/dev/" from /dev/nvmeXnY
+  std::ifstream f("/sys/block/" + s + "/queue/" + attr);
+  if (!(f >> val)) return 0;
+  return val;
+}
+
+int ZbdlibBackend::Identify(uint32_t cns, uint32_t nsid, void *data) {
+  struct nvme_admin_cmd cmd = {};
+  cmd.opcode = 0x06; /* Identify */
+  cmd.nsid = nsid;
+  cmd.addr = (uint64_t)(uintptr_t)data;
+  cmd.data_len = 4096;
+  cmd.cdw10 = cns;
+  return ioctl(write_f_, NVME_IOCTL_ADMIN_CMD, &cmd);
+}
+
+/* Zone append and Simple Copy are issued as NVMe passthrough on the write
+ * descriptor, so they are only used for NVMe namespaces */
+void ZbdlibBackend::DetectNvme(uint32_t lba_sz) {
+  if (write_f_ < 0 || lba_sz == 0) return;
+  if (filename_.compare(0, 9, "/dev/nvme") != 0) return;
+
+  int nsid = ioctl(write_f_, NVME_IOCTL_ID);
+  if (nsid <= 0) return;
+  nsid_ = nsid;
+  lba_sz_ = lba_sz;
+
+  uint64_t max_append = ReadQueueAttr("zone_append_max_bytes");
+  uint64_t max_hw = ReadQueueAttr("max_hw_sectors_kb") * 1024;
+  if (max_hw && max_hw < max_append) max_append = max_hw;
+  max_append_sz_ = max_append - max_append % block_sz_;
+
+  uint8_t *id;
+  if (posix_memalign((void **)&id, 4096, 4096)) return;
+
+  /* ONCS bit 8 in the controller data: Copy command supported */
+  if (Identify(1, 0, id) == 0 && (id[521] & 0x1)) {
+    /* MSSRL, MCL and MSRC (0's based) of the namespace */
+    if (Identify(0, nsid_, id) == 0) {
+      copy_range_len_ = id[74] | (id[75] << 8);
+      copy_len_ = id[76] | (id[77] << 8) | (id[78] << 16) |
+                  ((uint32_t)id[79] << 24);
+      if (copy_range_len_ && copy_len_) copy_ranges_ = id[80] + 1;
+    }
+  }
+  free(id);
+}
+
 IOStatus ZbdlibBackend::Open(bool readonly, bool exclusive,
                              unsigned int *max_active_zones,
                              unsigned int *max_open_zones) {
@@ -107,6 +168,8 @@ IOStatus ZbdlibBackend::Open(bool readonly, bool exclusive,
   block_sz_ = info.pblock_size;
   zone_sz_ = info.zone_size;
   nr_zones_ = info.nr_zones;
+  DetectNvme(info.lblock_size);
+  numa_node_ = device_numa_node(filename_);
   *max_active_zones = info.max_nr_active_zones;
   *max_open_zones = info.max_nr_open_zones;
   return IOStatus::OK();
@@ -205,12 +268,132 @@ int ZbdlibBackend::Read(char *buf, int size, uint64_t pos, bool direct) {
     pos2 += std::min(static_cast<int>(zone_sz_), sz);
     sz -= zone_sz_;
   }
-  return pread(direct ? read_direct_f_ : read_f_, buf, size, pos);
+  int ret = pread(direct ? read_direct_f_ : read_f_, buf, size, pos);
+  if (ret > 0) AccountNumaIO(ret);
+  return ret;
 }
 
 int ZbdlibBackend::Write(char *data, uint32_t size, uint64_t pos) {
   // printf("ZbdlibBackend::Write size=%x, pos=%lx\n", size, pos);
-  return pwrite(write_f_, data, size, pos);
+  int ret = pwrite(write_f_, data, size, pos);
+  if (ret > 0) AccountNumaIO(ret);
+  return ret;
+}
+
+int ZbdlibBackend::ZoneAppend(char *data, uint32_t size, uint64_t start,
+                              uint64_t *pos) {
+  if (size > max_append_sz_ || size % lba_sz_) {
+    errno = EOPNOTSUPP;
+    return -1;
+  }
+
+  struct nvme_passthru_cmd64 cmd = {};
+  uint64_t zslba = start / lba_sz_;
+  cmd.opcode = 0x7d; /* Zone Append */
+  cmd.nsid = nsid_;
+  cmd.addr = (uint64_t)(uintptr_t)data;
+  cmd.data_len = size;
+  cmd.cdw10 = zslba & 0xffffffff;
+  cmd.cdw11 = zslba >> 32;
+  cmd.cdw12 = size / lba_sz_ - 1;
+
+  int ret = ioctl(write_f_, NVME_IOCTL_IO64_CMD, &cmd);
+  if (ret < 0) return -1;
+  if (ret > 0) {
+    /* NVMe status code, the append was not done */
+    errno = EIO;
+    return -1;
+  }
+
+  /* Passthrough does not go through the page cache, drop anything cached
+   * for the range from before the zone was last reset */
+  *pos = cmd.result * lba_sz_;
+  posix_fadvise(read_f_, *pos, size, POSIX_FADV_DONTNEED);
+  AccountNumaIO(size);
+  return size;
+}
+
+/* NVMe Simple Copy, split into as few commands as the namespace limits
+ * allow. Source range descriptors use format 0. */
+int ZbdlibBackend::Copy(const std::vector<ZoneCopyRange> &ranges,
+                        uint64_t dst, uint64_t *copied) {
+  struct CopyDesc {
+    uint64_t rsvd0;
+    uint64_t slba;
+    uint16_t nlb;
+    uint8_t rsvd18[14];
+  };
+  static_assert(sizeof(CopyDesc) == 32, "NVMe copy descriptor is 32 bytes");
+
+  if (copy_ranges_ == 0)
+    return ZonedBlockDeviceBackend::Copy(ranges, dst, copied);
+
+  *copied = 0;
+
+  CopyDesc *desc;
+  if (posix_memalign((void **)&desc, 4096, copy_ranges_ * sizeof(CopyDesc))) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  uint64_t dlba = dst / lba_sz_;
+  uint64_t r_off = 0;
+  size_t r = 0;
+  while (r < ranges.size()) {
+    uint32_t nr = 0;
+    uint64_t total = 0;
+
+    memset(desc, 0, copy_ranges_ * sizeof(CopyDesc));
+    while (r < ranges.size() && nr < copy_ranges_ && total < copy_len_) {
+      uint64_t nlb = (ranges[r].size - r_off) / lba_sz_;
+      nlb = std::min<uint64_t>(nlb, copy_range_len_);
+      nlb = std::min<uint64_t>(nlb, copy_len_ - total);
+      nlb = std::min<uint64_t>(nlb, 1 << 16);
+      desc[nr].slba = (ranges[r].pos + r_off) / lba_sz_;
+      desc[nr].nlb = nlb - 1;
+      nr++;
+      total += nlb;
+      r_off += nlb * lba_sz_;
+      if (r_off == ranges[r].size) {
+        r++;
+        r_off = 0;
+      }
+    }
+
+    struct nvme_passthru_cmd64 cmd = {};
+    cmd.opcode = 0x19; /* Copy */
+    cmd.nsid = nsid_;
+    cmd.addr = (uint64_t)(uintptr_t)desc;
+    cmd.data_len = nr * sizeof(CopyDesc);
+    cmd.cdw10 = dlba & 0xffffffff;
+    cmd.cdw11 = dlba >> 32;
+    cmd.cdw12 = nr - 1;
+
+    int ret = ioctl(write_f_, NVME_IOCTL_IO64_CMD, &cmd);
+    if (ret != 0) {
+      if (ret > 0) errno = EIO;
+      int err = errno;
+      /* A failed command may still have copied some of its blocks, the
+       * write pointer tells how far it got */
+      unsigned int report = 1;
+      struct zbd_zone z;
+      uint64_t zone_start = dst / zone_sz_ * zone_sz_;
+      if (zbd_report_zones(read_f_, zone_start, zone_sz_, ZBD_RO_ALL, &z,
+                           &report) == 0 &&
+          report == 1 && zbd_zone_wp(&z) >= dst)
+        *copied = zbd_zone_wp(&z) - dst;
+      free(desc);
+      errno = err;
+      return -1;
+    }
+    posix_fadvise(read_f_, dlba * lba_sz_, total * lba_sz_,
+                  POSIX_FADV_DONTNEED);
+    dlba += total;
+    *copied += total * lba_sz_;
+  }
+
+  free(desc);
+  return 0;
 }
 
 }  // namespace AQUAFS_NAMESPACE
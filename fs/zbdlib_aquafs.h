@@ -26,6 +26,15 @@ public:
   int read_f_;
   int read_direct_f_;
   int write_f_;
+  /* NVMe namespace and LBA size for passthrough commands, nsid_ is 0 for
+   * devices that are not NVMe namespaces */
+  uint32_t nsid_;
+  uint32_t lba_sz_;
+  uint32_t max_append_sz_;
+  /* Simple Copy limits in LBAs, copy_ranges_ is 0 when not supported */
+  uint32_t copy_ranges_;
+  uint32_t copy_range_len_;
+  uint32_t copy_len_;
 
  public:
   explicit ZbdlibBackend(std::string bdevname);
@@ -44,6 +53,10 @@ public:
   int Read(char *buf, int size, uint64_t pos, bool direct);
   int Write(char *data, uint32_t size, uint64_t pos);
   int InvalidateCache(uint64_t pos, uint64_t size);
+  int ZoneAppend(char *data, uint32_t size, uint64_t start, uint64_t *pos);
+  int Copy(const std::vector<ZoneCopyRange> &ranges, uint64_t dst,
+           uint64_t *copied);
+  [[nodiscard]] uint32_t GetMaxAppendSize() const { return max_append_sz_; }
 
   bool ZoneIsSwr(std::unique_ptr<ZoneList> &zones, unsigned int idx) {
     struct zbd_zone *z = &((struct zbd_zone *)zones->GetData())[idx];
@@ -89,6 +102,9 @@ public:
 
  private:
   IOStatus CheckScheduler();
+  uint64_t ReadQueueAttr(const std::string &attr);
+  int Identify(uint32_t cns, uint32_t nsid, void *data);
+  void DetectNvme(uint32_t lba_sz);
   std::string ErrorToString(int err);
 };
 
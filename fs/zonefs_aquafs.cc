@@ -9,6 +9,7 @@
 #include "zonefs_aquafs.h"
 
 #include <assert.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <mntent.h>
@@ -32,6 +33,7 @@
     (S_IRUSR | S_IRGRP | S_IROTH | S_IWUSR | S_IWGRP | S_IWOTH)) == 0)
 #define AQUAFS_ZONEFS_DEFAULT_MAX_LIMIT 14
 #define AQUAFS_ZONEFS_DEFAULT_MAX_RD_LIMIT 100
+#define AQUAFS_ZONEFS_RD_SHARDS 16
 
 #include "rocksdb/io_status.h"
 #include "rocksdb/rocksdb_namespace.h"
@@ -39,26 +41,31 @@
 namespace AQUAFS_NAMESPACE {
 using namespace ROCKSDB_NAMESPACE;
 
-ZoneFsFileCache::ZoneFsFileCache(int flags) {
-  if (flags & O_RDONLY)
-    max_ = AQUAFS_ZONEFS_DEFAULT_MAX_RD_LIMIT;
+ZoneFsFileCache::ZoneFsFileCache(int flags, unsigned nr_shards) {
+  unsigned max;
+  if ((flags & O_ACCMODE) == O_RDONLY)
+    max = AQUAFS_ZONEFS_DEFAULT_MAX_RD_LIMIT;
   else
-    max_ = AQUAFS_ZONEFS_DEFAULT_MAX_LIMIT;
+    max = AQUAFS_ZONEFS_DEFAULT_MAX_LIMIT;
   flags_ = flags;
+  for (unsigned i = 0; i < std::max(1u, nr_shards); i++)
+    shards_.emplace_back(new Shard());
+  Resize(max);
 }
 
 ZoneFsFileCache::~ZoneFsFileCache() {}
 
 void ZoneFsFileCache::Put(uint64_t zone) {
-  std::lock_guard<std::mutex> lock(mtx_);
-  auto entry = map_.find(zone);
-  if (entry != map_.end()) {
-    list_.erase(entry->second);
-    map_.erase(entry);
+  Shard *shard = GetShard(zone);
+  std::lock_guard<std::mutex> lock(shard->mtx_);
+  auto entry = shard->map_.find(zone);
+  if (entry != shard->map_.end()) {
+    shard->list_.erase(entry->second);
+    shard->map_.erase(entry);
   }
 }
 
-void ZoneFsFileCache::Prune(unsigned limit) {
+void ZoneFsFileCache::Shard::Prune(unsigned limit) {
   while (list_.size() > limit) {
     map_.erase(list_.rbegin()->first);
     list_.pop_back();
@@ -67,38 +74,52 @@ void ZoneFsFileCache::Prune(unsigned limit) {
 
 std::shared_ptr<ZoneFsFile> ZoneFsFileCache::Get(uint64_t zone,
                                                  std::string filename) {
-  std::lock_guard<std::mutex> lock(mtx_);
-  std::shared_ptr<ZoneFsFile> zoneFsFile(nullptr);
-  auto entry = map_.find(zone);
-
-  if (entry == map_.end()) {
-    int fd = open(filename.c_str(), flags_);
-    if (fd == -1) return nullptr;
-    Prune(max_ - 1);
-    zoneFsFile = std::make_shared<ZoneFsFile>(fd);
-    list_.emplace_front(zone, zoneFsFile);
-    map_.emplace(zone, list_.begin());
-  } else {
-    zoneFsFile = entry->second->second;
-    list_.splice(list_.begin(), list_, entry->second);
+  Shard *shard = GetShard(zone);
+  {
+    std::lock_guard<std::mutex> lock(shard->mtx_);
+    auto entry = shard->map_.find(zone);
+    if (entry != shard->map_.end()) {
+      shard->list_.splice(shard->list_.begin(), shard->list_, entry->second);
+      return entry->second->second;
+    }
+  }
+
+  // Open without holding the shard lock, open() may block on the device
+  int fd = open(filename.c_str(), flags_);
+  if (fd == -1) return nullptr;
+  auto zoneFsFile = std::make_shared<ZoneFsFile>(fd);
+
+  std::lock_guard<std::mutex> lock(shard->mtx_);
+  auto entry = shard->map_.find(zone);
+  if (entry != shard->map_.end()) {
+    // Somebody else opened it meanwhile, ours is closed when dropped
+    shard->list_.splice(shard->list_.begin(), shard->list_, entry->second);
+    return entry->second->second;
   }
+  shard->Prune(shard->max_ - 1);
+  shard->list_.emplace_front(zone, zoneFsFile);
+  shard->map_.emplace(zone, shard->list_.begin());
   return zoneFsFile;
 }
 
 void ZoneFsFileCache::Resize(unsigned new_size) {
-  std::lock_guard<std::mutex> lock(mtx_);
-  if (new_size < max_) {
-    Prune(new_size);
+  unsigned nr_shards = shards_.size();
+  unsigned shard_size = std::max(1u, (new_size + nr_shards - 1) / nr_shards);
+  for (auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mtx_);
+    if (shard_size < shard->max_) {
+      shard->Prune(shard_size);
+    }
+    shard->max_ = shard_size;
   }
-  max_ = new_size;
 }
 
 ZoneFsBackend::ZoneFsBackend(std::string mountpoint)
     : mountpoint_(mountpoint),
       zone_zero_fd_(-1),
       readonly_(false),
-      rd_fds_(O_RDONLY),
-      direct_rd_fds_(O_RDONLY | O_DIRECT),
+      rd_fds_(O_RDONLY, AQUAFS_ZONEFS_RD_SHARDS),
+      direct_rd_fds_(O_RDONLY | O_DIRECT, AQUAFS_ZONEFS_RD_SHARDS),
       wr_fds_(O_WRONLY | O_DIRECT) {}
 
 ZoneFsBackend::~ZoneFsBackend() {
@@ -211,24 +232,94 @@ IOStatus ZoneFsBackend::Open(bool readonly,
   wr_fds_.Resize(*max_active_zones);
 
   readonly_ = readonly;
+  numa_node_ = device_numa_node(mountpoint_);
+
+  {
+    std::lock_guard<std::mutex> lock(zone_stat_mtx_);
+    zone_stat_valid_ = false;
+  }
+
+  return IOStatus::OK();
+}
+
+IOStatus ZoneFsBackend::RefreshZoneStat() {
+  std::string seqdirname = mountpoint_ + "/seq";
+  std::vector<struct stat> zone_stat(nr_zones_);
+  std::vector<bool> found(nr_zones_, false);
+  uint32_t nr_found = 0;
+
+  // One directory pass with stats relative to the directory fd, instead of
+  // a full path lookup per zone file
+  DIR *dir = opendir(seqdirname.c_str());
+  if (dir == nullptr)
+    return IOStatus::IOError("Failed to open zonefs sequential zone dir: " +
+                             ErrorToString(errno));
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != nullptr) {
+    char *end;
+    errno = 0;
+    unsigned long idx = strtoul(ent->d_name, &end, 10);
+    if (errno || *end != '\0' || end == ent->d_name || idx >= nr_zones_)
+      continue;
+    if (fstatat(dirfd(dir), ent->d_name, &zone_stat[idx], 0) < 0) {
+      closedir(dir);
+      return IOStatus::IOError("Failed to stat zonefs zone file " +
+                               std::string(ent->d_name) + ": " +
+                               ErrorToString(errno));
+    }
+    if (!found[idx]) nr_found++;
+    found[idx] = true;
+  }
+  closedir(dir);
+
+  if (nr_found != nr_zones_)
+    return IOStatus::IOError("Missing zonefs sequential zone files");
+
+  std::lock_guard<std::mutex> lock(zone_stat_mtx_);
+  zone_stat_ = std::move(zone_stat);
+  zone_stat_valid_ = true;
+  return IOStatus::OK();
+}
 
+IOStatus ZoneFsBackend::RefreshZoneStat(uint64_t start) {
+  struct stat file_stat;
+  std::string filename = LBAToZoneFile(start);
+
+  if (stat(filename.c_str(), &file_stat) < 0) {
+    std::lock_guard<std::mutex> lock(zone_stat_mtx_);
+    zone_stat_valid_ = false;
+    return IOStatus::InvalidArgument(
+        "Failed to access zonefs sequential zone " + filename + ": " +
+        ErrorToString(errno));
+  }
+
+  std::lock_guard<std::mutex> lock(zone_stat_mtx_);
+  if (zone_stat_valid_) zone_stat_[start / zone_sz_] = file_stat;
   return IOStatus::OK();
 }
 
+void ZoneFsBackend::UpdateZoneWp(uint64_t start, uint64_t offset) {
+  std::lock_guard<std::mutex> lock(zone_stat_mtx_);
+  if (!zone_stat_valid_) return;
+  auto &z = zone_stat_[start / zone_sz_];
+  if ((uint64_t)z.st_size < offset) z.st_size = offset;
+}
+
 std::unique_ptr<ZoneList> ZoneFsBackend::ListZones() {
-  uint32_t i;
+  bool valid;
+  {
+    std::lock_guard<std::mutex> lock(zone_stat_mtx_);
+    valid = zone_stat_valid_;
+  }
+  if (!valid && !RefreshZoneStat().ok()) return nullptr;
+
   struct stat *z = (struct stat *)calloc(nr_zones_, sizeof(struct stat));
   if (!z) {
     return nullptr;
   }
 
-  for (i = 0; i < nr_zones_; i++) {
-    std::string filename = mountpoint_ + "/seq/" + std::to_string(i);
-    if (stat(filename.c_str(), &z[i]) < 0) {
-      free(z);
-      return nullptr;
-    }
-  }
+  std::lock_guard<std::mutex> lock(zone_stat_mtx_);
+  memcpy(z, zone_stat_.data(), sizeof(struct stat) * nr_zones_);
 
   std::unique_ptr<ZoneList> zl(new ZoneList((void *)z, nr_zones_));
 
@@ -249,11 +340,18 @@ IOStatus ZoneFsBackend::Reset(uint64_t start, bool *offline,
   PutZoneFile(start, O_WRONLY);
 
   if (stat(filename.c_str(), &file_stat) < 0) {
+    std::lock_guard<std::mutex> lock(zone_stat_mtx_);
+    zone_stat_valid_ = false;
     return IOStatus::InvalidArgument(
         "Failed to access zonefs sequential zone " + filename + ": " +
         ErrorToString(errno));
   }
 
+  {
+    std::lock_guard<std::mutex> lock(zone_stat_mtx_);
+    if (zone_stat_valid_) zone_stat_[start / zone_sz_] = file_stat;
+  }
+
   if (AQUAFS_ZONEFS_ZONE_OFFLINE(file_stat.st_mode)) {
     *offline = true;
     *max_capacity = 0;
@@ -275,7 +373,7 @@ IOStatus ZoneFsBackend::Finish(uint64_t start) {
     return IOStatus::IOError("Zone finish failed: " + ErrorToString(errno));
   PutZoneFile(start, O_WRONLY);
 
-  return IOStatus::OK();
+  return RefreshZoneStat(start);
 }
 
 std::shared_ptr<ZoneFsFile> ZoneFsBackend::GetZoneFile(uint64_t start,
@@ -335,6 +433,7 @@ int ZoneFsBackend::Read(char *buf, int size, uint64_t pos, bool direct) {
       break;
     }
   }
+  if (read > 0) AccountNumaIO(read);
 
   return read;
 }
@@ -362,6 +461,10 @@ int ZoneFsBackend::Write(char *data, uint32_t size, uint64_t pos) {
       break;
     }
   }
+  if (written > 0) {
+    UpdateZoneWp(pos, offset);
+    AccountNumaIO(written);
+  }
 
   return written;
 }
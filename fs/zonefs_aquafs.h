@@ -10,11 +10,16 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <list>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "rocksdb/io_status.h"
 #include "rocksdb/rocksdb_namespace.h"
@@ -37,25 +42,33 @@ class ZoneFsFile {
 
 class ZoneFsFileCache {
  private:
-  std::list<std::pair<uint64_t, std::shared_ptr<ZoneFsFile>>> list_;
-  std::unordered_map<
-      uint64_t,
-      std::list<std::pair<uint64_t, std::shared_ptr<ZoneFsFile>>>::iterator>
-      map_;
-  std::mutex mtx_;
-  unsigned max_;
+  using FileList = std::list<std::pair<uint64_t, std::shared_ptr<ZoneFsFile>>>;
+
+  // Zones are spread over independent LRU shards so that readers of
+  // different zones do not contend on a single lock.
+  struct Shard {
+    FileList list_;
+    std::unordered_map<uint64_t, FileList::iterator> map_;
+    std::mutex mtx_;
+    unsigned max_;
+
+    void Prune(unsigned limit);
+  };
+
+  std::vector<std::unique_ptr<Shard>> shards_;
   int flags_;
 
+  Shard *GetShard(uint64_t zone) {
+    return shards_[zone % shards_.size()].get();
+  }
+
  public:
-  explicit ZoneFsFileCache(int flags);
+  explicit ZoneFsFileCache(int flags, unsigned nr_shards = 1);
   ~ZoneFsFileCache();
 
   void Put(uint64_t zone);
   std::shared_ptr<ZoneFsFile> Get(uint64_t zone, std::string filename);
   void Resize(unsigned new_size);
-
- private:
-  void Prune(unsigned limit);
 };
 
 class ZoneFsBackend : public ZonedBlockDeviceBackend {
@@ -67,6 +80,13 @@ class ZoneFsBackend : public ZonedBlockDeviceBackend {
   ZoneFsFileCache direct_rd_fds_;
   ZoneFsFileCache wr_fds_;
 
+  // Zone state as reported by zonefs, filled once by a single pass over the
+  // seq directory and then kept up to date by Reset/Finish/Write, so that
+  // ListZones() does not stat() every zone file each time.
+  std::vector<struct stat> zone_stat_;
+  bool zone_stat_valid_ = false;
+  std::mutex zone_stat_mtx_;
+
  public:
   explicit ZoneFsBackend(std::string mountpoint);
   ~ZoneFsBackend();
@@ -99,6 +119,9 @@ class ZoneFsBackend : public ZonedBlockDeviceBackend {
   unsigned int GetSysFsValue(std::string dev_name, std::string field);
   std::shared_ptr<ZoneFsFile> GetZoneFile(uint64_t start, int flags);
   void PutZoneFile(uint64_t start, int flags);
+  IOStatus RefreshZoneStat();
+  IOStatus RefreshZoneStat(uint64_t start);
+  void UpdateZoneWp(uint64_t start, uint64_t offset);
 };
 
 }  // namespace AQUAFS_NAMESPACE
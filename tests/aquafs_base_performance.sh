@@ -28,5 +28,29 @@ NAME="aquafs-$DEV-baseline_performance"
 
 echo "$(tput setaf 4)Running AquaFS baseline performance tests, results will be stored in results/$NAME $(tput sgr 0)"
 
+export AQUAFS_STATS=1
 DB_BENCH_EXTRA_PARAMS="$GOOD_PARAMS" FS_PARAMS="--fs_uri=$FS_URI" ./run.sh $NAME quick_performance
 DB_BENCH_EXTRA_PARAMS="$GOOD_PARAMS" FS_PARAMS="--fs_uri=$FS_URI" ./run.sh $NAME long_performance
+
+# Baselines are kept per device model, set UPDATE_BASELINE=1 to store this
+# run as the new baseline. PERF_THRESHOLDS takes e.g.
+# "--threshold ops_per_sec=3 --threshold p99_us=15"
+DEVICE_TYPE=$(cat /sys/class/block/$DEV/device/model 2>/dev/null | xargs | tr ' ' '_')
+DEVICE_TYPE=${DEVICE_TYPE:-unknown}
+if [[ "$MNT" != "" ]]; then
+    DEVICE_TYPE="$DEVICE_TYPE-zonefs"
+fi
+BASELINE=${BASELINE:-baselines/$DEVICE_TYPE.json}
+
+./perf_report.py parse results/$NAME --device-type $DEVICE_TYPE -o results/$NAME/perf.json
+echo "Performance results available at results/$NAME/perf.json"
+
+if [[ "$UPDATE_BASELINE" == "1" ]]; then
+    mkdir -p $(dirname $BASELINE)
+    cp results/$NAME/perf.json $BASELINE
+    echo "Stored as the baseline $BASELINE"
+elif [ -f $BASELINE ]; then
+    ./perf_report.py compare results/$NAME/perf.json $BASELINE $PERF_THRESHOLDS
+else
+    echo "No baseline $BASELINE to compare against, rerun with UPDATE_BASELINE=1 to store one"
+fi
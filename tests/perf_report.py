@@ -0,0 +1,192 @@
+#!/usr/bin/env python3
+#
+# Performance results of the db_bench test sets as JSON, and regression
+# checks against a stored baseline.
+#
+#   perf_report.py parse <result path> --device-type <type> -o <run.json>
+#   perf_report.py compare <run.json> <baseline.json> [--threshold m=pct]
+#
+# parse reads the .out files run.sh leaves for every test, and the
+# .stats.json files AquaFS writes when db_bench is given --stats_file.
+# compare exits with 1 when a metric moved the wrong way by more than its
+# threshold.
+
+import argparse
+import json
+import os
+import re
+import sys
+
+RUN_RE = re.compile(r'^# Running db_bench with parameters: (.*)$')
+RESULT_RE = re.compile(
+    r'^(\w+)\s+:\s+([\d.]+) micros/op\s+(\d+) ops/sec'
+    r'(?:.*?;\s+([\d.]+) MB/s)?')
+PERCENTILES_RE = re.compile(
+    r'^Percentiles: P50: ([\d.]+) P75: ([\d.]+) P99: ([\d.]+) '
+    r'P99\.9: ([\d.]+) P99\.99: ([\d.]+)')
+VALUE_SIZE_RE = re.compile(r'--value_size=(\d+)')
+
+# Metric: (direction, default threshold in percent). A metric regresses
+# when it goes down for 'higher' and up for 'lower'.
+METRICS = {
+    'ops_per_sec': ('higher', 5.0),
+    'mb_per_s': ('higher', 5.0),
+    'p50_us': ('lower', 10.0),
+    'p99_us': ('lower', 10.0),
+    'p999_us': ('lower', 20.0),
+    'write_amplification': ('lower', 5.0),
+    'gc_bytes': ('lower', 20.0),
+    'zone_resets': ('lower', 20.0),
+    'finish_wasted_bytes': ('lower', 20.0),
+}
+
+
+def parse_out(path):
+    """One entry per db_bench benchmark found in a test output"""
+    runs = []
+    params = ''
+    process = -1
+    current = None
+    with open(path) as f:
+        for line in f:
+            line = line.rstrip('\n')
+            m = RUN_RE.match(line)
+            if m:
+                params = m.group(1)
+                process += 1
+                continue
+            m = RESULT_RE.match(line)
+            if m:
+                current = {
+                    'benchmark': m.group(1),
+                    'params': params,
+                    'process': process,
+                    'micros_per_op': float(m.group(2)),
+                    'ops_per_sec': int(m.group(3)),
+                }
+                if m.group(4):
+                    current['mb_per_s'] = float(m.group(4))
+                runs.append(current)
+                continue
+            m = PERCENTILES_RE.match(line)
+            if m and current is not None and 'p50_us' not in current:
+                current['p50_us'] = float(m.group(1))
+                current['p99_us'] = float(m.group(3))
+                current['p999_us'] = float(m.group(4))
+    return runs
+
+
+def parse_stats(path):
+    if not os.path.exists(path):
+        return []
+    with open(path) as f:
+        return [json.loads(line) for line in f if line.strip()]
+
+
+def parse(result_path, device_type):
+    workloads = {}
+    for root, _, files in sorted(os.walk(result_path)):
+        for name in sorted(files):
+            if not name.endswith('.out') or '.PRE_CMD' in name or \
+                    '.POST_CMD' in name:
+                continue
+            test = os.path.relpath(os.path.join(root, name[:-4]),
+                                   result_path)
+            runs = parse_out(os.path.join(root, name))
+            stats = parse_stats(os.path.join(root, name[:-4] + '.stats.json'))
+            for run in runs:
+                # AquaFS writes one stats line per db_bench process
+                process = run.pop('process')
+                if 0 <= process < len(stats):
+                    s = stats[process]
+                    for k in ('write_amplification', 'gc_bytes',
+                              'zone_resets', 'zone_finishes',
+                              'finish_wasted_bytes'):
+                        if k in s:
+                            run[k] = s[k]
+                key = '%s/%s' % (test, run['benchmark'])
+                vs = VALUE_SIZE_RE.search(run['params'])
+                if vs:
+                    key += '/value_size=%s' % vs.group(1)
+                workloads[key] = run
+    return {'device_type': device_type, 'workloads': workloads}
+
+
+def compare(run, baseline, thresholds):
+    regressions = 0
+    print('%-60s %-20s %14s %14s %8s' %
+          ('workload', 'metric', 'baseline', 'current', 'change'))
+    for key, base in sorted(baseline['workloads'].items()):
+        cur = run['workloads'].get(key)
+        if cur is None:
+            print('%-60s missing from this run' % key)
+            regressions += 1
+            continue
+        for metric, (direction, _) in METRICS.items():
+            if metric not in base or metric not in cur or not base[metric]:
+                continue
+            change = 100.0 * (cur[metric] - base[metric]) / base[metric]
+            worse = -change if direction == 'higher' else change
+            flag = ''
+            if worse > thresholds[metric]:
+                flag = ' REGRESSION'
+                regressions += 1
+            print('%-60s %-20s %14.2f %14.2f %+7.1f%%%s' %
+                  (key, metric, base[metric], cur[metric], change, flag))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    sub = parser.add_subparsers(dest='cmd', required=True)
+
+    p = sub.add_parser('parse', help='collect the results of a run')
+    p.add_argument('result_path')
+    p.add_argument('--device-type', default='unknown')
+    p.add_argument('-o', '--output', help='defaults to stdout')
+
+    c = sub.add_parser('compare', help='check a run against a baseline')
+    c.add_argument('run')
+    c.add_argument('baseline')
+    c.add_argument('--threshold', action='append', default=[],
+                   metavar='METRIC=PERCENT',
+                   help='allowed change before a metric counts as a '
+                        'regression, one of: ' + ', '.join(METRICS))
+
+    args = parser.parse_args()
+
+    if args.cmd == 'parse':
+        report = json.dumps(parse(args.result_path, args.device_type),
+                            indent=2, sort_keys=True)
+        if args.output:
+            with open(args.output, 'w') as f:
+                f.write(report + '\n')
+        else:
+            print(report)
+        return 0
+
+    thresholds = {m: t for m, (_, t) in METRICS.items()}
+    for t in args.threshold:
+        metric, _, pct = t.partition('=')
+        if metric not in METRICS:
+            parser.error('unknown metric: ' + metric)
+        thresholds[metric] = float(pct)
+
+    with open(args.run) as f:
+        run = json.load(f)
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    if run['device_type'] != baseline['device_type']:
+        print('warning: comparing %s against a %s baseline' %
+              (run['device_type'], baseline['device_type']), file=sys.stderr)
+
+    regressions = compare(run, baseline, thresholds)
+    if regressions:
+        print('%d regression(s) against %s' % (regressions, args.baseline))
+        return 1
+    print('No regressions against %s' % args.baseline)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -6,7 +6,7 @@ echo "" > $TEST_OUT
 
 for VALUE_SIZE in 100 200 400 1000 2000 8000; do
   NUM=$(( $WORKLOAD_SZ / $VALUE_SIZE ))
-  DB_BENCH_PARAMS="--benchmarks=fillseq --num=$NUM --value_size=$VALUE_SIZE --compression_type=none --histogram $FS_PARAMS $DB_BENCH_EXTRA_PARAMS"
+  DB_BENCH_PARAMS="--benchmarks=fillseq --num=$NUM --value_size=$VALUE_SIZE --compression_type=none --histogram $FS_PARAMS $STATS_PARAMS $DB_BENCH_EXTRA_PARAMS"
   echo "# Running db_bench with parameters: $DB_BENCH_PARAMS" >> $TEST_OUT
   $TOOLS_DIR/db_bench $DB_BENCH_PARAMS >> $TEST_OUT
   RES=$?
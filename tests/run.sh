@@ -46,6 +46,12 @@ do
   
   export RESULT_DIR="$RESULT_DIR"
   export TEST_OUT="$RESULT_PATH/${TEST/.sh/.out}"
+  if [ -v AQUAFS_STATS ]; then
+    # AquaFS appends a JSON line per db_bench run when it unmounts
+    STATS_OUT="$RESULT_PATH/${TEST/.sh/.stats.json}"
+    rm -f $STATS_OUT
+    export STATS_PARAMS="--stats_file=$STATS_OUT"
+  fi
   START_SECONDS=$SECONDS
   
   if [ -v PRE_CMD ]; then
@@ -0,0 +1,567 @@
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+// Zone layer microbenchmarks
+//
+// Drives AquaFS and its ZonedBlockDevice directly, without a RocksDB
+// database on top, so that allocator, write path, read path, metadata and
+// GC costs can be measured in isolation. Every benchmark prints one JSON
+// object per line. Without a device an in-memory emulated one is used.
+
+#include <gflags/gflags.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fs/fs_aquafs.h"
+#include "fs/metrics.h"
+#include "fs/metrics_histogram.h"
+#include "fs/trace_aquafs.h"
+#include "tools/tools.h"
+
+DEFINE_string(benchmarks,
+              "alloc,wal,sst,buffered,seqread,randread,meta,gc,overhead",
+              "Comma separated benchmarks to run");
+DEFINE_int32(threads, 4, "Threads of the multi-threaded benchmarks");
+DEFINE_string(alloc_threads, "",
+              "Comma separated thread counts to run the alloc benchmark "
+              "with, e.g. 1,2,4,8,16,32, instead of --threads");
+DEFINE_uint64(ops, 10000, "Operations per thread");
+DEFINE_uint64(bytes, 64 << 20, "Bytes written per thread when streaming");
+DEFINE_uint64(wal_record_size, 512, "Bytes appended before every WAL sync");
+DEFINE_uint64(sst_block_size, 1 << 20, "Bytes per direct SST append");
+DEFINE_uint64(buffered_size, 16 << 10, "Bytes per buffered append");
+DEFINE_uint64(read_size, 4096, "Bytes per positioned read");
+DEFINE_string(raid_modes, "",
+              "Run the benchmarks once per RAID mode (raid0,raid1,raidc,"
+              "raida), on in-memory emulated members built from --emu");
+DEFINE_int32(raid_members, 2, "Emulated members per RAID device");
+
+namespace aquafs {
+
+/* Keeps a count of what is reported per label, so that the benchmarks can
+ * tell e.g. how many metadata zone rolls they caused */
+class BenchMetrics : public AquaFSMetrics {
+ public:
+  static const uint32_t kMaxLabels = 128;
+
+  void AddReporter(uint32_t /*label*/, uint32_t /*type*/) override {}
+  void Report(uint32_t label, size_t /*value*/,
+              uint32_t /*type_check*/) override {
+    if (label < kMaxLabels) count_[label].fetch_add(1, std::memory_order_relaxed);
+  }
+  void ReportSnapshot(const AquaFSSnapshot & /*snapshot*/) override {}
+
+  uint64_t Count(uint32_t label) const {
+    return count_[label].load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<uint64_t> count_[kMaxLabels] = {};
+};
+
+struct BenchResult {
+  std::string name;
+  int threads = FLAGS_threads;
+  uint64_t ops = 0;
+  uint64_t bytes = 0;
+  uint64_t elapsed_us = 0;
+  AquaFSHistogram latency;
+  std::map<std::string, double> extra;
+};
+
+struct BenchContext {
+  std::string device;
+  std::string raid;
+  ZonedBlockDevice *zbd;
+  AquaFS *fs;
+  BenchMetrics *metrics;
+  char *buf;
+  uint64_t buf_sz;
+};
+
+static uint64_t NowMicros() { return AquaFSMetricsClock::NowMicros(); }
+
+static void PrintResult(const BenchContext &ctx, BenchResult &r) {
+  AquaFSHistogramSnapshot lat = r.latency.Snapshot();
+  double secs = r.elapsed_us / 1e6;
+
+  std::ostringstream json;
+  json << "{\"benchmark\":\"" << r.name << "\",\"device\":\"" << ctx.device
+       << "\",\"raid\":\"" << ctx.raid << "\",\"threads\":" << r.threads
+       << ",\"ops\":" << r.ops << ",\"bytes\":" << r.bytes
+       << ",\"elapsed_us\":" << r.elapsed_us
+       << ",\"ops_per_s\":" << (secs > 0 ? r.ops / secs : 0)
+       << ",\"mb_per_s\":"
+       << (secs > 0 ? r.bytes / (1024.0 * 1024.0) / secs : 0)
+       << ",\"latency_us\":{\"mean\":" << lat.Mean()
+       << ",\"p50\":" << lat.Percentile(50) << ",\"p99\":"
+       << lat.Percentile(99) << ",\"p999\":" << lat.Percentile(99.9)
+       << ",\"max\":" << lat.max << "}";
+  for (const auto &e : r.extra) json << ",\"" << e.first << "\":" << e.second;
+  json << "}";
+  fprintf(stdout, "%s\n", json.str().c_str());
+  fflush(stdout);
+}
+
+/* Runs fn on every thread and times the whole run */
+static IOStatus RunThreads(int threads, BenchResult *r,
+                           const std::function<IOStatus(int)> &fn) {
+  std::vector<std::thread> workers;
+  std::vector<IOStatus> status(threads);
+  uint64_t start = NowMicros();
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t]() { status[t] = fn(t); });
+  }
+  for (auto &w : workers) w.join();
+  r->elapsed_us = NowMicros() - start;
+
+  for (const auto &s : status)
+    if (!s.ok()) return s;
+  return IOStatus::OK();
+}
+
+static IOStatus WriteFile(const BenchContext &ctx, const std::string &fname,
+                          uint64_t size, uint64_t append_sz, bool direct,
+                          Env::WriteLifeTimeHint lifetime,
+                          AquaFSHistogram *latency = nullptr) {
+  FileOptions fopts;
+  fopts.use_direct_writes = direct;
+  std::unique_ptr<FSWritableFile> file;
+  IOStatus s = ctx.fs->NewWritableFile(fname, fopts, &file, nullptr);
+  if (!s.ok()) return s;
+  file->SetWriteLifeTimeHint(lifetime);
+
+  for (uint64_t done = 0; done < size; done += append_sz) {
+    uint64_t n = std::min(append_sz, size - done);
+    uint64_t start = NowMicros();
+    s = file->Append(Slice(ctx.buf, n), IOOptions(), nullptr);
+    if (s.ok() && !direct) s = file->Flush(IOOptions(), nullptr);
+    if (!s.ok()) return s;
+    if (latency) latency->Record(NowMicros() - start);
+  }
+  return file->Close(IOOptions(), nullptr);
+}
+
+static std::string ThreadFile(const char *prefix, int t, const char *suffix) {
+  return std::string("bench/") + prefix + std::to_string(t) + suffix;
+}
+
+static void DeleteFiles(const BenchContext &ctx, const char *prefix,
+                        int threads, const char *suffix) {
+  for (int t = 0; t < threads; t++)
+    ctx.fs->DeleteFile(ThreadFile(prefix, t, suffix), IOOptions(), nullptr)
+        .PermitUncheckedError();
+}
+
+/* AllocateIOZone under contention, every thread allocates and gives back
+ * a zone for its own lifetime hint. Every fourth thread allocates for a WAL,
+ * medium lifetimes count as flushes and the rest as compactions. */
+static IOStatus BenchAlloc(const BenchContext &ctx, BenchResult *r,
+                           int threads) {
+  AquaFSHistogram wal_latency;
+  uint64_t waits = ctx.zbd->GetOpenIOZoneTokenWaits();
+  IOStatus s = RunThreads(threads, r, [&](int t) {
+    Env::WriteLifeTimeHint lifetime =
+        (Env::WriteLifeTimeHint)(Env::WLTH_SHORT + t % 4);
+    IOType io_type = t % 4 == 0 ? IOType::kWAL : IOType::kUnknown;
+    for (uint64_t i = 0; i < FLAGS_ops; i++) {
+      Zone *zone = nullptr;
+      uint64_t start = NowMicros();
+      IOStatus s = ctx.zbd->AllocateIOZone(
+          lifetime, io_type, zone_token_class(lifetime, io_type), &zone);
+      if (!s.ok()) return s;
+      if (zone == nullptr) return IOStatus::NoSpace("Zone allocation failed");
+      bool full = zone->IsFull();
+      s = zone->Close();
+      zone->Release();
+      ctx.zbd->PutOpenIOZoneToken();
+      if (full) ctx.zbd->PutActiveIOZoneToken();
+      if (!s.ok()) return s;
+      uint64_t lat = NowMicros() - start;
+      r->latency.Record(lat);
+      if (io_type == IOType::kWAL) wal_latency.Record(lat);
+    }
+    return IOStatus::OK();
+  });
+  r->threads = threads;
+  /* Count what completed, an allocation failure stops its thread early */
+  r->ops = r->latency.Snapshot().count;
+  r->extra["wal_p99_us"] = wal_latency.Snapshot().Percentile(99);
+  r->extra["token_waits"] = ctx.zbd->GetOpenIOZoneTokenWaits() - waits;
+  return s;
+}
+
+/* Small WAL records, each followed by a sync */
+static IOStatus BenchWal(const BenchContext &ctx, BenchResult *r) {
+  IOStatus s = RunThreads(FLAGS_threads, r, [&](int t) {
+    std::unique_ptr<FSWritableFile> file;
+    IOStatus s = ctx.fs->NewWritableFile(ThreadFile("wal", t, ".log"),
+                                         FileOptions(), &file, nullptr);
+    if (!s.ok()) return s;
+    for (uint64_t i = 0; i < FLAGS_ops; i++) {
+      uint64_t start = NowMicros();
+      s = file->Append(Slice(ctx.buf, FLAGS_wal_record_size), IOOptions(),
+                       nullptr);
+      if (s.ok()) s = file->Sync(IOOptions(), nullptr);
+      if (!s.ok()) return s;
+      r->latency.Record(NowMicros() - start);
+    }
+    return file->Close(IOOptions(), nullptr);
+  });
+  r->ops = FLAGS_threads * FLAGS_ops;
+  r->bytes = r->ops * FLAGS_wal_record_size;
+  DeleteFiles(ctx, "wal", FLAGS_threads, ".log");
+  return s;
+}
+
+/* Streaming direct writes, like flushes and compactions */
+static IOStatus BenchSst(const BenchContext &ctx, BenchResult *r) {
+  IOStatus s = RunThreads(FLAGS_threads, r, [&](int t) {
+    return WriteFile(ctx, ThreadFile("sst", t, ".sst"), FLAGS_bytes,
+                     FLAGS_sst_block_size, true, Env::WLTH_MEDIUM,
+                     &r->latency);
+  });
+  r->bytes = FLAGS_threads * FLAGS_bytes;
+  r->ops = r->latency.Snapshot().count;
+  DeleteFiles(ctx, "sst", FLAGS_threads, ".sst");
+  return s;
+}
+
+/* Buffered appends with a flush each */
+static IOStatus BenchBuffered(const BenchContext &ctx, BenchResult *r) {
+  IOStatus s = RunThreads(FLAGS_threads, r, [&](int t) {
+    return WriteFile(ctx, ThreadFile("buf", t, ".sst"), FLAGS_bytes,
+                     FLAGS_buffered_size, false, Env::WLTH_MEDIUM,
+                     &r->latency);
+  });
+  r->bytes = FLAGS_threads * FLAGS_bytes;
+  r->ops = r->latency.Snapshot().count;
+  DeleteFiles(ctx, "buf", FLAGS_threads, ".sst");
+  return s;
+}
+
+/* PositionedRead over files written first, untimed */
+static IOStatus BenchRead(const BenchContext &ctx, BenchResult *r,
+                          bool random) {
+  for (int t = 0; t < FLAGS_threads; t++) {
+    IOStatus s = WriteFile(ctx, ThreadFile("rd", t, ".sst"), FLAGS_bytes,
+                           FLAGS_sst_block_size, true, Env::WLTH_MEDIUM);
+    if (!s.ok()) return s;
+  }
+
+  uint64_t nr_blocks = FLAGS_bytes / FLAGS_read_size;
+  IOStatus s = RunThreads(FLAGS_threads, r, [&](int t) {
+    std::unique_ptr<FSRandomAccessFile> file;
+    FileOptions fopts;
+    fopts.use_direct_reads = true;
+    IOStatus s = ctx.fs->NewRandomAccessFile(ThreadFile("rd", t, ".sst"),
+                                             fopts, &file, nullptr);
+    if (!s.ok()) return s;
+
+    char *scratch = nullptr;
+    if (posix_memalign((void **)&scratch, ctx.zbd->GetBlockSize(),
+                       FLAGS_read_size))
+      return IOStatus::IOError("Failed to allocate read buffer");
+    std::mt19937_64 rng(t);
+    for (uint64_t i = 0; i < FLAGS_ops && s.ok(); i++) {
+      uint64_t block = random ? rng() % nr_blocks : i % nr_blocks;
+      Slice result;
+      uint64_t start = NowMicros();
+      s = file->Read(block * FLAGS_read_size, FLAGS_read_size, IOOptions(),
+                     &result, scratch, nullptr);
+      r->latency.Record(NowMicros() - start);
+    }
+    free(scratch);
+    return s;
+  });
+  r->ops = FLAGS_threads * FLAGS_ops;
+  r->bytes = r->ops * FLAGS_read_size;
+  DeleteFiles(ctx, "rd", FLAGS_threads, ".sst");
+  return s;
+}
+
+/* Metadata records through renames, rolling the metadata zone when it
+ * fills up */
+static IOStatus BenchMeta(const BenchContext &ctx, BenchResult *r) {
+  for (int t = 0; t < FLAGS_threads; t++) {
+    IOStatus s = WriteFile(ctx, ThreadFile("meta", t, ".a"), 4096, 4096,
+                           false, Env::WLTH_SHORT);
+    if (!s.ok()) return s;
+  }
+
+  uint64_t rolls = ctx.metrics->Count(AQUAFS_ROLL_LATENCY);
+  IOStatus s = RunThreads(FLAGS_threads, r, [&](int t) {
+    std::string a = ThreadFile("meta", t, ".a");
+    std::string b = ThreadFile("meta", t, ".b");
+    for (uint64_t i = 0; i < FLAGS_ops; i++) {
+      uint64_t start = NowMicros();
+      IOStatus s = ctx.fs->RenameFile(i % 2 ? b : a, i % 2 ? a : b,
+                                      IOOptions(), nullptr);
+      if (!s.ok()) return s;
+      r->latency.Record(NowMicros() - start);
+    }
+    return IOStatus::OK();
+  });
+  r->ops = FLAGS_threads * FLAGS_ops;
+  r->extra["meta_zone_rolls"] =
+      ctx.metrics->Count(AQUAFS_ROLL_LATENCY) - rolls;
+  DeleteFiles(ctx, "meta", FLAGS_threads, FLAGS_ops % 2 ? ".b" : ".a");
+  return s;
+}
+
+/* Files sharing zones, half of them deleted, then the live extents of
+ * those zones are migrated one zone at a time */
+static IOStatus BenchGC(const BenchContext &ctx, BenchResult *r) {
+  const int files = 16;
+  uint64_t file_sz = FLAGS_bytes / 4;
+  file_sz -= file_sz % ctx.zbd->GetBlockSize();
+  for (int f = 0; f < files; f++) {
+    IOStatus s = WriteFile(ctx, ThreadFile("gc", f, ".sst"), file_sz,
+                           FLAGS_sst_block_size, true, Env::WLTH_LONG);
+    if (!s.ok()) return s;
+  }
+  for (int f = 0; f < files; f += 2)
+    ctx.fs->DeleteFile(ThreadFile("gc", f, ".sst"), IOOptions(), nullptr)
+        .PermitUncheckedError();
+
+  AquaFSSnapshot snapshot;
+  AquaFSSnapshotOptions options;
+  options.zone_ = true;
+  options.zone_file_ = true;
+  ctx.fs->GetAquaFSSnapshot(snapshot, options);
+
+  /* Zones holding both live and deleted data */
+  std::map<uint64_t, std::vector<ZoneExtentSnapshot *>> victims;
+  for (const auto &zone : snapshot.zones_) {
+    if (zone.used_capacity > 0 && zone.used_capacity < zone.wp - zone.start)
+      victims[zone.start];
+  }
+  for (auto &file : snapshot.zone_files_) {
+    for (auto &ext : file.extents) {
+      auto it = victims.find(ext.zone_start);
+      if (it == victims.end()) continue;
+      it->second.push_back(&ext);
+      r->bytes += ext.length;
+    }
+  }
+
+  uint64_t start = NowMicros();
+  for (const auto &v : victims) {
+    uint64_t t0 = NowMicros();
+    IOStatus s = ctx.fs->MigrateExtents(v.second);
+    if (!s.ok()) return s;
+    r->latency.Record(NowMicros() - t0);
+    r->ops++;
+  }
+  r->elapsed_us = NowMicros() - start;
+  r->extra["zones"] = victims.size();
+
+  for (int f = 1; f < files; f += 2)
+    ctx.fs->DeleteFile(ThreadFile("gc", f, ".sst"), IOOptions(), nullptr)
+        .PermitUncheckedError();
+  return IOStatus::OK();
+}
+
+/* Cost of the instrumentation on the fast path, in nanoseconds per call:
+ * latency guards with disabled and enabled metrics, a disabled trace point
+ * and a histogram sample */
+static IOStatus BenchOverhead(const BenchContext &ctx, BenchResult *r) {
+  const uint64_t n = FLAGS_ops * 100;
+  auto no_metrics = std::make_shared<NoAquaFSMetrics>();
+  auto time_ns = [n](const std::function<void()> &fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < n; i++) fn();
+    auto end = std::chrono::steady_clock::now();
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               end - start)
+               .count() /
+           n;
+  };
+
+  uint64_t start = NowMicros();
+  r->extra["guard_disabled_ns"] = time_ns([&]() {
+    AquaFSMetricsLatencyGuard guard(no_metrics, AQUAFS_WRITE_LATENCY,
+                                    Env::Default());
+  });
+  r->extra["guard_enabled_ns"] = time_ns([&]() {
+    AquaFSMetricsLatencyGuard guard(ctx.metrics, AQUAFS_WRITE_LATENCY,
+                                    Env::Default());
+  });
+  r->extra["trace_ns"] = time_ns(
+      [&]() { AQUAFS_TRACE(TraceEvent::kWrite, 0, 0, 0); });
+  AquaFSHistogram hist;
+  uint64_t v = 0;
+  r->extra["histogram_record_ns"] = time_ns([&]() { hist.Record(v++); });
+  r->elapsed_us = NowMicros() - start;
+  r->ops = 4 * n;
+  return IOStatus::OK();
+}
+
+static IOStatus RunBenchmark(const BenchContext &ctx, const std::string &name,
+                             BenchResult *r) {
+  r->name = name;
+  if (name == "alloc") return BenchAlloc(ctx, r, FLAGS_threads);
+  if (name == "wal") return BenchWal(ctx, r);
+  if (name == "sst") return BenchSst(ctx, r);
+  if (name == "buffered") return BenchBuffered(ctx, r);
+  if (name == "seqread") return BenchRead(ctx, r, false);
+  if (name == "randread") return BenchRead(ctx, r, true);
+  if (name == "meta") return BenchMeta(ctx, r);
+  if (name == "gc") return BenchGC(ctx, r);
+  if (name == "overhead") return BenchOverhead(ctx, r);
+  return IOStatus::InvalidArgument("Unknown benchmark: " + name);
+}
+
+static std::vector<std::string> Split(const std::string &s, char sep) {
+  std::vector<std::string> out;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, sep))
+    if (!item.empty()) out.push_back(item);
+  return out;
+}
+
+/* Creates a fresh file system on the device and mounts it */
+static int RunSuite(const std::string &path, ZbdBackendType type,
+                    const std::string &raid) {
+  auto metrics = std::make_shared<BenchMetrics>();
+  mkdir(FLAGS_aux_path.c_str(), 0750);
+  if (FLAGS_aux_path.back() != '/') FLAGS_aux_path += "/";
+
+  for (int mount = 0; mount < 2; mount++) {
+    std::unique_ptr<AquaFS> fs;
+    ZonedBlockDevice *zbd = new ZonedBlockDevice(path, type, nullptr, metrics);
+    IOStatus ios = zbd->Open(false, true);
+    if (!ios.ok()) {
+      fprintf(stderr, "Failed to open %s: %s\n", path.c_str(),
+              ios.ToString().c_str());
+      delete zbd;
+      return 1;
+    }
+    fs.reset(new AquaFS(zbd, FileSystem::Default(), nullptr));
+
+    if (mount == 0) {
+      Status s = fs->MkFS(FLAGS_aux_path, 0, false);
+      if (!s.ok()) {
+        fprintf(stderr, "Failed to create file system: %s\n",
+                s.ToString().c_str());
+        return 1;
+      }
+      continue;
+    }
+
+    Status s = fs->Mount(false);
+    if (!s.ok()) {
+      fprintf(stderr, "Failed to mount: %s\n", s.ToString().c_str());
+      return 1;
+    }
+    fs->CreateDirIfMissing("bench", IOOptions(), nullptr)
+        .PermitUncheckedError();
+
+    BenchContext ctx;
+    ctx.device = path;
+    ctx.raid = raid;
+    ctx.zbd = zbd;
+    ctx.fs = fs.get();
+    ctx.metrics = metrics.get();
+    ctx.buf_sz = std::max({FLAGS_sst_block_size, FLAGS_buffered_size,
+                           FLAGS_wal_record_size, (uint64_t)4096});
+    if (posix_memalign((void **)&ctx.buf, zbd->GetBlockSize(), ctx.buf_sz))
+      return 1;
+    memset(ctx.buf, 0x5a, ctx.buf_sz);
+
+    int ret = 0;
+    for (const auto &name : Split(FLAGS_benchmarks, ',')) {
+      if (name == "alloc" && !FLAGS_alloc_threads.empty()) {
+        /* Allocation scalability against the number of threads */
+        for (const auto &threads : Split(FLAGS_alloc_threads, ',')) {
+          BenchResult r;
+          r.name = name;
+          IOStatus bs = BenchAlloc(ctx, &r, std::stoi(threads));
+          if (!bs.ok()) {
+            fprintf(stderr, "%s failed: %s\n", name.c_str(),
+                    bs.ToString().c_str());
+            ret = 1;
+            break;
+          }
+          PrintResult(ctx, r);
+        }
+        if (ret) break;
+        continue;
+      }
+      BenchResult r;
+      IOStatus bs = RunBenchmark(ctx, name, &r);
+      if (!bs.ok()) {
+        fprintf(stderr, "%s failed: %s\n", name.c_str(),
+                bs.ToString().c_str());
+        ret = 1;
+        break;
+      }
+      PrintResult(ctx, r);
+    }
+    free(ctx.buf);
+    return ret;
+  }
+  return 0;
+}
+
+}  // namespace aquafs
+
+int main(int argc, char **argv) {
+  using namespace aquafs;
+  gflags::SetUsageMessage(std::string("\nUSAGE:\n") + argv[0] +
+                          " [--zbd=<dev> | --zonefs=<mnt> | --raids=<uri> | "
+                          "--emu=<options>] [--benchmarks=...] [OPTIONS]");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (FLAGS_aux_path.empty()) FLAGS_aux_path = "/tmp/aquafs_bench_aux";
+
+  bool emulated = FLAGS_zbd.empty() && FLAGS_zonefs.empty() &&
+                  FLAGS_raids.empty();
+  if (!emulated && !FLAGS_force) {
+    fprintf(stderr,
+            "The benchmarks format the device, use --force if you want to "
+            "do this.\n");
+    return 1;
+  }
+  if (emulated && FLAGS_emu.empty()) FLAGS_emu = "zones=64:zone_size=64M";
+
+  if (!FLAGS_raid_modes.empty()) {
+    int ret = 0;
+    for (const auto &mode : Split(FLAGS_raid_modes, ',')) {
+      std::string uri = mode + ":";
+      for (int m = 0; m < FLAGS_raid_members; m++) {
+        if (m) uri += ",";
+        uri += "emu:" + FLAGS_emu + ":mem=aquafs_bench_" + mode + "_" +
+               std::to_string(m);
+      }
+      ret |= RunSuite(uri, ZbdBackendType::kRaid, mode);
+    }
+    return ret;
+  }
+
+  if (!FLAGS_zbd.empty())
+    return RunSuite(FLAGS_zbd, ZbdBackendType::kBlockDev, "");
+  if (!FLAGS_zonefs.empty())
+    return RunSuite(FLAGS_zonefs, ZbdBackendType::kZoneFS, "");
+  if (!FLAGS_raids.empty())
+    return RunSuite(FLAGS_raids, ZbdBackendType::kRaid,
+                    FLAGS_raids.substr(0, FLAGS_raids.find(':')));
+  return RunSuite(FLAGS_emu + ":mem=aquafs_bench", ZbdBackendType::kEmu, "");
+}
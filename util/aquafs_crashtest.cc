@@ -0,0 +1,395 @@
+// Copyright (c) 2019-present, Western Digital Corporation
+//  This source code is licensed under both the GPLv2 (found in the
+//  COPYING file in the root directory) and Apache 2.0 License
+//  (found in the LICENSE.Apache file in the root directory).
+
+// In-process crash consistency test
+//
+// Runs random file operations against AquaFS on an emulated device wrapped
+// in a fault injecting backend, cuts the power at a random I/O, mounts the
+// device again and checks what survived against a model of what was made
+// durable. Every iteration is reproducible from its seed.
+
+#include <gflags/gflags.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "fs/emu_aquafs.h"
+#include "fs/fault_aquafs.h"
+#include "fs/fs_aquafs.h"
+
+DEFINE_uint64(seed, 0, "Seed of the first iteration, iterations count up");
+DEFINE_uint64(iterations, 100, "Number of file systems created");
+DEFINE_uint64(epochs, 4, "Power cuts and remounts per file system");
+DEFINE_uint64(ops, 200, "File operations per epoch at most");
+DEFINE_string(emu_spec, "zones=40:zone_size=4M:max_active=12:max_open=12",
+              "Geometry of the emulated device, see --emu of aquafs");
+DEFINE_string(crash_aux_path, "/tmp/aquafs_crashtest_aux",
+              "Auxiliary directory of the file system");
+DEFINE_uint64(power_cut_range, 2000,
+              "The power is cut at a random mutating I/O below this");
+DEFINE_double(fail_write, 0, "Rate of failed writes");
+DEFINE_double(torn_write, 0.001, "Rate of torn writes");
+DEFINE_double(drop_write, 0,
+              "Rate of writes acknowledged without reaching the device, "
+              "data is not checksummed so expect these to be reported");
+DEFINE_double(fail_reset, 0.01, "Rate of failed zone resets");
+DEFINE_double(fail_finish, 0.01, "Rate of failed zone finishes");
+DEFINE_double(offline_on_reset, 0.001, "Rate of zones going offline on reset");
+DEFINE_bool(verbose, false, "Print every iteration");
+
+namespace aquafs {
+
+static const std::string kDir = "crash";
+
+/* Content of byte off of a file, so that data never has to be kept */
+static char PatternByte(uint64_t file_seed, uint64_t off) {
+  uint64_t x = file_seed * 0x9e3779b97f4a7c15ULL + (off >> 3);
+  x ^= x >> 31;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 29;
+  return (char)(x >> ((off & 7) * 8));
+}
+
+/* What the harness knows about a file */
+struct ModelFile {
+  uint64_t seed = 0;
+  uint64_t written = 0; /* bytes appended successfully */
+  uint64_t durable = 0; /* bytes covered by a successful fsync or close */
+  uint64_t attempted = 0; /* written plus an append that failed */
+  bool synced = false;  /* the file must exist after a crash */
+  bool may_be_gone = false;  /* a delete was interrupted */
+  std::string alt_name; /* name the file may have after an interrupted
+                           rename */
+};
+
+struct OpenFile {
+  std::unique_ptr<FSWritableFile> file;
+  bool direct = false;
+};
+
+class CrashTest {
+ public:
+  explicit CrashTest(uint64_t seed)
+      : seed_(seed),
+        rng_(seed),
+        mem_("aquafs_crashtest_" + std::to_string(seed)) {}
+  ~CrashTest() {
+    fs_.reset();
+    EmuBackend::RemoveMemoryDevice(mem_);
+  }
+
+  bool Run();
+
+ private:
+  std::string Spec() const { return FLAGS_emu_spec + ":mem=" + mem_; }
+  bool Format();
+  bool Mount(const FaultOptions &faults);
+  void Crash();
+  bool RunEpoch();
+  bool Verify();
+  bool Fail(const std::string &msg);
+
+  bool Create();
+  bool Append();
+  bool Sync(bool close);
+  bool Delete();
+  bool Rename();
+
+  uint64_t Rand(uint64_t n) { return n ? rng_() % n : 0; }
+  std::string NewName() {
+    bool wal = Rand(4) == 0;
+    return kDir + "/" + std::to_string(next_file_++) + (wal ? ".log" : ".sst");
+  }
+
+  uint64_t seed_;
+  std::mt19937_64 rng_;
+  std::string mem_;
+  uint64_t next_file_ = 0;
+  uint64_t epoch_ = 0;
+  uint64_t ios_ = 0;
+
+  std::unique_ptr<AquaFS> fs_;
+  FaultInjectionBackend *fault_ = nullptr;
+  std::map<std::string, ModelFile> model_;
+  std::map<std::string, OpenFile> open_;
+  char *buf_ = nullptr;
+};
+
+bool CrashTest::Fail(const std::string &msg) {
+  fprintf(stderr, "seed %lu epoch %lu: %s\n", seed_, epoch_, msg.c_str());
+  return false;
+}
+
+bool CrashTest::Format() {
+  mkdir(FLAGS_crash_aux_path.c_str(), 0750);
+  std::string aux = FLAGS_crash_aux_path;
+  if (aux.back() != '/') aux += "/";
+
+  ZonedBlockDevice *zbd =
+      new ZonedBlockDevice(Spec(), ZbdBackendType::kEmu, nullptr);
+  IOStatus ios = zbd->Open(false, true);
+  if (!ios.ok()) {
+    delete zbd;
+    return Fail("open failed: " + ios.ToString());
+  }
+  AquaFS fs(zbd, FileSystem::Default(), nullptr);
+  Status s = fs.MkFS(aux, 0, false);
+  if (!s.ok()) return Fail("mkfs failed: " + s.ToString());
+  return true;
+}
+
+bool CrashTest::Mount(const FaultOptions &faults) {
+  std::unique_ptr<FaultInjectionBackend> be(new FaultInjectionBackend(
+      std::unique_ptr<ZonedBlockDeviceBackend>(new EmuBackend(Spec())),
+      faults));
+  fault_ = be.get();
+  ZonedBlockDevice *zbd = new ZonedBlockDevice(std::move(be), nullptr);
+  IOStatus ios = zbd->Open(false, true);
+  if (!ios.ok()) {
+    delete zbd;
+    return Fail("open failed: " + ios.ToString());
+  }
+  fs_.reset(new AquaFS(zbd, FileSystem::Default(), nullptr));
+  Status s = fs_->Mount(false);
+  if (!s.ok()) return Fail("mount failed: " + s.ToString());
+  fs_->CreateDirIfMissing(kDir, IOOptions(), nullptr).PermitUncheckedError();
+  return true;
+}
+
+/* Nothing written after this point reaches the device */
+void CrashTest::Crash() {
+  if (fault_) {
+    fault_->PowerCut();
+    ios_ += fault_->GetStats().ios.load();
+  }
+  open_.clear();
+  fs_.reset();
+  fault_ = nullptr;
+}
+
+bool CrashTest::Create() {
+  if (open_.size() >= 4) return true;
+  std::string name = NewName();
+  FileOptions fopts;
+  fopts.use_direct_writes = Rand(2) == 0;
+  std::unique_ptr<FSWritableFile> file;
+  IOStatus s = fs_->NewWritableFile(name, fopts, &file, nullptr);
+  /* The file may or may not exist until synced */
+  ModelFile &m = model_[name];
+  m.seed = rng_();
+  if (!s.ok()) return false;
+  file->SetWriteLifeTimeHint((Env::WriteLifeTimeHint)(Env::WLTH_SHORT +
+                                                      Rand(4)));
+  open_[name] = OpenFile{std::move(file), fopts.use_direct_writes};
+  return true;
+}
+
+bool CrashTest::Append() {
+  if (open_.empty()) return true;
+  auto it = std::next(open_.begin(), Rand(open_.size()));
+  ModelFile &m = model_[it->first];
+
+  uint64_t size = 1 + Rand(64 << 10);
+  if (it->second.direct) size = (1 + Rand(16)) * 4096;
+  for (uint64_t i = 0; i < size; i++)
+    buf_[i] = PatternByte(m.seed, m.written + i);
+  IOStatus s =
+      it->second.file->Append(Slice(buf_, size), IOOptions(), nullptr);
+  if (!s.ok()) {
+    m.attempted = m.written + size;
+    return false;
+  }
+  m.written += size;
+  return true;
+}
+
+bool CrashTest::Sync(bool close) {
+  if (open_.empty()) return true;
+  auto it = std::next(open_.begin(), Rand(open_.size()));
+  ModelFile &m = model_[it->first];
+
+  IOStatus s = close ? it->second.file->Close(IOOptions(), nullptr)
+                     : it->second.file->Fsync(IOOptions(), nullptr);
+  if (!s.ok()) return false;
+  m.durable = m.written;
+  m.synced = true;
+  if (close) open_.erase(it);
+  return true;
+}
+
+bool CrashTest::Delete() {
+  std::vector<std::string> closed;
+  for (const auto &m : model_)
+    if (m.second.synced && !open_.count(m.first)) closed.push_back(m.first);
+  if (closed.empty()) return true;
+
+  std::string name = closed[Rand(closed.size())];
+  IOStatus s = fs_->DeleteFile(name, IOOptions(), nullptr);
+  if (!s.ok()) {
+    model_[name].may_be_gone = true;
+    return false;
+  }
+  model_.erase(name);
+  return true;
+}
+
+bool CrashTest::Rename() {
+  std::vector<std::string> closed;
+  for (const auto &m : model_)
+    if (m.second.synced && !open_.count(m.first)) closed.push_back(m.first);
+  if (closed.empty()) return true;
+
+  std::string from = closed[Rand(closed.size())];
+  std::string to = NewName();
+  IOStatus s = fs_->RenameFile(from, to, IOOptions(), nullptr);
+  if (!s.ok()) {
+    model_[from].alt_name = to;
+    return false;
+  }
+  model_[to] = model_[from];
+  model_.erase(from);
+  return true;
+}
+
+bool CrashTest::RunEpoch() {
+  FaultOptions faults;
+  faults.seed = rng_();
+  faults.fail_write = FLAGS_fail_write;
+  faults.torn_write = FLAGS_torn_write;
+  faults.drop_write = FLAGS_drop_write;
+  faults.fail_reset = FLAGS_fail_reset;
+  faults.fail_finish = FLAGS_fail_finish;
+  faults.offline_on_reset = FLAGS_offline_on_reset;
+  faults.power_cut_at = 1 + Rand(FLAGS_power_cut_range);
+  if (!Mount(faults)) return false;
+
+  /* Any failure is the power going out or a fault the file system can't
+   * hide, either way the epoch ends like a crash */
+  for (uint64_t i = 0; i < FLAGS_ops; i++) {
+    uint64_t op = Rand(100);
+    bool ok;
+    if (op < 15)
+      ok = Create();
+    else if (op < 70)
+      ok = Append();
+    else if (op < 80)
+      ok = Sync(false);
+    else if (op < 90)
+      ok = Sync(true);
+    else if (op < 95)
+      ok = Delete();
+    else
+      ok = Rename();
+    if (!ok) break;
+  }
+  Crash();
+  return true;
+}
+
+bool CrashTest::Verify() {
+  if (!Mount(FaultOptions())) return false;
+
+  std::vector<std::string> children;
+  IOStatus s = fs_->GetChildren(kDir, IOOptions(), &children, nullptr);
+  if (!s.ok()) return Fail("listing failed: " + s.ToString());
+  std::set<std::string> found;
+  for (const auto &c : children) found.insert(kDir + "/" + c);
+
+  std::map<std::string, ModelFile> recovered;
+  for (auto &it : model_) {
+    std::string name = it.first;
+    ModelFile m = it.second;
+    if (!found.count(name) && !m.alt_name.empty() && found.count(m.alt_name))
+      name = m.alt_name;
+    if (!found.count(name)) {
+      if (m.synced && !m.may_be_gone) return Fail(name + " is lost");
+      continue;
+    }
+    found.erase(name);
+
+    uint64_t size;
+    s = fs_->GetFileSize(name, IOOptions(), &size, nullptr);
+    if (!s.ok()) return Fail(name + ": " + s.ToString());
+    if (size < m.durable || size > std::max(m.written, m.attempted))
+      return Fail(name + " has " + std::to_string(size) + " bytes, durable " +
+                  std::to_string(m.durable) + " written " +
+                  std::to_string(m.written));
+
+    std::unique_ptr<FSRandomAccessFile> file;
+    s = fs_->NewRandomAccessFile(name, FileOptions(), &file, nullptr);
+    if (!s.ok()) return Fail(name + ": " + s.ToString());
+    for (uint64_t off = 0; off < size;) {
+      uint64_t n = std::min<uint64_t>(size - off, 1 << 20);
+      Slice result;
+      s = file->Read(off, n, IOOptions(), &result, buf_, nullptr);
+      if (!s.ok()) return Fail(name + ": " + s.ToString());
+      if (result.size() != n) return Fail(name + " short read");
+      for (uint64_t i = 0; i < n; i++) {
+        if (result.data()[i] != PatternByte(m.seed, off + i))
+          return Fail(name + " is corrupt at " + std::to_string(off + i));
+      }
+      off += n;
+    }
+
+    /* From now on the file is what was found */
+    m.written = m.durable = size;
+    m.attempted = 0;
+    m.synced = true;
+    m.may_be_gone = false;
+    m.alt_name.clear();
+    recovered[name] = m;
+  }
+  if (!found.empty()) return Fail(*found.begin() + " should not exist");
+  model_ = std::move(recovered);
+
+  /* The recovered file system must take writes again */
+  if (!Create() || !Append() || !Sync(true))
+    return Fail("writing after recovery failed");
+  fs_.reset();
+  fault_ = nullptr;
+  return true;
+}
+
+bool CrashTest::Run() {
+  if (posix_memalign((void **)&buf_, 4096, 1 << 20)) return false;
+  bool ok = Format();
+  for (epoch_ = 0; ok && epoch_ < FLAGS_epochs; epoch_++) {
+    ok = RunEpoch() && Verify();
+  }
+  if (ok && FLAGS_verbose)
+    fprintf(stdout, "seed %lu: ios %lu files %zu\n", seed_, ios_,
+            model_.size());
+  open_.clear();
+  free(buf_);
+  buf_ = nullptr;
+  return ok;
+}
+
+}  // namespace aquafs
+
+int main(int argc, char **argv) {
+  using namespace aquafs;
+  gflags::SetUsageMessage(std::string("\nUSAGE:\n") + argv[0] +
+                          " [--seed=<n>] [--iterations=<n>] [OPTIONS]");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  uint64_t failed = 0;
+  for (uint64_t i = 0; i < FLAGS_iterations; i++) {
+    CrashTest test(FLAGS_seed + i);
+    if (!test.Run()) failed++;
+  }
+  fprintf(stdout, "%lu iterations, %lu power cuts, %lu failed\n",
+          FLAGS_iterations, FLAGS_iterations * FLAGS_epochs, failed);
+  return failed ? 1 : 0;
+}
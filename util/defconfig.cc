@@ -20,7 +20,24 @@ int main(int argc, char **argv) {
 
   stream << "\"gc_start_level\":" << FLAGS_gc_start_level << ",";
   stream << "\"gc_slope\":" << FLAGS_gc_slope << ",";
-  stream << "\"gc_sleep_time\":" << FLAGS_gc_sleep_time;
+  stream << "\"gc_sleep_time\":" << FLAGS_gc_sleep_time << ",";
+  stream << "\"readahead_max_window\":" << FLAGS_readahead_max_window << ",";
+  stream << "\"readahead_budget\":" << FLAGS_readahead_budget << ",";
+  stream << "\"block_cache_size\":" << FLAGS_block_cache_size << ",";
+  stream << "\"block_cache_bypass\":\"" << FLAGS_block_cache_bypass << "\",";
+  stream << "\"zone_append_shared_wal\":"
+         << (FLAGS_zone_append_shared_wal ? "true" : "false") << ",";
+  stream << "\"trace_ring_size\":" << FLAGS_trace_ring_size << ",";
+  stream << "\"trace_file\":\"" << FLAGS_trace_file << "\",";
+  stream << "\"stats_file\":\"" << FLAGS_stats_file << "\",";
+  stream << "\"latency_histograms\":"
+         << (FLAGS_latency_histograms ? "true" : "false") << ",";
+  stream << "\"placement_policy\":\"" << FLAGS_placement_policy << "\",";
+  stream << "\"lifetime_prediction\":"
+         << (FLAGS_lifetime_prediction ? "true" : "false") << ",";
+  stream << "\"finish_headroom\":" << FLAGS_finish_headroom << ",";
+  stream << "\"reset_rate_limit\":" << FLAGS_reset_rate_limit << ",";
+  stream << "\"reset_pool_size\":" << FLAGS_reset_pool_size;
 
   stream << "}";
   std::cout << stream.str();
@@ -11,16 +11,21 @@
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <fs/configuration.h>
 #include <fs/fs_aquafs.h>
+#include <fs/raid/zone_raid.h>
 #include <gflags/gflags.h>
 #include <rocksdb/file_system.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -31,6 +36,9 @@ using GFLAGS_NAMESPACE::SetUsageMessage;
 DEFINE_string(zbd, "", "Path to a zoned block device.");
 DEFINE_string(zonefs, "", "Path to a zonefs mountpoint.");
 DEFINE_string(raids, "", "URI to raid devices.");
+DEFINE_string(emu, "",
+              "Options of an emulated zoned device, e.g. "
+              "file=/tmp/emu0:zones=64:zone_size=64M");
 DEFINE_string(aux_path, "",
               "Path for auxiliary file storage (log and lock files).");
 DEFINE_bool(
@@ -47,6 +55,9 @@ DEFINE_string(backup_path, "", "Path to backup files");
 DEFINE_string(src_file, "", "Source file path");
 DEFINE_string(dest_file, "", "Destination file path");
 DEFINE_bool(enable_gc, false, "Enable garbage collection");
+DEFINE_int32(raid_stripe_unit, 0,
+             "RAID striping granularity in bytes, used by mkfs. "
+             "0 means the device block size");
 
 namespace aquafs {
 
@@ -55,20 +66,26 @@ void AddDirSeparatorAtEnd(std::string &path) {
 }
 
 std::unique_ptr<ZonedBlockDevice> zbd_open(bool readonly, bool exclusive) {
-  std::unique_ptr<ZonedBlockDevice> zbd{new ZonedBlockDevice(
-      FLAGS_zbd.empty() ? FLAGS_zonefs.empty() ? FLAGS_raids : FLAGS_zonefs
-                        : FLAGS_zbd,
-      FLAGS_zbd.empty() ? FLAGS_zonefs.empty() ? ZbdBackendType::kRaid
-                                               : ZbdBackendType::kZoneFS
-                        : ZbdBackendType::kBlockDev,
-      nullptr)};
+  std::string path = FLAGS_zbd;
+  ZbdBackendType type = ZbdBackendType::kBlockDev;
+  if (!FLAGS_zonefs.empty()) {
+    path = FLAGS_zonefs;
+    type = ZbdBackendType::kZoneFS;
+  } else if (!FLAGS_emu.empty()) {
+    path = FLAGS_emu;
+    type = ZbdBackendType::kEmu;
+  } else if (FLAGS_zbd.empty()) {
+    path = FLAGS_raids;
+    type = ZbdBackendType::kRaid;
+  }
+  std::unique_ptr<ZonedBlockDevice> zbd{
+      new ZonedBlockDevice(path, type, nullptr)};
 
   IOStatus open_status = zbd->Open(readonly, exclusive);
 
   if (!open_status.ok()) {
     fprintf(stderr, "Failed to open zoned block device: %s, error: %s\n",
-            FLAGS_zbd.empty() ? FLAGS_raids.c_str() : FLAGS_zbd.c_str(),
-            open_status.ToString().c_str());
+            path.c_str(), open_status.ToString().c_str());
     zbd.reset();
   }
 
@@ -187,7 +204,23 @@ int aquafs_tool_mkfs() {
   aquaFS.reset();
 
   zbd = zbd_open(false, true);
+  if (!zbd) return 1;
   ZonedBlockDevice *zbdRaw = zbd.get();
+
+  if (FLAGS_raid_stripe_unit) {
+    auto be =
+        dynamic_cast<AbstractRaidZonedBlockDevice *>(zbd->getBackend().get());
+    if (!be) {
+      fprintf(stderr, "--raid_stripe_unit requires a RAID device (--raids)\n");
+      return 1;
+    }
+    s = be->setStripeUnit(static_cast<uint32_t>(FLAGS_raid_stripe_unit));
+    if (!s.ok()) {
+      fprintf(stderr, "Failed to set RAID stripe unit, error: %s\n",
+              s.ToString().c_str());
+      return 1;
+    }
+  }
   aquaFS.reset(new AquaFS(zbd.release(), FileSystem::Default(), nullptr));
 
   AddDirSeparatorAtEnd(FLAGS_aux_path);
@@ -291,6 +324,160 @@ int aquafs_tool_df() {
   return 0;
 }
 
+int aquafs_tool_write_stats() {
+  Status s;
+  std::unique_ptr<ZonedBlockDevice> zbd = zbd_open(true, false);
+  if (!zbd) return 1;
+
+  std::unique_ptr<AquaFS> aquaFS;
+  s = aquafs_mount(zbd, &aquaFS, true);
+  if (!s.ok()) {
+    fprintf(stderr, "Failed to mount filesystem, error: %s\n",
+            s.ToString().c_str());
+    return 1;
+  }
+
+  AquaFSSnapshot snapshot;
+  AquaFSSnapshotOptions options;
+  options.zbd_ = true;
+  options.zone_ = true;
+  aquaFS->GetAquaFSSnapshot(snapshot, options);
+
+  /* Counters only cover this mount, what is on the zones since their last
+   * reset is reported per lifetime hint as well */
+  const uint32_t lifetimes = AquaFSWriteStatsSnapshot::kLifetimes;
+  uint64_t zones[lifetimes] = {}, written[lifetimes] = {}, live[lifetimes] = {};
+  for (const auto &zone : snapshot.zones_) {
+    if (zone.wp == zone.start) continue;
+    uint32_t l = std::min<uint32_t>(zone.lifetime, lifetimes - 1);
+    zones[l]++;
+    written[l] += zone.wp - zone.start;
+    live[l] += zone.used_capacity;
+  }
+
+  std::ostringstream json;
+  json << "{\"mount\":";
+  snapshot.zbd_.write_stats.EncodeJson(json);
+  json << ",\"zones\":[";
+  for (uint32_t l = 0; l < lifetimes; l++) {
+    if (l) json << ",";
+    json << "{\"lifetime\":" << l << ",\"zones\":" << zones[l]
+         << ",\"written\":" << written[l] << ",\"live\":" << live[l] << "}";
+  }
+  json << "]}";
+  fprintf(stdout, "%s\n", json.str().c_str());
+  return 0;
+}
+
+int aquafs_tool_trace_print() {
+  std::vector<AquaFSTraceRecord> records;
+  IOStatus s = AquaFSTracer::Load(FLAGS_trace_file, &records);
+  if (!s.ok()) {
+    fprintf(stderr, "Failed to load trace, error: %s\n", s.ToString().c_str());
+    return 1;
+  }
+
+  uint64_t base = records.empty() ? 0 : records.front().ts_us;
+  for (const auto &rec : records) {
+    fprintf(stdout,
+            "%12lu %3u %-12s id: %-8u pos: 0x%-12lx size: %-10u lat: %-8u "
+            "lt: %u io: %u\n",
+            rec.ts_us - base, rec.thread,
+            trace_event_str((TraceEvent)rec.event), rec.id, rec.pos,
+            rec.size, rec.latency_us, rec.lifetime, rec.io_type);
+  }
+  return 0;
+}
+
+int aquafs_tool_trace_dump() {
+  if (FLAGS_aux_path.empty() || FLAGS_trace_file.empty()) {
+    fprintf(stderr, "You need to specify --aux_path and --trace_file\n");
+    return 1;
+  }
+
+  /* Ask the file system mounted on aux_path to dump its trace */
+  std::string request = AquaFSTracer::DumpRequestPath(FLAGS_aux_path);
+  std::string result = AquaFSTracer::DumpResultPath(FLAGS_aux_path);
+  std::string tmp = request + ".tmp";
+  remove(result.c_str());
+  {
+    std::ofstream out(tmp, std::ios::trunc);
+    out << FLAGS_trace_file << "\n";
+    if (!out.good()) {
+      fprintf(stderr, "Failed to write %s\n", tmp.c_str());
+      return 1;
+    }
+  }
+  if (rename(tmp.c_str(), request.c_str())) {
+    fprintf(stderr, "Failed to create %s: %s\n", request.c_str(),
+            strerror(errno));
+    return 1;
+  }
+
+  for (int i = 0; i < 100; i++) {
+    usleep(1000 * 100);
+    std::ifstream in(result);
+    if (!in.is_open()) continue;
+    std::string status;
+    std::getline(in, status);
+    in.close();
+    remove(result.c_str());
+    if (status != "OK") {
+      fprintf(stderr, "Failed to dump trace, error: %s\n", status.c_str());
+      return 1;
+    }
+    fprintf(stdout, "Trace dumped to %s\n", FLAGS_trace_file.c_str());
+    return 0;
+  }
+
+  remove(request.c_str());
+  fprintf(stderr,
+          "No answer from the file system, is it mounted with "
+          "--trace_ring_size set?\n");
+  return 1;
+}
+
+int aquafs_tool_trace_replay() {
+  if (!FLAGS_force) {
+    fprintf(stderr,
+            "Replaying a trace overwrites the device, use --force if you "
+            "want to do this.\n");
+    return 1;
+  }
+
+  std::vector<AquaFSTraceRecord> records;
+  IOStatus s = AquaFSTracer::Load(FLAGS_trace_file, &records);
+  if (!s.ok()) {
+    fprintf(stderr, "Failed to load trace, error: %s\n", s.ToString().c_str());
+    return 1;
+  }
+
+  std::unique_ptr<ZonedBlockDevice> zbd = zbd_open(false, true);
+  if (!zbd) return 1;
+
+  /* Nothing is mounted, every zone with data can go */
+  s = zbd->ResetUnusedIOZones();
+  if (!s.ok()) {
+    fprintf(stderr, "Failed to reset zones, error: %s\n",
+            s.ToString().c_str());
+    return 1;
+  }
+  zbd->StartBackgroundWorkers();
+
+  std::ostringstream json;
+  {
+    AquaFSTraceReplayer replayer(zbd.get());
+    s = replayer.Replay(records);
+    replayer.EncodeJson(json);
+  }
+  fprintf(stdout, "%s\n", json.str().c_str());
+  if (!s.ok()) {
+    fprintf(stderr, "Replay failed, error: %s\n", s.ToString().c_str());
+    return 1;
+  }
+  return 0;
+}
+
 int aquafs_tool_lsuuid() {
   std::map<std::string, std::pair<std::string, ZbdBackendType>> aquaFileSystems;
   Status s = ListAquaFileSystems(aquaFileSystems);
@@ -789,12 +976,15 @@ int aquafs_tools(int argc, char **argv) {
   gflags::SetUsageMessage(
       std::string("\nUSAGE:\n") + argv[0] +
       +" <command> [OPTIONS]...\nCommands: mkfs, list, ls-uuid, " +
-      +"df, backup, restore, dump, fs-info, link, delete, rename, rmdir");
+      +"df, write-stats, backup, restore, dump, fs-info, link, delete, "
+      "rename, rmdir, trace-print, trace-replay, trace-dump");
   if (argc < 2) {
     fprintf(stderr, "You need to specify a command:\n");
     fprintf(stderr,
-            "\t./aquafs [list | ls-uuid | df | backup | restore | dump | "
-            "fs-info | link | delete | rename | rmdir]\n");
+            "\t./aquafs [list | ls-uuid | df | write-stats | backup | restore | "
+            "dump | "
+            "fs-info | link | delete | rename | rmdir | trace-print | "
+            "trace-replay | trace-dump]\n");
     return 1;
   }
 
@@ -803,10 +993,11 @@ int aquafs_tools(int argc, char **argv) {
   gflags::ParseCommandLineFlags(&argc, &argv, true);
 
   if (FLAGS_zonefs.empty() && FLAGS_zbd.empty() && FLAGS_raids.empty() &&
-      subcmd != "ls-uuid") {
+      FLAGS_emu.empty() && subcmd != "ls-uuid" && subcmd != "trace-print" &&
+      subcmd != "trace-dump") {
     fprintf(stderr,
             "You need to specify a zoned block device using --zbd or --zonefs "
-            "or --raids\n");
+            "or --raids or --emu\n");
     return 1;
   }
   if (!FLAGS_zonefs.empty() && !FLAGS_zbd.empty()) {
@@ -823,6 +1014,8 @@ int aquafs_tools(int argc, char **argv) {
     return aquafs::aquafs_tool_lsuuid();
   } else if (subcmd == "df") {
     return aquafs::aquafs_tool_df();
+  } else if (subcmd == "write-stats") {
+    return aquafs::aquafs_tool_write_stats();
   } else if (subcmd == "backup") {
     return aquafs::aquafs_tool_backup();
   } else if (subcmd == "restore") {
@@ -839,6 +1032,12 @@ int aquafs_tools(int argc, char **argv) {
     return aquafs::aquafs_tool_rename_file();
   } else if (subcmd == "rmdir") {
     return aquafs::aquafs_tool_remove_directory();
+  } else if (subcmd == "trace-print") {
+    return aquafs::aquafs_tool_trace_print();
+  } else if (subcmd == "trace-replay") {
+    return aquafs::aquafs_tool_trace_replay();
+  } else if (subcmd == "trace-dump") {
+    return aquafs::aquafs_tool_trace_dump();
   } else {
     fprintf(stderr, "Subcommand not recognized: %s\n", subcmd.c_str());
     return 1;
@@ -15,6 +15,7 @@
 DECLARE_string(zbd);
 DECLARE_string(zonefs);
 DECLARE_string(raids);
+DECLARE_string(emu);
 DECLARE_string(aux_path);
 DECLARE_bool(force);
 DECLARE_string(path);
@@ -24,12 +25,14 @@ DECLARE_string(backup_path);
 DECLARE_string(src_file);
 DECLARE_string(dest_file);
 DECLARE_bool(enable_gc);
+DECLARE_int32(raid_stripe_unit);
 
 namespace aquafs {
 
 int aquafs_tool_mkfs();
 int aquafs_tool_list();
 int aquafs_tool_df();
+int aquafs_tool_write_stats();
 int aquafs_tool_lsuuid();
 
 rocksdb::IOStatus aquafs_tool_copy_file(rocksdb::FileSystem *f_fs,
@@ -49,6 +52,9 @@ int aquafs_tool_remove_directory();
 int aquafs_tool_restore();
 int aquafs_tool_dump();
 int aquafs_tool_fsinfo();
+int aquafs_tool_trace_print();
+int aquafs_tool_trace_replay();
+int aquafs_tool_trace_dump();
 
 int aquafs_tools(int argc, char **argv);
 int aquafs_tools_call(const std::vector<std::string> &v);
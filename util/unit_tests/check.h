@@ -0,0 +1,22 @@
+//
+// Assertions shared by the unit tests
+//
+
+#ifndef AQUAFS_UNIT_TESTS_CHECK_H
+#define AQUAFS_UNIT_TESTS_CHECK_H
+
+#include <cstdio>
+#include <cstdlib>
+
+/* Fails the test with the condition and its location. Unlike assert(), it
+ * is still checked when NDEBUG is defined. */
+#define CHECK(cond)                                                   \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+              #cond);                                                 \
+      exit(1);                                                        \
+    }                                                                 \
+  } while (0)
+
+#endif  // AQUAFS_UNIT_TESTS_CHECK_H
@@ -0,0 +1,107 @@
+//
+// Zone state machine of the emulated backend, runs without zoned hardware
+//
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "../tools/tools.h"
+#include "fs/emu_aquafs.h"
+#include "util/unit_tests/check.h"
+
+using namespace aquafs;
+
+int main() {
+  EmuBackend be("zones=8:zone_size=1M:zone_cap=512K:max_active=2:max_open=1");
+  unsigned int max_active, max_open;
+  CHECK(be.Open(false, true, &max_active, &max_open).ok());
+  CHECK(max_active == 2 && max_open == 1);
+  CHECK(be.GetNrZones() == 8 && be.GetZoneSize() == (1 << 20));
+
+  uint32_t bs = be.GetBlockSize();
+  char *buf = nullptr;
+  CHECK(posix_memalign((void **)&buf, bs, 4 * bs) == 0);
+  memset(buf, 0xa5, 4 * bs);
+  uint64_t zone_sz = be.GetZoneSize();
+
+  // Writes must land on the write pointer
+  CHECK(be.Write(buf, bs, zone_sz + bs) == -1 && errno == EIO);
+  CHECK(be.Write(buf, bs, 0) == (int)bs);
+  CHECK(be.Write(buf, bs, 2 * bs) == -1 && errno == EIO);
+
+  // Opening zone 1 implicitly closes zone 0, zone 2 is over the active limit
+  CHECK(be.Write(buf, bs, zone_sz) == (int)bs);
+  auto zones = be.ListZones();
+  CHECK(!be.ZoneIsOpen(zones, 0) && be.ZoneIsActive(zones, 0));
+  CHECK(be.ZoneIsOpen(zones, 1));
+  CHECK(be.Write(buf, bs, 2 * zone_sz) == -1 && errno == EOVERFLOW);
+
+  // Finish releases the active resource
+  CHECK(be.Finish(0).ok());
+  CHECK(be.Write(buf, bs, 2 * zone_sz) == (int)bs);
+  zones = be.ListZones();
+  CHECK(!be.ZoneIsWritable(zones, 0));
+
+  // Data reads back, reset zones read as zeroes
+  char *rd = nullptr;
+  CHECK(posix_memalign((void **)&rd, bs, 4 * bs) == 0);
+  CHECK(be.Read(rd, bs, zone_sz, false) == (int)bs);
+  CHECK(memcmp(rd, buf, bs) == 0);
+  bool offline;
+  uint64_t max_capacity;
+  CHECK(be.Reset(zone_sz, &offline, &max_capacity).ok());
+  CHECK(!offline && max_capacity == 512 * 1024);
+  CHECK(be.Read(rd, bs, zone_sz, false) == (int)bs);
+  for (uint32_t i = 0; i < bs; i++) CHECK(rd[i] == 0);
+
+  // A zone is full once its capacity is written
+  uint64_t wp = 3 * zone_sz;
+  CHECK(be.Close(2 * zone_sz).ok());
+  while (wp < 3 * zone_sz + max_capacity) {
+    CHECK(be.Write(buf, 4 * bs, wp) == (int)(4 * bs));
+    wp += 4 * bs;
+  }
+  CHECK(be.Write(buf, bs, wp) == -1);
+  zones = be.ListZones();
+  CHECK(!be.ZoneIsWritable(zones, 3) && !be.ZoneIsActive(zones, 3));
+
+  // Offline injection
+  be.setZoneOffline(4, 0, true);
+  zones = be.ListZones();
+  CHECK(be.ZoneIsOffline(zones, 4));
+  CHECK(be.Write(buf, bs, 4 * zone_sz) == -1 && errno == EIO);
+  CHECK(be.Reset(4 * zone_sz, &offline, &max_capacity).ok() && offline);
+
+  // File backed devices keep their zones across opens
+  const char *path = "/tmp/aquafs_emu_backend_test";
+  unlink(path);
+  {
+    EmuBackend fbe(std::string("file=") + path + ":zones=4:zone_size=1M");
+    CHECK(fbe.Open(false, true, &max_active, &max_open).ok());
+    CHECK(fbe.Write(buf, 2 * bs, 0) == (int)(2 * bs));
+
+    // The write pointer is on disk before the device is closed
+    EmuBackend live(std::string("file=") + path);
+    CHECK(live.Open(true, false, &max_active, &max_open).ok());
+    zones = live.ListZones();
+    CHECK(live.ZoneWp(zones, 0) == 2 * bs);
+  }
+  {
+    EmuBackend fbe(std::string("file=") + path);
+    CHECK(fbe.Open(true, false, &max_active, &max_open).ok());
+    CHECK(fbe.GetNrZones() == 4);
+    zones = fbe.ListZones();
+    CHECK(fbe.ZoneWp(zones, 0) == 2 * bs);
+    CHECK(fbe.Read(rd, 2 * bs, 0, false) == (int)(2 * bs));
+    CHECK(memcmp(rd, buf, 2 * bs) == 0);
+  }
+  unlink(path);
+
+  free(buf);
+  free(rd);
+  printf("emu backend ok\n");
+  return 0;
+}
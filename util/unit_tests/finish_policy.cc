@@ -0,0 +1,75 @@
+//
+// Victim selection and accounting of the zone finish policy
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+#include "fs/finish_aquafs.h"
+#include "util/unit_tests/check.h"
+
+using namespace aquafs;
+
+static FinishCandidate Candidate(uint64_t capacity, uint64_t written,
+                                 uint64_t open_us, uint64_t last_write_us) {
+  FinishCandidate c;
+  c.capacity = capacity;
+  c.max_capacity = 1000;
+  c.written = written;
+  c.open_us = open_us;
+  c.last_write_us = last_write_us;
+  return c;
+}
+
+int main() {
+  const uint64_t now = 100 * ZoneFinishPolicy::kIdleUs;
+  const uint64_t s = 1000 * 1000;
+
+  // Idle once not written to for kIdleUs
+  CHECK(!ZoneFinishPolicy::IsIdle(Candidate(500, 500, 1, now - 1), now));
+  CHECK(ZoneFinishPolicy::IsIdle(
+      Candidate(500, 500, 1, now - ZoneFinishPolicy::kIdleUs), now));
+
+  // Below the threshold is strictly less than threshold% left
+  CHECK(ZoneFinishPolicy::BelowThreshold(Candidate(99, 901, 1, now), 10));
+  CHECK(!ZoneFinishPolicy::BelowThreshold(Candidate(100, 900, 1, now), 10));
+  CHECK(!ZoneFinishPolicy::BelowThreshold(Candidate(0, 1000, 1, now), 0));
+
+  // 500 bytes written in 10s, 250 left fill in 5s
+  CHECK(ZoneFinishPolicy::FillTimeUs(Candidate(250, 500, now - 10 * s, now),
+                                     now) == 5 * s);
+
+  // Unknown rates, idle zones and slow zones never fill
+  CHECK(ZoneFinishPolicy::FillTimeUs(Candidate(250, 500, 0, now), now) ==
+        ZoneFinishPolicy::kMaxFillUs);
+  CHECK(ZoneFinishPolicy::FillTimeUs(Candidate(250, 0, now - s, now), now) ==
+        ZoneFinishPolicy::kMaxFillUs);
+  CHECK(ZoneFinishPolicy::FillTimeUs(Candidate(250, 500, 1, 1), now) ==
+        ZoneFinishPolicy::kMaxFillUs);
+  CHECK(ZoneFinishPolicy::FillTimeUs(Candidate(999, 1, now - 10 * s, now),
+                                     now) == ZoneFinishPolicy::kMaxFillUs);
+
+  // Less capacity left is cheaper at the same fill time
+  CHECK(ZoneFinishPolicy::Cost(Candidate(100, 500, 1, 1), now) <
+        ZoneFinishPolicy::Cost(Candidate(200, 500, 1, 1), now));
+  // A zone about to fill on its own is dearer than an idle one
+  CHECK(ZoneFinishPolicy::Cost(Candidate(200, 800, now - s, now), now) >
+        ZoneFinishPolicy::Cost(Candidate(200, 800, 1, 1), now));
+  CHECK(ZoneFinishPolicy::Cost(Candidate(0, 1000, now - s, now), now) == 0);
+
+  // Every reason is counted once
+  ZoneFinishPolicy policy;
+  policy.Finished(FinishReason::kThreshold, 10);
+  policy.Finished(FinishReason::kHeadroom, 20);
+  policy.Finished(FinishReason::kOther, 30);
+  CHECK(policy.GetFinishes() == 3);
+  CHECK(policy.GetWastedBytes() == 60);
+  std::ostringstream json;
+  policy.EncodeJson(json);
+  CHECK(json.str().find("\"other\":{\"finishes\":1,\"wasted_bytes\":30}") !=
+        std::string::npos);
+
+  printf("finish policy ok\n");
+  return 0;
+}
@@ -0,0 +1,156 @@
+//
+// Background zone resets: queueing, the periodic sweep, the rate limit and
+// the pool of empty zones, on an emulated device
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "fs/configuration.h"
+#include "fs/emu_aquafs.h"
+#include "fs/zbd_aquafs.h"
+#include "util/unit_tests/check.h"
+
+using namespace aquafs;
+
+static const uint64_t kZoneSize = 1 << 20;
+
+static uint64_t NowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/* Poll cond until it holds. The timeout only catches a hung worker, it is
+ * far beyond what any check below needs. */
+static bool WaitFor(const std::function<bool()> &cond) {
+  uint64_t deadline = NowMs() + 60 * 1000;
+  while (!cond()) {
+    if (NowMs() >= deadline) return false;
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return true;
+}
+
+static ZonedBlockDevice *OpenDevice(const char *name) {
+  ZonedBlockDevice *zbd = new ZonedBlockDevice(
+      std::string("zones=64:zone_size=1M:mem=") + name, ZbdBackendType::kEmu,
+      nullptr);
+  CHECK(zbd->Open(false, true).ok());
+  zbd->StartBackgroundWorkers();
+  return zbd;
+}
+
+/* Fill a zone with data that is all in use */
+static Zone *FillZone(ZonedBlockDevice *zbd, char *buf) {
+  Zone *z = nullptr;
+  CHECK(zbd->AllocateIOZone(Env::WLTH_SHORT, IOType::kUnknown,
+                            ZoneTokenClass::kCompaction, &z)
+            .ok());
+  CHECK(z != nullptr && z->IsEmpty());
+  CHECK(z->Append(buf, kZoneSize).ok());
+  z->used_capacity_ += kZoneSize;
+  CHECK(z->IsFull());
+  CHECK(z->Close().ok());
+  z->Release();
+  zbd->PutOpenIOZoneToken();
+  zbd->PutActiveIOZoneToken();
+  return z;
+}
+
+/* The pool holds exactly the empty io zones once resets settled */
+static bool PoolIsExact(ZonedBlockDevice *zbd) {
+  return zbd->GetEmptyZones() == zbd->GetFreeSpace() / kZoneSize;
+}
+
+int main() {
+  char *buf = nullptr;
+  CHECK(posix_memalign((void **)&buf, 4096, kZoneSize) == 0);
+  memset(buf, 0x5a, kZoneSize);
+  FLAGS_reset_rate_limit = 0;
+
+  // The token bucket gives a full batch at once, then refills at the rate
+  ResetRateLimiter limiter;
+  const uint64_t t0 = 1000 * 1000;
+  CHECK(limiter.Take(100, 4, t0) == AQUAFS_RESET_BATCH);
+  CHECK(limiter.Take(1, 4, t0) == 0);
+  CHECK(limiter.WaitUs(4) == 250 * 1000);
+  CHECK(limiter.Take(10, 4, t0 + 250 * 1000) == 1);
+  CHECK(limiter.Take(10, 4, t0 + 1250 * 1000) == 4);
+  CHECK(limiter.Take(2, 4, t0 + 3250 * 1000) == 2);
+  CHECK(limiter.Take(100, 4, t0 + 3600 * 1000 * 1000ull) ==
+        AQUAFS_RESET_BATCH);
+
+  // A zone whose data is all gone is queued and reset in the background,
+  // and goes back to the pool
+  ZonedBlockDevice *zbd = OpenDevice("reset_queue");
+  CHECK(PoolIsExact(zbd));
+  size_t pooled = zbd->GetEmptyZones();
+  Zone *z = FillZone(zbd, buf);
+  CHECK(zbd->GetEmptyZones() == pooled - 1);
+  uint64_t resets = zbd->GetZoneResets();
+  z->ReleaseCapacity(kZoneSize);
+  CHECK(WaitFor([&] { return z->IsEmpty(); }));
+  CHECK(zbd->GetZoneResets() == resets + 1);
+  CHECK(WaitFor([&] { return zbd->GetEmptyZones() == pooled; }));
+  CHECK(PoolIsExact(zbd));
+
+  // A zone busy when it was queued is left to the sweep
+  z = FillZone(zbd, buf);
+  CHECK(z->Acquire());
+  z->ReleaseCapacity(kZoneSize);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  CHECK(!z->IsEmpty());
+  z->Release();
+  zbd->SweepUnusedZones();
+  CHECK(WaitFor([&] { return z->IsEmpty(); }));
+
+  // ...which the worker also runs on its own while other resets keep the
+  // queue from going idle
+  z = FillZone(zbd, buf);
+  CHECK(z->Acquire());
+  z->ReleaseCapacity(kZoneSize);
+  z->Release();
+  CHECK(WaitFor([&] {
+    FillZone(zbd, buf)->ReleaseCapacity(kZoneSize);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    return z->IsEmpty();
+  }));
+  CHECK(WaitFor([&] { return PoolIsExact(zbd); }));
+
+  // The rate limit only applies while the pool holds enough empty zones
+  CHECK(!zbd->ResetsThrottled());
+  FLAGS_reset_rate_limit = 4;
+  FLAGS_reset_pool_size = 0;
+  CHECK(zbd->ResetsThrottled());
+  FLAGS_reset_pool_size = zbd->GetEmptyZones() + 1;
+  CHECK(!zbd->ResetsThrottled());
+  delete zbd;
+  EmuBackend::RemoveMemoryDevice("reset_queue");
+
+  // Throttled or not, every queued zone is reset and pooled in the end
+  const int kZones = AQUAFS_RESET_BATCH + 8;
+  for (uint64_t pool_size : {0, 1000}) {
+    zbd = OpenDevice("reset_rate");
+    std::vector<Zone *> zones;
+    FLAGS_reset_rate_limit = 0;
+    for (int i = 0; i < kZones; i++) zones.push_back(FillZone(zbd, buf));
+    FLAGS_reset_rate_limit = 100;
+    FLAGS_reset_pool_size = pool_size;
+    resets = zbd->GetZoneResets();
+    for (auto *zone : zones) zone->ReleaseCapacity(kZoneSize);
+    CHECK(WaitFor([&] { return zbd->GetZoneResets() - resets == kZones; }));
+    CHECK(WaitFor([&] { return PoolIsExact(zbd); }));
+    delete zbd;
+    EmuBackend::RemoveMemoryDevice("reset_rate");
+  }
+
+  free(buf);
+  printf("reset worker ok\n");
+  return 0;
+}